@@ -7,8 +7,15 @@
 # run from flexsemg/postprocess directory.
 # for data log collected through NRF Connect app:
 # $ python flexsemg_postprocess.py -src_type nrf_log -num_channels 1 -srate 1000 -fpath <datalog filepath>
-# for data collected using rhd2216_util:
+# long NRF logs load much faster converted to a binary datalog first
+# (rhd_diag/rhd_nrf_convert.c), then read like any rhdutil_log:
+# $ ../rhd_diag/build/rhd_nrf_convert <datalog filepath> 16 1000 nrf.bin
+# $ python flexsemg_postprocess.py -src_type rhdutil_log -fpath nrf.bin
+# for data collected using rhd2216_util (text, --format bin or --format rice datalogs):
 # $ python flexsemg_postprocess.py -src_type rhdutil_log -fpath <datalog filepath>
+# for recordings too long to load (multi-hour captures), bandpass and
+# Welch PSD in bounded memory, one process per group of channels:
+# $ python flexsemg_postprocess.py -src_type rhdutil_log -chunked -bandpass 20:450 -fpath <datalog filepath>
 # for testing this module:
 # $ python flexsemg_postprocess.py -test
 #
@@ -24,12 +31,55 @@ import math
 import argparse
 import numpy as np
 import os.path
+import multiprocessing
+from itertools import islice
 from matplotlib import pyplot as plt
-from scipy.signal import butter, sosfilt
+from scipy.signal import butter, sosfilt, get_window
 
 VLSB = 0.195E-6 # V per least-significant bit of ADC channel
 NRF_LOG = "nrf_log"
 RHDUTIL_LOG = "rhdutil_log"
+RHDUTIL_BIN_LOG = "rhdutil_bin_log"
+
+# binary datalog header, see rhd_diag/rhd_dlog.h (rhd_dlog_bin_header_t)
+RHDUTIL_BIN_MAGIC = b"RHDLOG\0\0"
+RHDUTIL_BIN_VERSION_MASK64 = 2 # first version with active_chs_mask64
+RHDUTIL_BIN_HEADER = np.dtype([
+    ("magic", "S8"),
+    ("version", "<u2"),
+    ("header_len", "<u2"),
+    ("active_chs_mask", "<u2"),
+    ("n_chs", "<u2"),
+    ("srate_hz", "<u4"),
+    ("spi_speed_hz", "<u4"),
+    ("start_unix_ns", "<i8"),
+    ("start_mono_ns", "<i8"),
+    ("n_frames", "<u8"),
+    ("flags", "<u4"),
+    ("active_chs_mask64", "<u8"), # chip i in bits 16i..16i+15, reserved before version 2
+    ("reserved", "V4"),
+])
+RHDUTIL_BIN_FLAG_FILTERED = 1 << 0 # samples passed through rhd_filter
+RHDUTIL_BIN_FLAG_RICE = 1 << 1 # data section is compressed blocks, --format rice
+
+# compressed block layout, see rhd_diag/rhd_rice.h
+RHDUTIL_RICE_BLOCK_HEADER = np.dtype([
+    ("n_bytes", "<u4"),
+    ("n_frames", "<u4"),
+    ("first_frame", "<u8"),
+])
+RHDUTIL_RICE_CH_HEADER = np.dtype([
+    ("order", "u1"),
+    ("k", "u1"),
+    ("n_esc", "<u2"),
+    ("unary_bytes", "<u4"),
+])
+RHDUTIL_RICE_ESC_Q = 32
+
+# frames per block read from disk in chunked processing, see
+# process_rhdutil_log_chunked. peak memory is about
+# 16 bytes * CHUNK_FRAMES * channels, whatever the recording length.
+CHUNK_FRAMES = 1 << 16
 
 def bitmask_to_indices(bitmask):
     """
@@ -70,9 +120,8 @@ def apply_bandpass_filter(data, srate, lowcut, highcut, order=4):
     """
     # design the bandpass filter
     sos = butter(order, [lowcut, highcut], btype='band', fs=srate, output='sos')
-    # apply the filter to each row of the data array
-    filtered_data = np.array([sosfilt(sos, row) for row in data])
-    return filtered_data
+    # filter all rows at once
+    return sosfilt(sos, data, axis=1)
 
 def get_fft(data, srate):
     """
@@ -134,12 +183,194 @@ def format_nrf_log_file(fpath, number_of_channels, sample_rate_hz):
     }
     return time, data, properties
 
+def is_rhdutil_bin_log(fpath):
+    with open(fpath, "rb") as f:
+        return f.read(len(RHDUTIL_BIN_MAGIC)) == RHDUTIL_BIN_MAGIC
+
+def read_rhdutil_text_flags(f):
+    """
+    Reads the optional "flags: <hex>" line after the sample rate of a text
+    rhd2216_util datalog (RHDUTIL_BIN_FLAG_* bits). Older logs go straight
+    to the samples, then f is left where it was and 0 is returned.
+    """
+    pos = f.tell()
+    m = re.match(r"flags: ([a-fA-F0-9]+)", f.readline())
+    if not m:
+        f.seek(pos)
+        return 0
+    return int(m.group(1), 16)
+
+def read_rhdutil_bin_header(fpath):
+    hdr = np.fromfile(fpath, dtype=RHDUTIL_BIN_HEADER, count=1)[0]
+    if hdr["magic"] != RHDUTIL_BIN_MAGIC.rstrip(b"\0"):
+        raise ValueError(f"{fpath} is not a binary rhd2216_util datalog")
+    header = {name: hdr[name].item() for name in RHDUTIL_BIN_HEADER.names
+              if name not in ("magic", "reserved", "active_chs_mask64")}
+    # multi-chip logs number channels across chips, chip i's ch c is 16*i + c
+    if hdr["version"] >= RHDUTIL_BIN_VERSION_MASK64:
+        header["active_chs_mask"] = hdr["active_chs_mask64"].item()
+    header["channels"] = bitmask_to_indices(header["active_chs_mask"])
+    return header
+
+def read_rhdutil_bin_log(fpath):
+    """
+    Map a binary rhd2216_util datalog without parsing or copying samples.
+    Compressed (--format rice) logs are decoded instead, see
+    read_rhdutil_rice_log.
+
+    :param fpath: path to datalog written with --format bin
+    :return: header (dict) and frames, a read-only (n_frames, n_chs) int16
+        np.memmap of raw ADC codes. frames[:, i] is channel header["channels"][i].
+    """
+    header = read_rhdutil_bin_header(fpath)
+    if header["flags"] & RHDUTIL_BIN_FLAG_RICE:
+        return read_rhdutil_rice_log(fpath)
+
+    n_chs = header["n_chs"]
+    offset = header["header_len"]
+    # n_frames is 0 if the writer was killed, fall back to file size
+    n_frames = header["n_frames"]
+    if n_frames == 0:
+        n_frames = (os.path.getsize(fpath) - offset) // (2 * n_chs)
+        header["n_frames"] = n_frames
+    frames = np.memmap(fpath, dtype="<i2", mode="r", offset=offset, shape=(n_frames, n_chs))
+    return header, frames
+
+def index_rhdutil_rice_blocks(buf, offset):
+    """
+    Walk the block headers of a compressed datalog.
+
+    :param buf: whole file as a uint8 array (np.memmap)
+    :param offset: byte offset of the first block
+    :return: (block byte offsets, first frame of each block, frames per
+        block) as np.arrays. a truncated last block (writer killed) is left out.
+    """
+    offsets, first_frames, n_frames = [], [], []
+    pos = offset
+    hdr_len = RHDUTIL_RICE_BLOCK_HEADER.itemsize
+    while pos + hdr_len <= len(buf):
+        blk = np.frombuffer(buf, dtype=RHDUTIL_RICE_BLOCK_HEADER, count=1, offset=pos)[0]
+        n_bytes = int(blk["n_bytes"])
+        if n_bytes < hdr_len or pos + n_bytes > len(buf):
+            break
+        offsets.append(pos)
+        first_frames.append(int(blk["first_frame"]))
+        n_frames.append(int(blk["n_frames"]))
+        pos += n_bytes
+    return np.array(offsets, dtype=np.int64), np.array(first_frames, dtype=np.int64), np.array(n_frames, dtype=np.int64)
+
+def decode_rhdutil_rice_block(buf, pos, n_chs, cols=None):
+    """
+    Decode one compressed block (rhd_diag/rhd_rice.h) at byte offset pos.
+    Both Rice streams are decoded with whole-array numpy ops, the only
+    python loop is over channels.
+
+    :param cols: frame columns to decode, None for all. the others are
+        only skipped over.
+    :return: (n_frames, len(cols)) int16 np.array
+    """
+    blk = np.frombuffer(buf, dtype=RHDUTIL_RICE_BLOCK_HEADER, count=1, offset=pos)[0]
+    n = int(blk["n_frames"])
+    cols = list(range(n_chs)) if cols is None else list(cols)
+    frames = np.empty((n, len(cols)), dtype=np.int16)
+    pos += RHDUTIL_RICE_BLOCK_HEADER.itemsize
+    for ch in range(n_chs):
+        ch_hdr = np.frombuffer(buf, dtype=RHDUTIL_RICE_CH_HEADER, count=1, offset=pos)[0]
+        k = int(ch_hdr["k"])
+        n_esc = int(ch_hdr["n_esc"])
+        unary_bytes = int(ch_hdr["unary_bytes"])
+        pos += RHDUTIL_RICE_CH_HEADER.itemsize
+
+        # remainders: n fixed width k bit fields
+        rem_bytes = (n * k + 7) // 8
+        if ch not in cols:
+            pos += rem_bytes + unary_bytes + 4 * n_esc
+            continue
+        if k:
+            bits = np.unpackbits(buf[pos:pos + rem_bytes])[:n * k].reshape(n, k)
+            r = bits.astype(np.int64) @ (1 << np.arange(k - 1, -1, -1, dtype=np.int64))
+        else:
+            r = 0
+        pos += rem_bytes
+
+        # quotients: run of ones ended by a zero, so q is the gap between zeros
+        zeros = np.flatnonzero(np.unpackbits(buf[pos:pos + unary_bytes]) == 0)[:n]
+        q = np.diff(zeros, prepend=-1) - 1
+        pos += unary_bytes
+
+        u = (q.astype(np.int64) << k) | r
+        if n_esc:
+            u[q >= RHDUTIL_RICE_ESC_Q] = np.frombuffer(buf, dtype="<u4", count=n_esc, offset=pos)
+        pos += 4 * n_esc
+
+        e = (u >> 1) ^ -(u & 1) # undo zigzag
+        x = np.cumsum(e)
+        if ch_hdr["order"] == 2:
+            x = np.cumsum(x)
+        frames[:, cols.index(ch)] = x
+    return frames
+
+def read_rhdutil_rice_log(fpath, start=0, stop=None):
+    """
+    Decode a compressed (--format rice) rhd2216_util datalog. Blocks are
+    independent, so only the ones overlapping [start, stop) are decoded.
+
+    :param fpath: path to datalog written with --format rice
+    :param start: first frame to return
+    :param stop: one past the last frame to return, None for end of log
+    :return: header (dict) and frames, a (n_frames, n_chs) int16 np.array
+        of raw ADC codes, same layout as read_rhdutil_bin_log.
+    """
+    header = read_rhdutil_bin_header(fpath)
+    n_chs = header["n_chs"]
+    buf = np.memmap(fpath, dtype=np.uint8, mode="r")
+    offsets, first_frames, n_frames = index_rhdutil_rice_blocks(buf, header["header_len"])
+    total = int(first_frames[-1] + n_frames[-1]) if len(offsets) else 0
+    # n_frames is 0 if the writer was killed, count what the blocks hold
+    header["n_frames"] = total
+    stop = total if stop is None else min(stop, total)
+    start = max(0, min(start, stop))
+
+    wanted = np.flatnonzero((first_frames < stop) & (first_frames + n_frames > start))
+    frames = np.empty((stop - start, n_chs), dtype=np.int16)
+    for b in wanted:
+        block = decode_rhdutil_rice_block(buf, int(offsets[b]), n_chs)
+        lo = max(start, first_frames[b])
+        hi = min(stop, first_frames[b] + n_frames[b])
+        frames[lo - start:hi - start] = block[lo - first_frames[b]:hi - first_frames[b]]
+    return header, frames
+
+def format_rhdutil_bin_file(fpath):
+    header, frames = read_rhdutil_bin_log(fpath)
+    srate = header["srate_hz"]
+    time = np.arange(frames.shape[0]) * (1/srate)
+    # transposed view, only the scaling to mV copies
+    data = VLSB * frames.T * 1000 # plot in mV
+
+    properties = {
+        "channels": header["channels"],
+        "src": fpath,
+        "src_type": RHDUTIL_BIN_LOG,
+        "active_chs_mask": header["active_chs_mask"],
+        "nsamples": frames.size,
+        "srate_hz": srate,
+        "spi_speed_hz": header["spi_speed_hz"],
+        "start_unix_ns": header["start_unix_ns"],
+        "filtered": bool(header["flags"] & RHDUTIL_BIN_FLAG_FILTERED),
+    }
+    return time, data, properties
+
 def format_rhdutil_log_file(fpath):
+    # binary datalogs are recognized by their magic, text otherwise
+    if is_rhdutil_bin_log(fpath):
+        return format_rhdutil_bin_file(fpath)
+
     f = open(fpath, 'r')
 
     active_chs_mask = 0
     nsamples = 0
     srate = 0
+    flags = 0
     properties = {}
 
     try:
@@ -161,25 +392,23 @@ def format_rhdutil_log_file(fpath):
         srate = int(m.group(1))
         # TODO handle things like kHz, MHz, and GHz (even though max srate is ~10000 Hz)
         print(f"got srate (assuming Hz): {srate}")
+        flags = read_rhdutil_text_flags(f)
     except:
         expected_format = "active_chs_mask: xxxx\nnum_samples: ####\nsample rate: #### Hz"
         print("Error getting properties active_chs_mask, nsamples, and srate.")
         print(f"Please check that first 3 lines match format:\n{expected_format}")
 
-    # read the next nsamples lines and add to data
+    # read the remaining nsamples lines in one go
     indices = bitmask_to_indices(active_chs_mask)
     nrows = len(indices)
     ncols = nsamples // nrows
-    data = np.zeros([len(indices), ncols])
-    for col in range(ncols):
-        for row in range(nrows):
-            line = f.readline()
-            data[row, col] = int(line, 16)
+    lines = f.read().split()[:nrows * ncols]
+    raw = np.array([int(x, 16) for x in lines], dtype=np.uint16)
     time = np.arange(ncols) * (1/srate)
     f.close()
 
-    # postprocess data
-    data = np.vectorize(unsigned_to_twoscomp)(data)
+    # postprocess data: reinterpret as twos complement, frames -> rows
+    data = raw.view(np.int16).reshape(ncols, nrows).T
     # convert data from raw int to voltage
     data = VLSB * data * 1000 # plot in mV
 
@@ -191,9 +420,288 @@ def format_rhdutil_log_file(fpath):
         "active_chs_mask": active_chs_mask,
         "nsamples": nsamples,
         "srate_hz": srate,
+        "filtered": bool(flags & RHDUTIL_BIN_FLAG_FILTERED),
     }
     return time, data, properties
       
+def format_rhdutil_feature_file(fpath):
+    """
+    Load a feature csv written by rhd2216_util --features.
+
+    :param fpath: path to <datalog>.features.csv
+    :return: time (1-d np.array, s), features (dict of feature name ->
+        KxM np.array, K channels by M windows) and properties (dict)
+    """
+    properties = {"src": fpath}
+    n_header = 0
+    with open(fpath, "r") as f:
+        for line in f:
+            n_header += 1
+            if not line.startswith("#"):
+                columns = line.strip().split(",")
+                break
+            key, val = line[1:].split(":", 1)
+            properties[key.strip()] = val.strip()
+    table = np.loadtxt(fpath, delimiter=",", skiprows=n_header, ndmin=2)
+
+    channels = sorted({int(c.split("_")[0][2:]) for c in columns[1:]})
+    names = [c.split("_", 1)[1] for c in columns[1:1 + len(columns[1:]) // len(channels)]]
+    features = {
+        name: np.array([table[:, columns.index(f"ch{ch}_{name}")] for ch in channels])
+        for name in names
+    }
+    properties["channels"] = channels
+    return table[:, 0], features, properties
+
+def read_rhdutil_events(fpath):
+    """
+    Split a datalog recorded with --trigger into its events, using
+    <fpath>.events.csv (see rhd_diag/rhd_trigger.h).
+
+    :param fpath: path to the datalog (text, bin or rice)
+    :return: list of (event, frames) where event is a dict of the csv row
+        and frames is an (n_frames, n_chs) int16 array of raw ADC codes
+        starting at sample event["start_seq"] (event["start_unix_ns"])
+    """
+    events = []
+    with open(fpath + ".events.csv", "r") as f:
+        rows = [line.strip() for line in f if not line.startswith("#")]
+    columns = rows[0].split(",")
+    header = read_rhdutil_log_header(fpath)
+    if header["flags"] & RHDUTIL_BIN_FLAG_RICE:
+        read = lambda start, stop: read_rhdutil_rice_log(fpath, start, stop)[1]
+    elif "data_offset" not in header:
+        frames = read_rhdutil_bin_log(fpath)[1]
+        read = lambda start, stop: frames[start:stop]
+    else:
+        frames = np.concatenate(list(iter_rhdutil_log_chunks(fpath, header)))
+        read = lambda start, stop: frames[start:stop]
+    for row in rows[1:]:
+        event = dict(zip(columns, (int(v) for v in row.split(","))))
+        events.append((event, read(event["file_frame"], event["file_frame"] + event["n_frames"])))
+    return events
+
+def read_rhdutil_log_header(fpath):
+    """
+    Header of any rhd2216_util datalog (text, bin or rice) without reading
+    the samples.
+
+    :return: dict with at least n_chs, n_frames, srate_hz, channels and
+        flags. text logs also get data_offset, the byte offset of the first
+        sample line.
+    """
+    if is_rhdutil_bin_log(fpath):
+        header = read_rhdutil_bin_header(fpath)
+        if header["flags"] & RHDUTIL_BIN_FLAG_RICE:
+            buf = np.memmap(fpath, dtype=np.uint8, mode="r")
+            offsets, first_frames, n_frames = index_rhdutil_rice_blocks(buf, header["header_len"])
+            header["n_frames"] = int(first_frames[-1] + n_frames[-1]) if len(offsets) else 0
+        elif header["n_frames"] == 0:
+            header["n_frames"] = (os.path.getsize(fpath) - header["header_len"]) // (2 * header["n_chs"])
+        return header
+
+    with open(fpath, "r") as f:
+        active_chs_mask = int(re.search(r"active_chs_mask: ([a-fA-F0-9]+)", f.readline()).group(1), 16)
+        nsamples = int(re.search(r"num_samples: (\d+)", f.readline()).group(1))
+        srate = int(re.search(r"sample rate: (\d+) ", f.readline()).group(1))
+        flags = read_rhdutil_text_flags(f)
+        data_offset = f.tell()
+    channels = bitmask_to_indices(active_chs_mask)
+    if nsamples == 0:
+        # writer didn't close cleanly, count the lines
+        with open(fpath, "rb") as f:
+            f.seek(data_offset)
+            nsamples = sum(block.count(b"\n") for block in iter(lambda: f.read(1 << 20), b""))
+    return {
+        "active_chs_mask": active_chs_mask,
+        "channels": channels,
+        "n_chs": len(channels),
+        "n_frames": nsamples // len(channels),
+        "srate_hz": srate,
+        "flags": flags,
+        "data_offset": data_offset,
+    }
+
+def iter_rhdutil_log_chunks(fpath, header, chunk_frames=CHUNK_FRAMES, cols=None):
+    """
+    Read a datalog chunk_frames frames at a time, so memory doesn't grow
+    with the recording length.
+
+    :param header: from read_rhdutil_log_header
+    :param cols: frame columns to return, None for all
+    :return: generator of (n, len(cols)) int16 np.arrays of raw ADC codes,
+        the last one may be shorter
+    """
+    n_chs = header["n_chs"]
+    n_frames = header["n_frames"]
+    cols = list(range(n_chs)) if cols is None else list(cols)
+
+    if header["flags"] & RHDUTIL_BIN_FLAG_RICE:
+        buf = np.memmap(fpath, dtype=np.uint8, mode="r")
+        offsets, _, _ = index_rhdutil_rice_blocks(buf, header["header_len"])
+        pending, n_pending = [], 0
+        for pos in offsets:
+            block = decode_rhdutil_rice_block(buf, int(pos), n_chs, cols)
+            pending.append(block)
+            n_pending += len(block)
+            if n_pending >= chunk_frames:
+                yield np.concatenate(pending)
+                pending, n_pending = [], 0
+        if pending:
+            yield np.concatenate(pending)
+    elif "data_offset" not in header:
+        frames = np.memmap(fpath, dtype="<i2", mode="r", offset=header["header_len"], shape=(n_frames, n_chs))
+        for start in range(0, n_frames, chunk_frames):
+            yield np.array(frames[start:start + chunk_frames, cols])
+    else:
+        with open(fpath, "r") as f:
+            f.seek(header["data_offset"])
+            for start in range(0, n_frames, chunk_frames):
+                n = min(chunk_frames, n_frames - start)
+                lines = list(islice(f, n * n_chs))
+                raw = np.array([int(x, 16) for x in lines], dtype=np.uint16)
+                yield raw.view(np.int16).reshape(-1, n_chs)[:, cols]
+
+class WelchAccumulator:
+    """
+    Welch PSD built up one chunk at a time: Hann windowed, mean removed,
+    half overlapping segments of nperseg samples. Segments that straddle
+    two chunks are kept, so the result matches
+    scipy.signal.welch(x, fs, nperseg=nperseg, axis=0) on the whole signal.
+    """
+    def __init__(self, nperseg, n_chs):
+        self.nperseg = nperseg
+        self.hop = nperseg - nperseg // 2
+        self.window = get_window("hann", nperseg)
+        self.tail = np.empty((0, n_chs))
+        self.power = np.zeros((nperseg // 2 + 1, n_chs))
+        self.n_segs = 0
+
+    def push(self, x):
+        """
+        :param x: (n, n_chs) samples following the previous push
+        """
+        buf = np.concatenate([self.tail, x])
+        n_segs = (len(buf) - self.nperseg) // self.hop + 1 if len(buf) >= self.nperseg else 0
+        if n_segs:
+            # (n_segs, n_chs, nperseg) view, no copy until the detrend
+            segs = np.lib.stride_tricks.sliding_window_view(buf, self.nperseg, axis=0)[::self.hop][:n_segs]
+            segs = segs - segs.mean(axis=-1, keepdims=True)
+            spec = np.fft.rfft(segs * self.window, axis=-1)
+            self.power += (np.abs(spec) ** 2).sum(axis=0).T
+            self.n_segs += n_segs
+        self.tail = buf[n_segs * self.hop:]
+
+    def psd(self, srate):
+        """
+        :return: freqs (Hz) and one-sided power spectral density
+            (n_freqs, n_chs), in units^2/Hz
+        """
+        psd = self.power / max(self.n_segs, 1) / (srate * np.sum(self.window ** 2))
+        # one-sided: everything but DC (and Nyquist for even nperseg) twice
+        if self.nperseg % 2:
+            psd[1:] *= 2
+        else:
+            psd[1:-1] *= 2
+        return np.fft.rfftfreq(self.nperseg, d=1/srate), psd
+
+def process_rhdutil_channels(fpath, cols, sos, nperseg, chunk_frames, out_path):
+    """
+    Worker of process_rhdutil_log_chunked: streams the given frame columns
+    of one datalog through the bandpass (filter state carried across
+    chunks) into the Welch accumulator and, if out_path, into the shared
+    output file.
+
+    :return: cols, freqs, psd (n_freqs, len(cols))
+    """
+    header = read_rhdutil_log_header(fpath)
+    out = np.lib.format.open_memmap(out_path, mode="r+") if out_path else None
+    zi = np.zeros((sos.shape[0], 2, len(cols))) if sos is not None else None
+    welch = WelchAccumulator(nperseg, len(cols))
+    pos = 0
+    for raw in iter_rhdutil_log_chunks(fpath, header, chunk_frames, cols):
+        x = VLSB * 1000 * raw.astype(np.float64) # mV
+        if sos is not None:
+            x, zi = sosfilt(sos, x, axis=0, zi=zi)
+        if out is not None:
+            out[pos:pos + len(x), cols] = x
+        welch.push(x)
+        pos += len(x)
+    if out is not None:
+        out.flush()
+    freqs, psd = welch.psd(header["srate_hz"])
+    return cols, freqs, psd
+
+def process_rhdutil_log_chunked(fpath, bandpass=None, order=4, nperseg=1024, out_path=None, jobs=None, chunk_frames=CHUNK_FRAMES):
+    """
+    Bandpass and Welch PSD of a datalog of any length in bounded memory.
+    The log is streamed chunk_frames frames at a time, and channels are
+    split across jobs processes, each reading only its own channels.
+    Filtering gives the same result as apply_bandpass_filter on the whole
+    recording.
+
+    :param bandpass: (lowcut, highcut) in Hz, None to skip filtering
+    :param order: Butterworth order, same as apply_bandpass_filter
+    :param nperseg: Welch segment length in frames, cut to the recording
+        length for shorter recordings (like scipy.signal.welch)
+    :param out_path: .npy to write the (n_frames, n_chs) float32 mV
+        samples (filtered, if bandpass) to, None to not keep them. load with
+        np.load(out_path, mmap_mode="r").
+    :param jobs: worker processes, default one per core (at most one per
+        channel)
+    :return: freqs (1-d np.array, Hz), psd (KxF np.array, K channels, in
+        mV^2/Hz) and properties (dict)
+    """
+    header = read_rhdutil_log_header(fpath)
+    srate = header["srate_hz"]
+    n_chs = header["n_chs"]
+    if header["n_frames"] == 0:
+        raise ValueError(f"{fpath} has no complete frames")
+    if nperseg > header["n_frames"]:
+        print(f"nperseg = {nperseg} is longer than the recording, using nperseg = {header['n_frames']}")
+        nperseg = header["n_frames"]
+    sos = butter(order, bandpass, btype='band', fs=srate, output='sos') if bandpass else None
+    if out_path:
+        # created here, the workers fill in their own columns
+        out = np.lib.format.open_memmap(out_path, mode="w+", dtype=np.float32, shape=(header["n_frames"], n_chs))
+        del out
+
+    jobs = max(1, min(jobs or os.cpu_count() or 1, n_chs))
+    tasks = [(fpath, list(g), sos, nperseg, chunk_frames, out_path) for g in np.array_split(np.arange(n_chs), jobs)]
+    if jobs == 1:
+        results = [process_rhdutil_channels(*t) for t in tasks]
+    else:
+        with multiprocessing.Pool(jobs) as pool:
+            results = pool.starmap(process_rhdutil_channels, tasks)
+
+    psd = np.empty((n_chs, nperseg // 2 + 1))
+    for cols, freqs, p in results:
+        psd[cols] = p.T
+    properties = {
+        "channels": header["channels"],
+        "src": fpath,
+        "src_type": RHDUTIL_LOG,
+        "active_chs_mask": header["active_chs_mask"],
+        "n_frames": header["n_frames"],
+        "srate_hz": srate,
+        "bandpass": bandpass,
+        "nperseg": nperseg,
+        "out_path": out_path,
+    }
+    return freqs, psd, properties
+
+def plot_psd(freqs, psd, properties):
+    nrows = np.shape(psd)[0]
+    channels = properties.get("channels", ["?"] * nrows)
+    fig, axs = plt.subplots(nrows=nrows, ncols=1, figsize=(8,16), sharex=True, sharey=True, squeeze=False)
+    for row in range(nrows):
+        axs[row, 0].semilogy(freqs, psd[row], c='orangered')
+        axs[row, 0].set_ylabel("ch %s" % str(channels[row]))
+    axs[0, 0].set_title("%s\nWelch PSD (mV^2/Hz)" % properties.get("src", ""))
+    axs[-1, 0].set_xlabel("Frequency (Hz)")
+    plt.tight_layout()
+    return fig, axs
+
 def plot_data(time, data, properties, plot_fft=True):
     nrows = np.shape(data)[0]
     ncols = 1
@@ -267,6 +775,11 @@ if __name__ == "__main__":
     parser.add_argument("-num_channels", action="store", type=int, choices=list(range(1,17)))
     parser.add_argument("-srate", action="store", type=int, default=1, help="sampling rate in hz")
     parser.add_argument("--fft", action='store_true', help="flag to plot fft along with time-domain data")
+    parser.add_argument("-chunked", action="store_true", help="rhdutil_log only: process in bounded memory, plot Welch PSD instead of the signal")
+    parser.add_argument("-bandpass", action="store", type=str, help="LO:HI bandpass in Hz, with -chunked")
+    parser.add_argument("-nperseg", action="store", type=int, default=1024, help="Welch segment length in frames, with -chunked")
+    parser.add_argument("-jobs", action="store", type=int, help="worker processes with -chunked, default one per core")
+    parser.add_argument("-out", action="store", type=str, help="with -chunked, write (filtered) samples in mV to this .npy")
     args, unknown = parser.parse_known_args()
 
     if args.test:
@@ -280,6 +793,23 @@ if __name__ == "__main__":
         raise Exception("Please provide argument -src_type. See module docstring for usage.")
     
     plt.ion() # turn on interactive plots
+    if args.chunked:
+        if args.src_type != "rhdutil_log":
+            raise Exception("-chunked only reads rhdutil_log datalogs.")
+        bandpass = tuple(float(f) for f in args.bandpass.split(":")) if args.bandpass else None
+        freqs, psd, properties = process_rhdutil_log_chunked(
+            args.fpath,
+            bandpass=bandpass,
+            nperseg=args.nperseg,
+            out_path=args.out,
+            jobs=args.jobs,
+            )
+        print(f"Returned properties {properties}")
+        fig, axs = plot_psd(freqs, psd, properties)
+        plt.show()
+        input("Press enter to exit...")
+        sys.exit()
+
     if args.src_type == "nrf_log":
         time, data, properties = format_nrf_log_file(
             fpath=args.fpath, 
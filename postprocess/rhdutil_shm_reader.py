@@ -0,0 +1,141 @@
+# Local reader for rhd2216_util --stream --shm NAME. Maps the frame ring
+# in /dev/shm read-only, so any number of consumers on the pi (plotter,
+# classifier, ...) can follow the recording without sockets and without
+# ever slowing the recorder down.
+#
+# Usage:
+# run from flexsemg/postprocess directory, on the pi:
+# $ ./build/rhd2216_util --config --calibrate --stream --active_chs 0x000f --srate 5000 --shm rhd_frames
+# $ python rhdutil_shm_reader.py -name rhd_frames
+# or from python:
+#   reader = RhdShmReader("rhd_frames")
+#   seq, t_ns, frames = reader.read() # (n,), (n,), (n, n_chs) int16, new frames only
+#
+# ring layout and seqlock protocol are documented in rhd_diag/rhd_shm.h
+#
+
+import time
+import mmap
+import argparse
+import numpy as np
+import flexsemg_postprocess
+
+# see rhd_diag/rhd_shm.h (rhd_shm_header_t)
+RHDSHM_MAGIC = b"RHDSHM"
+RHDSHM_VERSION = 1
+RHDSHM_HEADER = np.dtype({
+    "names": ["magic", "version", "n_chs", "srate_hz", "active_chs_mask", "n_slots", "slot_len",
+              "header_len", "flags", "producer_pid", "closed", "head"],
+    "formats": ["S8", "<u2", "<u2", "<u4", "<u8", "<u4", "<u4", "<u4", "<u4", "<i4", "<u4", "<u8"],
+    "offsets": [0, 8, 10, 12, 16, 24, 28, 32, 36, 40, 44, 64],
+    "itemsize": 128,
+})
+
+def shm_slot_dtype(n_chs, slot_len):
+    # rhd_shm_slot_t followed by n_chs samples, padded to slot_len
+    return np.dtype({
+        "names": ["gen", "seq", "t_ns", "data"],
+        "formats": ["<u8", "<u8", "<i8", ("<i2", (n_chs,))],
+        "offsets": [0, 8, 16, 24],
+        "itemsize": slot_len,
+    })
+
+class RhdShmReader:
+    """
+    Follows an rhd2216_util --shm frame ring from the newest frame on.
+
+    read() returns only frames that were intact while they were copied,
+    anything overwritten first (the reader fell more than n_slots frames
+    behind) is counted in n_dropped instead.
+    """
+    def __init__(self, name):
+        path = "/dev/shm/" + name.lstrip("/")
+        with open(path, "rb") as f:
+            self.mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        # views into the mapping, they change as the producer writes
+        self.hdr = np.frombuffer(self.mm, dtype=RHDSHM_HEADER, count=1)
+        hdr = self.hdr[0]
+        if not hdr["magic"].startswith(RHDSHM_MAGIC) or hdr["version"] != RHDSHM_VERSION:
+            raise ValueError(f"{path} is not an rhd2216_util frame ring")
+        self.header = {name: hdr[name].item() for name in
+                       ("n_chs", "srate_hz", "active_chs_mask", "n_slots", "flags", "producer_pid")}
+        self.header["channels"] = flexsemg_postprocess.bitmask_to_indices(self.header["active_chs_mask"])
+        self.header["filtered"] = bool(self.header["flags"] & flexsemg_postprocess.RHDUTIL_BIN_FLAG_FILTERED)
+        self.slots = np.frombuffer(self.mm, dtype=shm_slot_dtype(hdr["n_chs"], hdr["slot_len"]),
+                                   count=hdr["n_slots"], offset=hdr["header_len"])
+        self.n_slots = int(hdr["n_slots"])
+        self.next = self.head()
+        self.n_read = 0
+        self.n_dropped = 0
+
+    def head(self):
+        return int(self.hdr["head"][0])
+
+    def closed(self):
+        return bool(self.hdr["closed"][0])
+
+    def read(self, max_frames=None):
+        """
+        Copies out every frame published since the last call.
+
+        :param max_frames: read at most this many (oldest first)
+        :return: seq (n,) uint64, t_ns (n,) int64 CLOCK_MONOTONIC issue
+            times, frames (n, n_chs) int16 raw ADC codes
+        """
+        head = self.head()
+        if head - self.next > self.n_slots:
+            self.n_dropped += head - self.n_slots - self.next
+            self.next = head - self.n_slots
+        n = head - self.next
+        if max_frames is not None:
+            n = min(n, max_frames)
+        idx = np.arange(self.next, self.next + n, dtype=np.uint64)
+        slots = idx & np.uint64(self.n_slots - 1)
+        want = 2 * idx + 2
+
+        # seqlock, see rhd_shm.h: gen before and after the copy must both
+        # say the slot holds a complete frame idx
+        gen_before = self.slots["gen"][slots]
+        seq = self.slots["seq"][slots]
+        t_ns = self.slots["t_ns"][slots]
+        frames = self.slots["data"][slots]
+        gen_after = self.slots["gen"][slots]
+        ok = (gen_before == want) & (gen_after == want)
+
+        self.next += n
+        self.n_read += int(ok.sum())
+        self.n_dropped += n - int(ok.sum())
+        return seq[ok], t_ns[ok], frames[ok]
+
+    def close(self):
+        # drop the views before unmapping
+        self.hdr = None
+        self.slots = None
+        self.mm.close()
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-name", action="store", type=str, default="rhd_frames", help="name given to rhd2216_util --shm")
+    parser.add_argument("-n_frames", action="store", type=int, default=0, help="stop after N frames, 0 = until producer stops")
+    args = parser.parse_args()
+
+    reader = RhdShmReader(args.name)
+    print(f"opened {args.name}: {reader.header}")
+    t0 = time.monotonic()
+    last_print = t0
+    last_seq = None
+    while not (args.n_frames and reader.n_read >= args.n_frames):
+        closed = reader.closed()
+        seq, t_ns, frames = reader.read()
+        if len(seq):
+            last_seq = int(seq[-1])
+        elif closed:
+            break
+        else:
+            time.sleep(0.005)
+        if time.monotonic() - last_print >= 1:
+            print(f"frames read {reader.n_read}, dropped {reader.n_dropped}, last seq {last_seq}")
+            last_print = time.monotonic()
+    dt = time.monotonic() - t0
+    print(f"frames read {reader.n_read} in {dt:.2f} s ({reader.n_read / dt:.1f} Hz), dropped {reader.n_dropped}, last seq {last_seq}")
+    reader.close()
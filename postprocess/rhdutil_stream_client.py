@@ -0,0 +1,214 @@
+# Live client for rhd2216_util --stream --serve. Frames arrive within
+# ~10 ms of being logged, so a long capture can be watched (or processed)
+# while it runs instead of waiting for ssh + scp in rhdutil_wrapper.py.
+#
+# Usage:
+# run from flexsemg/postprocess directory.
+# on the pi:
+# $ ./build/rhd2216_util --config --calibrate --stream --active_chs 0x000f --srate 5000 --serve 5555
+# live plot of the last 5 s, from the laptop:
+# $ python rhdutil_stream_client.py -addr <pi ip>:5555 -window_s 5
+# print rate and seq gaps for 10000 frames, no plot (e.g. against --device sim on localhost):
+# $ python rhdutil_stream_client.py -addr localhost:5555 -n_frames 10000 -no_plot
+# unix socket:
+# $ python rhdutil_stream_client.py -addr unix:/tmp/rhd.sock -no_plot
+#
+# wire format is documented in rhd_diag/rhd_net.h
+#
+
+import time
+import socket
+import argparse
+import numpy as np
+from matplotlib import pyplot as plt
+import flexsemg_postprocess
+
+VLSB = flexsemg_postprocess.VLSB
+
+# see rhd_diag/rhd_net.h
+RHDNET_MAGIC = 0x4e444852
+RHDNET_VERSION = 1
+RHDNET_MSG_HELLO = 1
+RHDNET_MSG_FRAMES = 2
+RHDNET_MSG_HEADER = np.dtype([
+    ("magic", "<u4"),
+    ("type", "<u2"),
+    ("n_chs", "<u2"),
+    ("n_bytes", "<u4"),
+])
+RHDNET_HELLO = np.dtype([
+    ("version", "<u2"),
+    ("n_chs", "<u2"),
+    ("srate_hz", "<u4"),
+    ("active_chs_mask", "<u8"),
+    ("flags", "<u4"),
+    ("reserved", "<u4"),
+])
+RHDNET_FRAMES = np.dtype([
+    ("first_seq", "<u8"),
+    ("t_ns", "<i8"),
+    ("n_frames", "<u4"),
+    ("reserved", "<u4"),
+])
+
+def parse_addr(addr):
+    """
+    :param addr: "unix:PATH", or "[tcp:]HOST:PORT" as given to --serve
+        (HOST defaults to localhost)
+    :return: (socket family, address tuple or path)
+    """
+    if addr.startswith("unix:"):
+        return socket.AF_UNIX, addr[len("unix:"):]
+    if addr.startswith("tcp:"):
+        addr = addr[len("tcp:"):]
+    host, _, port = addr.rpartition(":")
+    return socket.AF_INET, (host or "localhost", int(port))
+
+class RhdStreamClient:
+    """
+    Connects to rhd2216_util --serve and reads frame batches.
+
+    client = RhdStreamClient("localhost:5555")
+    for seq, frames in client.batches():
+        # seq: first frame number, frames: (n, n_chs) int16 raw ADC codes,
+        # frames[:, i] is channel client.header["channels"][i]
+        ...
+    """
+    def __init__(self, addr, timeout_s=5.0):
+        family, sockaddr = parse_addr(addr)
+        if family == socket.AF_INET:
+            self.sock = socket.create_connection(sockaddr, timeout=timeout_s)
+        else:
+            self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            self.sock.settimeout(timeout_s)
+            self.sock.connect(sockaddr)
+        self.n_frames = 0 # frames received
+        self.n_lost = 0 # frames missing from seq, dropped by the server
+        self.next_seq = None
+
+        msg_type, payload = self._read_msg()
+        if msg_type != RHDNET_MSG_HELLO:
+            raise ValueError(f"expected hello from {addr}, got message type {msg_type}")
+        hello = np.frombuffer(payload, dtype=RHDNET_HELLO, count=1)[0]
+        if hello["version"] != RHDNET_VERSION:
+            raise ValueError(f"unsupported rhd_net version {hello['version']}")
+        self.header = {name: hello[name].item() for name in RHDNET_HELLO.names if name != "reserved"}
+        self.header["channels"] = flexsemg_postprocess.bitmask_to_indices(self.header["active_chs_mask"])
+        self.header["filtered"] = bool(self.header["flags"] & flexsemg_postprocess.RHDUTIL_BIN_FLAG_FILTERED)
+        # timeout_s only covers connect + hello, batches can be far apart
+        # (e.g. --trigger) and a recv timeout would end the stream
+        self.sock.settimeout(None)
+
+    def _recv_exact(self, n):
+        buf = bytearray(n)
+        view = memoryview(buf)
+        got = 0
+        while got < n:
+            k = self.sock.recv_into(view[got:])
+            if k == 0:
+                raise EOFError("server closed the connection")
+            got += k
+        return buf
+
+    def _read_msg(self):
+        hdr = np.frombuffer(self._recv_exact(RHDNET_MSG_HEADER.itemsize), dtype=RHDNET_MSG_HEADER)[0]
+        if hdr["magic"] != RHDNET_MAGIC:
+            raise ValueError(f"bad message magic {hdr['magic']:#x}")
+        return hdr["type"], self._recv_exact(int(hdr["n_bytes"]))
+
+    def read_batch(self):
+        """
+        Blocks for the next batch of frames.
+
+        :return: seq of the first frame, and (n, n_chs) int16 frames.
+            raises EOFError when the stream ends.
+        """
+        while True:
+            msg_type, payload = self._read_msg()
+            if msg_type == RHDNET_MSG_FRAMES:
+                break
+        info = np.frombuffer(payload, dtype=RHDNET_FRAMES, count=1)[0]
+        seq = int(info["first_seq"])
+        frames = np.frombuffer(payload, dtype="<i2", offset=RHDNET_FRAMES.itemsize)
+        frames = frames.reshape(int(info["n_frames"]), self.header["n_chs"])
+        if self.next_seq is not None and seq > self.next_seq:
+            self.n_lost += seq - self.next_seq
+        self.next_seq = seq + frames.shape[0]
+        self.n_frames += frames.shape[0]
+        return seq, frames
+
+    def batches(self):
+        """
+        Generator over (seq, frames) until the server hangs up.
+        """
+        try:
+            while True:
+                yield self.read_batch()
+        except EOFError:
+            return
+
+    def close(self):
+        self.sock.close()
+
+def print_stats(client, n_frames):
+    t0 = time.monotonic()
+    for seq, frames in client.batches():
+        if n_frames and client.n_frames >= n_frames:
+            break
+    dt = time.monotonic() - t0
+    print(f"received {client.n_frames} frames in {dt:.2f} s ({client.n_frames / dt:.1f} Hz), "
+          f"{client.n_lost} lost, last seq {client.next_seq - 1 if client.next_seq else None}")
+
+def plot_live(client, window_s, n_frames):
+    """
+    Scrolling plot of the last window_s seconds of every channel, in mV.
+    """
+    header = client.header
+    n_win = max(1, int(window_s * header["srate_hz"]))
+    buf = np.zeros((n_win, header["n_chs"]))
+    time_s = np.arange(-n_win, 0) / header["srate_hz"]
+
+    plt.ion()
+    fig, axs = plt.subplots(header["n_chs"], 1, sharex=True, squeeze=False)
+    lines = []
+    for i, ch in enumerate(header["channels"]):
+        lines.append(axs[i, 0].plot(time_s, buf[:, i])[0])
+        axs[i, 0].set_ylabel(f"ch {ch}\n(mV)")
+    axs[-1, 0].set_xlabel("time (s)")
+    fig.suptitle("rhd2216_util live" + (" (filtered)" if header["filtered"] else ""))
+
+    last_draw = 0
+    for seq, frames in client.batches():
+        frames = frames[-n_win:]
+        buf = np.roll(buf, -frames.shape[0], axis=0)
+        buf[-frames.shape[0]:] = VLSB * frames * 1000
+        # redraw at ~20 Hz, batches come every ~10 ms
+        if time.monotonic() - last_draw > 0.05:
+            for i, line in enumerate(lines):
+                line.set_ydata(buf[:, i])
+                axs[i, 0].relim()
+                axs[i, 0].autoscale_view(scalex=False)
+            fig.canvas.draw_idle()
+            plt.pause(0.001)
+            last_draw = time.monotonic()
+        if not plt.fignum_exists(fig.number):
+            break
+        if n_frames and client.n_frames >= n_frames:
+            break
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-addr", action="store", type=str, default="localhost:5555",
+                        help="address given to rhd2216_util --serve, [tcp:]HOST:PORT or unix:PATH")
+    parser.add_argument("-window_s", action="store", type=float, default=5, help="seconds shown in live plot")
+    parser.add_argument("-n_frames", action="store", type=int, default=0, help="stop after N frames, 0 = until stream ends")
+    parser.add_argument("-no_plot", action="store_true", help="only print frame rate and seq gaps")
+    args = parser.parse_args()
+
+    client = RhdStreamClient(args.addr)
+    print(f"connected to {args.addr}: {client.header}")
+    if args.no_plot:
+        print_stats(client, args.n_frames)
+    else:
+        plot_live(client, args.window_s, args.n_frames)
+    client.close()
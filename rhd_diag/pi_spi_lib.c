@@ -1,61 +1,54 @@
 #include "pi_spi_lib.h"
 
-static uint8_t _mode;
-static uint8_t _bpw;
-static uint32_t _speed;
-
 static void pabort(const char *s) {
 	perror(s);
 	abort();
 }
 
-int spi_config(int fd, uint8_t mode, uint8_t bpw, uint32_t speed) {
+// mode, bpw and speed are requested values in, resulting values out
+int pi_spi_config(int fd, uint8_t *mode, uint8_t *bpw, uint32_t *speed) {
 
     int ret;
 
-	_mode = mode;
-	_bpw = bpw;
-	_speed = speed;
-
     /*
 	 * spi mode
 	 */
-	ret = ioctl(fd, SPI_IOC_WR_MODE, &_mode);
+	ret = ioctl(fd, SPI_IOC_WR_MODE, mode);
 	if (ret == -1)
 		pabort("can't set spi mode");
 
-	ret = ioctl(fd, SPI_IOC_RD_MODE, &_mode);
+	ret = ioctl(fd, SPI_IOC_RD_MODE, mode);
 	if (ret == -1)
 		pabort("can't get spi mode");
 
 	/*
 	 * bits per word
 	 */
-	ret = ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &_bpw);
+	ret = ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, bpw);
 	if (ret == -1)
 		pabort("can't set bits per word");
 
-	ret = ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, &_bpw);
+	ret = ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, bpw);
 	if (ret == -1)
 		pabort("can't get bits per word");
 
 	/*
 	 * max speed hz
 	 */
-	ret = ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &_speed);
+	ret = ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, speed);
 	if (ret == -1)
 		pabort("can't set max speed hz");
 
-	ret = ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &_speed);
+	ret = ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, speed);
 	if (ret == -1)
 		pabort("can't get max speed hz");
     
     printf("resulting pi SPI config:\n");
-	printf("spi mode: %d\n", _mode);
-	printf("bits per word: %d\n", _bpw);
+	printf("spi mode: %d\n", *mode);
+	printf("bits per word: %d\n", *bpw);
 	printf("max speed: %d Hz (%d MHz)\n", 
-			_speed, 
-			_speed/1000000);
+			*speed, 
+			*speed/1000000);
 	printf("\n");
 
 	return ret;
@@ -63,7 +56,7 @@ int spi_config(int fd, uint8_t mode, uint8_t bpw, uint32_t speed) {
 
 // rx buf must have same size as tx buf
 // result stored in rx_buf
-int rhd_spi_xfer(int fd, uint8_t *tx_buf, size_t tx_len, uint8_t *rx_buf) {
+int pi_spi_xfer(int fd, uint8_t *tx_buf, size_t tx_len, uint8_t *rx_buf) {
     int ret;
     struct spi_ioc_transfer tr = {
         .tx_buf = (unsigned long)tx_buf,
@@ -91,9 +84,148 @@ int rhd_spi_xfer(int fd, uint8_t *tx_buf, size_t tx_len, uint8_t *rx_buf) {
     return ret;
 }
 
-// making a wrapper function because I don't want any dependent
-// libraries to use wiringPi functions (because it's only for pi).
-// -PV 2024-May-18
-void delay_us(unsigned long us) {
-	usleep(us);
-}
\ No newline at end of file
+// sends n_words 16-bit words in as few SPI_IOC_MESSAGE ioctls as possible.
+// RHD latches one command per CS rising edge, so CS is toggled after every
+// word using cs_change instead of issuing one ioctl per word.
+// rx buf must have same size as tx buf (2 * n_words bytes)
+int pi_spi_xfer_words(int fd, uint8_t *tx_buf, uint8_t *rx_buf, size_t n_words) {
+	struct spi_ioc_transfer tr[PI_SPI_MAX_MSG_XFERS];
+	size_t done = 0;
+	int ret = 0;
+
+	while (done < n_words) {
+		size_t n = n_words - done;
+		if (n > PI_SPI_MAX_MSG_XFERS) {
+			n = PI_SPI_MAX_MSG_XFERS;
+		}
+
+		memset(tr, 0, n * sizeof(tr[0]));
+		for (size_t i=0; i<n; ++i) {
+			tr[i].tx_buf = (unsigned long)(tx_buf + 2*(done+i));
+			tr[i].rx_buf = (unsigned long)(rx_buf + 2*(done+i));
+			tr[i].len = 2;
+			// deassert CS between words. cs_change on the last transfer
+			// would instead leave CS asserted after the message, so skip it.
+			tr[i].cs_change = (i+1 < n);
+		}
+
+		ret = ioctl(fd, SPI_IOC_MESSAGE(n), tr);
+		if (ret == -1) {
+			return ret;
+		}
+		done += n;
+	}
+
+	if (DEBUG) {
+		printf("xfer_words: %zu words\n", n_words);
+	}
+	return ret;
+}
+
+// spidev's per-message byte limit, read once
+static size_t pi_spi_bufsiz(void) {
+	static size_t bufsiz = 0;
+	if (bufsiz == 0) {
+		FILE *f = fopen(PI_SPI_BUFSIZ_PATH, "r");
+		unsigned long val = 0;
+		if (f) {
+			if (fscanf(f, "%lu", &val) != 1) {
+				val = 0;
+			}
+			fclose(f);
+		}
+		bufsiz = val ? val : PI_SPI_DEFAULT_BUFSIZ;
+	}
+	return bufsiz;
+}
+
+// like pi_spi_xfer_words, but the last word of frame f also carries
+// delay_usecs = gap_us[f], so the controller holds the bus idle between
+// frames and the whole burst is paced in the kernel. messages are split
+// on frame boundaries when the burst exceeds the per-message transfer or
+// byte limits; the gap after the last frame of each message still runs
+// before the ioctl returns, so spacing only grows by the syscall between
+// messages.
+int pi_spi_xfer_frames(int fd, uint8_t *tx_buf, uint8_t *rx_buf, size_t words_per_frame, size_t n_frames, const uint16_t *gap_us) {
+	struct spi_ioc_transfer tr[PI_SPI_MAX_MSG_XFERS];
+	size_t max_frames = PI_SPI_MAX_MSG_XFERS / words_per_frame;
+	size_t done = 0;
+	int ret = 0;
+
+	if (pi_spi_bufsiz() / (2 * words_per_frame) < max_frames) {
+		max_frames = pi_spi_bufsiz() / (2 * words_per_frame);
+	}
+	if (max_frames == 0) {
+		return -1;
+	}
+
+	while (done < n_frames) {
+		size_t n = n_frames - done;
+		size_t n_tr;
+		if (n > max_frames) {
+			n = max_frames;
+		}
+		n_tr = n * words_per_frame;
+
+		memset(tr, 0, n_tr * sizeof(tr[0]));
+		for (size_t i=0; i<n_tr; ++i) {
+			size_t w = done * words_per_frame + i;
+			tr[i].tx_buf = (unsigned long)(tx_buf + 2*w);
+			tr[i].rx_buf = (unsigned long)(rx_buf + 2*w);
+			tr[i].len = 2;
+			tr[i].cs_change = (i+1 < n_tr);
+			if ((i+1) % words_per_frame == 0) {
+				tr[i].delay_usecs = gap_us[done + i / words_per_frame];
+			}
+		}
+
+		ret = ioctl(fd, SPI_IOC_MESSAGE(n_tr), tr);
+		if (ret == -1) {
+			return ret;
+		}
+		done += n;
+	}
+	return ret;
+}
+
+// rhd_spi_backend_t glue, so rhd2216_lib can drive a real spidev device
+static int pi_backend_open(rhd_spi_t *spi, const char *device) {
+	spi->fd = open(device, O_RDWR);
+	return (spi->fd < 0) ? -1 : 0;
+}
+
+static int pi_backend_config(rhd_spi_t *spi, uint8_t mode, uint8_t bpw, uint32_t speed) {
+	spi->mode = mode;
+	spi->bpw = bpw;
+	spi->speed = speed;
+	return pi_spi_config(spi->fd, &spi->mode, &spi->bpw, &spi->speed);
+}
+
+static int pi_backend_xfer(rhd_spi_t *spi, uint8_t *tx_buf, size_t tx_len, uint8_t *rx_buf) {
+	return pi_spi_xfer(spi->fd, tx_buf, tx_len, rx_buf);
+}
+
+static int pi_backend_xfer_words(rhd_spi_t *spi, uint8_t *tx_buf, uint8_t *rx_buf, size_t n_words) {
+	return pi_spi_xfer_words(spi->fd, tx_buf, rx_buf, n_words);
+}
+
+static int pi_backend_xfer_frames(rhd_spi_t *spi, uint8_t *tx_buf, uint8_t *rx_buf, size_t words_per_frame, size_t n_frames, const uint16_t *gap_us) {
+	return pi_spi_xfer_frames(spi->fd, tx_buf, rx_buf, words_per_frame, n_frames, gap_us);
+}
+
+static void pi_backend_close(rhd_spi_t *spi) {
+	if (spi->fd >= 0) {
+		close(spi->fd);
+	}
+	spi->fd = -1;
+}
+
+const rhd_spi_backend_t pi_spi_backend = {
+	.name = "pi_spidev",
+	.open = pi_backend_open,
+	.config = pi_backend_config,
+	.xfer = pi_backend_xfer,
+	.xfer_words = pi_backend_xfer_words,
+	.xfer_frames = pi_backend_xfer_frames,
+	.close = pi_backend_close,
+};
\ No newline at end of file
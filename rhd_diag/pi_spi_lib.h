@@ -1,22 +1,33 @@
+#ifndef PI_SPI_LIB_H
+#define PI_SPI_LIB_H
+
 #include <stdint.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <linux/types.h>
 #include <linux/spi/spidev.h>
-#include <time.h> // not for SPI, but for udelay function
-
-#ifndef DEBUG
-#define DEBUG 0 // if nonzero, prints debug statements
-#endif
+#include "rhd_spi.h"
 
 #define PI_SPI_0_0 "/dev/spidev0.0"
 #define PI_SPI_0_1 "/dev/spidev0.1"
 #define PI_SPI_1_0 "/dev/spidev1.0"
 #define PI_SPI_1_1 "/dev/spidev1.1"
 
-int spi_config(int fd, uint8_t mode, uint8_t bpw, uint32_t speed);
-int rhd_spi_xfer(int fd, uint8_t *tx_buf, size_t tx_len, uint8_t *rx_buf); 
-void delay_us(unsigned long us);
\ No newline at end of file
+// max number of spi_ioc_transfer entries in one SPI_IOC_MESSAGE. ioctl size
+// field is 14 bits and each entry is 32 bytes, so 511 is the hard limit.
+#define PI_SPI_MAX_MSG_XFERS 511
+// spidev also caps the total bytes of one message at its bufsiz module
+// parameter, 4096 unless changed (spidev.bufsiz=N on the kernel cmdline)
+#define PI_SPI_BUFSIZ_PATH "/sys/module/spidev/parameters/bufsiz"
+#define PI_SPI_DEFAULT_BUFSIZ 4096
+
+int pi_spi_config(int fd, uint8_t *mode, uint8_t *bpw, uint32_t *speed);
+int pi_spi_xfer(int fd, uint8_t *tx_buf, size_t tx_len, uint8_t *rx_buf); 
+int pi_spi_xfer_words(int fd, uint8_t *tx_buf, uint8_t *rx_buf, size_t n_words);
+int pi_spi_xfer_frames(int fd, uint8_t *tx_buf, uint8_t *rx_buf, size_t words_per_frame, size_t n_frames, const uint16_t *gap_us);
+
+#endif
\ No newline at end of file
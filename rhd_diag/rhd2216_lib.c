@@ -1,7 +1,7 @@
 #include "rhd2216_lib.h"
+#include "rhd_stats.h"
+#include "rhd_spi_table.h"
 
-static int verbose = 0; // if 1, logs ALL spi read/writes/
-static int dsp_offset_rem_en = 0; // active high
 
 // register defaults
 const rhd_reg_t rhd2216_reg_list[] = {
@@ -41,105 +41,153 @@ static void pabort(const char *s) {
 	abort();
 }
 
-static int get_max_srate_and_delay(int fd, uint16_t srate, uint16_t active_chs_msk, uint16_t* max_srate, uint16_t* delay_us) {
-	// measures duration of convert for all chs in active_chs_msk
-	// then uses that duration to calculate appropriate delay needed 
-	// to reach desired srate
-	// returns -1 if desired srate is not possible (too fast)
+// wall time of one frame of the plan on CLOCK_MONOTONIC, averaged over
+// RHD_PROBE_FRAMES frames. burst plans are probed as whole bursts with no
+// gaps, since a frame inside one message costs less than a frame per
+// message.
+static double probe_frame_sec(rhd_dev_t *dev, rhd_acq_plan_t *plan) {
+	uint16_t no_gap[RHD_BURST_MAX_FRAMES] = {0};
+	size_t n_probed = 0;
+	int64_t begin;
+	int64_t end;
+
+	begin = rhd_now_ns();
+	if (plan->frames_per_xfer > 1) {
+		while (n_probed < RHD_PROBE_FRAMES) {
+			rhd_spi_xfer_frames(&dev->spi, plan->tx_buf, plan->rx_buf, plan->words_per_frame, plan->frames_per_xfer, no_gap);
+			n_probed += plan->frames_per_xfer;
+		}
+	} else {
+		for (; n_probed<RHD_PROBE_FRAMES; ++n_probed) {
+			rhd_acq_plan_run(dev, plan, plan->words_per_frame);
+		}
+	}
+	end = rhd_now_ns();
+	return (end - begin) / 1e9 / n_probed;
+}
 
-	int ch_num = 0;
-	size_t N = 2;
-	uint8_t tx_buf[] = {0, 0};
-	uint8_t rx_buf[] = {0xde, 0xad};
-	uint8_t command_word = 0;
+static int get_max_srate(rhd_dev_t *dev, rhd_acq_plan_t *plan, uint16_t srate, uint16_t* max_srate, double *frame_sec_out) {
+	// derives the fastest sustainable frame rate from the time one frame
+	// takes, looked up in dev->spi_table if it has the current clock,
+	// else probed.
+	// returns -1 if desired srate is not possible (too fast)
 	double desired_period_sec = 1.0 / srate;
-	double time_spent_sec;
-	clock_t begin;
-	clock_t end;
-
-	begin = clock();
+	double frame_sec;
 
-	command_word = 0;
-	command_word |= ch_num & 0x3f;
-	tx_buf[1] = dsp_offset_rem_en & 0b1;
-	// read from same channel 16 times just to get duration
-	rhd_spi_xfer(fd, tx_buf, N, rx_buf);
+	if (!dev->spi_table || rhd_spi_table_frame_sec(dev->spi_table, dev->spi.speed, plan->words_per_frame, plan->frames_per_xfer > 1, &frame_sec) == -1) {
+		frame_sec = probe_frame_sec(dev, plan);
+	}
+	*frame_sec_out = frame_sec;
+	*max_srate = (frame_sec * 65535 > 1.0) ? (uint16_t) (1.0 / frame_sec) : 65535;
 
 	printf(
-		"PVDEBUG: Desired srate: %.3e Hz, desired sampling period is %.3e s.\n",
-		(double) srate,
-		desired_period_sec
+		"PVDEBUG: one frame of active_chs_msk %04x takes %.2f us, desired period is %.2f us\n",
+		plan->active_chs_msk,
+		frame_sec * 1e6,
+		desired_period_sec * 1e6
 		);
-	end = clock();
-
-	time_spent_sec = (double)(end - begin) / CLOCKS_PER_SEC;
-	*max_srate = (uint16_t) (1.0 / time_spent_sec);
 
-	if (time_spent_sec > desired_period_sec) {
-		*delay_us = 0;
+	if (frame_sec > desired_period_sec) {
 		printf(
-			"PVDEBUG: Desired srate %.3e Hz too fast with current SPI properties. Each read from active_chs_mask %04x takes %.2e s, so max srate is %.3e Hz\n",
+			"PVDEBUG: Desired srate %.3e Hz too fast with current SPI properties, max srate is %.3e Hz\n",
 			(double) srate,
-			active_chs_msk,
-			time_spent_sec,
 			(double) *max_srate
 			);
 		return -1;
 	}
-
-	*delay_us = (uint16_t) ((desired_period_sec - time_spent_sec) * 1000000);
-	printf(
-		"PVDEBUG: reading from active_chs_msk %04x took %.2e s\n. Desired period is %.2e us. Resulting delay_us applied by controller is %d us\n", 
-		active_chs_msk,
-		time_spent_sec * 1000000,
-		desired_period_sec * 1000000,
-		*delay_us
-	);
 	return 0;	
 }
 
-int get_dsp_offset_rem_en(void) {
-	return dsp_offset_rem_en;
+int get_dsp_offset_rem_en(rhd_dev_t *dev) {
+	return dev->dsp_offset_rem_en;
 }
 
-int set_dsp_offset_rem_en(int en) {
-	dsp_offset_rem_en = en;
+int set_dsp_offset_rem_en(rhd_dev_t *dev, int en) {
+	dev->dsp_offset_rem_en = en;
 	return 0;
 }
 
-int rhd_reg_read(int fd, uint8_t reg_num, uint8_t *result) {
-	if (DEBUG) {
-		printf("R: reg#%d\n", reg_num);
+int64_t get_pacer_spin_ns(rhd_dev_t *dev) {
+	return dev->pacer_spin_ns;
+}
+
+int set_pacer_spin_ns(rhd_dev_t *dev, int64_t spin_ns) {
+	dev->pacer_spin_ns = (spin_ns > 0) ? spin_ns : 0;
+	return 0;
+}
+
+size_t get_burst_frames(rhd_dev_t *dev) {
+	return dev->burst_frames;
+}
+
+int set_burst_frames(rhd_dev_t *dev, size_t n_frames) {
+	if (n_frames > RHD_BURST_MAX_FRAMES) {
+		return -1;
+	}
+	dev->burst_frames = n_frames;
+	return 0;
+}
+
+// opens and configures the SPI link to one chip. device is a spidev path
+// or "sim..." (see rhd_spi_open). register shadow starts out empty.
+int rhd_dev_open(rhd_dev_t *dev, const char *device, uint8_t mode, uint8_t bpw, uint32_t speed) {
+	memset(dev, 0, sizeof(*dev));
+	dev->name = device;
+	if (rhd_spi_open(&dev->spi, device) == -1) {
+		return -1;
 	}
+	if (rhd_spi_config(&dev->spi, mode, bpw, speed) == -1) {
+		rhd_spi_close(&dev->spi);
+		return -1;
+	}
+	return 0;
+}
 
-	int ret;
-	size_t N = 2;
-	uint8_t tx_buf[] = {0, 0};
-	uint8_t rx_buf[] = {0xde, 0xad};
+void rhd_dev_close(rhd_dev_t *dev) {
+	rhd_spi_close(&dev->spi);
+}
+
+static uint8_t reg_read_cmd(uint8_t reg_num) {
+	return 0b11000000 | (reg_num & 0x3f);
+}
 
-	uint8_t command_word = 0;
-	command_word |= 0b11000000;
-	command_word |= reg_num & 0x3f;
-	tx_buf[0] = command_word;
-	tx_buf[1] = 0;
+static uint8_t reg_write_cmd(uint8_t reg_num) {
+	return 0b10000000 | (reg_num & 0x3f);
+}
 
-	// clear out any previous data from pipelining
-	rhd_spi_xfer(fd, tx_buf, N, rx_buf);
-	rhd_spi_xfer(fd, tx_buf, N, rx_buf);
+int rhd_reg_read(rhd_dev_t *dev, uint8_t reg_num, uint8_t *result) {
+	if (DEBUG) {
+		printf("R: reg#%d\n", reg_num);
+	}
 
-	// do the actual read now
-	ret = rhd_spi_xfer(fd, tx_buf, N, rx_buf);
+	int ret;
+	uint8_t tx_buf[2 * (RHD_PIPELINE_DEPTH + 1)];
+	uint8_t rx_buf[2 * (RHD_PIPELINE_DEPTH + 1)];
+
+	// READ followed by RHD_PIPELINE_DEPTH more READs of the same reg, all in
+	// one SPI message. last word clocks out the result of the first.
+	for (int i=0; i<RHD_PIPELINE_DEPTH + 1; ++i) {
+		tx_buf[2*i] = reg_read_cmd(reg_num);
+		tx_buf[2*i + 1] = 0;
+	}
+	ret = rhd_spi_xfer_words(&dev->spi, tx_buf, rx_buf, RHD_PIPELINE_DEPTH + 1);
 	
-	*result = rx_buf[1];
-	if (verbose) {
+	*result = rx_buf[2*RHD_PIPELINE_DEPTH + 1];
+	if (ret != -1 && reg_num < RHD_NUM_RW_REGS) {
+		dev->reg_shadow.val[reg_num] = *result;
+		dev->reg_shadow.valid_msk |= (0b1 << reg_num);
+	}
+	if (dev->verbose) {
 		printf("Got data %x\n\n", *result);
 	}
 	
 	return ret;
 }
 
-int rhd_reg_write(int fd, uint8_t reg_num, uint8_t reg_data) {
-	if (verbose) {
+// writes reg_data to reg_num. skipped if the shadow says the chip already
+// holds reg_data, use rhd_reg_shadow_invalidate to force a write.
+int rhd_reg_write(rhd_dev_t *dev, uint8_t reg_num, uint8_t reg_data) {
+	if (dev->verbose) {
 		printf("W: reg#%d, data %x\n", reg_num, reg_data);
 	}
 	int ret;
@@ -147,37 +195,420 @@ int rhd_reg_write(int fd, uint8_t reg_num, uint8_t reg_data) {
 	uint8_t tx_buf[] = {0, 0};
 	uint8_t rx_buf[] = {0xde, 0xad};
 
+	if (reg_num < RHD_NUM_RW_REGS
+			&& (dev->reg_shadow.valid_msk & (0b1 << reg_num))
+			&& dev->reg_shadow.val[reg_num] == reg_data) {
+		if (dev->verbose) {
+			printf("W: reg#%d unchanged, skipped\n", reg_num);
+		}
+		return 0;
+	}
+
 	// do write
-	uint8_t command_word = 0;
-	command_word |= 0b10000000;
-	command_word |= reg_num & 0x3f;
-	tx_buf[0] = command_word;
+	tx_buf[0] = reg_write_cmd(reg_num);
 	tx_buf[1] = reg_data;
 
 	// do the write
-	ret = rhd_spi_xfer(fd, tx_buf, N, rx_buf);
+	ret = rhd_spi_xfer(&dev->spi, tx_buf, N, rx_buf);
+	if (ret != -1 && reg_num < RHD_NUM_RW_REGS) {
+		dev->reg_shadow.val[reg_num] = reg_data;
+		dev->reg_shadow.valid_msk |= (0b1 << reg_num);
+	}
 	return ret;
 }
 
-// if all channels active, active_ch_msk = 0xffff. If only ch1 active, active_ch_msk = 0x01 etc...
-int rhd_convert(int fd, uint16_t active_chs_msk, uint16_t srate, uint16_t *data_buf, size_t buf_len) {
+// writes vals[r] to every reg r set in write_msk, each immediately
+// followed by a READ of r to verify it, as one SPI message. results come
+// back RHD_PIPELINE_DEPTH words later, so the message ends with that many
+// dummy READs instead of flushing before each read. n_dummy extra dummy
+// READs are sent first (used after power up).
+// regs whose shadow already matches are left out unless force is set.
+// returns number of regs that failed to verify, or -1 on SPI error.
+int rhd_reg_write_bulk(rhd_dev_t *dev, const uint8_t *vals, uint32_t write_msk, size_t n_dummy, int force) {
+	uint8_t tx_buf[2 * RHD_BULK_MAX_WORDS];
+	uint8_t rx_buf[2 * RHD_BULK_MAX_WORDS];
+	uint8_t read_at[RHD_BULK_MAX_WORDS]; // reg verified by word i, or 0xff
+	size_t n = 0;
+	int n_bad = 0;
+	int n_writes = 0;
+	int ret;
+
+	if (n_dummy > RHD_BULK_MAX_WORDS - 2 * RHD_NUM_RW_REGS - RHD_PIPELINE_DEPTH) {
+		n_dummy = RHD_BULK_MAX_WORDS - 2 * RHD_NUM_RW_REGS - RHD_PIPELINE_DEPTH;
+	}
+	memset(read_at, 0xff, sizeof(read_at));
+
+	for (size_t i=0; i<n_dummy; ++i, ++n) {
+		tx_buf[2*n] = reg_read_cmd(63);
+		tx_buf[2*n + 1] = 0;
+	}
+	for (uint8_t r=0; r<RHD_NUM_RW_REGS; ++r) {
+		if (!(write_msk & (0b1 << r))) {
+			continue;
+		}
+		if (!force && (dev->reg_shadow.valid_msk & (0b1 << r)) && dev->reg_shadow.val[r] == vals[r]) {
+			continue;
+		}
+		tx_buf[2*n] = reg_write_cmd(r);
+		tx_buf[2*n + 1] = vals[r];
+		++n;
+		read_at[n] = r;
+		tx_buf[2*n] = reg_read_cmd(r);
+		tx_buf[2*n + 1] = 0;
+		++n;
+		++n_writes;
+	}
+
+	if (n_writes == 0 && n_dummy == 0) {
+		printf("PVDEBUG: bulk reg write: all regs match shadow, nothing sent.\n");
+		return 0;
+	}
+
+	for (int i=0; i<RHD_PIPELINE_DEPTH; ++i, ++n) {
+		tx_buf[2*n] = reg_read_cmd(63);
+		tx_buf[2*n + 1] = 0;
+	}
+
+	ret = rhd_spi_xfer_words(&dev->spi, tx_buf, rx_buf, n);
+	if (ret == -1) {
+		dev->reg_shadow.valid_msk &= ~write_msk;
+		return -1;
+	}
+
+	for (size_t i=0; i+RHD_PIPELINE_DEPTH<n; ++i) {
+		if (read_at[i] == 0xff) {
+			continue;
+		}
+		uint8_t r = read_at[i];
+		uint8_t got = rx_buf[2*(i + RHD_PIPELINE_DEPTH) + 1];
+		if (got != vals[r]) {
+			printf(
+				"WARNING: bulk reg write: expected reg %d to read %x after writing, but got %x instead\n",
+				r,
+				vals[r],
+				got
+				);
+			dev->reg_shadow.valid_msk &= ~(0b1 << r);
+			++n_bad;
+			continue;
+		}
+		dev->reg_shadow.val[r] = got;
+		dev->reg_shadow.valid_msk |= (0b1 << r);
+	}
+
+	printf("PVDEBUG: bulk reg write: %d regs written and verified in %zu words, %d mismatched.\n", n_writes, n, n_bad);
+	return n_bad;
+}
+
+// reads regs 0-17 into the shadow as one SPI message of READs, results
+// matched up RHD_PIPELINE_DEPTH words later like rhd_reg_write_bulk.
+// n_dummy extra dummy READs are sent first (used after power up).
+int rhd_reg_read_bulk(rhd_dev_t *dev, size_t n_dummy) {
+	uint8_t tx_buf[2 * RHD_BULK_MAX_WORDS];
+	uint8_t rx_buf[2 * RHD_BULK_MAX_WORDS];
+	size_t n = 0;
+
+	if (n_dummy > RHD_BULK_MAX_WORDS - RHD_NUM_RW_REGS - RHD_PIPELINE_DEPTH) {
+		n_dummy = RHD_BULK_MAX_WORDS - RHD_NUM_RW_REGS - RHD_PIPELINE_DEPTH;
+	}
+	for (size_t i=0; i<n_dummy; ++i, ++n) {
+		tx_buf[2*n] = reg_read_cmd(63);
+		tx_buf[2*n + 1] = 0;
+	}
+	for (uint8_t r=0; r<RHD_NUM_RW_REGS; ++r, ++n) {
+		tx_buf[2*n] = reg_read_cmd(r);
+		tx_buf[2*n + 1] = 0;
+	}
+	for (int i=0; i<RHD_PIPELINE_DEPTH; ++i, ++n) {
+		tx_buf[2*n] = reg_read_cmd(63);
+		tx_buf[2*n + 1] = 0;
+	}
+
+	if (rhd_spi_xfer_words(&dev->spi, tx_buf, rx_buf, n) == -1) {
+		return -1;
+	}
+	for (uint8_t r=0; r<RHD_NUM_RW_REGS; ++r) {
+		dev->reg_shadow.val[r] = rx_buf[2*(n_dummy + r + RHD_PIPELINE_DEPTH) + 1];
+	}
+	dev->reg_shadow.valid_msk = (0b1 << RHD_NUM_RW_REGS) - 1;
+	return 0;
+}
+
+// forget cached register values, e.g. after the chip is power cycled
+void rhd_reg_shadow_invalidate(rhd_dev_t *dev) {
+	dev->reg_shadow.valid_msk = 0;
+}
+
+// returns -1 if reg_num is not cached
+int rhd_reg_shadow_get(rhd_dev_t *dev, uint8_t reg_num, uint8_t *val) {
+	if (reg_num >= RHD_NUM_RW_REGS || !(dev->reg_shadow.valid_msk & (0b1 << reg_num))) {
+		return -1;
+	}
+	*val = dev->reg_shadow.val[reg_num];
+	return 0;
+}
+
+// builds the CONVERT command words for frames_per_xfer frames of
+// active_chs_msk once, so the convert loop only has to issue them. the
+// n_aux slots after each frame start out as filler (rhd_aux_fill_idle).
+int rhd_acq_plan_init(rhd_acq_plan_t *plan, uint16_t active_chs_msk, int dsp_en, size_t n_aux, size_t frames_per_xfer) {
+	if (active_chs_msk == 0 || frames_per_xfer == 0 || n_aux > RHD_AUX_MAX_SLOTS) {
+		return -1;
+	}
+
+	memset(plan, 0, sizeof(*plan));
+	plan->active_chs_msk = active_chs_msk;
+	plan->dsp_en = dsp_en & 0b1;
+	plan->frames_per_xfer = frames_per_xfer;
+	for (int ch=0; ch<RHD_NUM_CHS; ++ch) {
+		if ((0b1 << ch) & active_chs_msk) {
+			plan->chs[plan->n_chs++] = ch;
+		}
+	}
+	plan->n_aux = n_aux;
+	plan->words_per_frame = plan->n_chs + n_aux;
+	plan->n_words = plan->words_per_frame * frames_per_xfer;
+
+	plan->tx_buf = (uint8_t*) malloc(2 * plan->n_words);
+	plan->rx_buf = (uint8_t*) calloc(2 * plan->n_words, 1);
+	if (!plan->tx_buf || !plan->rx_buf) {
+		rhd_acq_plan_free(plan);
+		return -1;
+	}
+
+	for (size_t i=0; i<plan->n_words; ++i) {
+		size_t idx = i % plan->words_per_frame;
+		if (idx < plan->n_chs) {
+			plan->tx_buf[2*i] = plan->chs[idx] & 0x3f;
+			plan->tx_buf[2*i + 1] = plan->dsp_en;
+		} else {
+			rhd_aux_cmd_t issued;
+			rhd_aux_fill_idle(NULL, plan->tx_buf + 2*i, &issued);
+		}
+	}
+	return 0;
+}
+
+// issues the first n_words command words of the plan as one SPI message.
+// n_words may stop mid-frame, but each call restarts at the first channel.
+int rhd_acq_plan_run(rhd_dev_t *dev, rhd_acq_plan_t *plan, size_t n_words) {
+	if (n_words > plan->n_words) {
+		n_words = plan->n_words;
+	}
+	return rhd_spi_xfer_words(&dev->spi, plan->tx_buf, plan->rx_buf, n_words);
+}
+
+void rhd_acq_plan_free(rhd_acq_plan_t *plan) {
+	free(plan->tx_buf);
+	free(plan->rx_buf);
+	plan->tx_buf = NULL;
+	plan->rx_buf = NULL;
+}
+
+// routes the result of aux slot `slot` of frame f to its consumer
+static void aux_result(rhd_acq_t *acq, uint64_t f, size_t slot, uint16_t result) {
+	size_t n_ts = sizeof(acq->t_issue_ns) / sizeof(acq->t_issue_ns[0]);
+	const rhd_aux_cmd_t *cmd = &acq->aux_issued[f % n_ts][slot];
+	uint8_t reg_num = cmd->tx[0] & 0x3f;
+
+	// a WRITE echoes 0xff then the data it wrote
+	if ((cmd->tx[0] >> 6) == 0b10 && reg_num < RHD_NUM_RW_REGS && result == (0xff00 | cmd->tx[1])) {
+		acq->dev->reg_shadow.val[reg_num] = cmd->tx[1];
+		acq->dev->reg_shadow.valid_msk |= (0b1 << reg_num);
+	}
+	if (cmd->cb) {
+		cmd->cb(cmd, result, f, cmd->arg);
+		acq->dev->aux->n_results++;
+	}
+}
+
+static void assemble_words(rhd_acq_t *acq, const uint8_t *rx_buf, size_t n_words) {
+	size_t n_ts = sizeof(acq->t_issue_ns) / sizeof(acq->t_issue_ns[0]);
+	for (size_t i=0; i<n_words; ++i, ++acq->words_rx) {
+		if (acq->words_rx < RHD_PIPELINE_DEPTH) {
+			continue;
+		}
+		uint64_t k = acq->words_rx - RHD_PIPELINE_DEPTH;
+		uint64_t f = k / acq->plan.words_per_frame;
+		size_t idx = k % acq->plan.words_per_frame;
+		uint16_t result = (rx_buf[2*i] << 8) | rx_buf[2*i + 1];
+		if (f >= acq->frames_issued) {
+			// pipeline flush words, not part of any frame
+			continue;
+		}
+		if (idx >= acq->plan.n_chs) {
+			aux_result(acq, f, idx - acq->plan.n_chs, result);
+			continue;
+		}
+		acq->frame.data[idx] = result;
+		if (idx == acq->plan.n_chs - 1 && acq->cb_ret == 0) {
+			acq->frame.seq = f;
+			acq->frame.t_ns = acq->t_issue_ns[f % n_ts];
+			acq->cb_ret = acq->cb(&acq->frame, acq->plan.n_chs, acq->cb_arg);
+		}
+	}
+}
+
+// sets up an unpaced acquisition on dev, with dev->aux->n_slots aux
+// slots per frame if dev->aux is set. the plan holds dev->burst_frames
+// frames if set, for rhd_acq_burst, else one.
+// caller issues frames with rhd_acq_frame (or rhd_acq_burst) on whatever
+// schedule it likes and must call rhd_acq_finish once done.
+int rhd_acq_init(rhd_acq_t *acq, rhd_dev_t *dev, uint16_t active_chs_msk, rhd_frame_cb_t frame_cb, void *cb_arg) {
+	size_t n_aux = dev->aux ? dev->aux->n_slots : 0;
+	size_t frames_per_xfer = (dev->burst_frames > 1) ? dev->burst_frames : 1;
+	memset(acq, 0, sizeof(*acq));
+	if (rhd_acq_plan_init(&acq->plan, active_chs_msk, dev->dsp_offset_rem_en, n_aux, frames_per_xfer) == -1) {
+		return -1;
+	}
+	acq->dev = dev;
+	acq->speed = dev->spi.speed;
+	acq->cb = frame_cb;
+	acq->cb_arg = cb_arg;
+	return 0;
+}
+
+// estimates max srate of the acquisition, see get_max_srate.
+// returns -1 if srate is too fast.
+int rhd_acq_probe(rhd_acq_t *acq, uint16_t srate, uint16_t *max_srate) {
+	acq->speed = acq->dev->spi.speed;
+	return get_max_srate(acq->dev, &acq->plan, srate, max_srate, &acq->frame_sec);
+}
+
+// spreads the bus idle time of a 1/srate frame period over each frame of
+// a burst. delays only come in whole us, so the fractional part is
+// dithered (frame f gets floor((f+1)*gap) - floor(f*gap)) and a burst
+// lasts n_frames/srate to within 1 us, less RHD_BURST_SLACK_US so the
+// next burst can be issued on time. call after rhd_acq_probe.
+void rhd_acq_set_burst(rhd_acq_t *acq, uint16_t srate) {
+	size_t n = acq->plan.frames_per_xfer;
+	double gap = (1e6 / srate - acq->frame_sec * 1e6) - (double) RHD_BURST_SLACK_US / n;
+
+	acq->period_ns = (int64_t) (1e9 / srate);
+	acq->srate = srate;
+	if (gap < 0) {
+		gap = 0;
+	}
+	if (gap > 65535) {
+		gap = 65535; // delay_usecs is 16 bits, only hit below ~15 Hz
+	}
+	for (size_t f=0; f<n; ++f) {
+		acq->gap_us[f] = (uint16_t) ((uint64_t) ((f + 1) * gap) - (uint64_t) (f * gap));
+	}
+	printf("PVDEBUG: burst of %zu frames, %.2f us per frame on the bus, %.2f us gap after each\n", n, acq->frame_sec * 1e6, gap);
+}
+
+// an aux callback (rhd_link) changed the SPI clock mid-run. frame_sec is
+// taken from dev->spi_table, or else scaled with the clock, and burst
+// gaps are recomputed so a burst still lasts n_frames/srate.
+static void clock_changed(rhd_acq_t *acq) {
+	rhd_dev_t *dev = acq->dev;
+	double frame_sec;
+
+	if (!dev->spi_table || rhd_spi_table_frame_sec(dev->spi_table, dev->spi.speed, acq->plan.words_per_frame, acq->plan.frames_per_xfer > 1, &frame_sec) == -1) {
+		frame_sec = acq->frame_sec * acq->speed / dev->spi.speed;
+	}
+	acq->frame_sec = frame_sec;
+	acq->speed = dev->spi.speed;
+	if (acq->plan.frames_per_xfer > 1 && acq->srate) {
+		rhd_acq_set_burst(acq, acq->srate);
+	}
+}
+
+// issues n_frames frames starting with the plan's first, stamped t_ns,
+// t_ns + period_ns, ..., with the controller idle gap_us[f] after frame f
+// if paced. hands every frame that completes to frame_cb.
+static int issue_frames(rhd_acq_t *acq, int64_t t_ns, size_t n_frames, int paced) {
+	size_t n_ts = sizeof(acq->t_issue_ns) / sizeof(acq->t_issue_ns[0]);
+	size_t wpf = acq->plan.words_per_frame;
+	int ret;
+
+	for (size_t f=0; f<n_frames; ++f) {
+		uint64_t seq = acq->frames_issued + f;
+		acq->t_issue_ns[seq % n_ts] = t_ns + (int64_t) f * acq->period_ns;
+		if (acq->plan.n_aux) {
+			rhd_aux_fill(acq->dev->aux, seq, acq->plan.tx_buf + 2 * (f * wpf + acq->plan.n_chs), acq->aux_issued[seq % n_ts]);
+		}
+	}
+	if (acq->dev->stats) {
+		int64_t begin = rhd_now_ns();
+		ret = paced
+			? rhd_spi_xfer_frames(&acq->dev->spi, acq->plan.tx_buf, acq->plan.rx_buf, wpf, n_frames, acq->gap_us)
+			: rhd_acq_plan_run(acq->dev, &acq->plan, n_frames * wpf);
+		rhd_hist_record(&acq->dev->stats->xfer_ns, rhd_now_ns() - begin);
+	} else {
+		ret = paced
+			? rhd_spi_xfer_frames(&acq->dev->spi, acq->plan.tx_buf, acq->plan.rx_buf, wpf, n_frames, acq->gap_us)
+			: rhd_acq_plan_run(acq->dev, &acq->plan, n_frames * wpf);
+	}
+	if (ret == -1) {
+		printf("spi xfer failed during convert frame %llu.\n", (unsigned long long) acq->frames_issued);
+	}
+	acq->frames_issued += n_frames;
+	assemble_words(acq, acq->plan.rx_buf, n_frames * wpf);
+	if (acq->dev->spi.speed != acq->speed) {
+		clock_changed(acq);
+	}
+	return acq->cb_ret;
+}
+
+// issues one frame stamped t_ns and hands any frame it completes (the one
+// issued before it, due to pipelining) to frame_cb.
+// returns nonzero once frame_cb asked to stop.
+int rhd_acq_frame(rhd_acq_t *acq, int64_t t_ns) {
+	return issue_frames(acq, t_ns, 1, 0);
+}
+
+// issues n_frames (up to dev->burst_frames) frames in one SPI message,
+// spaced 1/srate apart by the controller (rhd_acq_set_burst), so the
+// caller only wakes once per burst. frame f is stamped t_ns + f/srate.
+// returns nonzero once frame_cb asked to stop.
+int rhd_acq_burst(rhd_acq_t *acq, int64_t t_ns, size_t n_frames) {
+	if (n_frames > acq->plan.frames_per_xfer) {
+		n_frames = acq->plan.frames_per_xfer;
+	}
+	return issue_frames(acq, t_ns, n_frames, 1);
+}
+
+// clocks out results still in the pipeline for the last frame, then
+// frees the plan.
+void rhd_acq_finish(rhd_acq_t *acq) {
+	// flush words must not repeat the last frame's aux commands
+	for (size_t slot=0; slot<acq->plan.n_aux; ++slot) {
+		rhd_aux_cmd_t issued;
+		rhd_aux_fill_idle(acq->dev->aux, acq->plan.tx_buf + 2 * (acq->plan.n_chs + slot), &issued);
+	}
+	for (size_t flushed=0; flushed<RHD_PIPELINE_DEPTH; ) {
+		size_t n = RHD_PIPELINE_DEPTH - flushed;
+		if (n > acq->plan.n_words) {
+			n = acq->plan.n_words;
+		}
+		rhd_acq_plan_run(acq->dev, &acq->plan, n);
+		assemble_words(acq, acq->plan.rx_buf, n);
+		flushed += n;
+	}
+	rhd_acq_plan_free(&acq->plan);
+}
+
+// paced acquisition of n_frames frames (0 = until *stop is set or frame_cb
+// returns nonzero). frame_cb is called once per complete frame from the
+// calling thread, so it must not block if srate matters.
+int rhd_convert_stream(rhd_dev_t *dev, uint16_t active_chs_msk, uint16_t srate, uint64_t n_frames, volatile sig_atomic_t *stop, rhd_frame_cb_t frame_cb, void *cb_arg) {
 	if (active_chs_msk == 0) {
 		pabort("rhd_convert: argument active_chs_mask must be non-zero.");
 	}
 
-	size_t counter = 0;
-	int ret;
-	size_t N = 2;
-	uint8_t tx_buf[] = {0, 0};
-	uint8_t rx_buf[] = {0xde, 0xad};
-	uint8_t command_word = 0;
 	uint16_t max_srate;
-	uint16_t delay_amt_us;
+	rhd_pacer_t pacer;
+	rhd_acq_t acq;
+	rhd_rt_state_t rt_state;
+	size_t burst;
 
-	printf("PVDEBUG: start rhd_convert.");
-	ret = get_max_srate_and_delay(fd, srate, active_chs_msk, &max_srate, &delay_amt_us);
+	if (rhd_acq_init(&acq, dev, active_chs_msk, frame_cb, cb_arg) == -1) {
+		pabort("rhd_convert: could not build acquisition plan");
+	}
 
-	if (ret == -1) {
+	if (rhd_acq_probe(&acq, srate, &max_srate) == -1) {
 		printf(
 			"WARNING: desired srate %.2e Hz greater than max possible srate %.2e Hz. Using max srate.\n",
 			(double) srate,
@@ -187,104 +618,144 @@ int rhd_convert(int fd, uint16_t active_chs_msk, uint16_t srate, uint16_t *data_
 	}
 
 	// due to pipelining, first two rx results are garbage values.
-	// function will only start writing to data buf after first two spi transfers
-	printf("PVDEBUG: dsp rem en = %d\n", dsp_offset_rem_en);
-	while (counter < (buf_len+2)) {
-		// assume convert occurs instantly. 
-		// enforce sample rate by delaying by 1/srate seconds
-		delay_us(delay_amt_us);
-		for (int ch=0; ch<16; ++ch) {
-			if (counter >= (buf_len+2)) {
-				break;
-			}
-			// skip if channel not part of active_ch_msk
-			if ( !((0b1 << ch) & active_chs_msk) )
-				continue; // do not increment counter
-
-			command_word = 0;
-			command_word |= ch & 0x3f;
-			tx_buf[0] = command_word;
-			tx_buf[1] = dsp_offset_rem_en & 0b1;
-			ret = rhd_spi_xfer(fd, tx_buf, N, rx_buf);
-			if (ret == -1) {
-				printf("spi xfer failed during convert ch %d.\n", ch);
+	// the assembler only starts filling frames after first two words.
+	printf("PVDEBUG: dsp rem en = %d\n", dev->dsp_offset_rem_en);
+	// in burst mode the pacer wakes once per burst, the controller spaces
+	// the frames within it
+	burst = acq.plan.frames_per_xfer;
+	if (burst > 1) {
+		rhd_acq_set_burst(&acq, srate);
+	}
+	if (dev->rt) {
+		rhd_rt_enter(&rt_state, dev->rt, dev->rt->cpu >= 0 ? dev->rt->cpu : rhd_rt_pick_cpu(), dev->name);
+		rhd_rt_prefault(acq.plan.tx_buf, 2 * acq.plan.n_words);
+		rhd_rt_prefault(acq.plan.rx_buf, 2 * acq.plan.n_words);
+	}
+	rhd_pacer_init(&pacer, (double) srate / burst, dev->pacer_spin_ns);
+	rhd_pacer_set_burst(&pacer, burst);
+	if (dev->stats) {
+		rhd_stats_set_burst(dev->stats, burst);
+	}
+	while (!(n_frames && acq.frames_issued >= n_frames) && !(stop && *stop) && acq.cb_ret == 0) {
+		// frames start on an absolute 1/srate grid, so time spent in the
+		// transfer itself does not slow the effective srate down
+		size_t n = burst;
+		rhd_pacer_wait(&pacer);
+		if (burst > 1) {
+			if (n_frames && n_frames - acq.frames_issued < n) {
+				n = n_frames - acq.frames_issued;
 			}
+			rhd_acq_burst(&acq, pacer.last_ns, n);
+		} else {
+			rhd_acq_frame(&acq, pacer.last_ns);
+		}
+		rhd_pacer_frame_done(&pacer);
+		if (dev->stats) {
+			rhd_stats_frame(dev->stats, &pacer, n);
+		}
+		// TODO set DSP offset flag depending on sample rate and integral of past values
+	}
 
-			if (counter >= 2) {
-				data_buf[counter - 2] = (rx_buf[0] << 8) | rx_buf[1];
-			}
+	rhd_acq_finish(&acq);
+	if (dev->rt) {
+		rhd_rt_exit(&rt_state);
+	}
+	rhd_pacer_report(&pacer);
+	return 0;
+}
 
-			// printf("PVDEBUG: counter: %zu\n", counter);
-			++counter;
-			
-			// TODO set DSP offset flag depending on sample rate and integral of past values
-		}
+typedef struct convert_buf {
+	uint16_t *data_buf;
+	size_t buf_len;
+	size_t counter;
+} convert_buf_t;
+
+static int convert_buf_cb(const rhd_frame_t *frame, size_t n_chs, void *arg) {
+	convert_buf_t *cb = (convert_buf_t*) arg;
+	for (size_t i=0; i<n_chs && cb->counter < cb->buf_len; ++i) {
+		cb->data_buf[cb->counter++] = frame->data[i];
+	}
+	return 0;
+}
+
+// if all channels active, active_ch_msk = 0xffff. If only ch1 active, active_ch_msk = 0x01 etc...
+int rhd_convert(rhd_dev_t *dev, uint16_t active_chs_msk, uint16_t srate, uint16_t *data_buf, size_t buf_len) {
+	if (active_chs_msk == 0) {
+		pabort("rhd_convert: argument active_chs_mask must be non-zero.");
 	}
 
+	size_t n_chs = __builtin_popcount(active_chs_msk);
+	convert_buf_t cb = {
+		.data_buf = data_buf,
+		.buf_len = buf_len,
+		.counter = 0,
+	};
+
+	if (dev->rt) {
+		rhd_rt_prefault(data_buf, buf_len * sizeof(uint16_t));
+	}
+	printf("PVDEBUG: start rhd_convert.");
+	rhd_convert_stream(dev, active_chs_msk, srate, (buf_len + n_chs - 1) / n_chs, NULL, convert_buf_cb, &cb);
 	printf("PVDEBUG: end rhd_convert.");
 	return 0;
 }
 
 // // read until we get expected value or hit max_num_reads
-// static void check_read(int fd, uint8_t reg_num, uint8_t check_val, uint8_t *read_val) {
+// static void check_read(rhd_dev_t *dev, uint8_t reg_num, uint8_t check_val, uint8_t *read_val) {
 // 	size_t count = 0;
 // 	size_t max_num_reads = 100;
 
-// 	rhd_reg_read(fd, reg_num, read_val);
+// 	rhd_reg_read(dev, reg_num, read_val);
 // 	while(*read_val != check_val) {
 // 		if (count > max_num_reads) {
 // 			break;
 // 		}
-// 		rhd_reg_read(fd, reg_num, read_val);
+// 		rhd_reg_read(dev, reg_num, read_val);
 // 		count++;
 // 	}
 // }
 
-// initializes RHD registers to default
-int rhd_reg_config_default(int fd, uint16_t active_chs_mask) {
-	// idk why but michael does 20 extra reads in his 2022 nrf code.
-	// seems overkill but why not. -PV 2024-May-18
+// initializes RHD registers to default with one verified bulk write, see
+// rhd_reg_write_bulk. regs already known (via shadow) to hold their
+// default are skipped, so re-configuring an already configured chip is free.
+// the shadow only lives as long as dev, so while it is empty (first config
+// after start) it is seeded with one rhd_reg_read_bulk first, and a chip a
+// previous run already configured only gets the regs that differ.
+int rhd_reg_config_default(rhd_dev_t *dev, uint16_t active_chs_mask) {
 	size_t reg_list_len = sizeof(rhd2216_reg_list) / sizeof(rhd2216_reg_list[0]);
+	uint8_t vals[RHD_NUM_RW_REGS];
+	uint32_t write_msk = 0;
 	int ret;
-	uint8_t tx_buf[] = {0b11111111, 0};
-	uint8_t rx_buf[] = {0,0};
 
-	printf("PVDEBUG: Got reg_list_len %zu\n", reg_list_len);
-	for (int i=0; i<20; ++i) {
-		rhd_spi_xfer(fd, tx_buf, 2, rx_buf);
+	if (dev->reg_shadow.valid_msk == 0) {
+		// idk why but michael does 20 extra reads in his 2022 nrf code.
+		// seems overkill but why not. -PV 2024-May-18
+		if (rhd_reg_read_bulk(dev, RHD_CONFIG_DUMMY_CMDS) == -1) {
+			printf("ERROR: could not read registers before config\n");
+			return -1;
+		}
 	}
-	printf("PVDEBUG: begin register config w 20 reads, got %d\n", rx_buf[1]);
 
-	int i;
-	for (i=0; i<reg_list_len; ++i) {
+	printf("PVDEBUG: Got reg_list_len %zu\n", reg_list_len);
+	for (size_t i=0; i<reg_list_len; ++i) {
 		rhd_reg_t cur_reg = rhd2216_reg_list[i];
-		if (cur_reg.read_only) {
+		if (cur_reg.read_only || cur_reg.reg_num >= RHD_NUM_RW_REGS) {
 			continue;
 		}
-
-		uint8_t read_data;
-		ret = rhd_reg_write(fd, cur_reg.reg_num, cur_reg.config_write_val);
-		ret = rhd_reg_read(fd, cur_reg.reg_num, &read_data);
-		if (read_data != cur_reg.config_check_val) {
-			printf(
-				"WARNING: reg_config_default: expected reg %d to read %x after writing %x, but got %x instead\n",
-				cur_reg.reg_num,
-				cur_reg.config_check_val,
-				cur_reg.config_write_val,
-				read_data
-				);
-		}
+		vals[cur_reg.reg_num] = cur_reg.config_write_val;
+		write_msk |= (0b1 << cur_reg.reg_num);
 	}
 
 	// power on active channels based on active_chs_mask
-	rhd_reg_write(fd, 14, (uint8_t) (active_chs_mask & 0xff));
-	rhd_reg_write(fd, 15, (uint8_t) (active_chs_mask >> 8) && 0xff);
+	vals[14] = active_chs_mask & 0xff;
+	vals[15] = (active_chs_mask >> 8) & 0xff;
 
+	ret = rhd_reg_write_bulk(dev, vals, write_msk, 0, 0);
 	printf("PVDEBUG: end register config sequence, ret %d.\n", ret);
-	return 0;
+	return (ret == -1) ? -1 : 0;
 }
 
-int rhd_calibrate(int fd) {
+int rhd_calibrate(rhd_dev_t *dev) {
 	int ret;
 	int N = 16;
 	uint8_t tx_buf[] = {0,0};
@@ -294,7 +765,7 @@ int rhd_calibrate(int fd) {
 	tx_buf[0] = 0b01010101;
 
 	printf("PVDEBUG: start calibration");
-	ret = rhd_spi_xfer(fd, tx_buf, 2, rx_buf);
+	ret = rhd_spi_xfer(&dev->spi, tx_buf, 2, rx_buf);
 	if (ret == -1) {
 		pabort("ERROR: could not send calibration command\n");
 	}
@@ -304,24 +775,24 @@ int rhd_calibrate(int fd) {
 	tx_buf[0] = 255;
     tx_buf[1] = 0;
 	for( int i = 0; i < 50; i++){
-		ret = rhd_spi_xfer(fd, tx_buf, 2, rx_buf);
+		ret = rhd_spi_xfer(&dev->spi, tx_buf, 2, rx_buf);
 	}
 
 	// do DSP offset removal on all channels
-	set_dsp_offset_rem_en(1);
+	set_dsp_offset_rem_en(dev, 1);
 	// read from all 16 channels, doesn't matter if they are active or not.
-	rhd_convert(fd, 0xffff, 1000, databuf, N);
-	set_dsp_offset_rem_en(0);
+	rhd_convert(dev, 0xffff, 1000, databuf, N);
+	set_dsp_offset_rem_en(dev, 0);
 	printf("PVDEBUG: end calibration, ret %d.\n", ret);
 	return ret;
 }
 
-int rhd_clear_calibration(int fd) {
+int rhd_clear_calibration(rhd_dev_t *dev) {
 	int ret;
 	uint8_t tx_buf[] = {0,0};
 	uint8_t rx_buf[] = {0xde, 0xad};
 	tx_buf[0] = 0b1101010;
-	ret = rhd_spi_xfer(fd, tx_buf, 2, rx_buf);
+	ret = rhd_spi_xfer(&dev->spi, tx_buf, 2, rx_buf);
 	if (ret == -1) {
 		pabort("ERROR: could not send clear calibration command\n");
 	}
@@ -1,6 +1,8 @@
 /*
 RHD utility functions. 
-* If using pi controller, use "pi_spi_lib.h".
+* Each chip is an rhd_dev_t (rhd_dev_open). All chip access goes through
+  its rhd_spi_t (see "rhd_spi.h"). Pi spidev
+  backend is in "pi_spi_lib.h", software device model in "rhd_sim.h".
 * If using NRF-52DK board as controller, uhhhh (TODO create nrfdk_spi_lib.h)
 RHD2000 series chips datasheet: 
 https://intantech.com/files/Intan_RHD2000_series_datasheet.pdf
@@ -15,11 +17,20 @@ using SPI0:
 * GND: any GND pin.
 */
 
+#ifndef RHD2216_LIB_H
+#define RHD2216_LIB_H
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
 #include <getopt.h>
-#include "pi_spi_lib.h"
+#include "rhd_spi.h"
+#include "rhd_pacer.h"
+#include "rhd_aux.h"
+#include "rhd_rt.h"
 
 
 #ifndef DONT_CARE
@@ -30,6 +41,24 @@ using SPI0:
 #define RHD_MAX_SPI_RATE_HZ 25000000 // 25 MHz
 #endif
 
+#define RHD_NUM_CHS 16
+// result of a command is clocked out on MISO two commands later
+#define RHD_PIPELINE_DEPTH 2
+// regs 0-17 are read/write, the rest are read-only or unused
+#define RHD_NUM_RW_REGS 18
+// dummy commands sent before the first register config after start
+#define RHD_CONFIG_DUMMY_CMDS 20
+// largest single bulk register message
+#define RHD_BULK_MAX_WORDS (RHD_CONFIG_DUMMY_CMDS + 2 * RHD_NUM_RW_REGS + RHD_PIPELINE_DEPTH)
+// frames timed when estimating max srate before a convert
+#define RHD_PROBE_FRAMES 8
+// burst mode: frames per SPI message, spaced by the controller (rhd_acq_burst)
+#define RHD_BURST_MAX_FRAMES 256
+// idle time left at the end of each burst for the wakeup and ioctl of the next
+#define RHD_BURST_SLACK_US 50
+// frames whose issue time/aux commands are still needed when results arrive
+#define RHD_ACQ_HIST (RHD_BURST_MAX_FRAMES + RHD_PIPELINE_DEPTH + 2)
+
 typedef struct rhd_reg {
     uint8_t reg_num;
     uint8_t config_write_val;
@@ -39,14 +68,110 @@ typedef struct rhd_reg {
     const char* long_desc;
 } rhd_reg_t;
 
+// host side copy of the read/write registers, so unchanged values
+// don't have to be re-sent. bit r of valid_msk set if val[r] is known.
+typedef struct rhd_reg_shadow {
+	uint8_t val[RHD_NUM_RW_REGS];
+	uint32_t valid_msk;
+} rhd_reg_shadow_t;
+
+// precomputed CONVERT command sequence for one or more frames.
+// a frame is one CONVERT per active channel, lowest channel first,
+// followed by n_aux auxiliary command slots (rhd_aux.h).
+typedef struct rhd_acq_plan {
+	uint16_t active_chs_msk;
+	int dsp_en;
+	size_t n_chs;
+	size_t n_aux;
+	size_t words_per_frame; // n_chs + n_aux
+	size_t frames_per_xfer;
+	size_t n_words; // words_per_frame * frames_per_xfer
+	uint8_t chs[RHD_NUM_CHS]; // active channel numbers in frame order
+	uint8_t *tx_buf; // 2 * n_words bytes, built once
+	uint8_t *rx_buf; // 2 * n_words bytes, filled by rhd_acq_plan_run
+} rhd_acq_plan_t;
+
+// one sample from each active channel, lowest channel first
+typedef struct rhd_frame {
+	uint64_t seq; // frame number since start of acquisition
+	int64_t t_ns; // CLOCK_MONOTONIC time the frame was issued
+	uint16_t data[RHD_NUM_CHS]; // only first n_chs entries valid
+} rhd_frame_t;
+
+// return nonzero to stop acquisition
+typedef int (*rhd_frame_cb_t)(const rhd_frame_t *frame, size_t n_chs, void *arg);
+
+struct rhd_stats;
+struct rhd_spi_table;
+
+// everything the library knows about one chip. one per chip, so several
+// chips can be driven at once (one thread per dev).
+typedef struct rhd_dev {
+	rhd_spi_t spi;
+	const char *name; // device path it was opened with
+	int verbose; // if 1, logs ALL spi read/writes
+	int dsp_offset_rem_en; // active high
+	int64_t pacer_spin_ns; // busy-wait tail used by rhd_convert
+	size_t burst_frames; // frames per SPI message in rhd_convert, 0/1 = one
+	rhd_reg_shadow_t reg_shadow; // host copy of regs 0-17
+	struct rhd_stats *stats; // timing histograms (rhd_stats.h), NULL = off
+	rhd_aux_sched_t *aux; // aux command slots in each frame, NULL = none
+	const rhd_rt_cfg_t *rt; // real-time acquisition thread (rhd_rt.h), NULL = off
+	const struct rhd_spi_table *spi_table; // cached frame times (rhd_spi_table.h), NULL = probe
+} rhd_dev_t;
+
+// in-progress acquisition on one dev. frames are issued by the caller
+// (rhd_acq_frame), results are reassembled from the pipelined rx stream:
+// result of word k arrives as word k + RHD_PIPELINE_DEPTH, so a frame
+// completes partway through the next SPI message.
+typedef struct rhd_acq {
+	rhd_dev_t *dev;
+	rhd_acq_plan_t plan;
+	uint64_t words_rx; // total words clocked in so far
+	uint64_t frames_issued;
+	int64_t t_issue_ns[RHD_ACQ_HIST]; // issue time of recent frames
+	rhd_aux_cmd_t aux_issued[RHD_ACQ_HIST][RHD_AUX_MAX_SLOTS]; // aux commands of recent frames
+	double frame_sec; // one frame on the bus, from rhd_acq_probe
+	uint32_t speed; // SPI clock frame_sec is for, see clock_changed
+	uint16_t srate; // set by rhd_acq_set_burst
+	int64_t period_ns; // frame spacing within a burst, see rhd_acq_set_burst
+	uint16_t gap_us[RHD_BURST_MAX_FRAMES]; // bus idle time after each frame of a burst
+	rhd_frame_t frame;
+	rhd_frame_cb_t cb;
+	void *cb_arg;
+	int cb_ret;
+} rhd_acq_t;
+
 // get/set
-int get_dsp_offset_rem_en(void);
-int set_dsp_offset_rem_en(int en);
+int get_dsp_offset_rem_en(rhd_dev_t *dev);
+int set_dsp_offset_rem_en(rhd_dev_t *dev, int en);
+int64_t get_pacer_spin_ns(rhd_dev_t *dev);
+int set_pacer_spin_ns(rhd_dev_t *dev, int64_t spin_ns);
+size_t get_burst_frames(rhd_dev_t *dev);
+int set_burst_frames(rhd_dev_t *dev, size_t n_frames);
 
 // util functions
-int rhd_reg_read(int fd, uint8_t reg_num, uint8_t *result);
-int rhd_reg_write(int fd, uint8_t reg_num, uint8_t reg_data);
-int rhd_convert(int fd, uint16_t active_chs_msk, uint16_t srate, uint16_t *data_buf, size_t data_buf_len); // TODO implement srate
-int rhd_reg_config_default(int fd, uint16_t active_chs_mask);
-int rhd_calibrate(int fd);
-int rhd_clear_calibration(int fd);
\ No newline at end of file
+int rhd_dev_open(rhd_dev_t *dev, const char *device, uint8_t mode, uint8_t bpw, uint32_t speed);
+void rhd_dev_close(rhd_dev_t *dev);
+int rhd_reg_read(rhd_dev_t *dev, uint8_t reg_num, uint8_t *result);
+int rhd_reg_write(rhd_dev_t *dev, uint8_t reg_num, uint8_t reg_data);
+int rhd_convert(rhd_dev_t *dev, uint16_t active_chs_msk, uint16_t srate, uint16_t *data_buf, size_t data_buf_len);
+int rhd_convert_stream(rhd_dev_t *dev, uint16_t active_chs_msk, uint16_t srate, uint64_t n_frames, volatile sig_atomic_t *stop, rhd_frame_cb_t frame_cb, void *cb_arg);
+int rhd_reg_write_bulk(rhd_dev_t *dev, const uint8_t *vals, uint32_t write_msk, size_t n_dummy, int force);
+int rhd_reg_read_bulk(rhd_dev_t *dev, size_t n_dummy);
+void rhd_reg_shadow_invalidate(rhd_dev_t *dev);
+int rhd_reg_shadow_get(rhd_dev_t *dev, uint8_t reg_num, uint8_t *val);
+int rhd_reg_config_default(rhd_dev_t *dev, uint16_t active_chs_mask);
+int rhd_calibrate(rhd_dev_t *dev);
+int rhd_acq_plan_init(rhd_acq_plan_t *plan, uint16_t active_chs_msk, int dsp_en, size_t n_aux, size_t frames_per_xfer);
+int rhd_acq_plan_run(rhd_dev_t *dev, rhd_acq_plan_t *plan, size_t n_words);
+void rhd_acq_plan_free(rhd_acq_plan_t *plan);
+int rhd_acq_init(rhd_acq_t *acq, rhd_dev_t *dev, uint16_t active_chs_msk, rhd_frame_cb_t frame_cb, void *cb_arg);
+int rhd_acq_probe(rhd_acq_t *acq, uint16_t srate, uint16_t *max_srate);
+int rhd_acq_frame(rhd_acq_t *acq, int64_t t_ns);
+void rhd_acq_set_burst(rhd_acq_t *acq, uint16_t srate);
+int rhd_acq_burst(rhd_acq_t *acq, int64_t t_ns, size_t n_frames);
+void rhd_acq_finish(rhd_acq_t *acq);
+int rhd_clear_calibration(rhd_dev_t *dev);
+
+#endif
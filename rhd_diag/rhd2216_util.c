@@ -15,6 +15,59 @@ Run from rhd_diag directory
 	./build/rhd2216_util --config --calibrate --convert 1000
 * configure registers to default configuration, calibrate, then read from all odd chs until we read 1000 samples
 	./build/rhd2216_util --config --calibrate --convert 1000 --active_chs 0x5555
+* configure, calibrate, then stream chs 1-4 to disk at 5 kHz until Ctrl-C
+	./build/rhd2216_util --config --calibrate --stream --active_chs 0x000f --srate 5000
+* same, but stop after 60 seconds
+	./build/rhd2216_util --config --calibrate --stream=60 --active_chs 0x000f --srate 5000
+* same, but write the compact binary datalog (load with np.memmap)
+	./build/rhd2216_util --config --calibrate --stream=60 --active_chs 0x000f --srate 5000 --format bin
+* same, but losslessly compressed (~1.8x smaller than bin, 3-4x smaller than text, for long sessions on the SD card)
+	./build/rhd2216_util --config --calibrate --stream=60 --active_chs 0x000f --srate 5000 --format rice
+* stream with a 20-450 Hz 4th order bandpass and 60 Hz + 2 harmonics notch applied live
+	./build/rhd2216_util --config --calibrate --stream --active_chs 0x000f --srate 5000 --bandpass 20:450 --notch 60:3
+* stream, and also write RMS/MAV/WL/ZC/SSC/MNF/MDF per channel every 128 frames over 256 frame windows
+	./build/rhd2216_util --config --calibrate --stream --active_chs 0x000f --srate 5000 --bandpass 20:450 --features 256:128
+* stream at 5 kHz, and alongside the full-rate datalog write 1 kHz and 500 Hz ones (polyphase FIR decimation),
+  named like the datalog with _1000Hz/_500Hz before the extension
+	./build/rhd2216_util --config --calibrate --stream=60 --active_chs 0x000f --srate 5000 --format bin --decimate 1000,500
+* stream, and write p50/p99/p99.9/max SPI transfer, frame and interval times to <datalog>.stats.json
+	./build/rhd2216_util --config --calibrate --stream=10 --active_chs 0xffff --srate 5000 --stats
+* stream, and serve frames live on tcp port 5555 (plot with postprocess/rhdutil_stream_client.py)
+	./build/rhd2216_util --config --calibrate --stream --active_chs 0x000f --srate 5000 --serve 5555
+* same, but on a unix socket, and for 10 s against the simulated RHD2216
+	./build/rhd2216_util --device sim --config --calibrate --stream=10 --active_chs 0x000f --srate 5000 --serve unix:/tmp/rhd.sock
+* stream, and publish frames to shared memory for local readers (./build/rhd_shm_tail rhd_frames,
+  or postprocess/rhdutil_shm_reader.py)
+	./build/rhd2216_util --config --calibrate --stream --active_chs 0x000f --srate 5000 --shm rhd_frames
+* stream, and check supply voltage and chip id every 1000 frames in a spare command slot of each frame (no gaps)
+	./build/rhd2216_util --config --calibrate --stream=60 --active_chs 0x000f --srate 5000 --health 1000
+* stream, but only log bursts of activity (envelope over 4x its idle baseline) with 300 ms before and 500 ms
+  after each, listed with absolute start times in <datalog>.events.csv
+	./build/rhd2216_util --config --calibrate --stream=3600 --active_chs 0x000f --srate 5000 --format bin --trigger 4:300:500
+* stream with the acquisition thread SCHED_FIFO, pinned to core 3, memory locked and prefaulted (run as root)
+	sudo ./build/rhd2216_util --config --calibrate --stream=60 --active_chs 0xffff --srate 5000 --realtime=3
+* stream at 20 kHz in bursts of 64 frames per SPI message, frames spaced by the SPI controller (one wakeup per burst)
+	./build/rhd2216_util --config --calibrate --stream=60 --active_chs 0x000f --srate 20000 --burst 64
+* stream at the fastest SPI clock (25 MHz, or the fastest --characterize found good), reading the ROM registers back
+  in every spare command slot, and step the clock down if 3 reads within a second come back wrong
+	./build/rhd2216_util --config --calibrate --stream=60 --active_chs 0xffff --srate 5000 --link_check
+* same against the simulated RHD2216 with a MISO bit error rate of 1e-5 above 16 MHz, to watch it step down
+	./build/rhd2216_util --device sim --config --calibrate --stream=10 --active_chs 0xffff --srate 5000 --link_check --sim_ber 1e-5:16000000
+* configure, calibrate, then measure each active electrode's impedance at 1 kHz (on-chip Zcheck DAC, about 25 ms per
+  quiet channel), printed and written to ./dlogs/rhdutil_<time>_chmsk<mask>_zcheck.csv. --zcheck=250 for 250 Hz
+	./build/rhd2216_util --config --calibrate --zcheck
+* same, then stream
+	./build/rhd2216_util --config --calibrate --zcheck --stream=60 --active_chs 0x000f --srate 5000
+* measure sustained frame rate at each SPI clock (8-25 MHz) and frame size, and cache it in ~/.cache/rhdutil.
+  later runs then pick the SPI clock for --srate from the cache and skip the startup probe
+	./build/rhd2216_util --characterize
+* long stream to the SD card with the datalog written through io_uring (--aio=thread for a plain writer thread),
+  so writeback stalls never reach the writer thread or the ring
+	./build/rhd2216_util --config --calibrate --stream=3600 --active_chs 0xffff --srate 5000 --format bin --aio
+* configure, calibrate and convert against the simulated RHD2216 (no pi or chip needed)
+	./build/rhd2216_util --device sim --config --calibrate --convert 1000
+* stream 32 channels from two chips on separate SPI buses into one datalog
+	./build/rhd2216_util --device /dev/spidev0.0 --device /dev/spidev1.0 --config --calibrate --stream=60 --srate 2000 --format bin
 	
 Help:
 * following prints out complete usage
@@ -22,18 +75,66 @@ Help:
 */
 
 #include <time.h> // for timestamps
+#include <signal.h>
 #include "pi_spi_lib.h"
 #include "rhd2216_lib.h"
+#include "rhd_sim.h"
+#include "rhd_dlog.h"
+#include "rhd_stream.h"
+#include "rhd_filter.h"
+#include "rhd_features.h"
+#include "rhd_multi.h"
+#include "rhd_stats.h"
+#include "rhd_spi_table.h"
+#include "rhd_decim.h"
+#include "rhd_link.h"
+#include "rhd_zcheck.h"
 
 static uint8_t reg_data;
 static uint8_t reg_num;
 static uint8_t mode;
 static uint8_t bpw;
 static uint32_t speed;
-static char *device = PI_SPI_0_0;
+static char *devices[RHD_MULTI_MAX_DEVS] = {PI_SPI_0_0};
+static size_t n_devices = 0; // 0 = default device
 static size_t num_samples = 16;
 static uint16_t srate = 1000; 
 static uint16_t active_chs_mask = 0xffff;
+static long spin_us = 0;
+static size_t burst_frames = 0;
+static rhd_dlog_format_t dlog_format = RHD_DLOG_TEXT;
+static rhd_dlog_io_t dlog_io = RHD_DLOG_STDIO;
+static double stream_duration_s = 0; // 0 = until Ctrl-C
+static const char *serve_addr = NULL;
+static const char *shm_name = NULL;
+static uint64_t health_every = 0; // frames
+static uint32_t link_max_errs = RHD_LINK_DEFAULT_MAX_ERRS;
+static double sim_ber = 0;
+static double zcheck_hz = RHD_ZCHECK_DEFAULT_FREQ_HZ;
+static uint32_t sim_ber_above = 16000000; // Hz
+static uint16_t decim_rates[RHD_DECIM_MAX_OUTPUTS];
+static size_t n_decim_rates = 0;
+static rhd_trig_cfg_t trig_cfg = {
+	.thresh = 4,
+	.pre_s = 0.2,
+	.post_s = 0.2,
+};
+static rhd_rt_cfg_t rt_cfg = {
+	.priority = RHD_RT_DEFAULT_PRIO,
+	.cpu = -1,
+};
+static volatile sig_atomic_t stop_requested = 0;
+static double bp_lo_hz = 0;
+static double bp_hi_hz = 0;
+static int bp_order = 4;
+static double notch_hz = 0;
+static int notch_harmonics = 1;
+static rhd_feat_cfg_t feat_cfg = {
+	.window = 256,
+	.hop = 128,
+	.zc_thresh = 10,
+	.spectral = 1,
+};
 
 static int FOUND_REG_NUM = 0;
 static int FOUND_REG_READ = 0;
@@ -44,17 +145,39 @@ static int FOUND_CONFIG = 0;
 static int FOUND_CALIBRATE = 0;
 static int FOUND_CLEAR = 0;
 static int FOUND_SRATE = 0;
+static int FOUND_SPEED = 0;
+static int FOUND_CHARACTERIZE = 0;
+static int FOUND_STREAM = 0;
+static int FOUND_BANDPASS = 0;
+static int FOUND_NOTCH = 0;
+static int FOUND_FEATURES = 0;
+static int FOUND_STATS = 0;
+static int FOUND_SERVE = 0;
+static int FOUND_SHM = 0;
+static int FOUND_HEALTH = 0;
+static int FOUND_REALTIME = 0;
+static int FOUND_TRIGGER = 0;
+static int FOUND_DECIMATE = 0;
+static int FOUND_LINK = 0;
+static int FOUND_SIM_BER = 0;
+static int FOUND_ZCHECK = 0;
 
 static void pabort(const char *s) {
 	perror(s);
 	abort();
 }
 
+static void handle_sigint(int sig) {
+	(void) sig;
+	stop_requested = 1;
+}
+
 static void print_usage(const char *prog)
 {
 	printf("Usage: %s [-Dsdnrwc]\n", prog);
-	printf("  -D --device			device to use (default /dev/spidev0.1).\n"
-	     "  -s --speed			max speed (Hz), Default 12.5 MHz. \n"
+	printf("  -D --device			device to use (default /dev/spidev0.0). \"sim\" uses simulated RHD2216.\n"
+		 "    			\tRepeat (up to 4) to stream several chips into one datalog, one thread per SPI bus.\n"
+	     "  -s --speed			max speed (Hz), Default 8 MHz (25 MHz with --link_check), or picked for --srate from the --characterize cache.\n"
 	     "  -d --delay			delay (usec).\n"
 		 "  -n --reg_num		\tRHD register number to read or write.\n"
 		 "  -r --reg_read		\tRead register specified by --reg_num.\n"
@@ -65,7 +188,31 @@ static void print_usage(const char *prog)
 		 "  -C --calibrate		Initiate ADC self-calibration routine.\n"
 		 "  -e --clear			Clear Calibration.\n"
 		 "  -R --srate			Sampling rate in Hz, used with --convert command.\n"
-		 );
+		 "     --stream[=SEC]		Stream frames to disk until Ctrl-C (or for SEC seconds). Memory use is constant.\n"
+		 "     --format		\tDatalog format, \"text\" (default), \"bin\" (int16 frames) or \"rice\" (lossless compressed), see rhd_dlog.h.\n"
+		 "     --aio[=thread]		Write the datalog asynchronously (io_uring, or a writer thread), preallocated and synced as it goes.\n"
+		 "     --bandpass LO:HI[:ORDER]	Butterworth bandpass (Hz) applied to each channel before logging. Default order 4.\n"
+		 "     --notch F0[:N]		Notch at F0 Hz and its harmonics up to N*F0, applied before logging.\n"
+		 "     --decimate R[,R...]	Also write datalogs decimated to R Hz (up to 4, each dividing --srate by 2-64),\n"
+		 "    			\tpolyphase FIR anti-aliased, after --bandpass/--notch.\n"
+		 "     --features W:H		Write windowed EMG features (W frame window, every H frames) to <datalog>.features.csv.\n"
+		 "     --stats		\tRecord SPI transfer/frame/interval/deadline-lag histograms, written to <datalog>.stats.json.\n"
+		 "     --serve ADDR		Serve frames live to clients on [tcp:][HOST:]PORT or unix:PATH while streaming.\n"
+		 "     --shm NAME		\tPublish frames to shared-memory ring /dev/shm/NAME for local readers while streaming.\n"
+		 "     --trigger K[:PRE[:POST]]	Only log bursts where a channel's envelope exceeds K times its baseline, with PRE/POST ms\n"
+		 "    			\tof context (default 200:200). Events are listed in <datalog>.events.csv.\n"
+		 "     --health N		\tRead supply voltage and check ROM chip id every N frames, in an extra command slot per frame.\n"
+		 "     --link_check[=N]	Run at the fastest SPI clock, read the ROM registers back in every spare command slot and\n"
+		 "    			\tstep the clock down after N (default 3) bad reads within a second. Also checked at startup.\n"
+		 "     --zcheck[=FREQ]		Measure each active electrode's impedance at FREQ Hz (default 1000, 20-5000) with the on-chip\n"
+		 "    			\tZcheck DAC after --config/--calibrate, written to ./dlogs/rhdutil_<time>_chmsk<mask>_zcheck.csv.\n"
+		 "     --sim_ber BER[:HZ]	Simulated device flips MISO bits with probability BER above HZ (default 16 MHz).\n"
+		 "     --realtime[=CPU]	Run acquisition SCHED_FIFO with memory locked and prefaulted, pinned to CPU\n"
+		 "    			\t(default: an isolcpus core, else the highest). Needs root or CAP_SYS_NICE/CAP_IPC_LOCK.\n"
+		 "     --burst N		\tIssue N frames (2-256) per SPI message, spaced 1/srate apart by the SPI controller.\n"
+		 "     --characterize		Time frames at each SPI clock 8-25 MHz and cache the table in ~/%s.\n"
+		 "     --spin_us		\tBusy-wait the last N us before each frame deadline for tighter pacing. Default 0.\n"
+		 , RHD_SPI_TABLE_DIR);
 	printf(
 		"Example:\n./build/rhd2216_util --config --calibrate --convert 1000 --active_chs 0x5555 --srate 1250\n"
 		);
@@ -92,6 +239,25 @@ static void parse_opts(int argc, char *argv[])
 			{ "calibrate",  0, 0, 'l'},
 			{ "clear",		0, 0, 'e'},
 			{ "srate", 		1, 0, 'R'},
+			{ "spin_us",	1, 0, 'S'},
+			{ "burst",		1, 0, 'K'},
+			{ "characterize", 0, 0, 'Z'},
+			{ "stream",		2, 0, 'T'},
+			{ "format",		1, 0, 'F'},
+			{ "aio",		2, 0, 'A'},
+			{ "bandpass",	1, 0, 'B'},
+			{ "notch",		1, 0, 'N'},
+			{ "features",	1, 0, 'X'},
+			{ "decimate",	1, 0, 'J'},
+			{ "stats",		0, 0, 'P'},
+			{ "serve",		1, 0, 'V'},
+			{ "shm",		1, 0, 'H'},
+			{ "health",		1, 0, 'L'},
+			{ "trigger",	1, 0, 'G'},
+			{ "realtime",	2, 0, 'Y'},
+			{ "link_check",	2, 0, 'U'},
+			{ "sim_ber",	1, 0, 'W'},
+			{ "zcheck",		2, 0, 'I'},
 			{ NULL, 		0, 0, 0 },
 		};
 
@@ -103,10 +269,16 @@ static void parse_opts(int argc, char *argv[])
 
 		switch (c) {
 		case 'D':
-			// TODO
+			if (n_devices >= RHD_MULTI_MAX_DEVS) {
+				pabort("ERROR: too many --device");
+			}
+			devices[n_devices++] = optarg;
+			printf("PVDEBUG: found device %s\n", optarg);
 			break;
 		case 's':
-			// TODO
+			FOUND_SPEED = 1;
+			speed = (uint32_t) strtoul(optarg, NULL, 10);
+			printf("PVDEBUG: found speed %u Hz\n", speed);
 			break;
 		case 'd':
 			// TODO
@@ -152,6 +324,146 @@ static void parse_opts(int argc, char *argv[])
 			srate = strtol(optarg, NULL, 10);
 			printf("PVDEBUG found srate %d\n", srate);
 			break;
+		case 'T':
+			FOUND_STREAM = 1;
+			if (optarg) {
+				stream_duration_s = strtod(optarg, NULL);
+			}
+			printf("PVDEBUG: found stream, duration %.1f s\n", stream_duration_s);
+			break;
+		case 'F':
+			if (rhd_dlog_parse_format(optarg, &dlog_format) == -1) {
+				pabort("ERROR: --format must be text, bin or rice");
+			}
+			printf("PVDEBUG: found format %s\n", optarg);
+			break;
+		case 'A':
+			if (!optarg) {
+				dlog_io = RHD_DLOG_AIO;
+			} else if (strcmp(optarg, "thread") == 0) {
+				dlog_io = RHD_DLOG_AIO_THREAD;
+			} else {
+				pabort("ERROR: --aio takes no value or \"thread\"");
+			}
+			printf("PVDEBUG: found aio%s\n", optarg ? " (writer thread)" : "");
+			break;
+		case 'B':
+			FOUND_BANDPASS = 1;
+			if (sscanf(optarg, "%lf:%lf:%d", &bp_lo_hz, &bp_hi_hz, &bp_order) < 2) {
+				pabort("ERROR: --bandpass expects LO:HI[:ORDER]");
+			}
+			printf("PVDEBUG: found bandpass %.1f-%.1f Hz order %d\n", bp_lo_hz, bp_hi_hz, bp_order);
+			break;
+		case 'N':
+			FOUND_NOTCH = 1;
+			if (sscanf(optarg, "%lf:%d", &notch_hz, &notch_harmonics) < 1) {
+				pabort("ERROR: --notch expects F0[:N]");
+			}
+			printf("PVDEBUG: found notch %.1f Hz x%d\n", notch_hz, notch_harmonics);
+			break;
+		case 'X':
+			FOUND_FEATURES = 1;
+			if (sscanf(optarg, "%zu:%zu", &feat_cfg.window, &feat_cfg.hop) != 2) {
+				pabort("ERROR: --features expects WINDOW:HOP");
+			}
+			printf("PVDEBUG: found features window %zu hop %zu\n", feat_cfg.window, feat_cfg.hop);
+			break;
+		case 'G': {
+			double pre_ms = trig_cfg.pre_s * 1e3;
+			double post_ms = trig_cfg.post_s * 1e3;
+			FOUND_TRIGGER = 1;
+			if (sscanf(optarg, "%lf:%lf:%lf", &trig_cfg.thresh, &pre_ms, &post_ms) < 1 || trig_cfg.thresh <= 1) {
+				pabort("ERROR: --trigger expects K[:PRE_MS[:POST_MS]] with K > 1");
+			}
+			trig_cfg.pre_s = pre_ms / 1e3;
+			trig_cfg.post_s = post_ms / 1e3;
+			printf("PVDEBUG: found trigger %.2fx baseline, %.0f ms pre, %.0f ms post\n", trig_cfg.thresh, pre_ms, post_ms);
+			break;
+		}
+		case 'J': {
+			char *save = NULL;
+			FOUND_DECIMATE = 1;
+			n_decim_rates = 0;
+			for (char *tok=strtok_r(optarg, ",", &save); tok; tok=strtok_r(NULL, ",", &save)) {
+				if (n_decim_rates >= RHD_DECIM_MAX_OUTPUTS) {
+					pabort("ERROR: --decimate takes at most 4 rates");
+				}
+				decim_rates[n_decim_rates++] = (uint16_t) strtoul(tok, NULL, 10);
+			}
+			printf("PVDEBUG: found decimate, %zu outputs\n", n_decim_rates);
+			break;
+		}
+		case 'P':
+			FOUND_STATS = 1;
+			printf("PVDEBUG: found stats\n");
+			break;
+		case 'V':
+			FOUND_SERVE = 1;
+			serve_addr = optarg;
+			printf("PVDEBUG: found serve %s\n", serve_addr);
+			break;
+		case 'H':
+			FOUND_SHM = 1;
+			shm_name = optarg;
+			printf("PVDEBUG: found shm %s\n", shm_name);
+			break;
+		case 'L':
+			FOUND_HEALTH = 1;
+			health_every = strtoull(optarg, NULL, 10);
+			if (health_every == 0) {
+				pabort("ERROR: --health expects a frame count > 0");
+			}
+			printf("PVDEBUG: found health every %llu frames\n", (unsigned long long) health_every);
+			break;
+		case 'U':
+			FOUND_LINK = 1;
+			if (optarg) {
+				link_max_errs = (uint32_t) strtoul(optarg, NULL, 10);
+			}
+			if (link_max_errs == 0 || link_max_errs > RHD_LINK_MAX_ERRS) {
+				pabort("ERROR: --link_check expects 1-16 bad reads");
+			}
+			printf("PVDEBUG: found link_check, step down after %u bad reads\n", link_max_errs);
+			break;
+		case 'W':
+			FOUND_SIM_BER = 1;
+			if (sscanf(optarg, "%lf:%u", &sim_ber, &sim_ber_above) < 1 || sim_ber < 0 || sim_ber >= 1) {
+				pabort("ERROR: --sim_ber expects BER[:HZ] with 0 <= BER < 1");
+			}
+			printf("PVDEBUG: found sim_ber %.2e above %u Hz\n", sim_ber, sim_ber_above);
+			break;
+		case 'I':
+			FOUND_ZCHECK = 1;
+			if (optarg) {
+				zcheck_hz = strtod(optarg, NULL);
+			}
+			if (zcheck_hz < RHD_ZCHECK_MIN_FREQ_HZ || zcheck_hz > RHD_ZCHECK_MAX_FREQ_HZ) {
+				pabort("ERROR: --zcheck expects 20-5000 Hz");
+			}
+			printf("PVDEBUG: found zcheck at %.1f Hz\n", zcheck_hz);
+			break;
+		case 'Y':
+			FOUND_REALTIME = 1;
+			if (optarg) {
+				rt_cfg.cpu = (int) strtol(optarg, NULL, 10);
+			}
+			printf("PVDEBUG: found realtime, cpu %d\n", rt_cfg.cpu);
+			break;
+		case 'S':
+			spin_us = strtol(optarg, NULL, 10);
+			printf("PVDEBUG: found spin_us %ld\n", spin_us);
+			break;
+		case 'Z':
+			FOUND_CHARACTERIZE = 1;
+			printf("PVDEBUG: found characterize\n");
+			break;
+		case 'K':
+			burst_frames = strtoul(optarg, NULL, 10);
+			if (burst_frames < 2 || burst_frames > RHD_BURST_MAX_FRAMES) {
+				pabort("ERROR: --burst expects 2-256 frames");
+			}
+			printf("PVDEBUG: found burst %zu frames\n", burst_frames);
+			break;
 		}
 	}
 
@@ -166,8 +478,40 @@ static void parse_opts(int argc, char *argv[])
 			);
 	}
 
-	if ( FOUND_CONVERT && !FOUND_SRATE ) {
-		printf("WARNING: --convert specified but --srate not specified. Using default srate of 1000 Hz.\n");
+	if ( (FOUND_CONVERT || FOUND_STREAM) && !FOUND_SRATE ) {
+		printf("WARNING: --convert/--stream specified but --srate not specified. Using default srate of 1000 Hz.\n");
+	}
+
+	if ( FOUND_CONVERT && FOUND_STREAM ) {
+		pabort("ERROR: --convert and --stream are mutually exclusive");
+	}
+
+	if ( (FOUND_SERVE || FOUND_SHM) && !FOUND_STREAM ) {
+		pabort("ERROR: --serve/--shm only supported with --stream");
+	}
+
+	if ( FOUND_TRIGGER && !FOUND_STREAM ) {
+		pabort("ERROR: --trigger only supported with --stream");
+	}
+
+	if (n_devices == 0) {
+		n_devices = 1;
+	}
+
+	if ( n_devices > 1 && FOUND_CONVERT ) {
+		pabort("ERROR: multiple --device only supported with --stream");
+	}
+
+	if ( n_devices > 1 && (FOUND_BANDPASS || FOUND_NOTCH || FOUND_FEATURES || FOUND_DECIMATE) ) {
+		pabort("ERROR: --bandpass/--notch/--features/--decimate not supported with multiple --device");
+	}
+
+	if ( n_devices > 1 && FOUND_TRIGGER ) {
+		pabort("ERROR: --trigger not supported with multiple --device");
+	}
+
+	if ( n_devices > 1 && burst_frames ) {
+		pabort("ERROR: --burst not supported with multiple --device");
 	}
 
 	// default read reg
@@ -177,25 +521,300 @@ static void parse_opts(int argc, char *argv[])
 
 }
 
+// builds filter bank from --bandpass/--notch. returns NULL if neither given.
+static rhd_filter_t *setup_filter(rhd_filter_t *filt) {
+	if (!FOUND_BANDPASS && !FOUND_NOTCH) {
+		return NULL;
+	}
+	rhd_filter_init(filt, __builtin_popcount(active_chs_mask));
+	if (FOUND_BANDPASS && rhd_filter_add_bandpass(filt, srate, bp_lo_hz, bp_hi_hz, bp_order) == -1) {
+		pabort("ERROR: invalid --bandpass for this srate");
+	}
+	if (FOUND_NOTCH && rhd_filter_add_notch(filt, srate, notch_hz, RHD_FILTER_NOTCH_Q, notch_harmonics) == -1) {
+		pabort("ERROR: invalid --notch for this srate");
+	}
+	printf("INFO: filtering with %zu biquad sections\n", filt->n_sections);
+	return filt;
+}
+
+// sets up feature extraction from --features. returns NULL if not given.
+static rhd_feat_t *setup_features(rhd_feat_t *feat, char *feat_fname, size_t max_len, const char *fname) {
+	if (!FOUND_FEATURES) {
+		return NULL;
+	}
+	feat_cfg.srate = srate;
+	if (rhd_feat_init(feat, &feat_cfg, __builtin_popcount(active_chs_mask)) == -1) {
+		pabort("ERROR: invalid --features");
+	}
+	snprintf(feat_fname, max_len, "%s.features.csv", fname);
+	return feat;
+}
+
+// sets up one decimator per --decimate rate. fnames[i] is the datalog
+// name with _<rate>Hz before the extension. returns the number of outputs.
+static size_t setup_decim(rhd_decim_t *decims, char fnames[][300], const char **fname_ptrs, const char *fname) {
+	const char *ext = strrchr(fname, '.');
+	int stem_len = ext ? (int) (ext - fname) : (int) strlen(fname);
+
+	for (size_t i=0; i<n_decim_rates; ++i) {
+		if (decim_rates[i] == 0 || srate % decim_rates[i] != 0
+			|| rhd_decim_init(&decims[i], __builtin_popcount(active_chs_mask), srate / decim_rates[i]) == -1) {
+			pabort("ERROR: each --decimate rate must divide --srate by 2-64");
+		}
+		snprintf(fnames[i], 300, "%.*s_%uHz.%s", stem_len, fname, decim_rates[i], rhd_dlog_ext(dlog_format));
+		fname_ptrs[i] = fnames[i];
+	}
+	return n_decim_rates;
+}
+
+// attaches a stats collector to each chip, from here on its frames are
+// timed. done after config/calibrate so those don't show up.
+static void start_stats(rhd_dev_t *devs, rhd_stats_t *stats) {
+	if (!FOUND_STATS) {
+		return;
+	}
+	for (size_t d=0; d<n_devices; ++d) {
+		rhd_stats_init(&stats[d], srate);
+		devs[d].stats = &stats[d];
+	}
+}
+
+// prints percentiles and writes them to <fname>.stats.json
+static void finish_stats(rhd_dev_t *devs, const char *fname) {
+	rhd_stats_t *stats[RHD_MULTI_MAX_DEVS];
+	const char *names[RHD_MULTI_MAX_DEVS];
+	char stats_fname[300];
+	FILE *f;
+
+	if (!FOUND_STATS) {
+		return;
+	}
+	for (size_t d=0; d<n_devices; ++d) {
+		stats[d] = devs[d].stats;
+		names[d] = devs[d].name;
+		rhd_stats_report(stats[d], names[d]);
+		devs[d].stats = NULL;
+	}
+	snprintf(stats_fname, sizeof(stats_fname), "%s.stats.json", fname);
+	f = fopen(stats_fname, "w");
+	if (!f || rhd_stats_write_json(f, stats, names, n_devices) == -1) {
+		printf("ERROR: could not write %s\n", stats_fname);
+	} else {
+		printf("Timing stats stored in %s\n", stats_fname);
+	}
+	if (f) {
+		fclose(f);
+	}
+}
+
+// gives each chip one aux command slot per frame for --health checks
+// and --link_check ROM reads (which get whatever --health leaves free),
+// done after config/calibrate like start_stats
+static void start_aux(rhd_dev_t *devs, rhd_aux_sched_t *aux, rhd_health_t *health, rhd_link_t *links) {
+	if (!FOUND_HEALTH && !FOUND_LINK) {
+		return;
+	}
+	for (size_t d=0; d<n_devices; ++d) {
+		if (rhd_aux_init(&aux[d], 1) == -1) {
+			pabort("ERROR: could not set up aux command slots");
+		}
+		if (FOUND_HEALTH && rhd_health_init(&health[d], &aux[d], health_every) == -1) {
+			pabort("ERROR: could not set up --health");
+		}
+		if (FOUND_LINK && rhd_link_attach(&links[d], &aux[d], __builtin_popcount(active_chs_mask) + 1, srate) == -1) {
+			pabort("ERROR: could not set up --link_check");
+		}
+		devs[d].aux = &aux[d];
+	}
+}
+
+static void finish_aux(rhd_dev_t *devs, rhd_health_t *health, rhd_link_t *links) {
+	if (!FOUND_HEALTH && !FOUND_LINK) {
+		return;
+	}
+	for (size_t d=0; d<n_devices; ++d) {
+		if (FOUND_HEALTH) {
+			rhd_health_report(&health[d], devs[d].name);
+		}
+		if (FOUND_LINK) {
+			rhd_link_report(&links[d]);
+		}
+		devs[d].aux = NULL;
+	}
+}
+
+// with --link_check, makes sure each chip's ROM reads back right at the
+// clock it starts at, stepping down if not, before anything is written
+// to it at a clock that garbles it
+static void start_link(rhd_dev_t *devs, rhd_link_t *links) {
+	if (!FOUND_LINK) {
+		return;
+	}
+	for (size_t d=0; d<n_devices; ++d) {
+		if (rhd_link_start(&links[d], &devs[d], link_max_errs) == -1) {
+			pabort("ERROR: --link_check found no usable SPI clock");
+		}
+	}
+	speed = devs[0].spi.speed;
+}
+
+// fastest clock the table found the link good at, 0 if none
+static uint32_t fastest_good_speed(const rhd_spi_table_t *table) {
+	uint32_t fastest = 0;
+	for (size_t s=0; s<table->n_speeds; ++s) {
+		if (table->row[s].link_ok && table->row[s].speed > fastest) {
+			fastest = table->row[s].speed;
+		}
+	}
+	return fastest;
+}
+
+// with --characterize, sweeps each chip's SPI clocks and caches the
+// table. otherwise loads the cached table, if any, which then picks the
+// clock for --srate (unless --speed was given; the fastest good one with
+// --link_check) and stands in for the startup probe.
+static void start_spi_table(rhd_dev_t *devs, rhd_spi_table_t *tables) {
+	for (size_t d=0; d<n_devices; ++d) {
+		char path[256];
+		if (rhd_spi_table_path(devs[d].name, path, sizeof(path)) == -1) {
+			printf("WARNING: no SPI table cache path for %s, is $HOME set?\n", devs[d].name);
+			continue;
+		}
+		if (FOUND_CHARACTERIZE) {
+			if (rhd_spi_table_characterize(&tables[d], &devs[d]) == -1 || rhd_spi_table_save(&tables[d], path) == -1) {
+				printf("ERROR: could not characterize %s into %s\n", devs[d].name, path);
+				continue;
+			}
+			rhd_spi_table_print(&tables[d]);
+			printf("SPI table stored in %s\n", path);
+		} else if (rhd_spi_table_load(&tables[d], devs[d].name, path) == -1) {
+			continue;
+		}
+		devs[d].spi_table = &tables[d];
+
+		if (!FOUND_SPEED && (FOUND_CONVERT || FOUND_STREAM)) {
+			// --health/--link_check take one aux slot per frame, see start_aux
+			size_t words = __builtin_popcount(active_chs_mask) + ((FOUND_HEALTH || FOUND_LINK) ? 1 : 0);
+			uint32_t pick = FOUND_LINK
+				? fastest_good_speed(&tables[d])
+				: rhd_spi_table_pick_speed(&tables[d], words, srate, burst_frames > 1);
+			if (pick && pick != devs[d].spi.speed && rhd_spi_config(&devs[d].spi, mode, bpw, pick) == -1) {
+				pabort("can't set spi speed");
+			}
+			printf("INFO: %s SPI clock %.1f MHz for %u Hz from %s\n", devs[d].name, devs[d].spi.speed / 1e6, srate, path);
+		}
+	}
+	// the datalog header records chip 0's clock
+	speed = devs[0].spi.speed;
+}
+
+// measures every active electrode of each chip, after config/calibrate
+// and before anything is streamed, into ./dlogs/rhdutil_<time>_chmsk<mask>_zcheck.csv
+static void run_zcheck(rhd_dev_t *devs) {
+	rhd_zcheck_result_t res[RHD_NUM_CHS];
+	char fname[255];
+	char time_str[16];
+	time_t t;
+	FILE *f = NULL;
+
+	if (!FOUND_ZCHECK) {
+		return;
+	}
+	time(&t);
+	strftime(time_str, sizeof(time_str), "%Y%m%d_%H%M%S", localtime(&t));
+	snprintf(fname, sizeof(fname), "./dlogs/rhdutil_%s_chmsk%04x_zcheck.csv", time_str, active_chs_mask);
+	for (size_t d=0; d<n_devices; ++d) {
+		rhd_zcheck_t zc;
+		int n;
+
+		if (rhd_zcheck_init(&zc, &devs[d], zcheck_hz) == -1) {
+			pabort("ERROR: could not set up --zcheck");
+		}
+		// the simulated chip's time base is one conversion of a channel
+		// per 1/srate, here one per DAC step
+		if (rhd_sim_is_sim(&devs[d].spi)) {
+			rhd_sim_set_srate(&devs[d].spi, zc.step_rate);
+		}
+		n = rhd_zcheck_run(&zc, active_chs_mask, res);
+		if (rhd_sim_is_sim(&devs[d].spi)) {
+			rhd_sim_set_srate(&devs[d].spi, srate);
+		}
+		if (n == -1) {
+			pabort("ERROR: --zcheck failed");
+		}
+		if (d == 0) {
+			f = fopen(fname, "w");
+			if (!f || rhd_zcheck_write_header(f, &zc) == -1) {
+				pabort("can't open zcheck log");
+			}
+		}
+		rhd_zcheck_write_rows(f, res, n, d * RHD_NUM_CHS);
+		rhd_zcheck_free(&zc);
+	}
+	fclose(f);
+	printf("Impedances stored in %s\n", fname);
+}
+
+// locks memory and has every chip's acquisition run real-time, done
+// last so config/calibrate run as a normal thread
+static void start_realtime(rhd_dev_t *devs) {
+	if (!FOUND_REALTIME) {
+		return;
+	}
+	rhd_rt_lock_memory();
+	for (size_t d=0; d<n_devices; ++d) {
+		devs[d].rt = &rt_cfg;
+	}
+}
+
 static void get_fname(char *fname, size_t max_len) {
 	time_t t;
     struct tm *tmp;
-    char time_str[14];
+    char time_str[16];
 
 	// default name:
-	sprintf(fname, "rhd2216_util_unknown.txt");
+	snprintf(fname, max_len, "rhd2216_util_unknown.%s", rhd_dlog_ext(dlog_format));
 	
 	time(&t);
 	tmp = localtime(&t);
 	strftime(time_str, sizeof(time_str), "%Y%m%d_%H%M%S", tmp);
 
-	sprintf(
+	if (FOUND_STREAM && n_devices > 1) {
+		snprintf(
+			fname,
+			max_len,
+			"./dlogs/rhdutil_%s_%dHz_chmsk%04x_x%zu_stream.%s", 
+			time_str,
+			srate, 
+			active_chs_mask,
+			n_devices,
+			rhd_dlog_ext(dlog_format)
+			);
+		return;
+	}
+
+	if (FOUND_STREAM) {
+		snprintf(
+			fname,
+			max_len,
+			"./dlogs/rhdutil_%s_%dHz_chmsk%04x_stream.%s", 
+			time_str,
+			srate, 
+			active_chs_mask,
+			rhd_dlog_ext(dlog_format)
+			);
+		return;
+	}
+
+	snprintf(
 		fname,
-		"./dlogs/rhdutil_%s_%dHz_chmsk%04x_N%ld.txt", 
+		max_len,
+		"./dlogs/rhdutil_%s_%dHz_chmsk%04x_N%ld.%s", 
 		time_str,
 		srate, 
 		active_chs_mask,
-		num_samples
+		num_samples,
+		rhd_dlog_ext(dlog_format)
 		);
 }
 
@@ -208,65 +827,147 @@ int main(int argc, char *argv[]) {
 	// initialize with default values
 
 	int ret = 0;
-	int fd = open(device, O_RDWR);
+	int write_err = 0; // a datalog write or close failed
+	rhd_dev_t devs[RHD_MULTI_MAX_DEVS];
+	rhd_dev_t *dev = &devs[0];
+	// ~40 KB each, keep off the stack
+	static rhd_stats_t stats[RHD_MULTI_MAX_DEVS];
+	rhd_aux_sched_t aux[RHD_MULTI_MAX_DEVS];
+	rhd_health_t health[RHD_MULTI_MAX_DEVS];
+	static rhd_link_t links[RHD_MULTI_MAX_DEVS];
+	static rhd_spi_table_t spi_tables[RHD_MULTI_MAX_DEVS];
 
 	parse_opts(argc, argv);
 
-	if (fd < 0)
-		pabort("can't open device");
-
 	mode = 0;
 	bpw = 8;
-	speed = 8000000; //12500000; // 12.5 mHz
-	ret = spi_config(fd, mode, bpw, speed);
-	if (ret == -1) 
-		pabort("Could not configure pi spi properties");
-	
-	if (FOUND_REG_READ) {
-		uint8_t read_data;
-		ret = rhd_reg_read(fd, reg_num, &read_data);
-		printf("read: reg_num: %d, result: 0x%02x\n", reg_num, read_data);
+	if (!FOUND_SPEED) {
+		speed = FOUND_LINK ? RHD_MAX_SPI_RATE_HZ : 8000000; //12500000; // 12.5 mHz
 	}
-
-	if (FOUND_REG_WRITE) {
-		// TODO
-		printf("write: reg_num: %d, write_data: 0x%02x\n", reg_num, reg_data);
-		ret = rhd_reg_write(fd, reg_num, reg_data);
+	for (size_t d=0; d<n_devices; ++d) {
+		if (rhd_dev_open(&devs[d], devices[d], mode, bpw, speed) < 0)
+			pabort("can't open device");
+		set_pacer_spin_ns(&devs[d], (int64_t) spin_us * 1000);
+		if (rhd_sim_is_sim(&devs[d].spi)) {
+			rhd_sim_set_srate(&devs[d].spi, srate);
+		}
+		if (FOUND_SIM_BER && rhd_sim_set_link_errors(&devs[d].spi, sim_ber, sim_ber_above) == -1) {
+			pabort("ERROR: --sim_ber only works with --device sim");
+		}
 	}
+	start_spi_table(devs, spi_tables);
+	start_link(devs, links);
 
-	if (FOUND_CONFIG) {
-		ret = rhd_reg_config_default(fd, active_chs_mask);
-		printf("Default register configuration done, ret code: %d\n", ret);
-	}
+	// register access, config and calibration are done chip by chip
+	for (size_t d=0; d<n_devices; ++d) {
+		dev = &devs[d];
+		if (n_devices > 1) {
+			printf("INFO: device %s\n", dev->name);
+		}
+
+		if (FOUND_REG_READ) {
+			uint8_t read_data;
+			ret = rhd_reg_read(dev, reg_num, &read_data);
+			printf("read: reg_num: %d, result: 0x%02x\n", reg_num, read_data);
+		}
+
+		if (FOUND_REG_WRITE) {
+			// TODO
+			printf("write: reg_num: %d, write_data: 0x%02x\n", reg_num, reg_data);
+			ret = rhd_reg_write(dev, reg_num, reg_data);
+		}
+
+		if (FOUND_CONFIG) {
+			ret = rhd_reg_config_default(dev, active_chs_mask);
+			printf("Default register configuration done, ret code: %d\n", ret);
+		}
 
-	if (FOUND_CALIBRATE) {
-		ret = rhd_calibrate(fd);
-		// calibrate command always returns 2? not sure what this means
-		// but I analyzed the signals in a logic analyzer and they looked
-		// fine. -PV 2024-May-12
-		printf("Calibration done, ret code: %d\n", ret);
+		if (FOUND_CALIBRATE) {
+			ret = rhd_calibrate(dev);
+			// calibrate command always returns 2? not sure what this means
+			// but I analyzed the signals in a logic analyzer and they looked
+			// fine. -PV 2024-May-12
+			printf("Calibration done, ret code: %d\n", ret);
+		}
+	}
+	dev = &devs[0];
+	run_zcheck(devs);
+	// after calibrate, whose offset removal convert is a single frame
+	for (size_t d=0; d<n_devices; ++d) {
+		set_burst_frames(&devs[d], burst_frames);
 	}
+	start_stats(devs, stats);
+	start_aux(devs, aux, health, links);
+	start_realtime(devs);
 
 	if (FOUND_CONVERT) {
-		FILE *output;
+		rhd_dlog_t dlog;
 		char fname[255];
-		int i;
+		size_t i;
 
 		get_fname(fname, sizeof(fname));
-		output = fopen(fname, "w");
+		if (rhd_dlog_open_io(&dlog, fname, dlog_format, active_chs_mask, srate, speed, dlog_io, num_samples / __builtin_popcount(active_chs_mask)) == -1)
+			pabort("can't open datalog");
 		// uint16_t data_buf[num_samples];
 		uint16_t *data_buf = (uint16_t*) malloc(num_samples * sizeof(uint16_t));
-		ret = rhd_convert(fd, active_chs_mask, srate, data_buf, num_samples);
+		ret = rhd_convert(dev, active_chs_mask, srate, data_buf, num_samples);
+		finish_stats(devs, fname);
+		finish_aux(devs, health, links);
+		rhd_filter_t filt;
+		if (setup_filter(&filt)) {
+			size_t n_chs = __builtin_popcount(active_chs_mask);
+			rhd_filter_process_block(&filt, (int16_t*) data_buf, (int16_t*) data_buf, num_samples / n_chs);
+			rhd_dlog_set_flags(&dlog, RHD_DLOG_FLAG_FILTERED);
+		}
+		rhd_feat_t feat;
+		char feat_fname[300];
+		if (setup_features(&feat, feat_fname, sizeof(feat_fname), fname)) {
+			FILE *feat_f = fopen(feat_fname, "w");
+			size_t n_chs = feat.n_chs;
+			rhd_feat_vals_t vals[RHD_NUM_CHS];
+			if (!feat_f)
+				pabort("can't open feature log");
+			rhd_feat_write_header(feat_f, &feat, active_chs_mask);
+			for (i=0; i+n_chs<=num_samples; i+=n_chs) {
+				if (rhd_feat_push_frame(&feat, (int16_t*) data_buf + i, vals)) {
+					rhd_feat_write_row(feat_f, &feat, (double) (i / n_chs) / srate, vals);
+				}
+			}
+			fclose(feat_f);
+			rhd_feat_free(&feat);
+			printf("Features stored in %s\n", feat_fname);
+		}
+
+		rhd_decim_t decims[RHD_DECIM_MAX_OUTPUTS];
+		char decim_fnames[RHD_DECIM_MAX_OUTPUTS][300];
+		const char *decim_fname_ptrs[RHD_DECIM_MAX_OUTPUTS];
+		size_t n_decim = setup_decim(decims, decim_fnames, decim_fname_ptrs, fname);
+		for (size_t k=0; k<n_decim; ++k) {
+			size_t n_chs = decims[k].n_chs;
+			uint16_t *dec_buf = (uint16_t*) malloc((num_samples / n_chs / decims[k].factor + 1) * n_chs * sizeof(uint16_t));
+			rhd_dlog_t dec_dlog;
+			if (!dec_buf || rhd_dlog_open(&dec_dlog, decim_fnames[k], dlog_format, active_chs_mask, srate / decims[k].factor, speed) == -1)
+				pabort("can't open decimated datalog");
+			size_t n_out = rhd_decim_process_block(&decims[k], (int16_t*) data_buf, (int16_t*) dec_buf, num_samples / n_chs);
+			if (FOUND_BANDPASS || FOUND_NOTCH) {
+				rhd_dlog_set_flags(&dec_dlog, RHD_DLOG_FLAG_FILTERED);
+			}
+			int dec_err = rhd_dlog_write_samples(&dec_dlog, dec_buf, n_out * n_chs) == -1;
+			if (rhd_dlog_close(&dec_dlog) == -1 || dec_err) {
+				printf("ERROR: could not write %s\n", decim_fnames[k]);
+				write_err = 1;
+			}
+			rhd_decim_free(&decims[k]);
+			free(dec_buf);
+			printf("Decimated data stored in %s\n", decim_fnames[k]);
+		}
 
 		// write to file
 		printf("Writing to file...\n");
-		fprintf(output, "active_chs_mask: %x\n", active_chs_mask);
-		fprintf(output, "num_samples: %zu\n", num_samples);
-		fprintf(output, "sample rate: %d Hz\n", srate);
-		// TODO this can be optimized.
-		for (i=0; i<num_samples; ++i) {
-			fprintf(output, "%2x\n", data_buf[i]);
-		} 
+		if (rhd_dlog_write_samples(&dlog, data_buf, num_samples) == -1) {
+			printf("ERROR: could not write %s\n", fname);
+			write_err = 1;
+		}
 		printf("Done.\n");
 
 		printf("Printing first 16 values:\n");
@@ -274,22 +975,134 @@ int main(int argc, char *argv[]) {
 			printf("0x%x\n", data_buf[i]);
 		}
 
-		printf("Full data stored in %s\n", fname);
 		free(data_buf);
-		fclose(output);
+		// with aio, the last buffers are only written (and synced) here
+		if (rhd_dlog_close(&dlog) == -1) {
+			printf("ERROR: could not finish %s\n", fname);
+			write_err = 1;
+		} else if (!write_err) {
+			printf("Full data stored in %s\n", fname);
+		}
 	}
 
-	if (FOUND_CLEAR) {
-		ret = rhd_clear_calibration(fd);
+	if (FOUND_STREAM && n_devices > 1) {
+		char fname[255];
+		rhd_stream_result_t result;
+		rhd_multi_cfg_t cfg = {
+			.n_devs = n_devices,
+			.active_chs_msk = active_chs_mask,
+			.srate = srate,
+			.duration_s = stream_duration_s,
+			.ring_frames = RHD_RING_DEFAULT_FRAMES,
+			.fname = fname,
+			.format = dlog_format,
+			.io = dlog_io,
+			.spi_speed = speed,
+			.serve_addr = serve_addr,
+			.shm_name = shm_name,
+		};
+
+		for (size_t d=0; d<n_devices; ++d) {
+			cfg.devs[d] = &devs[d];
+		}
+		get_fname(fname, sizeof(fname));
+		signal(SIGINT, handle_sigint);
+		printf("INFO: streaming %zu chips to %s, press Ctrl-C to stop.\n", n_devices, fname);
+		ret = rhd_multi_run(&cfg, &stop_requested, &result);
+		if (ret == -1) {
+			write_err = 1;
+		}
+		signal(SIGINT, SIG_DFL);
+		finish_stats(devs, fname);
+		finish_aux(devs, health, links);
+		printf(
+			"INFO: stream done, ret %d. %llu frames written, %llu dropped, max ring fill %zu frames\n",
+			ret,
+			(unsigned long long) result.n_frames,
+			(unsigned long long) result.n_dropped,
+			result.max_ring_fill
+			);
+		if (ret == 0) {
+			printf("Full data stored in %s\n", fname);
+		}
+	} else if (FOUND_STREAM) {
+		char fname[255];
+		char feat_fname[300];
+		char events_fname[300];
+		rhd_decim_t decims[RHD_DECIM_MAX_OUTPUTS];
+		char decim_fnames[RHD_DECIM_MAX_OUTPUTS][300];
+		const char *decim_fname_ptrs[RHD_DECIM_MAX_OUTPUTS];
+		rhd_filter_t filt;
+		rhd_feat_t feat;
+		rhd_stream_result_t result;
+		rhd_stream_cfg_t cfg = {
+			.active_chs_msk = active_chs_mask,
+			.srate = srate,
+			.duration_s = stream_duration_s,
+			.ring_frames = RHD_RING_DEFAULT_FRAMES,
+			.fname = fname,
+			.format = dlog_format,
+			.io = dlog_io,
+			.spi_speed = speed,
+			.filter = setup_filter(&filt),
+			.feat_fname = feat_fname,
+			.serve_addr = serve_addr,
+			.shm_name = shm_name,
+			.trigger = FOUND_TRIGGER ? &trig_cfg : NULL,
+			.events_fname = events_fname,
+			.decim = decims,
+			.decim_fnames = decim_fname_ptrs,
+		};
+
+		get_fname(fname, sizeof(fname));
+		snprintf(events_fname, sizeof(events_fname), "%s.events.csv", fname);
+		cfg.n_decim = setup_decim(decims, decim_fnames, decim_fname_ptrs, fname);
+		cfg.features = setup_features(&feat, feat_fname, sizeof(feat_fname), fname);
+		signal(SIGINT, handle_sigint);
+		printf("INFO: streaming to %s, press Ctrl-C to stop.\n", fname);
+		ret = rhd_stream_run(dev, &cfg, &stop_requested, &result);
+		if (ret == -1) {
+			write_err = 1;
+		}
+		signal(SIGINT, SIG_DFL);
+		finish_stats(devs, fname);
+		finish_aux(devs, health, links);
+		printf(
+			"INFO: stream done, ret %d. %llu frames written, %llu dropped, max ring fill %zu frames\n",
+			ret,
+			(unsigned long long) result.n_frames,
+			(unsigned long long) result.n_dropped,
+			result.max_ring_fill
+			);
+		if (cfg.features) {
+			rhd_feat_free(&feat);
+			printf("Features stored in %s\n", feat_fname);
+		}
+		if (cfg.trigger) {
+			printf("Events stored in %s\n", events_fname);
+		}
+		for (size_t k=0; k<cfg.n_decim; ++k) {
+			rhd_decim_free(&decims[k]);
+			printf("Decimated data stored in %s\n", decim_fnames[k]);
+		}
 		if (ret == 0) {
-			printf("Clear calibration done, ret code: %d\n", ret);
-		} else {
-			printf("Clear calibration failed, err code: %d\n", ret);
+			printf("Full data stored in %s\n", fname);
 		}
 	}
 
-	close(fd);
-    return 0;
+	for (size_t d=0; d<n_devices; ++d) {
+		if (FOUND_CLEAR) {
+			ret = rhd_clear_calibration(&devs[d]);
+			if (ret == 0) {
+				printf("Clear calibration done, ret code: %d\n", ret);
+			} else {
+				printf("Clear calibration failed, err code: %d\n", ret);
+			}
+		}
+		rhd_dev_close(&devs[d]);
+	}
+	// a recording that didn't fully make it to disk is a failed run
+	return write_err ? 1 : 0;
 }
 
 
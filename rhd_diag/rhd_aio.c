@@ -0,0 +1,474 @@
+#define _GNU_SOURCE // fallocate
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "rhd_aio.h"
+
+_Static_assert(RHD_AIO_BUF_LEN % RHD_AIO_ALIGN == 0, "buffers must cover whole pages");
+_Static_assert((RHD_AIO_QUEUE_LEN & (RHD_AIO_QUEUE_LEN - 1)) == 0, "queue length must be a power of 2");
+
+enum {
+	OP_WRITE = 0,
+	OP_SYNC = 1,
+	OP_PREALLOC = 2,
+};
+
+// what a completion's user_data carries
+#define USER_DATA(op, buf) (((uint64_t) (op) << 32) | (uint32_t) (buf))
+#define USER_OP(ud) ((int) ((ud) >> 32))
+#define USER_BUF(ud) ((int) ((ud) & 0xffffffff))
+
+static int64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void set_err(rhd_aio_t *aio, int err) {
+	if (!aio->err) {
+		aio->err = err;
+	}
+}
+
+static int pwrite_all(int fd, const uint8_t *buf, size_t len, uint64_t off) {
+	while (len) {
+		ssize_t n = pwrite(fd, buf, len, (off_t) off);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		buf += n;
+		len -= (size_t) n;
+		off += (uint64_t) n;
+	}
+	return 0;
+}
+
+// bookkeeping for a finished operation, res as returned by the kernel.
+// thread backend: called with aio->lock held.
+static void complete(rhd_aio_t *aio, int op, int buf, int res) {
+	if (op == OP_WRITE) {
+		if (res < 0) {
+			set_err(aio, -res);
+		} else if ((size_t) res < aio->busy_len[buf]) {
+			// short write (disk full, signal), finish it in place
+			int r = pwrite_all(aio->fd, aio->bufs[buf] + res, aio->busy_len[buf] - (size_t) res, aio->busy_off[buf] + (uint64_t) res);
+			if (r < 0) {
+				set_err(aio, -r);
+			}
+		}
+		aio->busy[buf] = 0;
+	} else if (op == OP_SYNC) {
+		if (res < 0) {
+			set_err(aio, -res);
+		}
+	} else if (res < 0) {
+		// filesystems without fallocate (vfat, tmpfs on old kernels) just
+		// allocate as they go
+		aio->prealloc_end = UINT64_MAX;
+	}
+}
+
+// io_uring backend
+
+static int uring_setup(rhd_aio_t *aio) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int fd = (int) syscall(__NR_io_uring_setup, RHD_AIO_QUEUE_LEN, &p);
+	if (fd < 0) {
+		return -1;
+	}
+	aio->ring_fd = fd;
+
+	// writes, fsync and fallocate SQEs need 5.6+, the probe came in the same
+	// release, so a failed probe means too old
+	size_t probe_len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = (struct io_uring_probe*) calloc(1, probe_len);
+	int ok = probe && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0
+		&& probe->last_op >= IORING_OP_WRITE
+		&& (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)
+		&& (probe->ops[IORING_OP_FSYNC].flags & IO_URING_OP_SUPPORTED)
+		&& (probe->ops[IORING_OP_FALLOCATE].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	if (!ok) {
+		close(fd);
+		return -1;
+	}
+
+	aio->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	aio->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (aio->cq_ring_len > aio->sq_ring_len) {
+			aio->sq_ring_len = aio->cq_ring_len;
+		}
+		aio->cq_ring_len = 0; // shares the sq mapping
+	}
+	aio->sq_ring = mmap(NULL, aio->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (aio->sq_ring == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	if (aio->cq_ring_len) {
+		aio->cq_ring = mmap(NULL, aio->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (aio->cq_ring == MAP_FAILED) {
+			munmap(aio->sq_ring, aio->sq_ring_len);
+			close(fd);
+			return -1;
+		}
+	} else {
+		aio->cq_ring = aio->sq_ring;
+	}
+	aio->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	aio->sqes = mmap(NULL, aio->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (aio->sqes == MAP_FAILED) {
+		if (aio->cq_ring_len) {
+			munmap(aio->cq_ring, aio->cq_ring_len);
+		}
+		munmap(aio->sq_ring, aio->sq_ring_len);
+		close(fd);
+		return -1;
+	}
+
+	uint8_t *sq = (uint8_t*) aio->sq_ring;
+	uint8_t *cq = (uint8_t*) aio->cq_ring;
+	aio->sq_head = (unsigned*) (sq + p.sq_off.head);
+	aio->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+	aio->sq_mask = (unsigned*) (sq + p.sq_off.ring_mask);
+	aio->sq_array = (unsigned*) (sq + p.sq_off.array);
+	aio->cq_head = (unsigned*) (cq + p.cq_off.head);
+	aio->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+	aio->cq_mask = (unsigned*) (cq + p.cq_off.ring_mask);
+	aio->cqes = cq + p.cq_off.cqes;
+	return 0;
+}
+
+static void uring_teardown(rhd_aio_t *aio) {
+	munmap(aio->sqes, aio->sqes_len);
+	if (aio->cq_ring_len) {
+		munmap(aio->cq_ring, aio->cq_ring_len);
+	}
+	munmap(aio->sq_ring, aio->sq_ring_len);
+	close(aio->ring_fd);
+}
+
+// handles every completion already posted. with wait, first blocks until
+// there is at least one.
+static void uring_reap(rhd_aio_t *aio, int wait) {
+	if (wait && aio->n_inflight) {
+		if (syscall(__NR_io_uring_enter, aio->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+			set_err(aio, errno);
+		}
+	}
+	unsigned head = *aio->cq_head;
+	unsigned tail = __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		const struct io_uring_cqe *cqe = &((const struct io_uring_cqe*) aio->cqes)[head & *aio->cq_mask];
+		complete(aio, USER_OP(cqe->user_data), USER_BUF(cqe->user_data), cqe->res);
+		aio->n_inflight--;
+		head++;
+	}
+	__atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// every SQE is submitted right away, so the SQ never holds more than one
+static int uring_submit(rhd_aio_t *aio, int op, int buf, uint64_t off, uint64_t len) {
+	unsigned tail = *aio->sq_tail;
+	unsigned idx = tail & *aio->sq_mask;
+	struct io_uring_sqe *sqe = &((struct io_uring_sqe*) aio->sqes)[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = aio->fd;
+	sqe->user_data = USER_DATA(op, buf);
+	if (op == OP_WRITE) {
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->addr = (uint64_t) (uintptr_t) aio->bufs[buf];
+		sqe->len = (uint32_t) len;
+		sqe->off = off;
+	} else if (op == OP_SYNC) {
+		// after every write submitted before it
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		sqe->flags = IOSQE_IO_DRAIN;
+	} else {
+		sqe->opcode = IORING_OP_FALLOCATE;
+		sqe->off = off;
+		sqe->addr = len;
+		sqe->len = FALLOC_FL_KEEP_SIZE;
+	}
+	aio->sq_array[idx] = idx;
+	__atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	while (syscall(__NR_io_uring_enter, aio->ring_fd, 1, 0, 0, NULL, 0) < 0) {
+		if (errno != EINTR && errno != EAGAIN) {
+			return -1;
+		}
+		uring_reap(aio, 1);
+	}
+	aio->n_inflight++;
+	return 0;
+}
+
+// writer thread backend
+
+static int run_job(rhd_aio_t *aio, const rhd_aio_job_t *job) {
+	if (job->op == OP_WRITE) {
+		int r = pwrite_all(aio->fd, aio->bufs[job->buf], job->len, job->off);
+		return r < 0 ? r : (int) job->len;
+	} else if (job->op == OP_SYNC) {
+		return fdatasync(aio->fd) == 0 ? 0 : -errno;
+	}
+	return fallocate(aio->fd, FALLOC_FL_KEEP_SIZE, (off_t) job->off, (off_t) job->len) == 0 ? 0 : -errno;
+}
+
+static void *writer_thread(void *arg) {
+	rhd_aio_t *aio = (rhd_aio_t*) arg;
+	pthread_mutex_lock(&aio->lock);
+	while (1) {
+		while (aio->q_head == aio->q_tail && !aio->quit) {
+			pthread_cond_wait(&aio->cond, &aio->lock);
+		}
+		if (aio->q_head == aio->q_tail) {
+			break;
+		}
+		rhd_aio_job_t job = aio->queue[aio->q_tail & (RHD_AIO_QUEUE_LEN - 1)];
+		pthread_mutex_unlock(&aio->lock);
+		int res = run_job(aio, &job);
+		pthread_mutex_lock(&aio->lock);
+		aio->q_tail++;
+		complete(aio, job.op, job.buf, res);
+		aio->n_queued--;
+		pthread_cond_broadcast(&aio->cond);
+	}
+	pthread_mutex_unlock(&aio->lock);
+	return NULL;
+}
+
+static int thread_submit(rhd_aio_t *aio, int op, int buf, uint64_t off, uint64_t len) {
+	pthread_mutex_lock(&aio->lock);
+	while (aio->q_head - aio->q_tail >= RHD_AIO_QUEUE_LEN) {
+		pthread_cond_wait(&aio->cond, &aio->lock);
+	}
+	rhd_aio_job_t *job = &aio->queue[aio->q_head & (RHD_AIO_QUEUE_LEN - 1)];
+	job->op = op;
+	job->buf = buf;
+	job->off = off;
+	job->len = len;
+	aio->q_head++;
+	aio->n_queued++;
+	pthread_cond_broadcast(&aio->cond);
+	pthread_mutex_unlock(&aio->lock);
+	return 0;
+}
+
+// common
+
+static int submit(rhd_aio_t *aio, int op, int buf, uint64_t off, uint64_t len) {
+	if (aio->backend == RHD_AIO_URING) {
+		return uring_submit(aio, op, buf, off, len);
+	}
+	return thread_submit(aio, op, buf, off, len);
+}
+
+// room for a sync or prealloc next to the RHD_AIO_N_BUFS writes, they are
+// skipped (tried again on the next buffer) rather than waited for
+static int queue_has_room(rhd_aio_t *aio) {
+	unsigned n;
+	if (aio->backend == RHD_AIO_URING) {
+		return aio->n_inflight + 1 < RHD_AIO_QUEUE_LEN;
+	}
+	pthread_mutex_lock(&aio->lock);
+	n = aio->n_queued;
+	pthread_mutex_unlock(&aio->lock);
+	return n + 1 < RHD_AIO_QUEUE_LEN;
+}
+
+static void wait_buf(rhd_aio_t *aio, size_t b) {
+	int64_t t0 = 0;
+	if (aio->backend == RHD_AIO_URING) {
+		uring_reap(aio, 0);
+		if (!aio->busy[b]) {
+			return;
+		}
+		t0 = now_ns();
+		while (aio->busy[b]) {
+			uring_reap(aio, 1);
+		}
+	} else {
+		pthread_mutex_lock(&aio->lock);
+		if (aio->busy[b]) {
+			t0 = now_ns();
+			while (aio->busy[b]) {
+				pthread_cond_wait(&aio->cond, &aio->lock);
+			}
+		}
+		pthread_mutex_unlock(&aio->lock);
+		if (!t0) {
+			return;
+		}
+	}
+	int64_t dt = now_ns() - t0;
+	aio->n_waits++;
+	if (dt > aio->max_wait_ns) {
+		aio->max_wait_ns = dt;
+	}
+}
+
+// hands the current buffer to the kernel/thread and moves on to the next
+static int flush_cur(rhd_aio_t *aio) {
+	size_t b = aio->cur;
+	if (aio->fill == 0) {
+		return 0;
+	}
+	aio->busy[b] = 1;
+	aio->busy_off[b] = aio->off;
+	aio->busy_len[b] = aio->fill;
+	if (submit(aio, OP_WRITE, (int) b, aio->off, aio->fill) == -1) {
+		aio->busy[b] = 0;
+		set_err(aio, errno);
+		return -1;
+	}
+	aio->off += aio->fill;
+	aio->unsynced += aio->fill;
+	aio->n_writes++;
+	aio->fill = 0;
+
+	if (aio->unsynced >= RHD_AIO_SYNC_BYTES && queue_has_room(aio)) {
+		if (submit(aio, OP_SYNC, 0, 0, 0) == 0) {
+			aio->unsynced = 0;
+			aio->n_syncs++;
+		}
+	}
+	if (aio->prealloc_end != UINT64_MAX
+		&& aio->off + RHD_AIO_N_BUFS * RHD_AIO_BUF_LEN > aio->prealloc_end
+		&& queue_has_room(aio)) {
+		if (submit(aio, OP_PREALLOC, 0, aio->prealloc_end, RHD_AIO_PREALLOC_STEP) == 0) {
+			aio->prealloc_end += RHD_AIO_PREALLOC_STEP;
+		}
+	}
+
+	aio->cur = (b + 1) % RHD_AIO_N_BUFS;
+	wait_buf(aio, aio->cur);
+	return 0;
+}
+
+// fd must be open for writing. expected_bytes = 0 if the length isn't
+// known. force_thread skips io_uring.
+int rhd_aio_open(rhd_aio_t *aio, int fd, uint64_t expected_bytes, int force_thread) {
+	memset(aio, 0, sizeof(*aio));
+	aio->fd = fd;
+	aio->ring_fd = -1;
+	for (size_t b=0; b<RHD_AIO_N_BUFS; ++b) {
+		if (posix_memalign((void**) &aio->bufs[b], RHD_AIO_ALIGN, RHD_AIO_BUF_LEN) != 0) {
+			while (b--) {
+				free(aio->bufs[b]);
+			}
+			return -1;
+		}
+		// fault the pages in now, not on the first write
+		memset(aio->bufs[b], 0, RHD_AIO_BUF_LEN);
+	}
+
+	// the first chunk is allocated before acquisition starts, the rest
+	// (if the length isn't known) ahead of the data by the writer
+	uint64_t first = expected_bytes ? expected_bytes : RHD_AIO_PREALLOC_STEP;
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t) first) == 0) {
+		aio->prealloc_end = expected_bytes ? UINT64_MAX : first;
+	} else {
+		aio->prealloc_end = UINT64_MAX;
+	}
+
+	if (!force_thread && uring_setup(aio) == 0) {
+		aio->backend = RHD_AIO_URING;
+		return 0;
+	}
+	aio->backend = RHD_AIO_THREAD;
+	pthread_mutex_init(&aio->lock, NULL);
+	pthread_cond_init(&aio->cond, NULL);
+	if (pthread_create(&aio->tid, NULL, writer_thread, aio) != 0) {
+		pthread_mutex_destroy(&aio->lock);
+		pthread_cond_destroy(&aio->cond);
+		for (size_t b=0; b<RHD_AIO_N_BUFS; ++b) {
+			free(aio->bufs[b]);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+// only copies, unless every buffer is still being written
+int rhd_aio_write(rhd_aio_t *aio, const void *data, size_t len) {
+	const uint8_t *p = (const uint8_t*) data;
+	while (len) {
+		size_t take = RHD_AIO_BUF_LEN - aio->fill;
+		if (take > len) {
+			take = len;
+		}
+		memcpy(aio->bufs[aio->cur] + aio->fill, p, take);
+		aio->fill += take;
+		aio->n_bytes += take;
+		p += take;
+		len -= take;
+		if (aio->fill == RHD_AIO_BUF_LEN && flush_cur(aio) == -1) {
+			return -1;
+		}
+	}
+	return aio->err ? -1 : 0;
+}
+
+// writes out the partial buffer, waits for everything in flight, syncs
+// and trims preallocated blocks past the end. fd stays open.
+int rhd_aio_close(rhd_aio_t *aio) {
+	int ret = flush_cur(aio);
+
+	if (aio->backend == RHD_AIO_URING) {
+		while (aio->n_inflight) {
+			uring_reap(aio, 1);
+		}
+		uring_teardown(aio);
+	} else {
+		pthread_mutex_lock(&aio->lock);
+		aio->quit = 1;
+		pthread_cond_broadcast(&aio->cond);
+		pthread_mutex_unlock(&aio->lock);
+		pthread_join(aio->tid, NULL);
+		pthread_mutex_destroy(&aio->lock);
+		pthread_cond_destroy(&aio->cond);
+	}
+	if (fdatasync(aio->fd) != 0) {
+		set_err(aio, errno);
+	}
+	// KEEP_SIZE blocks past EOF are only released by a truncate
+	if (ftruncate(aio->fd, (off_t) aio->off) != 0) {
+		set_err(aio, errno);
+	}
+	for (size_t b=0; b<RHD_AIO_N_BUFS; ++b) {
+		free(aio->bufs[b]);
+		aio->bufs[b] = NULL;
+	}
+
+	printf("INFO: aio: %s wrote %llu bytes in %llu writes, %llu syncs, waited for a buffer %llu times (max %.1f ms)\n",
+		rhd_aio_backend_name(aio),
+		(unsigned long long) aio->n_bytes,
+		(unsigned long long) aio->n_writes,
+		(unsigned long long) aio->n_syncs,
+		(unsigned long long) aio->n_waits,
+		aio->max_wait_ns / 1e6);
+	if (aio->err) {
+		printf("ERROR: aio: %s\n", strerror(aio->err));
+		ret = -1;
+	}
+	return ret;
+}
+
+const char *rhd_aio_backend_name(const rhd_aio_t *aio) {
+	return (aio->backend == RHD_AIO_URING) ? "io_uring" : "writer thread";
+}
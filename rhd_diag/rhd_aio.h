@@ -0,0 +1,117 @@
+/*
+Asynchronous append-only file writer for datalogs (--aio).
+
+A plain fwrite returns quickly until the kernel decides to write back
+dirty pages, and then stalls for tens of ms on an SD card. rhd_aio keeps
+the caller off the disk entirely: rhd_aio_write only copies into one of
+RHD_AIO_N_BUFS page-aligned RHD_AIO_BUF_LEN byte buffers, and each full
+buffer is handed to the kernel as one aligned write at a buffer-aligned
+file offset. The caller only ever waits if every buffer is still in
+flight, i.e. the disk is slower than the data for
+RHD_AIO_N_BUFS * RHD_AIO_BUF_LEN bytes.
+
+Also off the caller's path:
+	the file is preallocated (fallocate, FALLOC_FL_KEEP_SIZE) up front for
+	expected_bytes, or RHD_AIO_PREALLOC_STEP at a time ahead of the data
+	when the length isn't known, so block allocation doesn't stall writes
+	fdatasync every RHD_AIO_SYNC_BYTES, so dirty pages never pile up into
+	one long writeback
+
+Two backends, picked at rhd_aio_open:
+	io_uring (raw syscalls, no liburing), writes/fsync/fallocate are SQEs
+	and completions are reaped whenever the caller writes
+	a writer thread doing pwrite/fdatasync/fallocate, if io_uring is
+	unavailable (old kernel, io_uring_disabled, seccomp) or not wanted
+Page cache is still used (no O_DIRECT), so the datalog header can be
+patched with pwrite on close.
+
+Usage:
+	rhd_aio_t aio;
+	int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	rhd_aio_open(&aio, fd, expected_bytes, 0);
+	rhd_aio_write(&aio, data, len); // any number of times
+	rhd_aio_close(&aio); // waits for everything, syncs, fd stays open
+*/
+#ifndef RHD_AIO_H
+#define RHD_AIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define RHD_AIO_BUF_LEN (256 * 1024) // multiple of the page size
+#define RHD_AIO_N_BUFS 4
+#define RHD_AIO_ALIGN 4096
+#define RHD_AIO_SYNC_BYTES (4 * 1024 * 1024)
+#define RHD_AIO_PREALLOC_STEP (64 * 1024 * 1024)
+#define RHD_AIO_QUEUE_LEN 16 // in flight ops, power of 2
+
+typedef enum rhd_aio_backend {
+	RHD_AIO_URING = 0,
+	RHD_AIO_THREAD = 1,
+} rhd_aio_backend_t;
+
+// one queued operation for the writer thread backend
+typedef struct rhd_aio_job {
+	int op; // see rhd_aio.c
+	int buf; // buffer index for writes
+	uint64_t off;
+	uint64_t len;
+} rhd_aio_job_t;
+
+typedef struct rhd_aio {
+	int fd;
+	rhd_aio_backend_t backend;
+	uint8_t *bufs[RHD_AIO_N_BUFS];
+	int busy[RHD_AIO_N_BUFS]; // write in flight
+	uint64_t busy_off[RHD_AIO_N_BUFS]; // where it goes
+	size_t busy_len[RHD_AIO_N_BUFS];
+	size_t cur; // buffer being filled
+	size_t fill; // bytes in it
+	uint64_t off; // file offset of the current buffer
+	uint64_t prealloc_end; // file preallocated up to here
+	uint64_t unsynced; // bytes submitted since last fdatasync
+	int err; // first error of any operation, 0 if none
+
+	// io_uring
+	int ring_fd;
+	void *sq_ring;
+	size_t sq_ring_len;
+	void *cq_ring;
+	size_t cq_ring_len;
+	void *sqes;
+	size_t sqes_len;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	void *cqes;
+	unsigned n_inflight;
+
+	// writer thread
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cond; // job queued, job done or quit
+	rhd_aio_job_t queue[RHD_AIO_QUEUE_LEN];
+	size_t q_head;
+	size_t q_tail;
+	int quit;
+	unsigned n_queued; // jobs queued or running
+
+	// stats
+	uint64_t n_bytes;
+	uint64_t n_writes;
+	uint64_t n_syncs;
+	uint64_t n_waits; // times rhd_aio_write had to wait for a buffer
+	int64_t max_wait_ns;
+} rhd_aio_t;
+
+int rhd_aio_open(rhd_aio_t *aio, int fd, uint64_t expected_bytes, int force_thread);
+int rhd_aio_write(rhd_aio_t *aio, const void *data, size_t len);
+int rhd_aio_close(rhd_aio_t *aio);
+const char *rhd_aio_backend_name(const rhd_aio_t *aio);
+
+#endif
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <string.h>
+#include "rhd_aux.h"
+
+// ROM register read in spare slots, result discarded
+#define FILLER_REG 63
+
+// ROM contents every RHD2216 reads back, see rhd_sim.c sim_rom
+static const struct {
+	uint8_t reg_num;
+	uint8_t val;
+} health_rom[] = {
+	{ 40, 'I' }, { 41, 'N' }, { 42, 'T' }, { 43, 'A' }, { 44, 'N' },
+	{ 63, 2 }, // chip id, RHD2216
+};
+
+rhd_aux_cmd_t rhd_aux_cmd_convert(uint8_t ch, rhd_aux_cb_t cb, void *arg) {
+	rhd_aux_cmd_t cmd = { .tx = { ch & 0x3f, 0 }, .cb = cb, .arg = arg };
+	return cmd;
+}
+
+rhd_aux_cmd_t rhd_aux_cmd_read(uint8_t reg_num, rhd_aux_cb_t cb, void *arg) {
+	rhd_aux_cmd_t cmd = { .tx = { 0b11000000 | (reg_num & 0x3f), 0 }, .cb = cb, .arg = arg };
+	return cmd;
+}
+
+rhd_aux_cmd_t rhd_aux_cmd_write(uint8_t reg_num, uint8_t reg_data, rhd_aux_cb_t cb, void *arg) {
+	rhd_aux_cmd_t cmd = { .tx = { 0b10000000 | (reg_num & 0x3f), reg_data }, .cb = cb, .arg = arg };
+	return cmd;
+}
+
+int rhd_aux_init(rhd_aux_sched_t *sched, size_t n_slots) {
+	memset(sched, 0, sizeof(*sched));
+	if (n_slots == 0 || n_slots > RHD_AUX_MAX_SLOTS) {
+		return -1;
+	}
+	sched->n_slots = n_slots;
+	atomic_init(&sched->head, 0);
+	atomic_init(&sched->tail, 0);
+	return 0;
+}
+
+// issues cmd every `every` frames starting at first_frame. must be set up
+// before acquisition starts.
+int rhd_aux_add_periodic(rhd_aux_sched_t *sched, const rhd_aux_cmd_t *cmd, uint64_t every, uint64_t first_frame) {
+	if (sched->n_periodic >= RHD_AUX_MAX_PERIODIC || every == 0) {
+		return -1;
+	}
+	sched->periodic[sched->n_periodic].cmd = *cmd;
+	sched->periodic[sched->n_periodic].every = every;
+	sched->periodic[sched->n_periodic].next_frame = first_frame;
+	sched->n_periodic++;
+	return 0;
+}
+
+// has spare slots issue cmds[0], cmds[1], ... in turn instead of the
+// discarded filler read. cmds must stay valid while acquisition runs and
+// only READs belong there, since flushes after the last frame repeat them.
+int rhd_aux_set_idle(rhd_aux_sched_t *sched, const rhd_aux_cmd_t *cmds, size_t n) {
+	for (size_t i=0; i<n; ++i) {
+		if ((cmds[i].tx[0] >> 6) != 0b11) {
+			return -1;
+		}
+	}
+	sched->idle = cmds;
+	sched->n_idle = n;
+	sched->idle_next = 0;
+	return 0;
+}
+
+// queues cmd for the next free slot. safe to call from one thread other
+// than the acquisition thread. returns -1 if the queue is full.
+int rhd_aux_submit(rhd_aux_sched_t *sched, const rhd_aux_cmd_t *cmd) {
+	size_t head = atomic_load_explicit(&sched->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&sched->tail, memory_order_acquire);
+	if (head - tail >= RHD_AUX_QUEUE_LEN) {
+		return -1;
+	}
+	sched->queue[head & (RHD_AUX_QUEUE_LEN - 1)] = *cmd;
+	atomic_store_explicit(&sched->head, head + 1, memory_order_release);
+	return 0;
+}
+
+static void put_cmd(uint8_t *tx, rhd_aux_cmd_t *issued, const rhd_aux_cmd_t *cmd) {
+	tx[0] = cmd->tx[0];
+	tx[1] = cmd->tx[1];
+	*issued = *cmd;
+}
+
+// fills the n_slots command words of frame (tx, 2 bytes each) and records
+// what went in each slot in issued[], so results can be routed back
+void rhd_aux_fill(rhd_aux_sched_t *sched, uint64_t frame, uint8_t *tx, rhd_aux_cmd_t *issued) {
+	size_t slot = 0;
+	size_t tail = atomic_load_explicit(&sched->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&sched->head, memory_order_acquire);
+
+	for (; slot<sched->n_slots && tail != head; ++slot, ++tail) {
+		put_cmd(tx + 2 * slot, &issued[slot], &sched->queue[tail & (RHD_AUX_QUEUE_LEN - 1)]);
+		sched->n_issued++;
+	}
+	atomic_store_explicit(&sched->tail, tail, memory_order_release);
+
+	// due periodic commands that don't fit wait for the next frame
+	for (size_t n=0; n<sched->n_periodic && slot<sched->n_slots; ++n) {
+		rhd_aux_periodic_t *p = &sched->periodic[(sched->rr + n) % sched->n_periodic];
+		if (frame < p->next_frame) {
+			continue;
+		}
+		put_cmd(tx + 2 * slot, &issued[slot], &p->cmd);
+		p->next_frame = frame + p->every;
+		sched->n_issued++;
+		slot++;
+	}
+	if (sched->n_periodic) {
+		sched->rr = (sched->rr + 1) % sched->n_periodic;
+	}
+
+	for (; slot<sched->n_slots; ++slot) {
+		rhd_aux_fill_idle(sched, tx + 2 * slot, issued + slot);
+	}
+}
+
+// one filler word, for slots with nothing to do and for pipeline flushes.
+// sched may be NULL.
+void rhd_aux_fill_idle(rhd_aux_sched_t *sched, uint8_t *tx, rhd_aux_cmd_t *issued) {
+	rhd_aux_cmd_t filler = rhd_aux_cmd_read(FILLER_REG, NULL, NULL);
+	if (sched && sched->n_idle) {
+		put_cmd(tx, issued, &sched->idle[sched->idle_next]);
+		sched->idle_next = (sched->idle_next + 1) % sched->n_idle;
+		return;
+	}
+	put_cmd(tx, issued, &filler);
+}
+
+static void health_supply_cb(const rhd_aux_cmd_t *cmd, uint16_t result, uint64_t frame, void *arg) {
+	(void) cmd;
+	(void) frame;
+	rhd_health_t *health = (rhd_health_t*) arg;
+	double vdd = result * RHD_AUX_SUPPLY_V_PER_LSB;
+	if (health->n_supply == 0 || vdd < health->vdd_min) {
+		health->vdd_min = vdd;
+	}
+	if (health->n_supply == 0 || vdd > health->vdd_max) {
+		health->vdd_max = vdd;
+	}
+	health->vdd_last = vdd;
+	health->n_supply++;
+}
+
+static void health_rom_cb(const rhd_aux_cmd_t *cmd, uint16_t result, uint64_t frame, void *arg) {
+	rhd_health_t *health = (rhd_health_t*) arg;
+	uint8_t reg_num = cmd->tx[0] & 0x3f;
+	for (size_t i=0; i<sizeof(health_rom) / sizeof(health_rom[0]); ++i) {
+		if (health_rom[i].reg_num != reg_num) {
+			continue;
+		}
+		health->n_id++;
+		if (result != health_rom[i].val) {
+			health->n_id_bad++;
+			health->last_bad_frame = frame;
+		}
+	}
+}
+
+// checks supply voltage and each ROM id register once every `every`
+// frames, spread out so at most one lands in a frame
+int rhd_health_init(rhd_health_t *health, rhd_aux_sched_t *sched, uint64_t every) {
+	size_t n_rom = sizeof(health_rom) / sizeof(health_rom[0]);
+	uint64_t step = every / (n_rom + 1);
+	rhd_aux_cmd_t cmd;
+
+	memset(health, 0, sizeof(*health));
+	cmd = rhd_aux_cmd_convert(RHD_AUX_CH_SUPPLY, health_supply_cb, health);
+	if (rhd_aux_add_periodic(sched, &cmd, every, 0) == -1) {
+		return -1;
+	}
+	for (size_t i=0; i<n_rom; ++i) {
+		cmd = rhd_aux_cmd_read(health_rom[i].reg_num, health_rom_cb, health);
+		if (rhd_aux_add_periodic(sched, &cmd, every, (i + 1) * step) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void rhd_health_report(const rhd_health_t *health, const char *name) {
+	printf("INFO: health: %s supply %.3f V (min %.3f, max %.3f, %llu reads), %llu ROM id checks, %llu mismatches\n",
+		name,
+		health->vdd_last,
+		health->vdd_min,
+		health->vdd_max,
+		(unsigned long long) health->n_supply,
+		(unsigned long long) health->n_id,
+		(unsigned long long) health->n_id_bad);
+	if (health->n_id_bad) {
+		printf("WARNING: health: %s ROM id read back wrong, last at frame %llu. check SPI wiring/speed\n",
+			name,
+			(unsigned long long) health->last_bad_frame);
+	}
+}
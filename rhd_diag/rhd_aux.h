@@ -0,0 +1,115 @@
+/*
+Auxiliary command slots: register reads/writes and aux ADC conversions
+interleaved with CONVERT frames, so chip health can be watched (or a
+register changed) without stopping acquisition.
+
+With dev->aux set, every frame gets n_slots extra command words after
+the amplifier CONVERTs. Before each frame the scheduler fills them with,
+in order of priority:
+	one-shot commands from rhd_aux_submit (any one thread may submit)
+	periodic commands that are due (rhd_aux_add_periodic)
+	filler commands set with rhd_aux_set_idle, in turn, or else a READ
+	of a ROM register with the result discarded
+Results come back RHD_PIPELINE_DEPTH words later like any other command
+and are handed to the command's callback from the acquisition thread,
+stamped with the frame the command rode in, so callbacks must not block.
+A WRITE that echoes back correctly also updates the register shadow.
+
+Each slot adds one SPI word per frame, so max srate drops by about
+n_slots / n_chs; rhd_acq_probe accounts for it. Amplifier samples within
+a frame keep their spacing since slots come after them.
+
+rhd_health_t is a ready-made consumer: supply voltage (CONVERT 48) and
+ROM id registers (40-44 "INTAN", 63 chip id) checked every N frames.
+rhd_link (rhd_link.h) checks the ROM in every spare slot instead, to
+catch a marginal SPI clock.
+Temperature (CONVERT 49) also needs tempEn/tempS in reg 3 sequenced by
+the caller, see the RHD2000 datasheet.
+
+Usage:
+	rhd_aux_sched_t aux;
+	rhd_health_t health;
+	rhd_aux_init(&aux, 1);
+	rhd_health_init(&health, &aux, 1000);
+	dev->aux = &aux;
+	rhd_convert_stream(dev, ...); // or rhd_stream_run, rhd_multi_run
+	dev->aux = NULL;
+	rhd_health_report(&health, dev->name);
+*/
+#ifndef RHD_AUX_H
+#define RHD_AUX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define RHD_AUX_MAX_SLOTS 4 // per frame
+#define RHD_AUX_MAX_PERIODIC 16
+#define RHD_AUX_QUEUE_LEN 64 // one-shot commands, power of 2
+
+// CONVERT channels besides the amplifiers
+#define RHD_AUX_CH_AUX1 32
+#define RHD_AUX_CH_AUX2 33
+#define RHD_AUX_CH_AUX3 34
+#define RHD_AUX_CH_SUPPLY 48
+#define RHD_AUX_CH_TEMP 49
+#define RHD_AUX_SUPPLY_V_PER_LSB (74.8e-6 * 4)
+
+typedef struct rhd_aux_cmd rhd_aux_cmd_t;
+
+// result is the 16-bit word the command produced, frame the frame seq it
+// was issued with
+typedef void (*rhd_aux_cb_t)(const rhd_aux_cmd_t *cmd, uint16_t result, uint64_t frame, void *arg);
+
+struct rhd_aux_cmd {
+	uint8_t tx[2]; // command word
+	rhd_aux_cb_t cb; // NULL to discard result
+	void *arg;
+};
+
+typedef struct rhd_aux_periodic {
+	rhd_aux_cmd_t cmd;
+	uint64_t every; // frames
+	uint64_t next_frame; // due at or after this frame
+} rhd_aux_periodic_t;
+
+typedef struct rhd_aux_sched {
+	size_t n_slots;
+	rhd_aux_periodic_t periodic[RHD_AUX_MAX_PERIODIC];
+	size_t n_periodic;
+	size_t rr; // periodic entry checked first, rotates so none starve
+	rhd_aux_cmd_t queue[RHD_AUX_QUEUE_LEN];
+	_Alignas(64) atomic_size_t head; // next queue slot submitter writes
+	_Alignas(64) atomic_size_t tail; // next queue slot scheduler reads
+	const rhd_aux_cmd_t *idle; // filler commands, NULL = discarded ROM read
+	size_t n_idle;
+	size_t idle_next; // idle entry the next spare slot gets
+	uint64_t n_issued; // commands other than filler
+	uint64_t n_results; // results routed to a callback
+} rhd_aux_sched_t;
+
+typedef struct rhd_health {
+	uint64_t n_supply;
+	double vdd_last;
+	double vdd_min;
+	double vdd_max;
+	uint64_t n_id; // ROM reads checked
+	uint64_t n_id_bad; // ROM reads that didn't match
+	uint64_t last_bad_frame;
+} rhd_health_t;
+
+rhd_aux_cmd_t rhd_aux_cmd_convert(uint8_t ch, rhd_aux_cb_t cb, void *arg);
+rhd_aux_cmd_t rhd_aux_cmd_read(uint8_t reg_num, rhd_aux_cb_t cb, void *arg);
+rhd_aux_cmd_t rhd_aux_cmd_write(uint8_t reg_num, uint8_t reg_data, rhd_aux_cb_t cb, void *arg);
+
+int rhd_aux_init(rhd_aux_sched_t *sched, size_t n_slots);
+int rhd_aux_add_periodic(rhd_aux_sched_t *sched, const rhd_aux_cmd_t *cmd, uint64_t every, uint64_t first_frame);
+int rhd_aux_set_idle(rhd_aux_sched_t *sched, const rhd_aux_cmd_t *cmds, size_t n);
+int rhd_aux_submit(rhd_aux_sched_t *sched, const rhd_aux_cmd_t *cmd);
+void rhd_aux_fill(rhd_aux_sched_t *sched, uint64_t frame, uint8_t *tx, rhd_aux_cmd_t *issued);
+void rhd_aux_fill_idle(rhd_aux_sched_t *sched, uint8_t *tx, rhd_aux_cmd_t *issued);
+
+int rhd_health_init(rhd_health_t *health, rhd_aux_sched_t *sched, uint64_t every);
+void rhd_health_report(const rhd_health_t *health, const char *name);
+
+#endif
@@ -0,0 +1,419 @@
+/*
+Offline benchmarks for the acquisition, logging and DSP hot paths.
+Needs no pi or chip: SPI goes to a synthetic backend that replays a
+precomputed rx pattern (or to the rhd_sim model for the end-to-end
+case), logs go to /dev/null.
+
+Every benchmark runs a fixed workload BENCH_REPS times after one warmup
+and reports the median, so numbers are comparable between runs and
+builds. Output is one line per benchmark:
+	<name> <ns per op> ns/op <items per second> <item>/s
+Names and order are stable, so two reports can be diffed directly.
+The library's own INFO/PVDEBUG prints (sim open, dlog close, ...) would
+land between those lines, so stdout is pointed at /dev/null while the
+benchmarks run and the report goes to a copy of the original stdout.
+
+Usage:
+Run from rhd_diag directory
+	make bench
+	or
+	./build/rhd_bench [filter]  # only benchmarks whose name contains filter
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rhd2216_lib.h"
+#include "rhd_dlog.h"
+#include "rhd_filter.h"
+#include "rhd_features.h"
+#include "rhd_decim.h"
+
+#define BENCH_REPS 5
+#define BENCH_PATTERN_WORDS 4096 // synthetic rx words replayed by bench backend
+
+typedef void (*bench_fn_t)(void *arg, size_t n_iters);
+
+typedef struct bench_pattern {
+	uint8_t rx[2 * BENCH_PATTERN_WORDS];
+	size_t pos; // next word to replay
+} bench_pattern_t;
+
+static bench_pattern_t pattern;
+static const char *name_filter = NULL;
+static FILE *report; // original stdout
+
+static void pabort(const char *s) {
+	perror(s);
+	abort();
+}
+
+// synthetic SPI source: returns the pattern, ignores tx. costs about as
+// much as copying the rx bytes, so acquisition benchmarks measure the
+// library's own per-frame overhead.
+static int bench_open(rhd_spi_t *spi, const char *device) {
+	(void) device;
+	spi->priv = &pattern;
+	return 0;
+}
+
+static int bench_config(rhd_spi_t *spi, uint8_t mode, uint8_t bpw, uint32_t speed) {
+	spi->mode = mode;
+	spi->bpw = bpw;
+	spi->speed = speed;
+	return 0;
+}
+
+static int bench_xfer_words(rhd_spi_t *spi, uint8_t *tx_buf, uint8_t *rx_buf, size_t n_words) {
+	(void) tx_buf;
+	bench_pattern_t *p = (bench_pattern_t*) spi->priv;
+	if (p->pos + n_words > BENCH_PATTERN_WORDS) {
+		p->pos = 0;
+	}
+	memcpy(rx_buf, p->rx + 2 * p->pos, 2 * n_words);
+	p->pos += n_words;
+	return 0;
+}
+
+static int bench_xfer(rhd_spi_t *spi, uint8_t *tx_buf, size_t tx_len, uint8_t *rx_buf) {
+	return bench_xfer_words(spi, tx_buf, rx_buf, tx_len / 2);
+}
+
+// gaps are not slept, so bursts measure per-frame overhead only
+static int bench_xfer_frames(rhd_spi_t *spi, uint8_t *tx_buf, uint8_t *rx_buf, size_t words_per_frame, size_t n_frames, const uint16_t *gap_us) {
+	(void) gap_us;
+	return bench_xfer_words(spi, tx_buf, rx_buf, words_per_frame * n_frames);
+}
+
+static void bench_close(rhd_spi_t *spi) {
+	(void) spi;
+}
+
+static const rhd_spi_backend_t bench_backend = {
+	.name = "bench",
+	.open = bench_open,
+	.config = bench_config,
+	.xfer = bench_xfer,
+	.xfer_words = bench_xfer_words,
+	.xfer_frames = bench_xfer_frames,
+	.close = bench_close,
+};
+
+static void bench_dev_open(rhd_dev_t *dev) {
+	memset(dev, 0, sizeof(*dev));
+	dev->name = "bench";
+	dev->spi.backend = &bench_backend;
+	dev->spi.fd = -1;
+	bench_open(&dev->spi, dev->name);
+}
+
+// emg-ish test signal: lcg noise plus a ramp, different per channel
+static void fill_samples(int16_t *buf, size_t n) {
+	uint32_t x = 12345;
+	for (size_t i=0; i<n; ++i) {
+		x = x * 1664525u + 1013904223u;
+		buf[i] = (int16_t) ((int32_t) (x >> 20) - 2048 + ((i * 37) % 400) - 200);
+	}
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+// median ns per iteration over BENCH_REPS runs of n_iters
+static void run_bench(const char *name, bench_fn_t fn, void *arg, size_t n_iters, double items_per_iter, const char *item) {
+	double ns[BENCH_REPS];
+
+	if (name_filter && !strstr(name, name_filter)) {
+		return;
+	}
+	fn(arg, n_iters / 10 + 1); // warmup
+	for (int r=0; r<BENCH_REPS; ++r) {
+		int64_t begin = rhd_now_ns();
+		fn(arg, n_iters);
+		ns[r] = (double) (rhd_now_ns() - begin) / n_iters;
+	}
+	qsort(ns, BENCH_REPS, sizeof(double), cmp_double);
+	double med = ns[BENCH_REPS / 2];
+	fprintf(report, "%-28s %12.1f ns/op %14.4e %s/s\n", name, med, items_per_iter * 1e9 / med, item);
+	fflush(report);
+}
+
+// -------------------- acquisition --------------------
+
+typedef struct acq_arg {
+	rhd_dev_t dev;
+	uint16_t active_chs_msk;
+	uint64_t n_frames_cb;
+} acq_arg_t;
+
+static int count_frame_cb(const rhd_frame_t *frame, size_t n_chs, void *arg) {
+	(void) frame;
+	(void) n_chs;
+	acq_arg_t *a = (acq_arg_t*) arg;
+	a->n_frames_cb++;
+	return 0;
+}
+
+// unpaced rhd_acq_frame loop: plan run + pipeline reassembly + callback
+static void bench_acq_frames(void *arg, size_t n_iters) {
+	acq_arg_t *a = (acq_arg_t*) arg;
+	rhd_acq_t acq;
+	if (rhd_acq_init(&acq, &a->dev, a->active_chs_msk, count_frame_cb, a) == -1) {
+		pabort("bench: rhd_acq_init failed");
+	}
+	for (size_t i=0; i<n_iters; ++i) {
+		rhd_acq_frame(&acq, 0);
+	}
+	rhd_acq_finish(&acq);
+}
+
+// same in bursts of dev.burst_frames, one iteration per burst
+static void bench_acq_bursts(void *arg, size_t n_iters) {
+	acq_arg_t *a = (acq_arg_t*) arg;
+	rhd_acq_t acq;
+	if (rhd_acq_init(&acq, &a->dev, a->active_chs_msk, count_frame_cb, a) == -1) {
+		pabort("bench: rhd_acq_init failed");
+	}
+	for (size_t i=0; i<n_iters; ++i) {
+		rhd_acq_burst(&acq, 0, a->dev.burst_frames);
+	}
+	rhd_acq_finish(&acq);
+}
+
+typedef struct xfer_arg {
+	rhd_dev_t dev;
+	size_t n_words;
+} xfer_arg_t;
+
+static void bench_spi_xfer(void *arg, size_t n_iters) {
+	xfer_arg_t *a = (xfer_arg_t*) arg;
+	uint8_t tx_buf[2] = {0xff, 0};
+	uint8_t rx_buf[2];
+	for (size_t i=0; i<n_iters; ++i) {
+		rhd_spi_xfer(&a->dev.spi, tx_buf, 2, rx_buf);
+	}
+}
+
+static void bench_spi_xfer_words(void *arg, size_t n_iters) {
+	xfer_arg_t *a = (xfer_arg_t*) arg;
+	uint8_t tx_buf[2 * RHD_NUM_CHS] = {0};
+	uint8_t rx_buf[2 * RHD_NUM_CHS];
+	for (size_t i=0; i<n_iters; ++i) {
+		rhd_spi_xfer_words(&a->dev.spi, tx_buf, rx_buf, a->n_words);
+	}
+}
+
+// -------------------- logging --------------------
+
+typedef struct dlog_arg {
+	rhd_dlog_format_t format;
+	const uint16_t *samples;
+	size_t n_samples; // per iteration
+} dlog_arg_t;
+
+static void bench_dlog(void *arg, size_t n_iters) {
+	dlog_arg_t *a = (dlog_arg_t*) arg;
+	rhd_dlog_t dlog;
+	if (rhd_dlog_open(&dlog, "/dev/null", a->format, 0xffff, 5000, 8000000) == -1) {
+		pabort("bench: could not open /dev/null");
+	}
+	for (size_t i=0; i<n_iters; ++i) {
+		rhd_dlog_write_samples(&dlog, a->samples, a->n_samples);
+	}
+	rhd_dlog_close(&dlog);
+}
+
+// -------------------- dsp --------------------
+
+typedef struct filt_arg {
+	rhd_filter_t filt;
+	const int16_t *in;
+	int16_t *out;
+	size_t n_frames; // per iteration
+} filt_arg_t;
+
+static void bench_filter_block(void *arg, size_t n_iters) {
+	filt_arg_t *a = (filt_arg_t*) arg;
+	for (size_t i=0; i<n_iters; ++i) {
+		rhd_filter_process_block(&a->filt, a->in, a->out, a->n_frames);
+	}
+}
+
+static void bench_filter_frame(void *arg, size_t n_iters) {
+	filt_arg_t *a = (filt_arg_t*) arg;
+	size_t n_chs = a->filt.n_chs;
+	for (size_t i=0; i<n_iters; ++i) {
+		for (size_t f=0; f<a->n_frames; ++f) {
+			rhd_filter_process_frame(&a->filt, a->in + f * n_chs, a->out + f * n_chs);
+		}
+	}
+}
+
+typedef struct decim_arg {
+	rhd_decim_t dec;
+	const int16_t *in;
+	int16_t *out;
+	size_t n_frames; // per iteration
+} decim_arg_t;
+
+static void bench_decim(void *arg, size_t n_iters) {
+	decim_arg_t *a = (decim_arg_t*) arg;
+	for (size_t i=0; i<n_iters; ++i) {
+		rhd_decim_process_block(&a->dec, a->in, a->out, a->n_frames);
+	}
+}
+
+typedef struct feat_arg {
+	rhd_feat_t feat;
+	const int16_t *in;
+	size_t n_frames; // per iteration
+} feat_arg_t;
+
+static void bench_features(void *arg, size_t n_iters) {
+	feat_arg_t *a = (feat_arg_t*) arg;
+	rhd_feat_vals_t vals[RHD_NUM_CHS];
+	for (size_t i=0; i<n_iters; ++i) {
+		for (size_t f=0; f<a->n_frames; ++f) {
+			rhd_feat_push_frame(&a->feat, a->in + f * a->feat.n_chs, vals);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	static const uint16_t masks[] = {0x0001, 0x000f, 0x00ff, 0xffff};
+	static const rhd_dlog_format_t formats[] = {RHD_DLOG_TEXT, RHD_DLOG_BIN, RHD_DLOG_RICE};
+	const size_t block_frames = 1000;
+	char name[64];
+	int16_t *samples;
+
+	if (argc > 1) {
+		name_filter = argv[1];
+	}
+	samples = (int16_t*) malloc(block_frames * RHD_NUM_CHS * sizeof(int16_t));
+	int16_t *out = (int16_t*) malloc(block_frames * RHD_NUM_CHS * sizeof(int16_t));
+	if (!samples || !out) {
+		pabort("bench: out of memory");
+	}
+	fill_samples(samples, block_frames * RHD_NUM_CHS);
+	memcpy(pattern.rx, samples, sizeof(pattern.rx));
+
+	fflush(stdout);
+	report = fdopen(dup(STDOUT_FILENO), "w");
+	if (!report || !freopen("/dev/null", "w", stdout)) {
+		pabort("bench: could not redirect stdout");
+	}
+	fprintf(report, "# rhd_bench: median of %d runs, synthetic SPI source, logs to /dev/null\n", BENCH_REPS);
+
+	// acquisition loop per channel mask
+	for (size_t i=0; i<sizeof(masks)/sizeof(masks[0]); ++i) {
+		acq_arg_t a;
+		int n_chs = __builtin_popcount(masks[i]);
+		memset(&a, 0, sizeof(a));
+		bench_dev_open(&a.dev);
+		a.active_chs_msk = masks[i];
+		snprintf(name, sizeof(name), "acq_frame_%02dch", n_chs);
+		run_bench(name, bench_acq_frames, &a, 200000, n_chs, "sample");
+	}
+	{
+		acq_arg_t a;
+		memset(&a, 0, sizeof(a));
+		bench_dev_open(&a.dev);
+		set_burst_frames(&a.dev, 64);
+		a.active_chs_msk = 0xffff;
+		run_bench("acq_burst64_16ch", bench_acq_bursts, &a, 2000, 64 * 16, "sample");
+	}
+	{
+		// end to end against the device model, dominated by waveform synthesis
+		acq_arg_t a;
+		memset(&a, 0, sizeof(a));
+		if (rhd_dev_open(&a.dev, "sim_bench", 0, 8, 8000000) == -1) {
+			pabort("bench: could not open sim");
+		}
+		a.active_chs_msk = 0xffff;
+		run_bench("acq_frame_16ch_sim", bench_acq_frames, &a, 20000, 16, "sample");
+		rhd_dev_close(&a.dev);
+	}
+
+	// spi call overhead
+	{
+		xfer_arg_t a;
+		bench_dev_open(&a.dev);
+		run_bench("spi_xfer_1word", bench_spi_xfer, &a, 2000000, 1, "call");
+		a.n_words = 1;
+		run_bench("spi_xfer_words_1", bench_spi_xfer_words, &a, 2000000, 1, "call");
+		a.n_words = RHD_NUM_CHS;
+		run_bench("spi_xfer_words_16", bench_spi_xfer_words, &a, 2000000, 1, "call");
+	}
+
+	// datalog formats, one 16 ch x 1000 frame block per op
+	for (size_t i=0; i<sizeof(formats)/sizeof(formats[0]); ++i) {
+		dlog_arg_t a = {
+			.format = formats[i],
+			.samples = (const uint16_t*) samples,
+			.n_samples = block_frames * RHD_NUM_CHS,
+		};
+		snprintf(name, sizeof(name), "dlog_write_%s", rhd_dlog_ext(formats[i]));
+		run_bench(name, bench_dlog, &a, 200, a.n_samples, "sample");
+	}
+
+	// filter bank, 20-450 Hz 4th order bandpass + 60 Hz notch x3 at 5 kHz
+	{
+		filt_arg_t *a = (filt_arg_t*) calloc(1, sizeof(filt_arg_t));
+		if (!a) {
+			pabort("bench: out of memory");
+		}
+		rhd_filter_init(&a->filt, RHD_NUM_CHS);
+		rhd_filter_add_bandpass(&a->filt, 5000, 20, 450, 4);
+		rhd_filter_add_notch(&a->filt, 5000, 60, RHD_FILTER_NOTCH_Q, 3);
+		a->in = samples;
+		a->out = out;
+		a->n_frames = block_frames;
+		snprintf(name, sizeof(name), "filter_block_%zusec", a->filt.n_sections);
+		run_bench(name, bench_filter_block, a, 200, block_frames * RHD_NUM_CHS, "sample");
+		snprintf(name, sizeof(name), "filter_frame_%zusec", a->filt.n_sections);
+		run_bench(name, bench_filter_frame, a, 200, block_frames * RHD_NUM_CHS, "sample");
+		free(a);
+	}
+
+	// polyphase decimation of 16 channels, 5 kHz to 1 kHz and 500 Hz
+	for (size_t factor=5; factor<=10; factor+=5) {
+		decim_arg_t a;
+		if (rhd_decim_init(&a.dec, RHD_NUM_CHS, factor) == -1) {
+			pabort("bench: rhd_decim_init failed");
+		}
+		a.in = samples;
+		a.out = out;
+		a.n_frames = block_frames;
+		snprintf(name, sizeof(name), "decim_x%zu_16ch", factor);
+		run_bench(name, bench_decim, &a, 200, block_frames * RHD_NUM_CHS, "sample");
+		rhd_decim_free(&a.dec);
+	}
+
+	// feature extraction, 256 frame window every 128 frames
+	for (int spectral=0; spectral<2; ++spectral) {
+		feat_arg_t a;
+		rhd_feat_cfg_t cfg = {
+			.window = 256,
+			.hop = 128,
+			.srate = 5000,
+			.zc_thresh = 10,
+			.spectral = spectral,
+		};
+		if (rhd_feat_init(&a.feat, &cfg, RHD_NUM_CHS) == -1) {
+			pabort("bench: rhd_feat_init failed");
+		}
+		a.in = samples;
+		a.n_frames = block_frames;
+		run_bench(spectral ? "features_w256_h128_spec" : "features_w256_h128_time", bench_features, &a, 200, block_frames * RHD_NUM_CHS, "sample");
+		rhd_feat_free(&a.feat);
+	}
+
+	free(samples);
+	free(out);
+	fclose(report);
+	return 0;
+}
@@ -0,0 +1,128 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rhd_decim.h"
+
+// modified Bessel function of the first kind, order 0
+static double bessel_i0(double x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k=1; k<50; ++k) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < 1e-12 * sum) {
+			break;
+		}
+	}
+	return sum;
+}
+
+// Kaiser windowed sinc lowpass at fc (cycles per input sample), unity DC
+// gain, stored split into polyphase branches
+static int design(rhd_decim_t *dec) {
+	size_t n = dec->n_taps;
+	double fc = RHD_DECIM_CUTOFF * 0.5 / dec->factor;
+	double mid = (n - 1) / 2.0;
+	double *h = (double*) malloc(n * sizeof(double));
+	double sum = 0;
+
+	if (!h) {
+		return -1;
+	}
+	for (size_t i=0; i<n; ++i) {
+		double t = i - mid;
+		double r = t / mid;
+		double sinc = (t == 0) ? 2.0 * fc : sin(2.0 * M_PI * fc * t) / (M_PI * t);
+		h[i] = sinc * bessel_i0(RHD_DECIM_KAISER_BETA * sqrt(1.0 - r * r)) / bessel_i0(RHD_DECIM_KAISER_BETA);
+		sum += h[i];
+	}
+	for (size_t p=0; p<dec->factor; ++p) {
+		for (size_t j=0; j<RHD_DECIM_TAPS_PER_PHASE; ++j) {
+			dec->coef[p * RHD_DECIM_TAPS_PER_PHASE + j] = (float) (h[j * dec->factor + p] / sum);
+		}
+	}
+	free(h);
+	return 0;
+}
+
+int rhd_decim_init(rhd_decim_t *dec, size_t n_chs, size_t factor) {
+	memset(dec, 0, sizeof(*dec));
+	if (factor < 2 || factor > RHD_DECIM_MAX_FACTOR) {
+		printf("ERROR: rhd_decim: factor %zu not in 2-%d\n", factor, RHD_DECIM_MAX_FACTOR);
+		return -1;
+	}
+	dec->n_chs = (n_chs > RHD_NUM_CHS) ? RHD_NUM_CHS : n_chs;
+	dec->factor = factor;
+	dec->n_taps = factor * RHD_DECIM_TAPS_PER_PHASE;
+	dec->coef = (float*) malloc(dec->n_taps * sizeof(float));
+	dec->hist = (rhd_v4f*) calloc(2 * dec->n_taps * RHD_FILTER_NUM_VECS, sizeof(rhd_v4f));
+	if (!dec->coef || !dec->hist || design(dec) == -1) {
+		rhd_decim_free(dec);
+		return -1;
+	}
+	return 0;
+}
+
+// returns 1 and fills out (n_chs samples) on every factor-th frame, else 0
+int rhd_decim_push_frame(rhd_decim_t *dec, const int16_t *in, int16_t *out) {
+	rhd_v4f x[RHD_FILTER_NUM_VECS];
+	float *xf = (float*) x;
+
+	memset(x, 0, sizeof(x));
+	for (size_t ch=0; ch<dec->n_chs; ++ch) {
+		xf[ch] = in[ch];
+	}
+	// stored twice, so the last n_taps frames are always contiguous:
+	// slots pos+1 .. pos+n_taps after the increment, oldest first
+	memcpy(&dec->hist[dec->pos * RHD_FILTER_NUM_VECS], x, sizeof(x));
+	memcpy(&dec->hist[(dec->pos + dec->n_taps) * RHD_FILTER_NUM_VECS], x, sizeof(x));
+	dec->pos = (dec->pos + 1) % dec->n_taps;
+	if (++dec->phase < dec->factor) {
+		return 0;
+	}
+	dec->phase = 0;
+
+	// branch p sees every factor-th frame starting p frames back
+	rhd_v4f acc[RHD_FILTER_NUM_VECS];
+	const rhd_v4f *newest = &dec->hist[(dec->pos + dec->n_taps - 1) * RHD_FILTER_NUM_VECS];
+	memset(acc, 0, sizeof(acc));
+	for (size_t p=0; p<dec->factor; ++p) {
+		const float *c = &dec->coef[p * RHD_DECIM_TAPS_PER_PHASE];
+		for (size_t j=0; j<RHD_DECIM_TAPS_PER_PHASE; ++j) {
+			const rhd_v4f *h = newest - (j * dec->factor + p) * RHD_FILTER_NUM_VECS;
+			for (int v=0; v<RHD_FILTER_NUM_VECS; ++v) {
+				acc[v] += c[j] * h[v];
+			}
+		}
+	}
+
+	float *yf = (float*) acc;
+	for (size_t ch=0; ch<dec->n_chs; ++ch) {
+		float y = yf[ch];
+		if (y > INT16_MAX) {
+			y = INT16_MAX;
+		} else if (y < INT16_MIN) {
+			y = INT16_MIN;
+		}
+		out[ch] = (int16_t) lrintf(y);
+	}
+	return 1;
+}
+
+// in is n_frames interleaved frames, out gets the decimated frames (at
+// most n_frames / factor + 1). returns the number of output frames.
+size_t rhd_decim_process_block(rhd_decim_t *dec, const int16_t *in, int16_t *out, size_t n_frames) {
+	size_t n_out = 0;
+	for (size_t i=0; i<n_frames; ++i) {
+		n_out += rhd_decim_push_frame(dec, in + i * dec->n_chs, out + n_out * dec->n_chs);
+	}
+	return n_out;
+}
+
+void rhd_decim_free(rhd_decim_t *dec) {
+	free(dec->coef);
+	free(dec->hist);
+	dec->coef = NULL;
+	dec->hist = NULL;
+}
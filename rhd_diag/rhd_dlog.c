@@ -0,0 +1,333 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "rhd_dlog.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "rhd_dlog binary format is written in host order, expects little-endian"
+#endif
+
+_Static_assert(sizeof(rhd_dlog_bin_header_t) == RHD_DLOG_BIN_HEADER_LEN, "binary header must be RHD_DLOG_BIN_HEADER_LEN bytes");
+
+// wide enough for any uint64_t, so patching never changes line length
+#define NUM_SAMPLES_WIDTH 20
+#define FLAGS_WIDTH 8 // hex digits
+// text lines are formatted into this buffer before one fwrite
+#define TEXT_CHUNK_SAMPLES 256
+// longest text line, "ffff\n"
+#define TEXT_LINE_MAX 5
+
+static int64_t clock_ns(clockid_t clk) {
+	struct timespec ts;
+	clock_gettime(clk, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// everything written goes through here, to the FILE or the aio writer
+static int put(rhd_dlog_t *dlog, const void *data, size_t len) {
+	int ret;
+	if (dlog->aio) {
+		ret = rhd_aio_write(dlog->aio, data, len);
+	} else {
+		ret = (fwrite(data, 1, len, dlog->f) == len) ? 0 : -1;
+	}
+	if (ret == 0) {
+		dlog->pos += len;
+	}
+	return ret;
+}
+
+// overwrites len already written bytes at off. with aio, only once
+// rhd_aio_close has written everything out.
+static int patch(rhd_dlog_t *dlog, uint64_t off, const void *data, size_t len) {
+	if (dlog->aio) {
+		return (pwrite(dlog->fd, data, len, (off_t) off) == (ssize_t) len) ? 0 : -1;
+	}
+	long pos = ftell(dlog->f);
+	if (fseek(dlog->f, (long) off, SEEK_SET) != 0) {
+		return -1;
+	}
+	int ret = (fwrite(data, 1, len, dlog->f) == len) ? 0 : -1;
+	if (fseek(dlog->f, pos, SEEK_SET) != 0) {
+		ret = -1;
+	}
+	return ret;
+}
+
+static int open_text(rhd_dlog_t *dlog) {
+	char buf[128];
+	int len = snprintf(buf, sizeof(buf), "active_chs_mask: %llx\nnum_samples: ", (unsigned long long) dlog->active_chs_msk);
+	if (put(dlog, buf, len) == -1) {
+		return -1;
+	}
+	dlog->n_samples_pos = dlog->pos;
+	len = snprintf(buf, sizeof(buf), "%0*d\nsample rate: %d Hz\nflags: ", NUM_SAMPLES_WIDTH, 0, dlog->srate);
+	if (put(dlog, buf, len) == -1) {
+		return -1;
+	}
+	dlog->flags_pos = dlog->pos;
+	len = snprintf(buf, sizeof(buf), "%0*x\n", FLAGS_WIDTH, 0);
+	return put(dlog, buf, len);
+}
+
+static int open_bin(rhd_dlog_t *dlog) {
+	if (dlog->format == RHD_DLOG_RICE) {
+		dlog->flags |= RHD_DLOG_FLAG_RICE;
+		dlog->block = (uint16_t*) malloc(RHD_RICE_BLOCK_FRAMES * dlog->n_chs * sizeof(uint16_t));
+		dlog->enc_buf = (uint8_t*) malloc(rhd_rice_max_block_bytes(RHD_RICE_BLOCK_FRAMES, dlog->n_chs));
+		if (!dlog->block || !dlog->enc_buf) {
+			return -1;
+		}
+	}
+
+	rhd_dlog_bin_header_t hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, RHD_DLOG_BIN_MAGIC, sizeof(hdr.magic));
+	hdr.version = RHD_DLOG_BIN_VERSION;
+	hdr.header_len = RHD_DLOG_BIN_HEADER_LEN;
+	hdr.active_chs_msk = dlog->active_chs_msk & 0xffff;
+	hdr.active_chs_msk64 = dlog->active_chs_msk;
+	hdr.n_chs = dlog->n_chs;
+	hdr.srate_hz = dlog->srate;
+	hdr.spi_speed_hz = dlog->spi_speed;
+	hdr.start_unix_ns = clock_ns(CLOCK_REALTIME);
+	hdr.start_mono_ns = clock_ns(CLOCK_MONOTONIC);
+	hdr.flags = dlog->flags;
+	dlog->n_samples_pos = offsetof(rhd_dlog_bin_header_t, n_frames);
+	return put(dlog, &hdr, sizeof(hdr));
+}
+
+static int open_header(rhd_dlog_t *dlog, rhd_dlog_format_t format, uint64_t active_chs_msk, uint16_t srate, uint32_t spi_speed) {
+	dlog->format = format;
+	dlog->active_chs_msk = active_chs_msk;
+	dlog->n_chs = __builtin_popcountll(active_chs_msk);
+	dlog->srate = srate;
+	dlog->spi_speed = spi_speed;
+
+	if (format == RHD_DLOG_BIN || format == RHD_DLOG_RICE) {
+		return open_bin(dlog);
+	}
+	return open_text(dlog);
+}
+
+int rhd_dlog_open(rhd_dlog_t *dlog, const char *fname, rhd_dlog_format_t format, uint64_t active_chs_msk, uint16_t srate, uint32_t spi_speed) {
+	memset(dlog, 0, sizeof(*dlog));
+	dlog->fd = -1;
+	dlog->f = fopen(fname, (format == RHD_DLOG_TEXT) ? "w" : "wb");
+	if (!dlog->f) {
+		return -1;
+	}
+	return open_header(dlog, format, active_chs_msk, srate, spi_speed);
+}
+
+// rhd_dlog_open, or the same file written by rhd_aio so writes never wait
+// on the disk. expected_frames (0 if unknown) sizes the preallocation.
+int rhd_dlog_open_io(rhd_dlog_t *dlog, const char *fname, rhd_dlog_format_t format, uint64_t active_chs_msk, uint16_t srate, uint32_t spi_speed, rhd_dlog_io_t io, uint64_t expected_frames) {
+	if (io == RHD_DLOG_STDIO) {
+		return rhd_dlog_open(dlog, fname, format, active_chs_msk, srate, spi_speed);
+	}
+	size_t n_chs = __builtin_popcountll(active_chs_msk);
+	// upper bound, rice blocks are smaller and the rest is trimmed on close
+	uint64_t expected_bytes = expected_frames * n_chs * ((format == RHD_DLOG_TEXT) ? TEXT_LINE_MAX : sizeof(uint16_t));
+
+	memset(dlog, 0, sizeof(*dlog));
+	dlog->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (dlog->fd == -1) {
+		return -1;
+	}
+	dlog->aio = (rhd_aio_t*) malloc(sizeof(rhd_aio_t));
+	if (!dlog->aio || rhd_aio_open(dlog->aio, dlog->fd, expected_bytes ? expected_bytes + RHD_DLOG_BIN_HEADER_LEN : 0, io == RHD_DLOG_AIO_THREAD) == -1) {
+		free(dlog->aio);
+		dlog->aio = NULL;
+		close(dlog->fd);
+		dlog->fd = -1;
+		return -1;
+	}
+	printf("INFO: dlog: writing %s through %s\n", fname, rhd_aio_backend_name(dlog->aio));
+	return open_header(dlog, format, active_chs_msk, srate, spi_speed);
+}
+
+// same output as fprintf("%2x\n") without the per-sample format parsing
+static size_t format_hex_line(char *out, uint16_t v) {
+	static const char digits[] = "0123456789abcdef";
+	char tmp[4];
+	size_t n = 0;
+	size_t len = 0;
+	do {
+		tmp[n++] = digits[v & 0xf];
+		v >>= 4;
+	} while (v);
+	if (n < 2) {
+		out[len++] = ' ';
+	}
+	while (n) {
+		out[len++] = tmp[--n];
+	}
+	out[len++] = '\n';
+	return len;
+}
+
+static int write_text(rhd_dlog_t *dlog, const uint16_t *samples, size_t n) {
+	char buf[TEXT_CHUNK_SAMPLES * 5];
+	size_t i = 0;
+	while (i < n) {
+		size_t len = 0;
+		for (size_t j=0; j<TEXT_CHUNK_SAMPLES && i<n; ++j, ++i) {
+			len += format_hex_line(buf + len, samples[i]);
+		}
+		if (put(dlog, buf, len) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// encodes and writes the first n_frames frames of the pending block
+static int flush_block(rhd_dlog_t *dlog, size_t n_frames) {
+	uint64_t first_frame = (dlog->n_samples - dlog->block_fill) / dlog->n_chs;
+	size_t len = rhd_rice_encode_block(dlog->block, n_frames, dlog->n_chs, first_frame, dlog->enc_buf);
+	dlog->block_fill = 0;
+	if (len == 0 || put(dlog, dlog->enc_buf, len) == -1) {
+		return -1;
+	}
+	dlog->n_bytes_enc += len;
+	return 0;
+}
+
+static int write_rice(rhd_dlog_t *dlog, const uint16_t *samples, size_t n) {
+	size_t block_len = RHD_RICE_BLOCK_FRAMES * dlog->n_chs;
+	while (n) {
+		size_t take = block_len - dlog->block_fill;
+		if (take > n) {
+			take = n;
+		}
+		memcpy(dlog->block + dlog->block_fill, samples, take * sizeof(uint16_t));
+		dlog->block_fill += take;
+		dlog->n_samples += take;
+		samples += take;
+		n -= take;
+		if (dlog->block_fill == block_len && flush_block(dlog, RHD_RICE_BLOCK_FRAMES) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int rhd_dlog_write_samples(rhd_dlog_t *dlog, const uint16_t *samples, size_t n) {
+	int ret;
+	if (dlog->format == RHD_DLOG_RICE) {
+		// counts samples itself, a block may be written partway through
+		return write_rice(dlog, samples, n);
+	} else if (dlog->format == RHD_DLOG_BIN) {
+		// chip is configured for twoscomp output, so samples are already
+		// int16 bit patterns
+		ret = put(dlog, samples, n * sizeof(uint16_t));
+	} else {
+		ret = write_text(dlog, samples, n);
+	}
+	if (ret == 0) {
+		dlog->n_samples += n;
+	}
+	return ret;
+}
+
+int rhd_dlog_write_frame(rhd_dlog_t *dlog, const rhd_frame_t *frame) {
+	return rhd_dlog_write_samples(dlog, frame->data, dlog->n_chs);
+}
+
+// records flags in the binary header. text logs get them in their flags
+// line on close, like the sample count. with aio the header may still be
+// in a buffer, so it is patched on close too.
+int rhd_dlog_set_flags(rhd_dlog_t *dlog, uint32_t flags) {
+	flags |= (dlog->flags & RHD_DLOG_FLAG_RICE);
+	dlog->flags = flags;
+	if (dlog->format == RHD_DLOG_TEXT || dlog->aio) {
+		return 0;
+	}
+	return patch(dlog, offsetof(rhd_dlog_bin_header_t, flags), &flags, sizeof(flags));
+}
+
+int rhd_dlog_close(rhd_dlog_t *dlog) {
+	int ret = 0;
+	if (!dlog->f && !dlog->aio) {
+		return -1;
+	}
+	if (dlog->format == RHD_DLOG_RICE) {
+		// whole frames only, the partial one is dropped from the count too
+		size_t n_frames = dlog->block_fill / dlog->n_chs;
+		dlog->n_samples -= dlog->block_fill % dlog->n_chs;
+		if (n_frames && flush_block(dlog, n_frames) == -1) {
+			ret = -1;
+		}
+		if (dlog->n_samples) {
+			printf("INFO: dlog: %llu samples compressed to %llu bytes, %.2f bits/sample (%.2fx vs bin)\n",
+				(unsigned long long) dlog->n_samples,
+				(unsigned long long) dlog->n_bytes_enc,
+				8.0 * dlog->n_bytes_enc / dlog->n_samples,
+				2.0 * dlog->n_samples / (dlog->n_bytes_enc ? dlog->n_bytes_enc : 1));
+		}
+		free(dlog->block);
+		free(dlog->enc_buf);
+		dlog->block = NULL;
+		dlog->enc_buf = NULL;
+	}
+	if (dlog->aio && rhd_aio_close(dlog->aio) == -1) {
+		ret = -1;
+	}
+	if (dlog->format != RHD_DLOG_TEXT) {
+		uint64_t n_frames = dlog->n_chs ? dlog->n_samples / dlog->n_chs : 0;
+		if (patch(dlog, dlog->n_samples_pos, &n_frames, sizeof(n_frames)) == -1) {
+			ret = -1;
+		}
+		if (dlog->aio && patch(dlog, offsetof(rhd_dlog_bin_header_t, flags), &dlog->flags, sizeof(dlog->flags)) == -1) {
+			ret = -1;
+		}
+	} else {
+		char buf[NUM_SAMPLES_WIDTH + 1];
+		snprintf(buf, sizeof(buf), "%0*llu", NUM_SAMPLES_WIDTH, (unsigned long long) dlog->n_samples);
+		if (patch(dlog, dlog->n_samples_pos, buf, NUM_SAMPLES_WIDTH) == -1) {
+			ret = -1;
+		}
+		char flags_buf[FLAGS_WIDTH + 1];
+		snprintf(flags_buf, sizeof(flags_buf), "%0*x", FLAGS_WIDTH, dlog->flags);
+		if (patch(dlog, dlog->flags_pos, flags_buf, FLAGS_WIDTH) == -1) {
+			ret = -1;
+		}
+	}
+	if (dlog->aio) {
+		if (close(dlog->fd) != 0) {
+			ret = -1;
+		}
+		free(dlog->aio);
+		dlog->aio = NULL;
+		dlog->fd = -1;
+	} else if (fclose(dlog->f) != 0) {
+		ret = -1;
+	}
+	dlog->f = NULL;
+	return ret;
+}
+
+const char *rhd_dlog_ext(rhd_dlog_format_t format) {
+	if (format == RHD_DLOG_RICE) {
+		return "rhc";
+	}
+	return (format == RHD_DLOG_BIN) ? "bin" : "txt";
+}
+
+// "text", "bin" or "rice". returns -1 if s is none of them
+int rhd_dlog_parse_format(const char *s, rhd_dlog_format_t *format) {
+	if (strcmp(s, "text") == 0 || strcmp(s, "txt") == 0) {
+		*format = RHD_DLOG_TEXT;
+	} else if (strcmp(s, "bin") == 0) {
+		*format = RHD_DLOG_BIN;
+	} else if (strcmp(s, "rice") == 0) {
+		*format = RHD_DLOG_RICE;
+	} else {
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,112 @@
+/*
+Datalog writer for rhd2216_util. Two formats:
+
+RHD_DLOG_TEXT, one sample per line:
+	active_chs_mask: <hex>
+	num_samples: <decimal, zero padded>
+	sample rate: <decimal> Hz
+	flags: <hex RHD_DLOG_FLAG_*, 8 digits>
+	<hex sample>
+	...
+(logs from before the flags line have the samples right after the rate)
+
+RHD_DLOG_BIN, a fixed RHD_DLOG_BIN_HEADER_LEN byte little-endian header
+(rhd_dlog_bin_header_t) followed by interleaved int16 frames:
+	ch_a[0], ch_b[0], ..., ch_a[1], ch_b[1], ...
+one int16 per active channel per frame, lowest channel first. The data
+section can be mapped directly as an (n_frames, n_chs) int16 array.
+Multi-chip logs (rhd_multi.h) number channels across chips, chip i's
+channel c is channel 16*i + c of the 64-bit mask.
+
+RHD_DLOG_RICE, the RHD_DLOG_BIN header with RHD_DLOG_FLAG_RICE set,
+followed by independently decodable compressed blocks of
+RHD_RICE_BLOCK_FRAMES frames (see rhd_rice.h for the block layout).
+For EMG that is about 8-9.5 bits per sample, 1.7-1.9x smaller than
+RHD_DLOG_BIN and 3-4x smaller than RHD_DLOG_TEXT. A partial last frame
+is dropped on close.
+
+In all formats the sample count is patched on close, so a log can be
+written as frames arrive without knowing the recording length up front.
+rhd_dlog_open_io with RHD_DLOG_AIO writes the same file through rhd_aio
+(rhd_aio.h), so the caller never blocks on the disk.
+All are read by format_rhdutil_log_file in
+postprocess/flexsemg_postprocess.py.
+*/
+#ifndef RHD_DLOG_H
+#define RHD_DLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rhd2216_lib.h"
+#include "rhd_rice.h"
+#include "rhd_aio.h"
+
+#define RHD_DLOG_BIN_MAGIC "RHDLOG\0\0"
+// 2: active_chs_msk64 (multi-chip) in what were reserved bytes
+#define RHD_DLOG_BIN_VERSION 2
+#define RHD_DLOG_BIN_HEADER_LEN 64
+
+// rhd_dlog_bin_header_t.flags
+#define RHD_DLOG_FLAG_FILTERED (1 << 0) // samples passed through rhd_filter
+#define RHD_DLOG_FLAG_RICE (1 << 1) // data section is rhd_rice blocks
+
+typedef enum rhd_dlog_format {
+	RHD_DLOG_TEXT = 0,
+	RHD_DLOG_BIN = 1,
+	RHD_DLOG_RICE = 2,
+} rhd_dlog_format_t;
+
+// how the file is written, see rhd_dlog_open_io
+typedef enum rhd_dlog_io {
+	RHD_DLOG_STDIO = 0, // buffered fwrite, blocks during writeback
+	RHD_DLOG_AIO = 1, // rhd_aio, io_uring if the kernel has it
+	RHD_DLOG_AIO_THREAD = 2, // rhd_aio, writer thread backend
+} rhd_dlog_io_t;
+
+typedef struct __attribute__((packed)) rhd_dlog_bin_header {
+	char magic[8];
+	uint16_t version;
+	uint16_t header_len; // offset of first frame
+	uint16_t active_chs_msk; // low 16 bits of active_chs_msk64
+	uint16_t n_chs;
+	uint32_t srate_hz;
+	uint32_t spi_speed_hz;
+	int64_t start_unix_ns; // CLOCK_REALTIME at open
+	int64_t start_mono_ns; // CLOCK_MONOTONIC at open, same base as frame t_ns
+	uint64_t n_frames; // 0 if writer didn't close cleanly, use file size
+	uint32_t flags; // RHD_DLOG_FLAG_*
+	uint64_t active_chs_msk64; // chip i in bits 16i-16i+15, version 2 and up
+	uint8_t reserved[4];
+} rhd_dlog_bin_header_t;
+
+typedef struct rhd_dlog {
+	FILE *f; // NULL when writing through aio
+	int fd; // rhd_dlog_open_io with an aio mode, -1 otherwise
+	rhd_aio_t *aio; // NULL for RHD_DLOG_STDIO
+	uint64_t pos; // bytes written so far
+	rhd_dlog_format_t format;
+	uint64_t active_chs_msk; // > 16 bits when merging several chips
+	size_t n_chs;
+	uint16_t srate;
+	uint32_t spi_speed;
+	uint64_t n_samples;
+	long n_samples_pos; // file offset of sample count
+	long flags_pos; // file offset of text flags line value
+	uint32_t flags; // RHD_DLOG_FLAG_*, set before first write
+	// RHD_DLOG_RICE only
+	uint16_t *block; // samples waiting to be encoded
+	size_t block_fill; // samples in block
+	uint8_t *enc_buf; // one encoded block
+	uint64_t n_bytes_enc; // data section bytes written so far
+} rhd_dlog_t;
+
+int rhd_dlog_open(rhd_dlog_t *dlog, const char *fname, rhd_dlog_format_t format, uint64_t active_chs_msk, uint16_t srate, uint32_t spi_speed);
+int rhd_dlog_open_io(rhd_dlog_t *dlog, const char *fname, rhd_dlog_format_t format, uint64_t active_chs_msk, uint16_t srate, uint32_t spi_speed, rhd_dlog_io_t io, uint64_t expected_frames);
+int rhd_dlog_write_samples(rhd_dlog_t *dlog, const uint16_t *samples, size_t n);
+int rhd_dlog_write_frame(rhd_dlog_t *dlog, const rhd_frame_t *frame);
+int rhd_dlog_set_flags(rhd_dlog_t *dlog, uint32_t flags);
+int rhd_dlog_close(rhd_dlog_t *dlog);
+const char *rhd_dlog_ext(rhd_dlog_format_t format);
+int rhd_dlog_parse_format(const char *s, rhd_dlog_format_t *format);
+
+#endif
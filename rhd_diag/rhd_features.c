@@ -0,0 +1,245 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rhd_features.h"
+
+static size_t next_pow2(size_t n) {
+	size_t p = 1;
+	while (p < n) {
+		p <<= 1;
+	}
+	return p;
+}
+
+int rhd_feat_init(rhd_feat_t *feat, const rhd_feat_cfg_t *cfg, size_t n_chs) {
+	memset(feat, 0, sizeof(*feat));
+	if (cfg->window < 2 || cfg->window > RHD_FEAT_MAX_WINDOW || cfg->hop == 0 || n_chs == 0 || n_chs > RHD_NUM_CHS) {
+		printf("ERROR: rhd_feat: window must be 2-%d frames and hop nonzero\n", RHD_FEAT_MAX_WINDOW);
+		return -1;
+	}
+	feat->cfg = *cfg;
+	feat->n_chs = n_chs;
+
+	size_t n = cfg->window * n_chs;
+	feat->x = (int16_t*) calloc(n, sizeof(int16_t));
+	feat->d = (int32_t*) calloc(n, sizeof(int32_t));
+	feat->zc = (uint8_t*) calloc(n, 1);
+	feat->ssc = (uint8_t*) calloc(n, 1);
+	if (!feat->x || !feat->d || !feat->zc || !feat->ssc) {
+		rhd_feat_free(feat);
+		return -1;
+	}
+
+	if (cfg->spectral) {
+		feat->nfft = next_pow2(cfg->window);
+		feat->hann = (float*) malloc(cfg->window * sizeof(float));
+		feat->re = (float*) malloc(feat->nfft * sizeof(float));
+		feat->im = (float*) malloc(feat->nfft * sizeof(float));
+		feat->twr = (float*) malloc(feat->nfft / 2 * sizeof(float));
+		feat->twi = (float*) malloc(feat->nfft / 2 * sizeof(float));
+		if (!feat->hann || !feat->re || !feat->im || !feat->twr || !feat->twi) {
+			rhd_feat_free(feat);
+			return -1;
+		}
+		for (size_t i=0; i<cfg->window; ++i) {
+			feat->hann[i] = 0.5 - 0.5 * cos(2.0 * M_PI * i / (cfg->window - 1));
+		}
+		for (size_t k=0; k<feat->nfft/2; ++k) {
+			feat->twr[k] = cos(2.0 * M_PI * k / feat->nfft);
+			feat->twi[k] = -sin(2.0 * M_PI * k / feat->nfft);
+		}
+	}
+	return 0;
+}
+
+void rhd_feat_free(rhd_feat_t *feat) {
+	free(feat->x);
+	free(feat->d);
+	free(feat->zc);
+	free(feat->ssc);
+	free(feat->hann);
+	free(feat->re);
+	free(feat->im);
+	free(feat->twr);
+	free(feat->twi);
+	memset(feat, 0, sizeof(*feat));
+}
+
+// in-place iterative radix-2 complex FFT, n = feat->nfft
+static void fft(rhd_feat_t *feat, float *re, float *im) {
+	size_t n = feat->nfft;
+	for (size_t i=1, j=0; i<n; ++i) {
+		size_t bit = n >> 1;
+		for (; j & bit; bit >>= 1) {
+			j ^= bit;
+		}
+		j ^= bit;
+		if (i < j) {
+			float t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+	for (size_t len=2; len<=n; len<<=1) {
+		size_t step = n / len;
+		for (size_t i=0; i<n; i+=len) {
+			for (size_t k=0; k<len/2; ++k) {
+				float wr = feat->twr[k * step];
+				float wi = feat->twi[k * step];
+				size_t a = i + k;
+				size_t b = a + len/2;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+static void spectral_features(rhd_feat_t *feat, size_t ch, rhd_feat_vals_t *v) {
+	size_t w = feat->cfg.window;
+	size_t n = feat->nfft;
+	float mean;
+	double sum = 0;
+
+	// oldest sample is at feat->pos once the window is full
+	for (size_t i=0; i<w; ++i) {
+		sum += feat->x[((feat->pos + i) % w) * feat->n_chs + ch];
+	}
+	mean = sum / w;
+	for (size_t i=0; i<w; ++i) {
+		feat->re[i] = (feat->x[((feat->pos + i) % w) * feat->n_chs + ch] - mean) * feat->hann[i];
+		feat->im[i] = 0;
+	}
+	memset(feat->re + w, 0, (n - w) * sizeof(float));
+	memset(feat->im + w, 0, (n - w) * sizeof(float));
+	fft(feat, feat->re, feat->im);
+
+	// power spectrum into re[0..n/2], skipping DC
+	double total = 0;
+	double moment = 0;
+	double df = feat->cfg.srate / n;
+	for (size_t k=1; k<=n/2; ++k) {
+		double p = (double) feat->re[k] * feat->re[k] + (double) feat->im[k] * feat->im[k];
+		feat->re[k] = p;
+		total += p;
+		moment += p * k * df;
+	}
+	if (total <= 0) {
+		v->mnf = 0;
+		v->mdf = 0;
+		return;
+	}
+	v->mnf = moment / total;
+	double acc = 0;
+	size_t k = 1;
+	for (; k<=n/2; ++k) {
+		acc += feat->re[k];
+		if (acc >= total / 2) {
+			break;
+		}
+	}
+	v->mdf = k * df;
+}
+
+// adds one frame. returns 1 and fills vals[0..n_chs-1] when a hop completes
+// with a full window, 0 otherwise.
+int rhd_feat_push_frame(rhd_feat_t *feat, const int16_t *frame, rhd_feat_vals_t *vals) {
+	size_t w = feat->cfg.window;
+	size_t slot = feat->pos * feat->n_chs;
+	int full = feat->n_frames >= w;
+	int32_t thresh = feat->cfg.zc_thresh;
+
+	for (size_t ch=0; ch<feat->n_chs; ++ch) {
+		int32_t x = frame[ch];
+
+		// remove the frame leaving the window
+		if (full) {
+			int32_t old = feat->x[slot + ch];
+			feat->sum_sq[ch] -= old * old;
+			feat->sum_abs[ch] -= abs(old);
+			feat->sum_d[ch] -= feat->d[slot + ch];
+			feat->n_zc[ch] -= feat->zc[slot + ch];
+			feat->n_ssc[ch] -= feat->ssc[slot + ch];
+		}
+
+		int32_t d = 0;
+		uint8_t zc = 0;
+		uint8_t ssc = 0;
+		if (feat->n_frames >= 1) {
+			int32_t p = feat->prev[ch];
+			d = abs(x - p);
+			zc = ((x > 0 && p < 0) || (x < 0 && p > 0)) && d >= thresh;
+		}
+		if (feat->n_frames >= 2) {
+			int32_t p = feat->prev[ch];
+			int32_t pp = feat->prev2[ch];
+			ssc = ((p - pp) * (p - x) > 0) && (abs(p - pp) >= thresh || abs(p - x) >= thresh);
+		}
+
+		feat->x[slot + ch] = x;
+		feat->d[slot + ch] = d;
+		feat->zc[slot + ch] = zc;
+		feat->ssc[slot + ch] = ssc;
+		feat->sum_sq[ch] += x * x;
+		feat->sum_abs[ch] += abs(x);
+		feat->sum_d[ch] += d;
+		feat->n_zc[ch] += zc;
+		feat->n_ssc[ch] += ssc;
+		feat->prev2[ch] = feat->prev[ch];
+		feat->prev[ch] = x;
+	}
+
+	feat->pos = (feat->pos + 1) % w;
+	feat->n_frames++;
+	feat->since_emit++;
+	if (feat->n_frames < w || feat->since_emit < feat->cfg.hop) {
+		return 0;
+	}
+	feat->since_emit = 0;
+
+	for (size_t ch=0; ch<feat->n_chs; ++ch) {
+		rhd_feat_vals_t *v = &vals[ch];
+		v->rms = sqrt((double) feat->sum_sq[ch] / w);
+		v->mav = (double) feat->sum_abs[ch] / w;
+		v->wl = feat->sum_d[ch];
+		v->zc = feat->n_zc[ch];
+		v->ssc = feat->n_ssc[ch];
+		v->mnf = 0;
+		v->mdf = 0;
+		if (feat->cfg.spectral) {
+			spectral_features(feat, ch, v);
+		}
+	}
+	return 1;
+}
+
+// csv, one row per hop. parsed by format_rhdutil_feature_file in
+// postprocess/flexsemg_postprocess.py
+int rhd_feat_write_header(FILE *f, const rhd_feat_t *feat, uint16_t active_chs_msk) {
+	static const char *names[] = {"rms", "mav", "wl", "zc", "ssc", "mnf", "mdf"};
+	fprintf(f, "# active_chs_mask: %x\n", active_chs_msk);
+	fprintf(f, "# sample rate: %.0f Hz\n", feat->cfg.srate);
+	fprintf(f, "# window: %zu\n# hop: %zu\n", feat->cfg.window, feat->cfg.hop);
+	fprintf(f, "t_s");
+	for (int ch=0; ch<RHD_NUM_CHS; ++ch) {
+		if (!((0b1 << ch) & active_chs_msk)) {
+			continue;
+		}
+		for (size_t i=0; i<sizeof(names)/sizeof(names[0]); ++i) {
+			fprintf(f, ",ch%d_%s", ch, names[i]);
+		}
+	}
+	return (fprintf(f, "\n") < 0) ? -1 : 0;
+}
+
+int rhd_feat_write_row(FILE *f, const rhd_feat_t *feat, double t_s, const rhd_feat_vals_t *vals) {
+	fprintf(f, "%.6f", t_s);
+	for (size_t ch=0; ch<feat->n_chs; ++ch) {
+		const rhd_feat_vals_t *v = &vals[ch];
+		fprintf(f, ",%.2f,%.2f,%.0f,%.0f,%.0f,%.2f,%.2f", v->rms, v->mav, v->wl, v->zc, v->ssc, v->mnf, v->mdf);
+	}
+	return (fprintf(f, "\n") < 0) ? -1 : 0;
+}
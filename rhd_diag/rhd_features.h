@@ -0,0 +1,91 @@
+/*
+Streaming EMG feature extraction. Every hop frames, computes per channel
+features over the last window frames:
+* rms, mav: root mean square and mean absolute value (ADC LSB)
+* wl: waveform length, sum of |x[n] - x[n-1]| (ADC LSB)
+* zc, ssc: zero crossings and slope sign changes, both ignoring changes
+  smaller than zc_thresh LSB
+* mnf, mdf: mean and median frequency (Hz) of the Hann windowed power
+  spectrum
+
+Time-domain features are kept as running sums that are updated in O(1)
+per sample as samples enter and leave the window. Spectral features
+need a radix-2 FFT of the window (zero padded to a power of 2), which is
+only computed once per hop, so its cost is spread over hop samples.
+
+Usage:
+	rhd_feat_t feat;
+	rhd_feat_cfg_t cfg = {.window = 256, .hop = 128, .srate = srate, .zc_thresh = 10, .spectral = 1};
+	rhd_feat_init(&feat, &cfg, n_chs);
+	// per frame
+	if (rhd_feat_push_frame(&feat, frame, vals)) {
+		... vals[0..n_chs-1] hold features of the window ending at frame ...
+	}
+	rhd_feat_free(&feat);
+*/
+#ifndef RHD_FEATURES_H
+#define RHD_FEATURES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "rhd2216_lib.h"
+
+#define RHD_FEAT_MAX_WINDOW 8192
+
+typedef struct rhd_feat_cfg {
+	size_t window; // frames per window
+	size_t hop; // frames between feature vectors
+	double srate;
+	int16_t zc_thresh; // LSB
+	int spectral; // if nonzero compute mnf/mdf
+} rhd_feat_cfg_t;
+
+typedef struct rhd_feat_vals {
+	float rms;
+	float mav;
+	float wl;
+	float zc;
+	float ssc;
+	float mnf;
+	float mdf;
+} rhd_feat_vals_t;
+
+typedef struct rhd_feat {
+	rhd_feat_cfg_t cfg;
+	size_t n_chs;
+	size_t pos; // ring slot the next frame goes into
+	uint64_t n_frames; // frames pushed so far
+	size_t since_emit; // frames since last feature vector
+
+	// rings of window frames, [slot * n_chs + ch]
+	int16_t *x;
+	int32_t *d; // |x[n] - x[n-1]| that entered with this slot
+	uint8_t *zc; // zero crossing between previous slot and this one
+	uint8_t *ssc; // slope sign change at the previous slot
+
+	// running sums over the window, per channel
+	int64_t sum_sq[RHD_NUM_CHS];
+	int64_t sum_abs[RHD_NUM_CHS];
+	int64_t sum_d[RHD_NUM_CHS];
+	int32_t n_zc[RHD_NUM_CHS];
+	int32_t n_ssc[RHD_NUM_CHS];
+	int16_t prev[RHD_NUM_CHS];
+	int16_t prev2[RHD_NUM_CHS];
+
+	// spectral scratch
+	size_t nfft;
+	float *hann;
+	float *re;
+	float *im;
+	float *twr; // twiddles, nfft/2
+	float *twi;
+} rhd_feat_t;
+
+int rhd_feat_init(rhd_feat_t *feat, const rhd_feat_cfg_t *cfg, size_t n_chs);
+void rhd_feat_free(rhd_feat_t *feat);
+int rhd_feat_push_frame(rhd_feat_t *feat, const int16_t *frame, rhd_feat_vals_t *vals);
+int rhd_feat_write_header(FILE *f, const rhd_feat_t *feat, uint16_t active_chs_msk);
+int rhd_feat_write_row(FILE *f, const rhd_feat_t *feat, double t_s, const rhd_feat_vals_t *vals);
+
+#endif
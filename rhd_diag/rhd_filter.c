@@ -0,0 +1,154 @@
+#include <math.h>
+#include <string.h>
+#include "rhd_filter.h"
+
+void rhd_filter_init(rhd_filter_t *filt, size_t n_chs) {
+	memset(filt, 0, sizeof(*filt));
+	filt->n_chs = (n_chs > RHD_NUM_CHS) ? RHD_NUM_CHS : n_chs;
+}
+
+void rhd_filter_reset(rhd_filter_t *filt) {
+	memset(filt->z1, 0, sizeof(filt->z1));
+	memset(filt->z2, 0, sizeof(filt->z2));
+}
+
+int rhd_filter_add_section(rhd_filter_t *filt, const rhd_biquad_coef_t *coef) {
+	if (filt->n_sections >= RHD_FILTER_MAX_SECTIONS) {
+		printf("ERROR: rhd_filter: more than %d biquad sections\n", RHD_FILTER_MAX_SECTIONS);
+		return -1;
+	}
+	filt->coef[filt->n_sections++] = *coef;
+	return 0;
+}
+
+// Q of each second order section of an order-N Butterworth filter
+static double butter_q(int order, int k) {
+	return 1.0 / (2.0 * cos(M_PI * (2 * k + 1) / (2.0 * order)));
+}
+
+// RBJ audio EQ cookbook low/high-pass, plus a first order section (via
+// bilinear transform) for odd orders. highpass selects the type.
+static int add_butter(rhd_filter_t *filt, double srate, double fc, int order, int highpass) {
+	if (order < 1 || fc <= 0 || fc >= srate / 2) {
+		printf("ERROR: rhd_filter: cutoff %.1f Hz must be in (0, %.1f) Hz\n", fc, srate / 2);
+		return -1;
+	}
+
+	double w0 = 2.0 * M_PI * fc / srate;
+	double cw = cos(w0);
+	double sw = sin(w0);
+	for (int k=0; k<order/2; ++k) {
+		double alpha = sw / (2.0 * butter_q(order, k));
+		double a0 = 1.0 + alpha;
+		double b = highpass ? (1.0 + cw) / 2.0 : (1.0 - cw) / 2.0;
+		rhd_biquad_coef_t c = {
+			.b0 = b / a0,
+			.b1 = (highpass ? -2.0 * b : 2.0 * b) / a0,
+			.b2 = b / a0,
+			.a1 = -2.0 * cw / a0,
+			.a2 = (1.0 - alpha) / a0,
+		};
+		if (rhd_filter_add_section(filt, &c) == -1) {
+			return -1;
+		}
+	}
+
+	if (order % 2) {
+		double K = tan(w0 / 2.0);
+		double b = highpass ? 1.0 / (1.0 + K) : K / (1.0 + K);
+		rhd_biquad_coef_t c = {
+			.b0 = b,
+			.b1 = highpass ? -b : b,
+			.b2 = 0,
+			.a1 = (K - 1.0) / (K + 1.0),
+			.a2 = 0,
+		};
+		return rhd_filter_add_section(filt, &c);
+	}
+	return 0;
+}
+
+int rhd_filter_add_lowpass(rhd_filter_t *filt, double srate, double fc, int order) {
+	return add_butter(filt, srate, fc, order, 0);
+}
+
+int rhd_filter_add_highpass(rhd_filter_t *filt, double srate, double fc, int order) {
+	return add_butter(filt, srate, fc, order, 1);
+}
+
+// order-N Butterworth high-pass at lo cascaded with order-N low-pass at hi
+int rhd_filter_add_bandpass(rhd_filter_t *filt, double srate, double lo, double hi, int order) {
+	if (lo >= hi) {
+		printf("ERROR: rhd_filter: bandpass lo %.1f Hz must be below hi %.1f Hz\n", lo, hi);
+		return -1;
+	}
+	if (rhd_filter_add_highpass(filt, srate, lo, order) == -1) {
+		return -1;
+	}
+	return rhd_filter_add_lowpass(filt, srate, hi, order);
+}
+
+// notch at f0 and its first n_harmonics - 1 harmonics below nyquist
+int rhd_filter_add_notch(rhd_filter_t *filt, double srate, double f0, double q, int n_harmonics) {
+	for (int h=1; h<=n_harmonics; ++h) {
+		double f = f0 * h;
+		if (f >= srate / 2) {
+			break;
+		}
+		double w0 = 2.0 * M_PI * f / srate;
+		double alpha = sin(w0) / (2.0 * q);
+		double a0 = 1.0 + alpha;
+		rhd_biquad_coef_t c = {
+			.b0 = 1.0 / a0,
+			.b1 = -2.0 * cos(w0) / a0,
+			.b2 = 1.0 / a0,
+			.a1 = -2.0 * cos(w0) / a0,
+			.a2 = (1.0 - alpha) / a0,
+		};
+		if (rhd_filter_add_section(filt, &c) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// runs one frame through every section, all channels in parallel.
+// lanes past n_chs carry zeros and are never written out.
+void rhd_filter_process_frame(rhd_filter_t *filt, const int16_t *in, int16_t *out) {
+	rhd_v4f x[RHD_FILTER_NUM_VECS];
+	float *xf = (float*) x;
+
+	memset(x, 0, sizeof(x));
+	for (size_t ch=0; ch<filt->n_chs; ++ch) {
+		xf[ch] = in[ch];
+	}
+
+	for (size_t s=0; s<filt->n_sections; ++s) {
+		const rhd_biquad_coef_t *c = &filt->coef[s];
+		rhd_v4f *z1 = filt->z1[s];
+		rhd_v4f *z2 = filt->z2[s];
+		for (int v=0; v<RHD_FILTER_NUM_VECS; ++v) {
+			rhd_v4f y = c->b0 * x[v] + z1[v];
+			z1[v] = c->b1 * x[v] - c->a1 * y + z2[v];
+			z2[v] = c->b2 * x[v] - c->a2 * y;
+			x[v] = y;
+		}
+	}
+
+	for (size_t ch=0; ch<filt->n_chs; ++ch) {
+		float y = xf[ch];
+		if (y > INT16_MAX) {
+			y = INT16_MAX;
+		} else if (y < INT16_MIN) {
+			y = INT16_MIN;
+		}
+		out[ch] = (int16_t) lrintf(y);
+	}
+}
+
+// in and out are n_frames interleaved frames of n_chs samples, may alias
+void rhd_filter_process_block(rhd_filter_t *filt, const int16_t *in, int16_t *out, size_t n_frames) {
+	for (size_t i=0; i<n_frames; ++i) {
+		rhd_filter_process_frame(filt, in + i * filt->n_chs, out + i * filt->n_chs);
+	}
+}
@@ -0,0 +1,58 @@
+/*
+Streaming IIR filter bank applied to every active channel as frames
+arrive: Butterworth high/low/band-pass and mains notch + harmonics,
+built as a cascade of biquad sections.
+
+Samples go in and out as int16 ADC codes. Section state is kept in a
+structure-of-arrays layout, one float lane per channel
+(z1[section][ch]), so each biquad section runs over all 16 channels at
+once with 4-wide float vectors (NEON on the pi, SSE on x86) instead of
+looping per channel.
+
+Usage:
+	rhd_filter_t filt;
+	rhd_filter_init(&filt, n_chs);
+	rhd_filter_add_bandpass(&filt, srate, 20, 450, 4);
+	rhd_filter_add_notch(&filt, srate, 60, RHD_FILTER_NOTCH_Q, 3);
+	// per frame
+	rhd_filter_process_frame(&filt, in, out);
+*/
+#ifndef RHD_FILTER_H
+#define RHD_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rhd2216_lib.h"
+
+#define RHD_FILTER_MAX_SECTIONS 16
+#define RHD_FILTER_VEC_LANES 4
+#define RHD_FILTER_NUM_VECS (RHD_NUM_CHS / RHD_FILTER_VEC_LANES)
+#define RHD_FILTER_NOTCH_Q 30.0
+
+typedef float rhd_v4f __attribute__((vector_size(16)));
+
+// normalized so a0 = 1. transposed direct form II:
+// y = b0*x + z1; z1 = b1*x - a1*y + z2; z2 = b2*x - a2*y
+typedef struct rhd_biquad_coef {
+	float b0, b1, b2, a1, a2;
+} rhd_biquad_coef_t;
+
+typedef struct rhd_filter {
+	size_t n_chs;
+	size_t n_sections;
+	rhd_biquad_coef_t coef[RHD_FILTER_MAX_SECTIONS];
+	rhd_v4f z1[RHD_FILTER_MAX_SECTIONS][RHD_FILTER_NUM_VECS];
+	rhd_v4f z2[RHD_FILTER_MAX_SECTIONS][RHD_FILTER_NUM_VECS];
+} rhd_filter_t;
+
+void rhd_filter_init(rhd_filter_t *filt, size_t n_chs);
+void rhd_filter_reset(rhd_filter_t *filt);
+int rhd_filter_add_section(rhd_filter_t *filt, const rhd_biquad_coef_t *coef);
+int rhd_filter_add_lowpass(rhd_filter_t *filt, double srate, double fc, int order);
+int rhd_filter_add_highpass(rhd_filter_t *filt, double srate, double fc, int order);
+int rhd_filter_add_bandpass(rhd_filter_t *filt, double srate, double lo, double hi, int order);
+int rhd_filter_add_notch(rhd_filter_t *filt, double srate, double f0, double q, int n_harmonics);
+void rhd_filter_process_frame(rhd_filter_t *filt, const int16_t *in, int16_t *out);
+void rhd_filter_process_block(rhd_filter_t *filt, const int16_t *in, int16_t *out, size_t n_frames);
+
+#endif
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <string.h>
+#include "rhd_link.h"
+#include "rhd_spi_table.h"
+
+#define LEARNED (-1) // read at start, differs between chips
+
+static const uint8_t rom_regs[RHD_LINK_N_ROM] = { 40, 41, 42, 43, 44, 60, 61, 62, 63 };
+static const int rom_vals[RHD_LINK_N_ROM] = {
+	'I', 'N', 'T', 'A', 'N',
+	LEARNED, // die revision
+	0, // bipolar amplifiers
+	RHD_NUM_CHS, // number of amplifiers
+	2, // chip id, RHD2216
+};
+
+static int rom_index(uint8_t reg_num) {
+	for (int i=0; i<RHD_LINK_N_ROM; ++i) {
+		if (rom_regs[i] == reg_num) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static const rhd_spi_table_row_t *table_row(const rhd_spi_table_t *table, uint32_t speed) {
+	for (size_t s=0; s<table->n_speeds; ++s) {
+		if (table->row[s].speed == speed) {
+			return &table->row[s];
+		}
+	}
+	return NULL;
+}
+
+// next slower clock of rhd_spi_table_speeds, skipping those dev->spi_table
+// found bad or (once attached) too slow for srate. 0 if there is none.
+static uint32_t next_speed(const rhd_link_t *link, uint32_t speed) {
+	const rhd_spi_table_t *table = link->dev->spi_table;
+	for (size_t s=rhd_spi_table_n_speeds; s-- > 0; ) {
+		uint32_t cand = rhd_spi_table_speeds[s];
+		const rhd_spi_table_row_t *row = table ? table_row(table, cand) : NULL;
+		if (cand >= speed || cand < RHD_LINK_MIN_SPEED) {
+			continue;
+		}
+		if (row && !row->link_ok) {
+			continue;
+		}
+		if (row && link->srate && link->words_per_frame <= RHD_SPI_TABLE_MAX_WORDS) {
+			double sec = (link->dev->burst_frames > 1) ? row->burst_frame_sec[link->words_per_frame] : row->frame_sec[link->words_per_frame];
+			if (sec > 1.0 / link->srate) {
+				continue;
+			}
+		}
+		return cand;
+	}
+	return 0;
+}
+
+// returns -1 if there is no slower clock to go to
+static int step_down(rhd_link_t *link, uint64_t frame, const char *why) {
+	rhd_dev_t *dev = link->dev;
+	uint32_t from = dev->spi.speed;
+	uint32_t to = next_speed(link, from);
+
+	if (to == 0) {
+		if (!link->floor_warned) {
+			printf("WARNING: link: %s still corrupt at %.1f MHz and no slower clock to go to\n", dev->name, from / 1e6);
+			link->floor_warned = 1;
+		}
+		return -1;
+	}
+	if (rhd_spi_config(&dev->spi, dev->spi.mode, dev->spi.bpw, to) == -1) {
+		return -1;
+	}
+	if (link->n_steps < RHD_LINK_MAX_STEPS) {
+		link->steps[link->n_steps].frame = frame;
+		link->steps[link->n_steps].from = from;
+		link->steps[link->n_steps].to = dev->spi.speed;
+	}
+	link->n_steps++;
+	printf("WARNING: link: %s SPI clock %.1f -> %.1f MHz, %s\n", dev->name, from / 1e6, dev->spi.speed / 1e6, why);
+	return 0;
+}
+
+// RHD_LINK_START_READS reads of each ROM register, learning the die
+// revision from the first. returns -1 on the first bad one.
+static int check_rom(rhd_link_t *link) {
+	for (int i=0; i<RHD_LINK_N_ROM; ++i) {
+		for (int n=0; n<RHD_LINK_START_READS; ++n) {
+			uint8_t val;
+			if (rhd_reg_read(link->dev, rom_regs[i], &val) == -1) {
+				return -1;
+			}
+			if (n == 0 && rom_vals[i] == LEARNED) {
+				link->expect[i] = val;
+			}
+			if (val != link->expect[i]) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+// checks the ROM at dev's current clock, stepping down until it reads
+// back right. call before the chip is configured.
+int rhd_link_start(rhd_link_t *link, rhd_dev_t *dev, uint32_t max_errs) {
+	memset(link, 0, sizeof(*link));
+	if (max_errs == 0 || max_errs > RHD_LINK_MAX_ERRS) {
+		return -1;
+	}
+	link->dev = dev;
+	link->max_errs = max_errs;
+	for (int i=0; i<RHD_LINK_N_ROM; ++i) {
+		link->expect[i] = (uint8_t) rom_vals[i];
+	}
+	while (check_rom(link) == -1) {
+		if (step_down(link, 0, "ROM read back wrong at start") == -1) {
+			printf("ERROR: link: %s no SPI clock down to %.1f MHz reads the ROM back right\n", dev->name, RHD_LINK_MIN_SPEED / 1e6);
+			return -1;
+		}
+	}
+	link->n_steps = 0;
+	link->floor_warned = 0;
+	link->start_speed = dev->spi.speed;
+	printf("INFO: link: %s ROM reads back right at %.1f MHz (die revision %u)\n", dev->name, dev->spi.speed / 1e6, link->expect[5]);
+	return 0;
+}
+
+// runs in the acquisition thread for every ROM read
+static void rom_cb(const rhd_aux_cmd_t *cmd, uint16_t result, uint64_t frame, void *arg) {
+	rhd_link_t *link = (rhd_link_t*) arg;
+	int i = rom_index(cmd->tx[0] & 0x3f);
+
+	if (i < 0) {
+		return;
+	}
+	link->n_checks++;
+	if (result == link->expect[i]) {
+		link->good_to = frame + 1;
+		return;
+	}
+
+	// frames since the last good read may have been hit too
+	uint64_t from = (link->good_to > link->counted_to) ? link->good_to : link->counted_to;
+	if (frame + 1 > from) {
+		link->n_suspect += frame + 1 - from;
+		link->counted_to = frame + 1;
+	}
+	link->n_bad++;
+	if (frame < link->holdoff_frame) {
+		return;
+	}
+
+	// step down on max_errs bad reads within window_frames
+	link->err_frames[link->err_head] = frame;
+	link->err_head = (link->err_head + 1) % link->max_errs;
+	if (link->n_err < link->max_errs) {
+		link->n_err++;
+	}
+	if (link->n_err == link->max_errs && frame - link->err_frames[link->err_head] < link->window_frames) {
+		link->n_err = 0;
+		link->err_head = 0;
+		if (step_down(link, frame, "ROM read back wrong during acquisition") == 0) {
+			link->holdoff_frame = frame + RHD_ACQ_HIST;
+		}
+	}
+}
+
+// makes the ROM reads the filler of sched. words_per_frame and srate are
+// the acquisition's, so no clock too slow for it is stepped down to.
+int rhd_link_attach(rhd_link_t *link, rhd_aux_sched_t *sched, size_t words_per_frame, uint16_t srate) {
+	for (int i=0; i<RHD_LINK_N_ROM; ++i) {
+		link->rom_cmds[i] = rhd_aux_cmd_read(rom_regs[i], rom_cb, link);
+	}
+	link->words_per_frame = words_per_frame;
+	link->srate = srate;
+	link->window_frames = (uint64_t) (RHD_LINK_WINDOW_S * srate);
+	if (link->window_frames == 0) {
+		link->window_frames = 1;
+	}
+	return rhd_aux_set_idle(sched, link->rom_cmds, RHD_LINK_N_ROM);
+}
+
+void rhd_link_report(const rhd_link_t *link) {
+	printf("INFO: link: %s %llu ROM checks, %llu bad, %llu frames suspect, SPI clock %.1f MHz (started at %.1f)\n",
+		link->dev->name,
+		(unsigned long long) link->n_checks,
+		(unsigned long long) link->n_bad,
+		(unsigned long long) link->n_suspect,
+		link->dev->spi.speed / 1e6,
+		link->start_speed / 1e6);
+	for (size_t s=0; s<link->n_steps && s<RHD_LINK_MAX_STEPS; ++s) {
+		printf("INFO: link: %s stepped down %.1f -> %.1f MHz at frame %llu\n",
+			link->dev->name,
+			link->steps[s].from / 1e6,
+			link->steps[s].to / 1e6,
+			(unsigned long long) link->steps[s].frame);
+	}
+}
@@ -0,0 +1,88 @@
+/*
+SPI link integrity checks for high SPI clocks (--link_check).
+
+The RHD2216 takes up to 25 MHz, but whether a given cable and pi carry
+it is another matter, and a flipped MISO bit in an amplifier sample
+looks like any other EMG. The ROM registers read back known values (40-44
+"INTAN", 61-63 amplifier type, count and chip id; 60, the die revision,
+is learned at start), so reading them back is a check of the link that
+costs no sample gaps:
+
+* rhd_link_start reads each ROM register RHD_LINK_START_READS times at
+  the current clock, and steps the clock down until they all read back
+  right, before the chip is configured at a clock that garbles it.
+* rhd_link_attach makes the ROM reads the filler of the aux scheduler
+  (rhd_aux_set_idle), so every aux slot not needed for anything else
+  (--health, rhd_aux_submit) checks one register, i.e. with one slot per
+  frame about every frame.
+* a read that doesn't match marks the frames since the last good one
+  suspect. after max_errs bad reads within RHD_LINK_WINDOW_S the clock
+  is stepped down to the next rhd_spi_table_speeds entry, mid-run, from
+  the acquisition thread. with dev->spi_table, clocks it found bad or
+  too slow for srate are skipped. it never goes below RHD_LINK_MIN_SPEED.
+  errors of frames already in flight at the old clock don't count
+  against the new one.
+
+Usage:
+	rhd_link_t link;
+	rhd_aux_sched_t aux;
+	rhd_dev_open(dev, device, 0, 8, RHD_MAX_SPI_RATE_HZ);
+	rhd_link_start(&link, dev, 3);
+	... config, calibrate ...
+	rhd_aux_init(&aux, 1);
+	rhd_link_attach(&link, &aux, n_chs + 1, srate);
+	dev->aux = &aux;
+	rhd_convert_stream(dev, ...); // or rhd_stream_run, rhd_multi_run
+	dev->aux = NULL;
+	rhd_link_report(&link);
+*/
+#ifndef RHD_LINK_H
+#define RHD_LINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rhd2216_lib.h"
+
+#define RHD_LINK_N_ROM 9 // regs 40-44, 60-63
+#define RHD_LINK_DEFAULT_MAX_ERRS 3
+#define RHD_LINK_MAX_ERRS 16
+#define RHD_LINK_WINDOW_S 1.0
+#define RHD_LINK_MIN_SPEED 8000000 // what this tool ran at before
+#define RHD_LINK_START_READS 20 // per ROM register per clock
+#define RHD_LINK_MAX_STEPS 8
+
+typedef struct rhd_link_step {
+	uint64_t frame; // frame whose bad read triggered it
+	uint32_t from;
+	uint32_t to;
+} rhd_link_step_t;
+
+typedef struct rhd_link {
+	rhd_dev_t *dev;
+	uint32_t max_errs;
+	uint64_t window_frames;
+	size_t words_per_frame; // to look clocks up in dev->spi_table
+	uint16_t srate;
+	uint32_t start_speed;
+	rhd_aux_cmd_t rom_cmds[RHD_LINK_N_ROM];
+	uint8_t expect[RHD_LINK_N_ROM];
+
+	uint64_t n_checks;
+	uint64_t n_bad;
+	uint64_t n_suspect; // frames between a bad read and the good one before it
+	uint64_t good_to; // frames before this are vouched for by a good read
+	uint64_t counted_to; // suspect frames counted up to, excluding
+	uint64_t err_frames[RHD_LINK_MAX_ERRS]; // ring of recent bad reads
+	size_t err_head;
+	size_t n_err;
+	uint64_t holdoff_frame; // bad reads before this were clocked at the old speed
+	rhd_link_step_t steps[RHD_LINK_MAX_STEPS];
+	size_t n_steps;
+	int floor_warned;
+} rhd_link_t;
+
+int rhd_link_start(rhd_link_t *link, rhd_dev_t *dev, uint32_t max_errs);
+int rhd_link_attach(rhd_link_t *link, rhd_aux_sched_t *sched, size_t words_per_frame, uint16_t srate);
+void rhd_link_report(const rhd_link_t *link);
+
+#endif
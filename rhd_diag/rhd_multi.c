@@ -0,0 +1,377 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include "rhd_multi.h"
+#include "rhd_stats.h"
+
+typedef struct multi_ctx multi_ctx_t;
+
+typedef struct bus_ctx {
+	multi_ctx_t *m;
+	int bus; // spidev bus number, -1 for non-spidev devices
+	int cpu;
+	size_t n_devs;
+	size_t dev_idx[RHD_MULTI_MAX_DEVS]; // into cfg->devs
+	double frame_sec; // all chips on the bus, from rhd_acq_probe
+	rhd_pacer_t pacer;
+	pthread_t tid;
+} bus_ctx_t;
+
+struct multi_ctx {
+	const rhd_multi_cfg_t *cfg;
+	volatile sig_atomic_t *stop;
+	uint16_t srate;
+	uint64_t n_frames; // per chip, 0 = until *stop
+	int64_t start_ns; // shared first deadline
+	rhd_acq_t acq[RHD_MULTI_MAX_DEVS];
+	rhd_ring_t ring[RHD_MULTI_MAX_DEVS];
+	bus_ctx_t bus[RHD_MULTI_MAX_DEVS];
+	size_t n_buses;
+	atomic_int n_buses_done;
+	atomic_int abort; // a bus thread could not be started
+	rhd_dlog_t dlog;
+	rhd_net_t net;
+	int serving;
+	rhd_shm_t shm;
+	size_t max_ring_fill;
+	uint64_t n_written;
+	uint64_t n_unaligned; // frames dropped because another chip lost them
+	int write_err;
+};
+
+// bus number of a /dev/spidevB.C path, or -1 if device is not spidev
+// (e.g. "sim"), in which case it gets a bus to itself.
+int rhd_multi_bus_of(const char *device) {
+	int bus;
+	int cs;
+	if (sscanf(device, "/dev/spidev%d.%d", &bus, &cs) != 2) {
+		return -1;
+	}
+	return bus;
+}
+
+static int push_frame_cb(const rhd_frame_t *frame, size_t n_chs, void *arg) {
+	(void) n_chs;
+	rhd_ring_push((rhd_ring_t*) arg, frame);
+	return 0;
+}
+
+// highest cores first, core 0 usually takes most interrupts
+static void pin_to_cpu(bus_ctx_t *b) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(b->cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		printf("WARNING: multi: could not pin bus %d thread to cpu %d\n", b->bus, b->cpu);
+	}
+}
+
+static void *bus_thread(void *arg) {
+	bus_ctx_t *b = (bus_ctx_t*) arg;
+	multi_ctx_t *m = b->m;
+	const rhd_rt_cfg_t *rt = m->cfg->devs[b->dev_idx[0]]->rt;
+	rhd_rt_state_t rt_state;
+	char who[32];
+
+	// with --realtime the bus keeps the core assign_buses gave it, one
+	// per bus, rather than rt->cpu
+	if (rt) {
+		snprintf(who, sizeof(who), "bus %d", b->bus);
+		rhd_rt_enter(&rt_state, rt, b->cpu, who);
+	} else {
+		pin_to_cpu(b);
+	}
+	rhd_pacer_init(&b->pacer, m->srate, m->cfg->devs[b->dev_idx[0]]->pacer_spin_ns);
+	rhd_pacer_start_at(&b->pacer, m->start_ns);
+	for (uint64_t f=0; !(m->n_frames && f >= m->n_frames) && !(m->stop && *m->stop) && !atomic_load(&m->abort); ++f) {
+		rhd_pacer_wait(&b->pacer);
+		for (size_t i=0; i<b->n_devs; ++i) {
+			rhd_acq_frame(&m->acq[b->dev_idx[i]], b->pacer.last_ns);
+		}
+		rhd_pacer_frame_done(&b->pacer);
+		for (size_t i=0; i<b->n_devs; ++i) {
+			rhd_dev_t *dev = m->cfg->devs[b->dev_idx[i]];
+			if (dev->stats) {
+				rhd_stats_frame(dev->stats, &b->pacer, 1);
+			}
+		}
+	}
+	for (size_t i=0; i<b->n_devs; ++i) {
+		rhd_acq_finish(&m->acq[b->dev_idx[i]]);
+	}
+	if (rt) {
+		rhd_rt_exit(&rt_state);
+	}
+	atomic_fetch_add(&m->n_buses_done, 1);
+	return NULL;
+}
+
+static void *merge_thread(void *arg) {
+	multi_ctx_t *m = (multi_ctx_t*) arg;
+	size_t n_devs = m->cfg->n_devs;
+	size_t n_chs = m->acq[0].plan.n_chs;
+	rhd_frame_t pending[RHD_MULTI_MAX_DEVS];
+	int have[RHD_MULTI_MAX_DEVS] = {0};
+	uint16_t merged[RHD_MULTI_MAX_DEVS * RHD_NUM_CHS];
+
+	while (1) {
+		int all = 1;
+		for (size_t i=0; i<n_devs; ++i) {
+			size_t fill = rhd_ring_count(&m->ring[i]);
+			if (fill > m->max_ring_fill) {
+				m->max_ring_fill = fill;
+			}
+			if (!have[i]) {
+				have[i] = (rhd_ring_pop(&m->ring[i], &pending[i]) == 0);
+			}
+			all &= have[i];
+		}
+
+		if (all) {
+			uint64_t seq = 0;
+			int aligned = 1;
+			for (size_t i=0; i<n_devs; ++i) {
+				if (pending[i].seq > seq) {
+					seq = pending[i].seq;
+				}
+			}
+			// a chip behind the newest seq lost frames to overflow, throw
+			// away what the others have until they agree again
+			for (size_t i=0; i<n_devs; ++i) {
+				if (pending[i].seq < seq) {
+					have[i] = 0;
+					m->n_unaligned++;
+					aligned = 0;
+				}
+			}
+			if (!aligned) {
+				continue;
+			}
+			for (size_t i=0; i<n_devs; ++i) {
+				memcpy(merged + i * n_chs, pending[i].data, n_chs * sizeof(uint16_t));
+				have[i] = 0;
+			}
+			if (!m->write_err) {
+				if (rhd_dlog_write_samples(&m->dlog, merged, n_devs * n_chs) == -1) {
+					printf("ERROR: multi: write to %s failed, dropping remaining frames\n", m->cfg->fname);
+					m->write_err = 1;
+				} else {
+					m->n_written++;
+				}
+			}
+			if (m->shm.hdr) {
+				rhd_shm_publish(&m->shm, seq, pending[0].t_ns, merged);
+			}
+			if (m->serving) {
+				rhd_net_publish(&m->net, seq, pending[0].t_ns, merged);
+			}
+			continue;
+		}
+
+		// once every bus is done, a chip with nothing pending and an empty
+		// ring means no more complete frames can arrive
+		if (atomic_load(&m->n_buses_done) == (int) m->n_buses) {
+			int starved = 0;
+			for (size_t i=0; i<n_devs; ++i) {
+				if (!have[i] && rhd_ring_count(&m->ring[i]) == 0) {
+					starved = 1;
+				}
+			}
+			if (starved) {
+				break;
+			}
+		}
+		if (m->serving) {
+			rhd_net_service(&m->net);
+		}
+		usleep(RHD_STREAM_WRITER_POLL_US);
+	}
+	return NULL;
+}
+
+// groups cfg->devs into buses and gives each bus thread a core
+static void assign_buses(multi_ctx_t *m) {
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_cpus < 1) {
+		n_cpus = 1;
+	}
+	for (size_t i=0; i<m->cfg->n_devs; ++i) {
+		int bus = rhd_multi_bus_of(m->cfg->devs[i]->name);
+		bus_ctx_t *b = NULL;
+		for (size_t k=0; bus != -1 && k<m->n_buses; ++k) {
+			if (m->bus[k].bus == bus) {
+				b = &m->bus[k];
+			}
+		}
+		if (!b) {
+			b = &m->bus[m->n_buses];
+			b->m = m;
+			b->bus = bus;
+			b->cpu = (n_cpus - 1 - m->n_buses) % n_cpus;
+			if (b->cpu < 0) {
+				b->cpu += n_cpus;
+			}
+			m->n_buses++;
+		}
+		b->dev_idx[b->n_devs++] = i;
+	}
+}
+
+// probes every chip and lowers srate to what the slowest bus can keep up
+// with, see get_max_srate in rhd2216_lib.c.
+static void check_srate(multi_ctx_t *m) {
+	double max_srate = 0;
+	for (size_t k=0; k<m->n_buses; ++k) {
+		bus_ctx_t *b = &m->bus[k];
+		for (size_t i=0; i<b->n_devs; ++i) {
+			uint16_t dev_max;
+			rhd_acq_probe(&m->acq[b->dev_idx[i]], m->srate, &dev_max);
+			b->frame_sec += 1.0 / dev_max;
+		}
+		if (max_srate == 0 || 1.0 / b->frame_sec < max_srate) {
+			max_srate = 1.0 / b->frame_sec;
+		}
+		printf("INFO: multi: bus %d, %zu chips, cpu %d, %.2f us per frame\n", b->bus, b->n_devs, b->cpu, b->frame_sec * 1e6);
+	}
+	if (m->srate > max_srate) {
+		printf(
+			"WARNING: desired srate %.2e Hz greater than max possible srate %.2e Hz. Using max srate.\n",
+			(double) m->srate,
+			max_srate
+		);
+		m->srate = (uint16_t) max_srate;
+	}
+}
+
+// records cfg->n_devs chips into one datalog until duration_s elapses or
+// *stop is set. chips must already be configured (and calibrated).
+int rhd_multi_run(const rhd_multi_cfg_t *cfg, volatile sig_atomic_t *stop, rhd_stream_result_t *result) {
+	multi_ctx_t *m;
+	pthread_t merge_tid;
+	uint64_t chs_msk = 0;
+	size_t n_chs = cfg->n_devs * __builtin_popcount(cfg->active_chs_msk);
+	size_t n_init = 0;
+	int ret;
+
+	if (cfg->n_devs == 0 || cfg->n_devs > RHD_MULTI_MAX_DEVS || cfg->active_chs_msk == 0) {
+		return -1;
+	}
+	// ~1 KB of state plus rings, keep it off the caller's stack
+	m = (multi_ctx_t*) calloc(1, sizeof(multi_ctx_t));
+	if (!m) {
+		return -1;
+	}
+	m->cfg = cfg;
+	m->stop = stop;
+	m->srate = cfg->srate;
+	atomic_init(&m->n_buses_done, 0);
+	atomic_init(&m->abort, 0);
+
+	for (n_init=0; n_init<cfg->n_devs; ++n_init) {
+		if (rhd_ring_init(&m->ring[n_init], cfg->ring_frames ? cfg->ring_frames : RHD_RING_DEFAULT_FRAMES) == -1) {
+			break;
+		}
+		if (rhd_acq_init(&m->acq[n_init], cfg->devs[n_init], cfg->active_chs_msk, push_frame_cb, &m->ring[n_init]) == -1) {
+			rhd_ring_free(&m->ring[n_init]);
+			break;
+		}
+		if (cfg->devs[n_init]->rt) {
+			rhd_rt_prefault(m->ring[n_init].slots, (m->ring[n_init].mask + 1) * sizeof(rhd_frame_t));
+		}
+		chs_msk |= (uint64_t) cfg->active_chs_msk << (RHD_NUM_CHS * n_init);
+	}
+	if (n_init < cfg->n_devs) {
+		printf("ERROR: multi: could not set up acquisition for %s\n", cfg->devs[n_init]->name);
+		ret = -1;
+		goto out;
+	}
+
+	assign_buses(m);
+	check_srate(m);
+	m->n_frames = (uint64_t) (cfg->duration_s * m->srate);
+
+	if (rhd_dlog_open_io(&m->dlog, cfg->fname, cfg->format, chs_msk, m->srate, cfg->spi_speed, cfg->io, m->n_frames) == -1) {
+		printf("ERROR: multi: could not open %s\n", cfg->fname);
+		ret = -1;
+		goto out;
+	}
+	if (cfg->serve_addr) {
+		if (rhd_net_open(&m->net, cfg->serve_addr, n_chs, chs_msk, m->srate, 0) == -1) {
+			printf("ERROR: multi: could not serve on %s\n", cfg->serve_addr);
+			rhd_dlog_close(&m->dlog);
+			ret = -1;
+			goto out;
+		}
+		m->serving = 1;
+	}
+	if (cfg->shm_name && rhd_shm_create(&m->shm, cfg->shm_name, RHD_SHM_DEFAULT_SLOTS, n_chs, chs_msk, m->srate, 0) == -1) {
+		if (m->serving) {
+			rhd_net_close(&m->net);
+		}
+		rhd_dlog_close(&m->dlog);
+		ret = -1;
+		goto out;
+	}
+
+	if (pthread_create(&merge_tid, NULL, merge_thread, m) != 0) {
+		printf("ERROR: multi: could not start the merge thread\n");
+		rhd_shm_close(&m->shm);
+		if (m->serving) {
+			rhd_net_close(&m->net);
+		}
+		rhd_dlog_close(&m->dlog);
+		ret = -1;
+		goto out;
+	}
+	m->start_ns = rhd_now_ns() + RHD_MULTI_START_DELAY_NS;
+	size_t n_started = 0;
+	for (; n_started<m->n_buses; ++n_started) {
+		if (pthread_create(&m->bus[n_started].tid, NULL, bus_thread, &m->bus[n_started]) != 0) {
+			printf("ERROR: multi: could not start the thread for bus %d\n", m->bus[n_started].bus);
+			// stop the buses already running, count the others as done so the merge thread exits
+			atomic_store(&m->abort, 1);
+			atomic_fetch_add(&m->n_buses_done, (int) (m->n_buses - n_started));
+			break;
+		}
+	}
+	for (size_t k=0; k<n_started; ++k) {
+		pthread_join(m->bus[k].tid, NULL);
+	}
+	pthread_join(merge_tid, NULL);
+	// with aio, the last buffers are only written (and synced) here
+	if (rhd_dlog_close(&m->dlog) == -1) {
+		printf("ERROR: multi: could not finish %s\n", cfg->fname);
+		m->write_err = 1;
+	}
+	if (m->serving) {
+		rhd_net_close(&m->net);
+	}
+	rhd_shm_close(&m->shm);
+
+	// an aborted bus may not have paced a single frame
+	for (size_t k=0; k<n_started && !atomic_load(&m->abort); ++k) {
+		bus_ctx_t *b = &m->bus[k];
+		printf("INFO: multi: bus %d first frame %+.1f us from shared start\n", b->bus, (b->pacer.first_ns - m->start_ns) / 1e3);
+		rhd_pacer_report(&b->pacer);
+	}
+	if (result) {
+		result->n_frames = m->n_written;
+		result->n_dropped = m->n_unaligned;
+		result->max_ring_fill = m->max_ring_fill;
+		for (size_t i=0; i<cfg->n_devs; ++i) {
+			result->n_dropped += atomic_load(&m->ring[i].n_dropped);
+		}
+	}
+	ret = (m->write_err || atomic_load(&m->abort)) ? -1 : 0;
+
+out:
+	for (size_t i=0; i<n_init; ++i) {
+		// plans are freed by the bus threads, unless they never ran
+		rhd_acq_plan_free(&m->acq[i].plan);
+		rhd_ring_free(&m->ring[i]);
+	}
+	free(m);
+	return ret;
+}
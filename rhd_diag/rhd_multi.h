@@ -0,0 +1,56 @@
+/*
+Multi-chip streaming: 2-4 RHD2216s recorded into one datalog with a
+shared CLOCK_MONOTONIC timebase.
+
+Chips are grouped by SPI bus (/dev/spidevB.C is bus B, every sim device
+is a bus of its own). Each bus gets one acquisition thread, pinned to its
+own core, that paces frames with rhd_pacer and issues one frame to each
+chip on the bus back to back. Chips sharing a bus share a thread since
+their transfers can't overlap anyway. All bus pacers run at the same
+rate from the same first deadline (rhd_pacer_start_at), so frame k of
+every chip sits on one deadline grid.
+
+Every chip pushes into its own SPSC ring (rhd_ring.h). A merge thread
+pops the frame with the same seq from each ring and writes them as one
+wide frame, chip i's channel c logged as channel 16*i + c (rhd_dlog.h).
+If one ring overflows, frames the other chips have for the missing seqs
+are dropped so the merged stream stays aligned. Merged frames are also
+what --serve sends (rhd_net.h) and --shm publishes (rhd_shm.h).
+
+Usage:
+	./build/rhd2216_util --device /dev/spidev0.0 --device /dev/spidev1.0 --config --calibrate --stream=60 --srate 2000 --format bin
+*/
+#ifndef RHD_MULTI_H
+#define RHD_MULTI_H
+
+#include <signal.h>
+#include "rhd2216_lib.h"
+#include "rhd_ring.h"
+#include "rhd_dlog.h"
+#include "rhd_stream.h"
+#include "rhd_net.h"
+#include "rhd_shm.h"
+
+#define RHD_MULTI_MAX_DEVS 4 // 64 channels, all the datalog mask can hold
+// first shared deadline is this far after the bus threads are started
+#define RHD_MULTI_START_DELAY_NS 20000000LL
+
+typedef struct rhd_multi_cfg {
+	rhd_dev_t *devs[RHD_MULTI_MAX_DEVS]; // opened and configured
+	size_t n_devs;
+	uint16_t active_chs_msk; // same channels on every chip
+	uint16_t srate;
+	double duration_s; // 0 = until *stop
+	size_t ring_frames; // per chip
+	const char *fname;
+	rhd_dlog_format_t format;
+	rhd_dlog_io_t io;
+	uint32_t spi_speed; // recorded in binary datalog header
+	const char *serve_addr; // rhd_net_open address, NULL to not serve
+	const char *shm_name; // rhd_shm_create name, NULL for no frame ring
+} rhd_multi_cfg_t;
+
+int rhd_multi_bus_of(const char *device);
+int rhd_multi_run(const rhd_multi_cfg_t *cfg, volatile sig_atomic_t *stop, rhd_stream_result_t *result);
+
+#endif
@@ -0,0 +1,342 @@
+#define _GNU_SOURCE // accept4
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "rhd_net.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "rhd_net messages are sent in host order, expects little-endian"
+#endif
+
+#define MSG_HDR_LEN sizeof(rhd_net_msg_header_t)
+#define FRAMES_HDR_LEN (MSG_HDR_LEN + sizeof(rhd_net_frames_t))
+
+_Static_assert(sizeof(rhd_net_msg_header_t) == 12, "message header must be 12 bytes");
+_Static_assert(sizeof(rhd_net_hello_t) == 24, "hello must be 24 bytes");
+_Static_assert(sizeof(rhd_net_frames_t) == 24, "frames header must be 24 bytes");
+
+static int listen_unix(rhd_net_t *net, const char *path) {
+	struct sockaddr_un sa;
+	int fd;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		printf("ERROR: net: unix socket path too long: %s\n", path);
+		return -1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd == -1) {
+		return -1;
+	}
+	// stale socket from a run that didn't exit cleanly
+	unlink(path);
+	if (bind(fd, (struct sockaddr*) &sa, sizeof(sa)) == -1 || listen(fd, RHD_NET_MAX_CLIENTS) == -1) {
+		close(fd);
+		return -1;
+	}
+	strcpy(net->unix_path, path);
+	return fd;
+}
+
+// host may be NULL for all interfaces
+static int listen_tcp(const char *host, const char *port) {
+	struct addrinfo hints;
+	struct addrinfo *res;
+	int fd = -1;
+	int one = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(host, port, &hints, &res) != 0) {
+		return -1;
+	}
+	for (struct addrinfo *ai=res; ai; ai=ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK, ai->ai_protocol);
+		if (fd == -1) {
+			continue;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, RHD_NET_MAX_CLIENTS) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+// "unix:PATH", or "[tcp:][HOST:]PORT"
+static int listen_addr(rhd_net_t *net, const char *addr) {
+	char host[256];
+	const char *port;
+	const char *colon;
+
+	if (strncmp(addr, "unix:", 5) == 0) {
+		return listen_unix(net, addr + 5);
+	}
+	if (strncmp(addr, "tcp:", 4) == 0) {
+		addr += 4;
+	}
+	colon = strrchr(addr, ':');
+	if (!colon) {
+		return listen_tcp(NULL, addr);
+	}
+	if ((size_t) (colon - addr) >= sizeof(host)) {
+		return -1;
+	}
+	memcpy(host, addr, colon - addr);
+	host[colon - addr] = '\0';
+	port = colon + 1;
+	return listen_tcp(host, port);
+}
+
+static void put_msg_header(uint8_t *p, uint16_t type, uint16_t n_chs, uint32_t n_bytes) {
+	rhd_net_msg_header_t hdr = {
+		.magic = RHD_NET_MAGIC,
+		.type = type,
+		.n_chs = n_chs,
+		.n_bytes = n_bytes,
+	};
+	memcpy(p, &hdr, sizeof(hdr));
+}
+
+static void drop_client(rhd_net_client_t *c, const char *why) {
+	printf("INFO: net: client %d %s, %llu frames sent, %llu dropped\n",
+		c->fd,
+		why,
+		(unsigned long long) c->n_sent,
+		(unsigned long long) c->n_dropped);
+	close(c->fd);
+	free(c->buf);
+	c->fd = -1;
+	c->buf = NULL;
+	c->len = 0;
+}
+
+// sends as much pending output as the socket takes without blocking
+static void drain_client(rhd_net_client_t *c) {
+	size_t off = 0;
+	while (off < c->len) {
+		ssize_t n = send(c->fd, c->buf + off, c->len - off, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n > 0) {
+			off += n;
+			continue;
+		}
+		if (n == -1 && errno == EINTR) {
+			continue;
+		}
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		c->len = 0;
+		drop_client(c, "disconnected");
+		return;
+	}
+	memmove(c->buf, c->buf + off, c->len - off);
+	c->len -= off;
+}
+
+// whole message or nothing, so a slow client never sees a torn message
+static int queue_msg(rhd_net_client_t *c, const uint8_t *msg, size_t len) {
+	if (c->len + len > RHD_NET_CLIENT_BUF) {
+		return -1;
+	}
+	memcpy(c->buf + c->len, msg, len);
+	c->len += len;
+	return 0;
+}
+
+static void accept_clients(rhd_net_t *net) {
+	uint8_t hello[MSG_HDR_LEN + sizeof(rhd_net_hello_t)];
+	int one = 1;
+
+	put_msg_header(hello, RHD_NET_MSG_HELLO, net->n_chs, sizeof(rhd_net_hello_t));
+	memcpy(hello + MSG_HDR_LEN, &net->hello, sizeof(rhd_net_hello_t));
+
+	while (1) {
+		rhd_net_client_t *c = NULL;
+		int fd = accept4(net->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) {
+			return;
+		}
+		for (size_t i=0; i<RHD_NET_MAX_CLIENTS; ++i) {
+			if (net->clients[i].fd == -1) {
+				c = &net->clients[i];
+				break;
+			}
+		}
+		if (!c || !(c->buf = (uint8_t*) malloc(RHD_NET_CLIENT_BUF))) {
+			printf("WARNING: net: refusing client, %d already connected\n", RHD_NET_MAX_CLIENTS);
+			close(fd);
+			continue;
+		}
+		// batches are already sized for the wire, don't hold them back
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		c->fd = fd;
+		c->len = 0;
+		c->n_sent = 0;
+		c->n_dropped = 0;
+		queue_msg(c, hello, sizeof(hello));
+		drain_client(c);
+		printf("INFO: net: client %d connected\n", fd);
+	}
+}
+
+// clients never send anything we need, but reading tells us they hung up
+static void check_hangup(rhd_net_client_t *c) {
+	uint8_t scratch[256];
+	ssize_t n = recv(c->fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+	if (n == 0) {
+		drop_client(c, "disconnected");
+	} else if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		drop_client(c, "disconnected");
+	}
+}
+
+static void flush_batch(rhd_net_t *net) {
+	size_t n_frames = net->batch_frames;
+	size_t len = FRAMES_HDR_LEN + n_frames * net->n_chs * sizeof(uint16_t);
+
+	if (n_frames == 0) {
+		return;
+	}
+	net->batch_frames = 0;
+	put_msg_header(net->batch, RHD_NET_MSG_FRAMES, net->n_chs, len - MSG_HDR_LEN);
+	((rhd_net_frames_t*) (net->batch + MSG_HDR_LEN))->n_frames = n_frames;
+
+	for (size_t i=0; i<RHD_NET_MAX_CLIENTS; ++i) {
+		rhd_net_client_t *c = &net->clients[i];
+		if (c->fd == -1) {
+			continue;
+		}
+		if (queue_msg(c, net->batch, len) == -1) {
+			c->n_dropped += n_frames;
+		} else {
+			c->n_sent += n_frames;
+		}
+		drain_client(c);
+	}
+}
+
+// listens on addr, see listen_addr. flags go to clients in the hello.
+int rhd_net_open(rhd_net_t *net, const char *addr, size_t n_chs, uint64_t active_chs_msk, uint32_t srate, uint32_t flags) {
+	memset(net, 0, sizeof(*net));
+	net->listen_fd = -1;
+	for (size_t i=0; i<RHD_NET_MAX_CLIENTS; ++i) {
+		net->clients[i].fd = -1;
+	}
+	if (n_chs == 0 || n_chs > RHD_NET_MAX_CHS) {
+		return -1;
+	}
+	net->n_chs = n_chs;
+	net->hello.version = RHD_NET_VERSION;
+	net->hello.n_chs = n_chs;
+	net->hello.srate_hz = srate;
+	net->hello.active_chs_msk = active_chs_msk;
+	net->hello.flags = flags;
+
+	net->batch = (uint8_t*) malloc(FRAMES_HDR_LEN + RHD_NET_BATCH_FRAMES * n_chs * sizeof(uint16_t));
+	if (!net->batch) {
+		return -1;
+	}
+	net->listen_fd = listen_addr(net, addr);
+	if (net->listen_fd == -1) {
+		printf("ERROR: net: could not listen on %s: %s\n", addr, strerror(errno));
+		free(net->batch);
+		net->batch = NULL;
+		return -1;
+	}
+	printf("INFO: net: serving frames on %s\n", addr);
+	return 0;
+}
+
+// adds one frame of n_chs samples to the pending batch, sending it if
+// full or if seq doesn't follow on from it
+void rhd_net_publish(rhd_net_t *net, uint64_t seq, int64_t t_ns, const uint16_t *samples) {
+	rhd_net_frames_t *frames = (rhd_net_frames_t*) (net->batch + MSG_HDR_LEN);
+
+	if (net->batch_frames && seq != frames->first_seq + net->batch_frames) {
+		flush_batch(net);
+	}
+	if (net->batch_frames == 0) {
+		frames->first_seq = seq;
+		frames->t_ns = t_ns;
+		frames->reserved = 0;
+		net->batch_start_ns = rhd_now_ns();
+	}
+	memcpy(
+		net->batch + FRAMES_HDR_LEN + net->batch_frames * net->n_chs * sizeof(uint16_t),
+		samples,
+		net->n_chs * sizeof(uint16_t)
+	);
+	net->batch_frames++;
+	if (net->batch_frames == RHD_NET_BATCH_FRAMES) {
+		flush_batch(net);
+		rhd_net_service(net);
+	}
+}
+
+// accepts new clients, sends a batch that has waited RHD_NET_MAX_LATENCY_NS
+// and pushes out pending output. call whenever the caller is idle.
+void rhd_net_service(rhd_net_t *net) {
+	accept_clients(net);
+	if (net->batch_frames && rhd_now_ns() - net->batch_start_ns >= RHD_NET_MAX_LATENCY_NS) {
+		flush_batch(net);
+	}
+	for (size_t i=0; i<RHD_NET_MAX_CLIENTS; ++i) {
+		rhd_net_client_t *c = &net->clients[i];
+		if (c->fd != -1) {
+			check_hangup(c);
+		}
+		if (c->fd != -1 && c->len) {
+			drain_client(c);
+		}
+	}
+}
+
+// sends what's pending, giving slow clients up to RHD_NET_CLOSE_WAIT_MS
+// to take it, then hangs up
+void rhd_net_close(rhd_net_t *net) {
+	if (net->listen_fd == -1) {
+		return;
+	}
+	flush_batch(net);
+	for (int ms=0; ms<RHD_NET_CLOSE_WAIT_MS; ++ms) {
+		int pending = 0;
+		for (size_t i=0; i<RHD_NET_MAX_CLIENTS; ++i) {
+			rhd_net_client_t *c = &net->clients[i];
+			if (c->fd != -1 && c->len) {
+				drain_client(c);
+				pending |= (c->fd != -1 && c->len);
+			}
+		}
+		if (!pending) {
+			break;
+		}
+		usleep(1000);
+	}
+	for (size_t i=0; i<RHD_NET_MAX_CLIENTS; ++i) {
+		if (net->clients[i].fd != -1) {
+			drop_client(&net->clients[i], "closed");
+		}
+	}
+	close(net->listen_fd);
+	net->listen_fd = -1;
+	if (net->unix_path[0]) {
+		unlink(net->unix_path);
+	}
+	free(net->batch);
+	net->batch = NULL;
+}
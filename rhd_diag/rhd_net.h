@@ -0,0 +1,101 @@
+/*
+Live frame server for --stream --serve: clients connect over TCP or a
+Unix-domain socket and get frames as they are logged, so a laptop can
+plot a recording while it is running instead of waiting to scp the log.
+
+The server is driven from the thread that writes the datalog
+(rhd_stream.h writer, rhd_multi.h merge), never the SPI thread, and
+never blocks it: sockets are non-blocking, each client has an output
+buffer of RHD_NET_CLIENT_BUF bytes, and a batch that doesn't fit is
+dropped for that client only. Clients see drops as gaps in seq.
+
+Wire format, all little-endian. Every message is an rhd_net_msg_header_t
+followed by n_bytes of payload. On connect a client gets one
+RHD_NET_MSG_HELLO (rhd_net_hello_t) describing the stream, then
+RHD_NET_MSG_FRAMES messages: an rhd_net_frames_t followed by n_frames
+interleaved int16 frames of n_chs samples, channel order as in the
+datalog (rhd_dlog.h). Frames in one message have consecutive seq, and
+frame i was issued at about t_ns + i / srate_hz seconds. Batches are
+sent once RHD_NET_BATCH_FRAMES frames are pending or the oldest is
+RHD_NET_MAX_LATENCY_NS old. Anything a client sends is ignored.
+
+Client: postprocess/rhdutil_stream_client.py
+
+Usage:
+	rhd_net_t net;
+	rhd_net_open(&net, "tcp:5555", n_chs, active_chs_msk, srate, flags);
+	for each frame:
+		rhd_net_publish(&net, frame.seq, frame.t_ns, frame.data);
+	while idle:
+		rhd_net_service(&net);
+	rhd_net_close(&net);
+*/
+#ifndef RHD_NET_H
+#define RHD_NET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rhd2216_lib.h"
+
+#define RHD_NET_MAGIC 0x4e444852 // "RHDN"
+#define RHD_NET_VERSION 1
+#define RHD_NET_MAX_CLIENTS 8
+#define RHD_NET_MAX_CHS 64
+#define RHD_NET_BATCH_FRAMES 64
+#define RHD_NET_MAX_LATENCY_NS 10000000LL // 10 ms
+#define RHD_NET_CLIENT_BUF (256 * 1024) // ~0.8 s of 16 chs at 10 kHz
+#define RHD_NET_CLOSE_WAIT_MS 200 // for clients to take the last frames
+
+// rhd_net_msg_header_t.type
+#define RHD_NET_MSG_HELLO 1
+#define RHD_NET_MSG_FRAMES 2
+
+typedef struct __attribute__((packed)) rhd_net_msg_header {
+	uint32_t magic; // RHD_NET_MAGIC
+	uint16_t type;
+	uint16_t n_chs;
+	uint32_t n_bytes; // payload after this header
+} rhd_net_msg_header_t;
+
+typedef struct __attribute__((packed)) rhd_net_hello {
+	uint16_t version; // RHD_NET_VERSION
+	uint16_t n_chs;
+	uint32_t srate_hz;
+	uint64_t active_chs_msk; // chip i in bits 16i..16i+15, as in the datalog
+	uint32_t flags; // RHD_DLOG_FLAG_FILTERED
+	uint32_t reserved;
+} rhd_net_hello_t;
+
+typedef struct __attribute__((packed)) rhd_net_frames {
+	uint64_t first_seq;
+	int64_t t_ns; // CLOCK_MONOTONIC issue time of first frame
+	uint32_t n_frames;
+	uint32_t reserved;
+} rhd_net_frames_t;
+
+typedef struct rhd_net_client {
+	int fd; // -1 if slot unused
+	uint8_t *buf; // pending output, RHD_NET_CLIENT_BUF bytes
+	size_t len;
+	uint64_t n_sent; // frames queued to this client
+	uint64_t n_dropped; // frames dropped because the client fell behind
+} rhd_net_client_t;
+
+typedef struct rhd_net {
+	int listen_fd;
+	char unix_path[108]; // unlinked on close, empty for tcp
+	rhd_net_hello_t hello;
+	size_t n_chs;
+	rhd_net_client_t clients[RHD_NET_MAX_CLIENTS];
+	// batch being filled, sent by rhd_net_publish/rhd_net_service
+	uint8_t *batch;
+	size_t batch_frames;
+	int64_t batch_start_ns; // when the first pending frame was published
+} rhd_net_t;
+
+int rhd_net_open(rhd_net_t *net, const char *addr, size_t n_chs, uint64_t active_chs_msk, uint32_t srate, uint32_t flags);
+void rhd_net_publish(rhd_net_t *net, uint64_t seq, int64_t t_ns, const uint16_t *samples);
+void rhd_net_service(rhd_net_t *net);
+void rhd_net_close(rhd_net_t *net);
+
+#endif
@@ -0,0 +1,276 @@
+/*
+Converts an nRF Connect log of BLE notifications into an rhd2216_util
+datalog (rhd_dlog.h), so BLE captures load through the same
+format_rhdutil_log_file / np.memmap path as SPI ones instead of the
+line-by-line regex in format_nrf_log_file.
+
+Only the value lines are used, e.g.
+	A	01:49:17.771	"(0x) F2-03-D9-12-...-B1-FA" received
+every 2 bytes are one sample, written as they appear (first byte high,
+the same values format_nrf_log_file returns; -l swaps them), and samples
+go to channels in turn. A partial last frame is dropped.
+The output is the frame-interleaved rhd_dlog layout (all channels of a
+frame, then the next frame) that rhd2216_util writes, not a channel-major
+one, so it needs no reader of its own and can be written as it is parsed.
+SRATE is not in the nRF log, the device name usually has it (e.g.
+EMGS_16ch_800Hz in ../postprocess/example_dlogs/example_nrf_log_16_chs.txt).
+
+The log is read in one streaming pass, RD_BUF_LEN bytes at a time, and
+samples go straight to the datalog, so memory use doesn't depend on the
+length of the log.
+
+Usage:
+Run from rhd_diag directory
+	make rhd_nrf_convert
+	./build/rhd_nrf_convert [-f bin|rice|text] [-l] NRF_LOG N_CHS SRATE [DATALOG]
+	python ../postprocess/flexsemg_postprocess.py -src_type rhdutil_log -fpath DATALOG
+DATALOG defaults to NRF_LOG with its extension replaced by that of the
+format (.bin by default).
+*/
+
+#define _GNU_SOURCE // memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rhd_dlog.h"
+
+#define RD_BUF_LEN (1 << 20)
+#define OUT_BUF_SAMPLES 65536
+#define NRF_MAX_CHS 64 // rhd_dlog mask is 64 bits
+
+static const char value_start[] = "\"(0x) ";
+static const char value_end[] = "\" received";
+
+typedef struct nrf_conv {
+	rhd_dlog_t dlog;
+	size_t n_chs;
+	int swap;
+	uint16_t out[OUT_BUF_SAMPLES];
+	size_t out_fill;
+	uint64_t n_lines; // value lines
+	uint64_t n_samples;
+} nrf_conv_t;
+
+static int8_t hex_val[256];
+
+static void init_hex_val(void) {
+	memset(hex_val, -1, sizeof(hex_val));
+	for (int i=0; i<10; ++i) {
+		hex_val['0' + i] = i;
+	}
+	for (int i=0; i<6; ++i) {
+		hex_val['a' + i] = 10 + i;
+		hex_val['A' + i] = 10 + i;
+	}
+}
+
+// writes the whole frames in out, keeps the rest for the next flush
+static int flush_out(nrf_conv_t *conv) {
+	size_t n = conv->out_fill - conv->out_fill % conv->n_chs;
+	if (n == 0) {
+		return 0;
+	}
+	if (rhd_dlog_write_samples(&conv->dlog, conv->out, n) == -1) {
+		return -1;
+	}
+	memmove(conv->out, conv->out + n, (conv->out_fill - n) * sizeof(uint16_t));
+	conv->out_fill -= n;
+	return 0;
+}
+
+// hex digits between the quotes, anything else (the '-' separators) is
+// skipped. a trailing odd byte or nibble is dropped.
+static int parse_value(nrf_conv_t *conv, const char *p, const char *end) {
+	uint32_t v = 0;
+	int n_nibbles = 0;
+
+	for (; p < end; ++p) {
+		int8_t h = hex_val[(uint8_t) *p];
+		if (h < 0) {
+			continue;
+		}
+		v = (v << 4) | h;
+		if (++n_nibbles < 4) {
+			continue;
+		}
+		if (conv->swap) {
+			v = ((v & 0xff) << 8) | (v >> 8);
+		}
+		conv->out[conv->out_fill++] = (uint16_t) v;
+		conv->n_samples++;
+		v = 0;
+		n_nibbles = 0;
+		if (conv->out_fill == OUT_BUF_SAMPLES && flush_out(conv) == -1) {
+			return -1;
+		}
+	}
+	conv->n_lines++;
+	return 0;
+}
+
+static int parse_line(nrf_conv_t *conv, const char *line, size_t len) {
+	const char *start = memmem(line, len, value_start, sizeof(value_start) - 1);
+	if (!start) {
+		return 0;
+	}
+	start += sizeof(value_start) - 1;
+	const char *end = memmem(start, line + len - start, value_end, sizeof(value_end) - 1);
+	if (!end) {
+		return 0;
+	}
+	return parse_value(conv, start, end);
+}
+
+static int convert(nrf_conv_t *conv, FILE *in) {
+	char *buf = (char*) malloc(RD_BUF_LEN);
+	size_t fill = 0;
+	int ret = 0;
+
+	if (!buf) {
+		return -1;
+	}
+	while (ret == 0) {
+		size_t n = fread(buf + fill, 1, RD_BUF_LEN - fill, in);
+		int eof = (n == 0);
+		fill += n;
+		if (eof && fill == 0) {
+			break;
+		}
+
+		// whole lines, the last partial one moves to the front
+		char *p = buf;
+		char *buf_end = buf + fill;
+		char *nl;
+		while ((nl = memchr(p, '\n', buf_end - p))) {
+			if (parse_line(conv, p, nl - p) == -1) {
+				ret = -1;
+				break;
+			}
+			p = nl + 1;
+		}
+		if (ret == -1) {
+			break;
+		}
+		if (eof) {
+			// no newline at the end of the log
+			ret = parse_line(conv, p, buf_end - p);
+			break;
+		}
+		if (p == buf && fill == RD_BUF_LEN) {
+			printf("ERROR: line longer than %d bytes\n", RD_BUF_LEN);
+			ret = -1;
+			break;
+		}
+		fill = buf_end - p;
+		memmove(buf, p, fill);
+	}
+	if (ferror(in)) {
+		ret = -1;
+	}
+	free(buf);
+	return ret;
+}
+
+static void usage(const char *prog) {
+	printf("Usage: %s [-f bin|rice|text] [-l] NRF_LOG N_CHS SRATE [DATALOG]\n", prog);
+	printf("  -f  datalog format, default bin\n");
+	printf("  -l  samples are little-endian (low byte first)\n");
+}
+
+int main(int argc, char *argv[]) {
+	rhd_dlog_format_t format = RHD_DLOG_BIN;
+	nrf_conv_t *conv;
+	char out_fname[4096];
+	const char *in_fname;
+	unsigned long n_chs, srate;
+	FILE *in;
+	int swap = 0;
+	int opt;
+	int ret = 0;
+
+	while ((opt = getopt(argc, argv, "f:lh")) != -1) {
+		if (opt == 'f') {
+			if (rhd_dlog_parse_format(optarg, &format) == -1) {
+				printf("ERROR: unknown format %s, expected text, bin or rice\n", optarg);
+				return 1;
+			}
+		} else if (opt == 'l') {
+			swap = 1;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (argc - optind < 3) {
+		usage(argv[0]);
+		return 1;
+	}
+	in_fname = argv[optind];
+	n_chs = strtoul(argv[optind + 1], NULL, 0);
+	srate = strtoul(argv[optind + 2], NULL, 0);
+	if (n_chs == 0 || n_chs > NRF_MAX_CHS) {
+		printf("ERROR: N_CHS must be 1-%d\n", NRF_MAX_CHS);
+		return 1;
+	}
+	if (srate == 0 || srate > UINT16_MAX) {
+		printf("ERROR: SRATE must be 1-%d Hz\n", UINT16_MAX);
+		return 1;
+	}
+	if (argc - optind > 3) {
+		snprintf(out_fname, sizeof(out_fname), "%s", argv[optind + 3]);
+	} else {
+		const char *dot = strrchr(in_fname, '.');
+		const char *slash = strrchr(in_fname, '/');
+		int stem_len = (dot && (!slash || dot > slash)) ? (int) (dot - in_fname) : (int) strlen(in_fname);
+		snprintf(out_fname, sizeof(out_fname), "%.*s.%s", stem_len, in_fname, rhd_dlog_ext(format));
+		if (strcmp(out_fname, in_fname) == 0) {
+			printf("ERROR: DATALOG would overwrite NRF_LOG, give it explicitly\n");
+			return 1;
+		}
+	}
+
+	in = fopen(in_fname, "r");
+	if (!in) {
+		printf("ERROR: could not open %s\n", in_fname);
+		return 1;
+	}
+	conv = (nrf_conv_t*) calloc(1, sizeof(nrf_conv_t));
+	if (!conv) {
+		fclose(in);
+		return 1;
+	}
+	conv->n_chs = n_chs;
+	conv->swap = swap;
+	init_hex_val();
+	uint64_t msk = (n_chs == 64) ? UINT64_MAX : (1ULL << n_chs) - 1;
+	if (rhd_dlog_open(&conv->dlog, out_fname, format, msk, (uint16_t) srate, 0) == -1) {
+		printf("ERROR: could not open %s\n", out_fname);
+		fclose(in);
+		free(conv);
+		return 1;
+	}
+
+	if (convert(conv, in) == -1 || flush_out(conv) == -1) {
+		printf("ERROR: converting %s failed\n", in_fname);
+		ret = 1;
+	}
+	if (rhd_dlog_close(&conv->dlog) == -1) {
+		printf("ERROR: could not close %s\n", out_fname);
+		ret = 1;
+	}
+	fclose(in);
+
+	if (conv->out_fill) {
+		printf("WARNING: dropped %zu samples of a partial last frame\n", conv->out_fill);
+	}
+	printf("INFO: %s: %llu notifications, %llu frames of %lu chs at %lu Hz -> %s\n",
+		in_fname,
+		(unsigned long long) conv->n_lines,
+		(unsigned long long) (conv->n_samples / n_chs),
+		n_chs,
+		srate,
+		out_fname);
+	free(conv);
+	return ret;
+}
@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "rhd_pacer.h"
+
+#define NS_PER_SEC 1000000000LL
+
+int64_t rhd_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// sleeps until deadline_ns on CLOCK_MONOTONIC. last spin_ns are busy-waited.
+void rhd_sleep_until_ns(int64_t deadline_ns, int64_t spin_ns) {
+	int64_t wake_ns = deadline_ns - spin_ns;
+	if (wake_ns > rhd_now_ns()) {
+		struct timespec ts = {
+			.tv_sec = wake_ns / NS_PER_SEC,
+			.tv_nsec = wake_ns % NS_PER_SEC,
+		};
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+			// restart on signals, deadline is absolute so no drift
+		}
+	}
+	if (spin_ns > 0) {
+		while (rhd_now_ns() < deadline_ns) {
+			// spin
+		}
+	}
+}
+
+void rhd_pacer_init(rhd_pacer_t *pacer, double rate_hz, int64_t spin_ns) {
+	memset(pacer, 0, sizeof(*pacer));
+	pacer->period_ns = (rate_hz > 0) ? (int64_t) llround(NS_PER_SEC / rate_hz) : 0;
+	pacer->spin_ns = spin_ns;
+	pacer->burst = 1;
+	pacer->ifi_min_ns = INT64_MAX;
+}
+
+// puts the first deadline at start_ns instead of the first wait call.
+// pacers given the same start_ns and rate share one deadline grid, so
+// frames from separate threads line up in time.
+void rhd_pacer_start_at(rhd_pacer_t *pacer, int64_t start_ns) {
+	pacer->start_ns = start_ns;
+}
+
+// each wakeup issues burst frames, only changes what rhd_pacer_report
+// prints. a short last burst doesn't skew the achieved rate, it only
+// counts intervals up to the start of the last wakeup.
+void rhd_pacer_set_burst(rhd_pacer_t *pacer, size_t burst) {
+	pacer->burst = burst ? burst : 1;
+}
+
+// waits for the next frame deadline and records the frame start time.
+// returns 1 if the deadline had already passed, 0 otherwise.
+int rhd_pacer_wait(rhd_pacer_t *pacer) {
+	int late = 0;
+	int64_t now = rhd_now_ns();
+
+	if (pacer->n_frames == 0) {
+		pacer->next_ns = (pacer->start_ns > now) ? pacer->start_ns : now;
+	}
+	pacer->lag_ns = 0;
+	if (now > pacer->next_ns) {
+		late = 1;
+		pacer->n_late++;
+		pacer->lag_ns = now - pacer->next_ns;
+		if (now - pacer->next_ns > RHD_PACER_MAX_LAG_PERIODS * pacer->period_ns) {
+			pacer->next_ns = now;
+			pacer->n_resync++;
+		}
+	} else {
+		rhd_sleep_until_ns(pacer->next_ns, pacer->spin_ns);
+		now = rhd_now_ns();
+	}
+
+	if (pacer->n_frames == 0) {
+		pacer->first_ns = now;
+	} else {
+		int64_t ifi = now - pacer->last_ns;
+		if (ifi < pacer->ifi_min_ns) {
+			pacer->ifi_min_ns = ifi;
+		}
+		if (ifi > pacer->ifi_max_ns) {
+			pacer->ifi_max_ns = ifi;
+		}
+		pacer->ifi_sum_ns += ifi;
+		pacer->ifi_sumsq_ns += (double) ifi * ifi;
+	}
+	pacer->last_ns = now;
+	pacer->n_frames++;
+	pacer->next_ns += pacer->period_ns;
+	return late;
+}
+
+// marks end of the current frame's work, used to measure frame duration.
+void rhd_pacer_frame_done(rhd_pacer_t *pacer) {
+	int64_t busy = rhd_now_ns() - pacer->last_ns;
+	pacer->busy_ns = busy;
+	if (busy > pacer->busy_max_ns) {
+		pacer->busy_max_ns = busy;
+	}
+	pacer->busy_sum_ns += busy;
+}
+
+double rhd_pacer_achieved_rate(const rhd_pacer_t *pacer) {
+	if (pacer->n_frames < 2 || pacer->last_ns == pacer->first_ns) {
+		return 0;
+	}
+	return (pacer->n_frames - 1) * (double) NS_PER_SEC / (pacer->last_ns - pacer->first_ns);
+}
+
+// standard deviation of the inter-frame interval
+double rhd_pacer_jitter_ns(const rhd_pacer_t *pacer) {
+	if (pacer->n_frames < 3) {
+		return 0;
+	}
+	double n = pacer->n_frames - 1;
+	double mean = pacer->ifi_sum_ns / n;
+	double var = pacer->ifi_sumsq_ns / n - mean * mean;
+	return (var > 0) ? sqrt(var) : 0;
+}
+
+void rhd_pacer_report(const rhd_pacer_t *pacer) {
+	double requested = (pacer->period_ns > 0) ? (double) NS_PER_SEC / pacer->period_ns : 0;
+	const char *unit = (pacer->burst > 1) ? "burst" : "frame";
+	if (pacer->burst > 1) {
+		printf("INFO: pacer: %llu bursts of %zu frames, requested %.3f Hz, achieved %.3f Hz sample rate\n",
+			(unsigned long long) pacer->n_frames,
+			pacer->burst,
+			requested * pacer->burst,
+			rhd_pacer_achieved_rate(pacer) * pacer->burst);
+	} else {
+		printf("INFO: pacer: %llu frames, requested %.3f Hz, achieved %.3f Hz\n",
+			(unsigned long long) pacer->n_frames,
+			requested,
+			rhd_pacer_achieved_rate(pacer));
+	}
+	if (pacer->n_frames < 2) {
+		return;
+	}
+	printf("INFO: pacer: %s interval min %.2f us, mean %.2f us, max %.2f us, jitter (std) %.2f us\n",
+		unit,
+		pacer->ifi_min_ns / 1000.0,
+		pacer->ifi_sum_ns / (pacer->n_frames - 1) / 1000.0,
+		pacer->ifi_max_ns / 1000.0,
+		rhd_pacer_jitter_ns(pacer) / 1000.0);
+	printf("INFO: pacer: %s duration mean %.2f us, max %.2f us, late %ss %llu, resyncs %llu\n",
+		unit,
+		pacer->busy_sum_ns / pacer->n_frames / 1000.0,
+		pacer->busy_max_ns / 1000.0,
+		unit,
+		(unsigned long long) pacer->n_late,
+		(unsigned long long) pacer->n_resync);
+}
@@ -0,0 +1,68 @@
+/*
+Absolute-deadline frame clock for paced acquisition.
+Deadlines are kept on CLOCK_MONOTONIC and slept to with
+clock_nanosleep(TIMER_ABSTIME), so the time a frame takes to transfer
+does not push the next frame back (unlike a fixed usleep per frame).
+An optional busy-wait tail wakes spin_ns early and spins to the deadline
+for sub-50 us precision, at the cost of burning a core.
+
+Usage:
+	rhd_pacer_t pacer;
+	rhd_pacer_init(&pacer, srate, 0);
+	while (running) {
+		rhd_pacer_wait(&pacer);
+		... do one frame ...
+		rhd_pacer_frame_done(&pacer);
+	}
+	rhd_pacer_report(&pacer);
+When each wakeup issues a burst of frames (--burst), rate_hz is the
+burst rate and rhd_pacer_set_burst makes rhd_pacer_report give the
+sample rate; the interval and duration figures stay per burst.
+*/
+#ifndef RHD_PACER_H
+#define RHD_PACER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+// if a frame starts later than this many periods past its deadline, the
+// schedule is restarted from now instead of bursting to catch up.
+#define RHD_PACER_MAX_LAG_PERIODS 2
+
+typedef struct rhd_pacer {
+	int64_t period_ns;
+	int64_t spin_ns; // busy-wait tail, 0 to always sleep
+	int64_t next_ns; // absolute deadline of next frame
+	int64_t start_ns; // deadline of first frame, 0 = first wait call
+	size_t burst; // frames per wakeup, 1 unless rhd_pacer_set_burst
+
+	// measured timing
+	uint64_t n_frames;
+	uint64_t n_late; // frames started after their deadline
+	uint64_t n_resync; // times schedule was restarted
+	int64_t first_ns;
+	int64_t last_ns; // start of most recent frame
+	int64_t lag_ns; // how late most recent frame started, 0 if on time
+	int64_t busy_ns; // duration of most recent frame
+	int64_t ifi_min_ns; // inter-frame interval
+	int64_t ifi_max_ns;
+	double ifi_sum_ns;
+	double ifi_sumsq_ns;
+	int64_t busy_max_ns; // longest frame (start to frame_done)
+	double busy_sum_ns;
+} rhd_pacer_t;
+
+int64_t rhd_now_ns(void);
+void rhd_sleep_until_ns(int64_t deadline_ns, int64_t spin_ns);
+
+void rhd_pacer_init(rhd_pacer_t *pacer, double rate_hz, int64_t spin_ns);
+void rhd_pacer_start_at(rhd_pacer_t *pacer, int64_t start_ns);
+void rhd_pacer_set_burst(rhd_pacer_t *pacer, size_t burst);
+int rhd_pacer_wait(rhd_pacer_t *pacer);
+void rhd_pacer_frame_done(rhd_pacer_t *pacer);
+double rhd_pacer_achieved_rate(const rhd_pacer_t *pacer);
+double rhd_pacer_jitter_ns(const rhd_pacer_t *pacer);
+void rhd_pacer_report(const rhd_pacer_t *pacer);
+
+#endif
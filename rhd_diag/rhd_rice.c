@@ -0,0 +1,244 @@
+#include <string.h>
+#include "rhd_rice.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "rhd_rice headers are written in host order, expects little-endian"
+#endif
+
+_Static_assert(sizeof(rhd_rice_block_header_t) == 16, "block header must be 16 bytes");
+_Static_assert(sizeof(rhd_rice_ch_header_t) == 8, "channel header must be 8 bytes");
+
+// MSB first bit writer. acc holds n pending bits in its low end.
+typedef struct bit_writer {
+	uint8_t *p;
+	uint64_t acc;
+	int n;
+} bit_writer_t;
+
+static inline void bw_put(bit_writer_t *w, uint32_t v, int n_bits) {
+	w->acc = (w->acc << n_bits) | v;
+	w->n += n_bits;
+	while (w->n >= 8) {
+		w->n -= 8;
+		*w->p++ = (uint8_t) (w->acc >> w->n);
+	}
+}
+
+static inline void bw_flush(bit_writer_t *w) {
+	if (w->n > 0) {
+		*w->p++ = (uint8_t) (w->acc << (8 - w->n));
+	}
+	w->acc = 0;
+	w->n = 0;
+}
+
+typedef struct bit_reader {
+	const uint8_t *p;
+	const uint8_t *end;
+	uint64_t acc;
+	int n;
+} bit_reader_t;
+
+static inline int br_fill(bit_reader_t *r, int n_bits) {
+	while (r->n < n_bits) {
+		if (r->p >= r->end) {
+			return -1;
+		}
+		r->acc = (r->acc << 8) | *r->p++;
+		r->n += 8;
+	}
+	return 0;
+}
+
+static inline int br_get(bit_reader_t *r, int n_bits, uint32_t *v) {
+	if (n_bits == 0) {
+		*v = 0;
+		return 0;
+	}
+	if (br_fill(r, n_bits) == -1) {
+		return -1;
+	}
+	r->n -= n_bits;
+	*v = (uint32_t) (r->acc >> r->n) & ((1u << n_bits) - 1);
+	return 0;
+}
+
+static inline uint32_t zigzag(int32_t e) {
+	return ((uint32_t) e << 1) ^ (uint32_t) (e >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u) {
+	return (int32_t) (u >> 1) ^ -(int32_t) (u & 1);
+}
+
+// remainders (k bits) + unary (q+1 bits, 33 when escaped) + escape, per
+// sample, plus per channel headers and padding
+size_t rhd_rice_max_block_bytes(size_t n_frames, size_t n_chs) {
+	size_t bits = n_frames * (RHD_RICE_MAX_K + RHD_RICE_ESC_Q + 1 + 32);
+	return sizeof(rhd_rice_block_header_t) + n_chs * (sizeof(rhd_rice_ch_header_t) + bits / 8 + 2);
+}
+
+// encodes n_frames (<= RHD_RICE_BLOCK_FRAMES) interleaved frames of n_chs
+// samples into out, which must hold rhd_rice_max_block_bytes. returns
+// bytes written, 0 if n_frames is out of range.
+size_t rhd_rice_encode_block(const uint16_t *samples, size_t n_frames, size_t n_chs, uint64_t first_frame, uint8_t *out) {
+	uint32_t u[RHD_RICE_BLOCK_FRAMES];
+	rhd_rice_block_header_t hdr;
+	uint8_t *p = out + sizeof(hdr);
+
+	if (n_frames == 0 || n_frames > RHD_RICE_BLOCK_FRAMES) {
+		return 0;
+	}
+
+	for (size_t ch=0; ch<n_chs; ++ch) {
+		rhd_rice_ch_header_t ch_hdr;
+		uint64_t sum1 = 0;
+		uint64_t sum2 = 0;
+		uint64_t sum;
+		int32_t x1 = 0;
+		int32_t x2 = 0;
+		uint8_t *esc;
+		bit_writer_t w = {0};
+
+		// pick predictor by total zigzag residual, which tracks coded size
+		for (size_t i=0; i<n_frames; ++i) {
+			int32_t x = (int16_t) samples[i * n_chs + ch];
+			sum1 += zigzag(x - x1);
+			sum2 += zigzag(x - 2 * x1 + x2);
+			x2 = x1;
+			x1 = x;
+		}
+		ch_hdr.order = (sum2 < sum1) ? 2 : 1;
+		sum = (sum2 < sum1) ? sum2 : sum1;
+
+		x1 = 0;
+		x2 = 0;
+		for (size_t i=0; i<n_frames; ++i) {
+			int32_t x = (int16_t) samples[i * n_chs + ch];
+			u[i] = zigzag((ch_hdr.order == 2) ? x - 2 * x1 + x2 : x - x1);
+			x2 = x1;
+			x1 = x;
+		}
+
+		// k ~ log2(mean residual)
+		ch_hdr.k = 0;
+		while (ch_hdr.k < RHD_RICE_MAX_K && ((uint64_t) n_frames << (ch_hdr.k + 1)) <= sum) {
+			ch_hdr.k++;
+		}
+
+		w.p = p + sizeof(ch_hdr);
+		for (size_t i=0; i<n_frames; ++i) {
+			uint32_t r = ((u[i] >> ch_hdr.k) >= RHD_RICE_ESC_Q) ? 0 : u[i] & ((1u << ch_hdr.k) - 1);
+			bw_put(&w, r, ch_hdr.k);
+		}
+		bw_flush(&w);
+
+		uint8_t *unary = w.p;
+		ch_hdr.n_esc = 0;
+		for (size_t i=0; i<n_frames; ++i) {
+			uint32_t q = u[i] >> ch_hdr.k;
+			if (q >= RHD_RICE_ESC_Q) {
+				bw_put(&w, 0xffffffffu, 32);
+				bw_put(&w, 0, 1);
+				ch_hdr.n_esc++;
+			} else {
+				// q ones then a zero
+				bw_put(&w, ((1u << q) - 1) << 1, q + 1);
+			}
+		}
+		bw_flush(&w);
+		ch_hdr.unary_bytes = w.p - unary;
+
+		esc = w.p;
+		for (size_t i=0; i<n_frames; ++i) {
+			if ((u[i] >> ch_hdr.k) >= RHD_RICE_ESC_Q) {
+				memcpy(esc, &u[i], sizeof(uint32_t));
+				esc += sizeof(uint32_t);
+			}
+		}
+
+		memcpy(p, &ch_hdr, sizeof(ch_hdr));
+		p = esc;
+	}
+
+	hdr.n_bytes = p - out;
+	hdr.n_frames = n_frames;
+	hdr.first_frame = first_frame;
+	memcpy(out, &hdr, sizeof(hdr));
+	return hdr.n_bytes;
+}
+
+// decodes one block of len bytes into samples (n_frames * n_chs,
+// interleaved). returns n_frames, or -1 if the block is malformed.
+int rhd_rice_decode_block(const uint8_t *in, size_t len, size_t n_chs, uint16_t *samples) {
+	rhd_rice_block_header_t hdr;
+	const uint8_t *p = in + sizeof(hdr);
+	const uint8_t *end = in + len;
+
+	if (len < sizeof(hdr)) {
+		return -1;
+	}
+	memcpy(&hdr, in, sizeof(hdr));
+	if (hdr.n_bytes > len || hdr.n_frames > RHD_RICE_BLOCK_FRAMES) {
+		return -1;
+	}
+	end = in + hdr.n_bytes;
+
+	for (size_t ch=0; ch<n_chs; ++ch) {
+		rhd_rice_ch_header_t ch_hdr;
+		bit_reader_t rem = {0};
+		bit_reader_t unary = {0};
+		const uint8_t *esc;
+		int32_t x1 = 0;
+		int32_t x2 = 0;
+
+		if (p + sizeof(ch_hdr) > end) {
+			return -1;
+		}
+		memcpy(&ch_hdr, p, sizeof(ch_hdr));
+		p += sizeof(ch_hdr);
+		if (ch_hdr.k > RHD_RICE_MAX_K) {
+			return -1;
+		}
+		rem.p = p;
+		rem.end = p + ((size_t) hdr.n_frames * ch_hdr.k + 7) / 8;
+		unary.p = rem.end;
+		unary.end = unary.p + ch_hdr.unary_bytes;
+		esc = unary.end;
+		p = esc + ch_hdr.n_esc * sizeof(uint32_t);
+		if (p > end) {
+			return -1;
+		}
+
+		for (size_t i=0; i<hdr.n_frames; ++i) {
+			uint32_t r;
+			uint32_t q = 0;
+			uint32_t bit;
+			uint32_t u;
+			if (br_get(&rem, ch_hdr.k, &r) == -1) {
+				return -1;
+			}
+			while (1) {
+				if (br_get(&unary, 1, &bit) == -1) {
+					return -1;
+				}
+				if (!bit) {
+					break;
+				}
+				q++;
+			}
+			if (q >= RHD_RICE_ESC_Q) {
+				memcpy(&u, esc, sizeof(u));
+				esc += sizeof(u);
+			} else {
+				u = (q << ch_hdr.k) | r;
+			}
+			int32_t e = unzigzag(u);
+			int32_t x = (ch_hdr.order == 2) ? e + 2 * x1 - x2 : e + x1;
+			samples[i * n_chs + ch] = (uint16_t) x;
+			x2 = x1;
+			x1 = (int16_t) x;
+		}
+	}
+	return hdr.n_frames;
+}
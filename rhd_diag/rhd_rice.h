@@ -0,0 +1,57 @@
+/*
+Lossless block codec for int16 EMG frames (--format rice).
+
+A block holds up to RHD_RICE_BLOCK_FRAMES interleaved frames and decodes
+without any other block, so a log can be read from any block boundary
+and a crash loses at most the block being filled. Block layout, all
+little-endian:
+	rhd_rice_block_header_t
+	per channel, lowest first:
+		rhd_rice_ch_header_t
+		remainders: n_frames values of k bits, MSB first, byte padded
+		quotients: unary, q one bits then a zero, byte padded
+		escapes: n_esc uint32 residuals too large for unary
+
+Each channel is predicted with a fixed first (x[i-1]) or second
+(2x[i-1] - x[i-2]) order predictor, whichever leaves the smaller
+residuals, with x[-1] = x[-2] = 0. Residuals are zigzag mapped and Rice
+coded with a per block/channel k. Quotients and remainders go in
+separate streams so a decoder can vectorize both (np.unpackbits, see
+read_rhdutil_rice_log in postprocess/flexsemg_postprocess.py). A
+quotient of RHD_RICE_ESC_Q marks an escaped residual, stored raw.
+
+Usage:
+	uint8_t *buf = malloc(rhd_rice_max_block_bytes(n_frames, n_chs));
+	size_t len = rhd_rice_encode_block(samples, n_frames, n_chs, first_frame, buf);
+	fwrite(buf, 1, len, f);
+	...
+	rhd_rice_decode_block(buf, len, n_chs, samples);
+*/
+#ifndef RHD_RICE_H
+#define RHD_RICE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RHD_RICE_BLOCK_FRAMES 1024 // 0.1 s at 10 kHz
+#define RHD_RICE_MAX_K 20 // residuals fit in 18 bits after zigzag
+#define RHD_RICE_ESC_Q 32 // unary quotient that marks an escaped residual
+
+typedef struct __attribute__((packed)) rhd_rice_block_header {
+	uint32_t n_bytes; // whole block, including this header
+	uint32_t n_frames;
+	uint64_t first_frame; // frame number of the first frame in the log
+} rhd_rice_block_header_t;
+
+typedef struct __attribute__((packed)) rhd_rice_ch_header {
+	uint8_t order; // predictor order, 1 or 2
+	uint8_t k; // rice parameter
+	uint16_t n_esc; // escaped residuals
+	uint32_t unary_bytes; // length of quotient stream
+} rhd_rice_ch_header_t;
+
+size_t rhd_rice_max_block_bytes(size_t n_frames, size_t n_chs);
+size_t rhd_rice_encode_block(const uint16_t *samples, size_t n_frames, size_t n_chs, uint64_t first_frame, uint8_t *out);
+int rhd_rice_decode_block(const uint8_t *in, size_t len, size_t n_chs, uint16_t *samples);
+
+#endif
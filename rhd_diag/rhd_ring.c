@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include "rhd_ring.h"
+
+int rhd_ring_init(rhd_ring_t *ring, size_t capacity) {
+	size_t cap = 1;
+	while (cap < capacity) {
+		cap <<= 1;
+	}
+	ring->slots = (rhd_frame_t*) calloc(cap, sizeof(rhd_frame_t));
+	if (!ring->slots) {
+		return -1;
+	}
+	ring->mask = cap - 1;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->n_dropped, 0);
+	return 0;
+}
+
+void rhd_ring_free(rhd_ring_t *ring) {
+	free(ring->slots);
+	ring->slots = NULL;
+}
+
+// producer side. returns -1 (and drops the frame) if ring is full.
+int rhd_ring_push(rhd_ring_t *ring, const rhd_frame_t *frame) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head - tail > ring->mask) {
+		atomic_fetch_add_explicit(&ring->n_dropped, 1, memory_order_relaxed);
+		return -1;
+	}
+	ring->slots[head & ring->mask] = *frame;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return 0;
+}
+
+// consumer side. returns -1 if ring is empty.
+int rhd_ring_pop(rhd_ring_t *ring, rhd_frame_t *frame) {
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	if (tail == head) {
+		return -1;
+	}
+	*frame = ring->slots[tail & ring->mask];
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return 0;
+}
+
+size_t rhd_ring_count(rhd_ring_t *ring) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	return head - tail;
+}
@@ -0,0 +1,41 @@
+/*
+Lock-free single-producer/single-consumer ring of rhd_frame_t.
+The producer (acquisition thread) never blocks: if the ring is full the
+frame is dropped and counted in n_dropped. The consumer polls.
+Capacity is rounded up to a power of two.
+
+Usage:
+	rhd_ring_t ring;
+	rhd_ring_init(&ring, 1 << 16);
+	// producer thread
+	rhd_ring_push(&ring, &frame);
+	// consumer thread
+	while (rhd_ring_pop(&ring, &frame) == 0) { ... }
+	rhd_ring_free(&ring);
+*/
+#ifndef RHD_RING_H
+#define RHD_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include "rhd2216_lib.h"
+
+#define RHD_RING_DEFAULT_FRAMES (1 << 16)
+
+typedef struct rhd_ring {
+	rhd_frame_t *slots;
+	size_t mask; // capacity - 1
+	// head and tail on separate cache lines so producer and consumer
+	// don't false-share
+	_Alignas(64) atomic_size_t head; // next slot producer writes
+	_Alignas(64) atomic_size_t tail; // next slot consumer reads
+	_Alignas(64) atomic_size_t n_dropped;
+} rhd_ring_t;
+
+int rhd_ring_init(rhd_ring_t *ring, size_t capacity);
+void rhd_ring_free(rhd_ring_t *ring);
+int rhd_ring_push(rhd_ring_t *ring, const rhd_frame_t *frame);
+int rhd_ring_pop(rhd_ring_t *ring, rhd_frame_t *frame);
+size_t rhd_ring_count(rhd_ring_t *ring);
+
+#endif
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE // pthread_*affinity_np, cpu_set_t
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "rhd_rt.h"
+
+#define ISOLATED_CPUS_PATH "/sys/devices/system/cpu/isolated"
+
+_Static_assert(sizeof(cpu_set_t) <= sizeof(((rhd_rt_state_t*) 0)->cpus), "rhd_rt_state_t.cpus too small for cpu_set_t");
+
+// locks current and future pages of the whole process, so nothing the
+// acquisition touches can be paged out (or lazily faulted in) later
+int rhd_rt_lock_memory(void) {
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+		printf("WARNING: realtime: could not lock memory (%s), run as root or raise ulimit -l\n", strerror(errno));
+		return -1;
+	}
+	printf("INFO: realtime: memory locked\n");
+	return 0;
+}
+
+// highest core listed in /sys/devices/system/cpu/isolated (isolcpus= on
+// the kernel command line), else the highest online core, which usually
+// takes the fewest interrupts
+int rhd_rt_pick_cpu(void) {
+	char list[256] = "";
+	FILE *f = fopen(ISOLATED_CPUS_PATH, "r");
+	long n_cpus;
+	int cpu = -1;
+
+	if (f) {
+		if (fgets(list, sizeof(list), f)) {
+			// list looks like "2-3" or "1,3"; the last number is the highest
+			for (char *p=list; *p; ++p) {
+				if ((*p >= '0' && *p <= '9') && (p == list || p[-1] < '0' || p[-1] > '9')) {
+					sscanf(p, "%d", &cpu);
+				}
+			}
+		}
+		fclose(f);
+	}
+	if (cpu >= 0) {
+		return cpu;
+	}
+	n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n_cpus > 1) ? n_cpus - 1 : 0;
+}
+
+// touches every page of buf so the first real write isn't a page fault.
+// contents are left as they are.
+void rhd_rt_prefault(void *buf, size_t len) {
+	volatile uint8_t *p = (volatile uint8_t*) buf;
+	long page = sysconf(_SC_PAGESIZE);
+	if (!buf || len == 0) {
+		return;
+	}
+	if (page <= 0) {
+		page = 4096;
+	}
+	for (size_t i=0; i<len; i+=page) {
+		p[i] = p[i];
+	}
+	p[len - 1] = p[len - 1];
+}
+
+// grows the calling thread's stack by RHD_RT_STACK_PREFAULT up front
+void __attribute__((noinline)) rhd_rt_prefault_stack(void) {
+	volatile uint8_t stack[RHD_RT_STACK_PREFAULT];
+	for (size_t i=0; i<sizeof(stack); i+=1024) {
+		stack[i] = 0;
+	}
+}
+
+// moves the calling thread to SCHED_FIFO cfg->priority on cpu (-1 to
+// leave affinity alone) and prefaults its stack. who names the thread in
+// messages. returns the number of things it could not get.
+int rhd_rt_enter(rhd_rt_state_t *st, const rhd_rt_cfg_t *cfg, int cpu, const char *who) {
+	struct sched_param param = { .sched_priority = cfg->priority };
+	cpu_set_t *saved = (cpu_set_t*) st->cpus;
+	cpu_set_t set;
+	int n_failed = 0;
+	int err;
+
+	memset(st, 0, sizeof(*st));
+	pthread_getschedparam(pthread_self(), &st->policy, &st->param);
+	err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (err == 0) {
+		st->have_sched = 1;
+	} else {
+		printf("WARNING: realtime: %s could not get SCHED_FIFO priority %d (%s), run as root or raise ulimit -r\n",
+			who,
+			cfg->priority,
+			strerror(err));
+		n_failed++;
+	}
+
+	if (cpu >= 0) {
+		pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), saved);
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (err == 0) {
+			st->have_cpus = 1;
+		} else {
+			printf("WARNING: realtime: %s could not pin to cpu %d (%s)\n", who, cpu, strerror(err));
+			n_failed++;
+		}
+	}
+
+	rhd_rt_prefault_stack();
+	if (st->have_sched) {
+		printf("INFO: realtime: %s SCHED_FIFO priority %d, ", who, cfg->priority);
+	} else {
+		printf("INFO: realtime: %s SCHED_OTHER, ", who);
+	}
+	if (st->have_cpus) {
+		printf("pinned to cpu %d\n", cpu);
+	} else {
+		printf("not pinned\n");
+	}
+	return n_failed;
+}
+
+// puts back the policy and affinity rhd_rt_enter replaced
+void rhd_rt_exit(rhd_rt_state_t *st) {
+	if (st->have_sched) {
+		pthread_setschedparam(pthread_self(), st->policy, &st->param);
+	}
+	if (st->have_cpus) {
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), (cpu_set_t*) st->cpus);
+	}
+	st->have_sched = 0;
+	st->have_cpus = 0;
+}
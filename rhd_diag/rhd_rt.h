@@ -0,0 +1,57 @@
+/*
+Real-time execution for the acquisition thread (--realtime).
+
+Paced frames are only as good as the thread issuing them: on a stock
+kernel a SCHED_OTHER thread can be preempted for milliseconds, and the
+first touch of a fresh malloc/calloc page is a page fault in the middle
+of a frame. With dev->rt set, rhd_convert_stream (and each bus thread in
+rhd_multi.h) enters real-time mode for the duration of the acquisition:
+	SCHED_FIFO at rt->priority
+	pinned to rt->cpu, or by default an isolated core (isolcpus=) if the
+	kernel has one, else the highest numbered core
+	its stack and acquisition buffers prefaulted
+and restores the thread's old policy and affinity afterwards. The caller
+locks the whole process in memory once up front (rhd_rt_lock_memory),
+and prefaults whatever the frame callback writes into.
+
+Anything that can't be had (no CAP_SYS_NICE / RLIMIT_RTPRIO, no
+CAP_IPC_LOCK / RLIMIT_MEMLOCK, core offline) is reported as a WARNING
+and acquisition goes on without it.
+
+Usage:
+	rhd_rt_cfg_t rt = { .priority = RHD_RT_DEFAULT_PRIO, .cpu = -1 };
+	rhd_rt_lock_memory();
+	dev->rt = &rt;
+	rhd_convert_stream(dev, ...);
+*/
+#ifndef RHD_RT_H
+#define RHD_RT_H
+
+#include <sched.h>
+#include <stddef.h>
+
+#define RHD_RT_DEFAULT_PRIO 80 // above irq threads' default of 50
+#define RHD_RT_STACK_PREFAULT (256 * 1024)
+
+typedef struct rhd_rt_cfg {
+	int priority; // SCHED_FIFO, 1-99
+	int cpu; // core to pin acquisition to, -1 = rhd_rt_pick_cpu
+} rhd_rt_cfg_t;
+
+// what rhd_rt_enter changed, so rhd_rt_exit can put it back
+typedef struct rhd_rt_state {
+	int policy;
+	struct sched_param param;
+	unsigned char cpus[128]; // cpu_set_t, opaque so includers don't need _GNU_SOURCE
+	int have_sched;
+	int have_cpus;
+} rhd_rt_state_t;
+
+int rhd_rt_lock_memory(void);
+int rhd_rt_pick_cpu(void);
+void rhd_rt_prefault(void *buf, size_t len);
+void rhd_rt_prefault_stack(void);
+int rhd_rt_enter(rhd_rt_state_t *st, const rhd_rt_cfg_t *cfg, int cpu, const char *who);
+void rhd_rt_exit(rhd_rt_state_t *st);
+
+#endif
@@ -0,0 +1,212 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rhd_shm.h"
+
+_Static_assert(sizeof(rhd_shm_header_t) <= RHD_SHM_HEADER_LEN, "header must fit in RHD_SHM_HEADER_LEN");
+_Static_assert(offsetof(rhd_shm_header_t, head) == 64, "head must start the second cache line");
+_Static_assert(sizeof(rhd_shm_slot_t) == 24, "slot header must be 24 bytes");
+
+#define SLOT_ALIGN 64
+
+// shm_open wants "/name"
+static void shm_path(char *out, size_t max_len, const char *name) {
+	snprintf(out, max_len, "%s%s", (name[0] == '/') ? "" : "/", name);
+}
+
+static inline rhd_shm_slot_t *slot_at(const rhd_shm_header_t *hdr, uint64_t i) {
+	return (rhd_shm_slot_t*) ((uint8_t*) hdr + hdr->header_len + (i & (hdr->n_slots - 1)) * hdr->slot_len);
+}
+
+// creates /dev/shm/name (replacing one left by an earlier run) with
+// n_slots rounded up to a power of 2
+int rhd_shm_create(rhd_shm_t *shm, const char *name, size_t n_slots, size_t n_chs, uint64_t active_chs_msk, uint32_t srate, uint32_t flags) {
+	size_t cap = 1;
+	size_t slot_len;
+	rhd_shm_header_t *hdr;
+	int fd;
+
+	memset(shm, 0, sizeof(*shm));
+	if (n_chs == 0 || n_chs > RHD_SHM_MAX_CHS) {
+		return -1;
+	}
+	while (cap < n_slots) {
+		cap <<= 1;
+	}
+	// 16 chs fill exactly one cache line
+	slot_len = (sizeof(rhd_shm_slot_t) + n_chs * sizeof(uint16_t) + SLOT_ALIGN - 1) & ~(size_t) (SLOT_ALIGN - 1);
+	shm->map_len = RHD_SHM_HEADER_LEN + cap * slot_len;
+
+	shm_path(shm->name, sizeof(shm->name), name);
+	// readers still mapping an old ring keep it, new ones get this one
+	shm_unlink(shm->name);
+	fd = shm_open(shm->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd == -1) {
+		printf("ERROR: shm: could not create %s: %s\n", shm->name, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(fd, shm->map_len) == -1) {
+		printf("ERROR: shm: could not size %s: %s\n", shm->name, strerror(errno));
+		close(fd);
+		shm_unlink(shm->name);
+		return -1;
+	}
+	hdr = (rhd_shm_header_t*) mmap(NULL, shm->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		shm_unlink(shm->name);
+		return -1;
+	}
+
+	// ftruncate zero filled it, so every gen starts out "no frame"
+	hdr->version = RHD_SHM_VERSION;
+	hdr->n_chs = n_chs;
+	hdr->srate_hz = srate;
+	hdr->active_chs_msk = active_chs_msk;
+	hdr->n_slots = cap;
+	hdr->slot_len = slot_len;
+	hdr->header_len = RHD_SHM_HEADER_LEN;
+	hdr->flags = flags;
+	hdr->producer_pid = getpid();
+	atomic_thread_fence(memory_order_release);
+	// readers check magic last
+	memcpy(hdr->magic, RHD_SHM_MAGIC, sizeof(hdr->magic));
+	shm->hdr = hdr;
+	printf("INFO: shm: publishing frames to /dev/shm%s, %zu slots of %zu bytes\n", shm->name, cap, slot_len);
+	return 0;
+}
+
+// never waits, a slot is overwritten whether or not readers have seen it
+void rhd_shm_publish(rhd_shm_t *shm, uint64_t seq, int64_t t_ns, const uint16_t *samples) {
+	rhd_shm_header_t *hdr = shm->hdr;
+	uint64_t i = shm->head;
+	rhd_shm_slot_t *slot = slot_at(hdr, i);
+
+	atomic_store_explicit(&slot->gen, 2 * i + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot->seq = seq;
+	slot->t_ns = t_ns;
+	memcpy(slot->data, samples, hdr->n_chs * sizeof(uint16_t));
+	atomic_store_explicit(&slot->gen, 2 * i + 2, memory_order_release);
+	shm->head = i + 1;
+	atomic_store_explicit(&hdr->head, i + 1, memory_order_release);
+}
+
+// marks the ring closed and unlinks it. readers that have it mapped can
+// still read what's left.
+void rhd_shm_close(rhd_shm_t *shm) {
+	if (!shm->hdr) {
+		return;
+	}
+	atomic_store_explicit(&shm->hdr->closed, 1, memory_order_release);
+	munmap(shm->hdr, shm->map_len);
+	shm_unlink(shm->name);
+	shm->hdr = NULL;
+}
+
+// maps an existing ring read-only, starting at the newest frame
+int rhd_shm_reader_open(rhd_shm_reader_t *rd, const char *name) {
+	char path[64];
+	struct stat st;
+	const rhd_shm_header_t *hdr;
+	int fd;
+
+	memset(rd, 0, sizeof(*rd));
+	shm_path(path, sizeof(path), name);
+	fd = shm_open(path, O_RDONLY, 0);
+	if (fd == -1) {
+		return -1;
+	}
+	if (fstat(fd, &st) == -1 || (size_t) st.st_size < RHD_SHM_HEADER_LEN) {
+		close(fd);
+		return -1;
+	}
+	hdr = (const rhd_shm_header_t*) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		return -1;
+	}
+	if (memcmp(hdr->magic, RHD_SHM_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->version != RHD_SHM_VERSION ||
+		hdr->header_len + (size_t) hdr->n_slots * hdr->slot_len > (size_t) st.st_size) {
+		munmap((void*) hdr, st.st_size);
+		return -1;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	rd->hdr = hdr;
+	rd->map_len = st.st_size;
+	rd->next = atomic_load_explicit(&((rhd_shm_header_t*) hdr)->head, memory_order_acquire);
+	return 0;
+}
+
+// next frame in place, or NULL if there is none yet. frames the reader
+// fell too far behind for are skipped and counted in n_dropped. the slot
+// must be handed back with rhd_shm_release before the next peek.
+const rhd_shm_slot_t *rhd_shm_peek(rhd_shm_reader_t *rd) {
+	rhd_shm_header_t *hdr = (rhd_shm_header_t*) rd->hdr;
+
+	while (1) {
+		uint64_t head = atomic_load_explicit(&hdr->head, memory_order_acquire);
+		rhd_shm_slot_t *slot;
+		if (rd->next >= head) {
+			return NULL;
+		}
+		// the slot at head - n_slots may already be being overwritten,
+		// the gen check below catches that
+		if (head - rd->next > hdr->n_slots) {
+			rd->n_dropped += head - hdr->n_slots - rd->next;
+			rd->next = head - hdr->n_slots;
+		}
+		slot = slot_at(hdr, rd->next);
+		if (atomic_load_explicit(&slot->gen, memory_order_acquire) == 2 * rd->next + 2) {
+			return slot;
+		}
+		rd->n_dropped++;
+		rd->next++;
+	}
+}
+
+// 0 if the slot from rhd_shm_peek was intact the whole time it was used,
+// -1 if the producer overwrote it meanwhile (counted as dropped)
+int rhd_shm_release(rhd_shm_reader_t *rd, const rhd_shm_slot_t *slot) {
+	uint64_t want = 2 * rd->next + 2;
+	rd->next++;
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&((rhd_shm_slot_t*) slot)->gen, memory_order_relaxed) != want) {
+		rd->n_dropped++;
+		return -1;
+	}
+	rd->n_read++;
+	return 0;
+}
+
+// copies the next frame out. returns 1 if a frame was read, 0 if none is
+// available yet, -1 once the producer has closed and everything is read.
+int rhd_shm_read(rhd_shm_reader_t *rd, uint64_t *seq, int64_t *t_ns, uint16_t *samples) {
+	const rhd_shm_slot_t *slot;
+
+	while ((slot = rhd_shm_peek(rd))) {
+		*seq = slot->seq;
+		*t_ns = slot->t_ns;
+		memcpy(samples, slot->data, rd->hdr->n_chs * sizeof(uint16_t));
+		if (rhd_shm_release(rd, slot) == 0) {
+			return 1;
+		}
+	}
+	if (atomic_load_explicit(&((rhd_shm_header_t*) rd->hdr)->closed, memory_order_acquire)) {
+		// head is final once closed, make sure nothing was published in between
+		return rhd_shm_peek(rd) ? 0 : -1;
+	}
+	return 0;
+}
+
+void rhd_shm_reader_close(rhd_shm_reader_t *rd) {
+	if (rd->hdr) {
+		munmap((void*) rd->hdr, rd->map_len);
+		rd->hdr = NULL;
+	}
+}
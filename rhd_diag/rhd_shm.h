@@ -0,0 +1,102 @@
+/*
+Shared-memory frame ring for local consumers (--stream --shm NAME).
+
+The stream writer (rhd_stream.h, rhd_multi.h) publishes every logged
+frame into a POSIX shared-memory object, /dev/shm/NAME. Any number of
+reader processes map it read-only and follow along without a socket
+and without the producer ever waiting on them: a reader that falls more
+than n_slots frames behind is overwritten and told exactly how many
+frames it lost.
+
+Layout: an rhd_shm_header_t, then n_slots slots of slot_len bytes, each
+an rhd_shm_slot_t followed by n_chs int16 samples (channel order as in
+the datalog, rhd_dlog.h). Frame i (counting frames published, not
+frame seq, which has gaps if the acquisition ring overflowed) goes in
+slot i % n_slots.
+
+Each slot is a seqlock keyed on i: the producer sets gen to 2i + 1,
+writes the frame, then sets gen to 2i + 2 and advances head to i + 1.
+A reader wanting frame i checks gen == 2i + 2, uses the slot in place,
+and checks gen again afterwards; if it changed the frame was
+overwritten meanwhile and is counted as dropped. rhd_shm_peek and
+rhd_shm_release expose that zero-copy path, rhd_shm_read copies.
+
+Python reader: postprocess/rhdutil_shm_reader.py
+
+Usage:
+	producer:
+		rhd_shm_t shm;
+		rhd_shm_create(&shm, "rhd_frames", RHD_SHM_DEFAULT_SLOTS, n_chs, active_chs_msk, srate, flags);
+		rhd_shm_publish(&shm, frame.seq, frame.t_ns, frame.data);
+		rhd_shm_close(&shm);
+	reader:
+		rhd_shm_reader_t rd;
+		rhd_shm_reader_open(&rd, "rhd_frames");
+		while ((ret = rhd_shm_read(&rd, &seq, &t_ns, samples)) >= 0) {
+			if (ret == 0) usleep(1000);
+		}
+		rhd_shm_reader_close(&rd);
+	or see rhd_shm_tail.c (make rhd_shm_tail)
+*/
+#ifndef RHD_SHM_H
+#define RHD_SHM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define RHD_SHM_MAGIC "RHDSHM\0\0"
+#define RHD_SHM_VERSION 1
+#define RHD_SHM_HEADER_LEN 128
+#define RHD_SHM_DEFAULT_SLOTS (1 << 14) // 1.6 s at 10 kHz, 1 MiB at 16 chs
+#define RHD_SHM_MAX_CHS 64
+
+typedef struct rhd_shm_header {
+	char magic[8];
+	uint16_t version;
+	uint16_t n_chs;
+	uint32_t srate_hz;
+	uint64_t active_chs_msk; // chip i in bits 16i..16i+15
+	uint32_t n_slots; // power of 2
+	uint32_t slot_len; // bytes, multiple of 64
+	uint32_t header_len; // offset of slot 0
+	uint32_t flags; // RHD_DLOG_FLAG_FILTERED
+	int32_t producer_pid;
+	_Atomic uint32_t closed; // set once the producer is done
+	uint8_t reserved[16];
+	_Alignas(64) _Atomic uint64_t head; // frames published so far
+} rhd_shm_header_t;
+
+typedef struct rhd_shm_slot {
+	_Atomic uint64_t gen; // 2i + 1 while frame i is written, 2i + 2 once complete
+	uint64_t seq; // rhd_frame_t.seq
+	int64_t t_ns; // CLOCK_MONOTONIC issue time
+	uint16_t data[]; // n_chs samples
+} rhd_shm_slot_t;
+
+typedef struct rhd_shm {
+	char name[64];
+	rhd_shm_header_t *hdr;
+	size_t map_len;
+	uint64_t head; // producer's copy of hdr->head
+} rhd_shm_t;
+
+typedef struct rhd_shm_reader {
+	const rhd_shm_header_t *hdr;
+	size_t map_len;
+	uint64_t next; // next frame index to read
+	uint64_t n_read;
+	uint64_t n_dropped; // overwritten before this reader got to them
+} rhd_shm_reader_t;
+
+int rhd_shm_create(rhd_shm_t *shm, const char *name, size_t n_slots, size_t n_chs, uint64_t active_chs_msk, uint32_t srate, uint32_t flags);
+void rhd_shm_publish(rhd_shm_t *shm, uint64_t seq, int64_t t_ns, const uint16_t *samples);
+void rhd_shm_close(rhd_shm_t *shm);
+
+int rhd_shm_reader_open(rhd_shm_reader_t *rd, const char *name);
+const rhd_shm_slot_t *rhd_shm_peek(rhd_shm_reader_t *rd);
+int rhd_shm_release(rhd_shm_reader_t *rd, const rhd_shm_slot_t *slot);
+int rhd_shm_read(rhd_shm_reader_t *rd, uint64_t *seq, int64_t *t_ns, uint16_t *samples);
+void rhd_shm_reader_close(rhd_shm_reader_t *rd);
+
+#endif
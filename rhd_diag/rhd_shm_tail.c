@@ -0,0 +1,83 @@
+/*
+Minimal reader for the --shm frame ring (rhd_shm.h), also a template
+for C consumers. Follows the ring until the producer stops (or N frames
+are read) and prints once a second how many frames were read and
+dropped, the last frame seq, and how long after being issued on the SPI
+bus frames reached this process.
+
+Usage:
+Run from rhd_diag directory
+	make rhd_shm_tail
+	./build/rhd2216_util --config --calibrate --stream --active_chs 0x000f --srate 5000 --shm rhd_frames
+	./build/rhd_shm_tail rhd_frames [N]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "rhd2216_lib.h"
+#include "rhd_shm.h"
+
+#define TAIL_POLL_US 500
+
+static void print_line(const rhd_shm_reader_t *rd, uint64_t seq, int64_t max_latency_ns) {
+	printf("frames read %llu, dropped %llu, last seq %llu, max latency %.1f us\n",
+		(unsigned long long) rd->n_read,
+		(unsigned long long) rd->n_dropped,
+		(unsigned long long) seq,
+		max_latency_ns / 1e3);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+	rhd_shm_reader_t rd;
+	uint16_t samples[RHD_SHM_MAX_CHS];
+	uint64_t seq = 0;
+	int64_t t_ns;
+	int64_t max_latency_ns = 0;
+	uint64_t n_max = 0;
+	int64_t next_print_ns;
+	int ret;
+
+	if (argc < 2) {
+		printf("Usage: %s NAME [N]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2) {
+		n_max = strtoull(argv[2], NULL, 10);
+	}
+	if (rhd_shm_reader_open(&rd, argv[1]) == -1) {
+		printf("ERROR: could not open frame ring %s, is rhd2216_util running with --shm?\n", argv[1]);
+		return 1;
+	}
+	printf("INFO: %s: %u chs at %u Hz, mask 0x%llx, %u slots\n",
+		argv[1],
+		rd.hdr->n_chs,
+		rd.hdr->srate_hz,
+		(unsigned long long) rd.hdr->active_chs_msk,
+		rd.hdr->n_slots);
+
+	next_print_ns = rhd_now_ns() + 1000000000LL;
+	while (!(n_max && rd.n_read >= n_max)) {
+		ret = rhd_shm_read(&rd, &seq, &t_ns, samples);
+		if (ret == -1) {
+			break;
+		}
+		if (ret == 1) {
+			int64_t latency_ns = rhd_now_ns() - t_ns;
+			if (latency_ns > max_latency_ns) {
+				max_latency_ns = latency_ns;
+			}
+		} else {
+			usleep(TAIL_POLL_US);
+		}
+		if (rhd_now_ns() >= next_print_ns) {
+			print_line(&rd, seq, max_latency_ns);
+			max_latency_ns = 0;
+			next_print_ns += 1000000000LL;
+		}
+	}
+	print_line(&rd, seq, max_latency_ns);
+	rhd_shm_reader_close(&rd);
+	return 0;
+}
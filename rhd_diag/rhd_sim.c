@@ -0,0 +1,423 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rhd_sim.h"
+
+#define SIM_NUM_REGS 64
+#define SIM_NUM_AMPS 16
+#define SIM_PIPELINE_DEPTH 2
+#define SIM_VLSB 0.195e-6 // V per LSB of amplifier channels
+#define SIM_ZCHECK_DAC_V_PER_LSB (1.225 / 256)
+
+typedef struct rhd_sim {
+	uint8_t regs[SIM_NUM_REGS];
+	uint16_t pipe[SIM_PIPELINE_DEPTH]; // results not yet clocked out
+	int cal_busy; // commands left until calibration finishes
+	int calibrated;
+	uint32_t speed;
+	double srate;
+	uint64_t seed; // rng state after reset, differs per device name
+	uint64_t rng;
+
+	// MISO bit errors, see rhd_sim_set_link_errors. own rng, so the
+	// waveforms don't change with them
+	double ber;
+	uint32_t ber_above_speed;
+	uint64_t err_rng;
+	uint64_t bits_to_err; // MISO bits until the next flipped one
+	uint64_t n_bit_errs;
+
+	// per amplifier channel waveform state
+	uint64_t n[SIM_NUM_AMPS]; // number of conversions so far
+	double dc_lsb[SIM_NUM_AMPS]; // electrode offset
+	double adc_offset_lsb[SIM_NUM_AMPS]; // removed by calibration
+	double burst_amp_lsb[SIM_NUM_AMPS];
+	double burst_period_s[SIM_NUM_AMPS];
+	double burst_duty[SIM_NUM_AMPS];
+	double burst_phase[SIM_NUM_AMPS];
+	double lp1[SIM_NUM_AMPS]; // noise shaping filter states
+	double lp2[SIM_NUM_AMPS];
+	double hpf[SIM_NUM_AMPS]; // DSP offset removal state
+
+	// electrode seen by the Zcheck current: z_rs in series with
+	// z_rct || z_cdl. own rng, so the waveforms don't change with them
+	double z_rs[SIM_NUM_AMPS];
+	double z_rct[SIM_NUM_AMPS];
+	double z_cdl[SIM_NUM_AMPS];
+	int zc_ch; // channel zc_* is for, -1 after a reg 5/7 write
+	uint8_t zc_dac; // DAC value at its previous conversion
+	double zc_vc; // voltage across z_cdl
+} rhd_sim_t;
+
+// DSP high-pass cutoff / srate, indexed by reg 4 bits [3:0]. from datasheet
+static const double dsp_cutoff_ratio[16] = {
+	0, 0.1103, 0.04579, 0.02125, 0.01027, 0.005053, 0.002506, 0.001248,
+	0.0006229, 0.0003112, 0.0001555, 0.00007773, 0.00003886, 0.00001943,
+	0.000009714, 0.000004857,
+};
+
+static const uint8_t sim_rom[SIM_NUM_REGS] = {
+	[40] = 'I', [41] = 'N', [42] = 'T', [43] = 'A', [44] = 'N',
+	[60] = 1, // die revision
+	[61] = 0, // bipolar amplifiers
+	[62] = SIM_NUM_AMPS,
+	[63] = 2, // RHD2216
+};
+
+static uint64_t xorshift64s(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t sim_rand_u64(rhd_sim_t *sim) {
+	return xorshift64s(&sim->rng);
+}
+
+static double sim_rand_uniform(rhd_sim_t *sim) {
+	return (sim_rand_u64(sim) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double sim_rand_gauss(rhd_sim_t *sim) {
+	// Box-Muller, second value dropped to keep state simple
+	double u1 = sim_rand_uniform(sim);
+	double u2 = sim_rand_uniform(sim);
+	if (u1 < 1e-300) {
+		u1 = 1e-300;
+	}
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static void sim_reset(rhd_sim_t *sim) {
+	memset(sim->regs, 0, sizeof(sim->regs));
+	memcpy(sim->regs, sim_rom, sizeof(sim_rom));
+	memset(sim->pipe, 0, sizeof(sim->pipe));
+	sim->cal_busy = 0;
+	sim->calibrated = 0;
+	sim->rng = sim->seed;
+
+	for (int ch=0; ch<SIM_NUM_AMPS; ++ch) {
+		sim->n[ch] = 0;
+		sim->dc_lsb[ch] = (sim_rand_uniform(sim) - 0.5) * 4000.0;
+		sim->adc_offset_lsb[ch] = (sim_rand_uniform(sim) - 0.5) * 200.0;
+		// 100-600 uV bursts
+		sim->burst_amp_lsb[ch] = (100e-6 + 500e-6 * sim_rand_uniform(sim)) / SIM_VLSB;
+		sim->burst_period_s[ch] = 1.0 + 2.0 * sim_rand_uniform(sim);
+		sim->burst_duty[ch] = 0.2 + 0.3 * sim_rand_uniform(sim);
+		sim->burst_phase[ch] = sim_rand_uniform(sim);
+		sim->lp1[ch] = 0;
+		sim->lp2[ch] = 0;
+		sim->hpf[ch] = 0;
+	}
+
+	// wet surface electrodes, at 1 kHz 1.7-8 kOhm and -55 to -86 deg
+	// ("sim" gets 1.7-7.3 kOhm, -63 to -84 deg)
+	uint64_t z_rng = (sim->seed ^ 0xd1b54a32d192ed03ULL) | 1;
+	for (int ch=0; ch<SIM_NUM_AMPS; ++ch) {
+		sim->z_rs[ch] = 200.0 + 800.0 * (xorshift64s(&z_rng) >> 11) * (1.0 / 9007199254740992.0);
+		sim->z_rct[ch] = 20e3 + 180e3 * (xorshift64s(&z_rng) >> 11) * (1.0 / 9007199254740992.0);
+		sim->z_cdl[ch] = 20e-9 + 80e-9 * (xorshift64s(&z_rng) >> 11) * (1.0 / 9007199254740992.0);
+	}
+	sim->zc_ch = -1;
+	sim->zc_vc = 0;
+}
+
+// raw amplifier output in LSB, before DSP and output formatting
+static double sim_emg_sample(rhd_sim_t *sim, int ch) {
+	double t = sim->n[ch] / sim->srate;
+	double p = fmod(t / sim->burst_period_s[ch] + sim->burst_phase[ch], 1.0);
+	double env = 0;
+	if (p < sim->burst_duty[ch]) {
+		double s = sin(M_PI * p / sim->burst_duty[ch]);
+		env = s * s;
+	}
+
+	// band-limit white noise to roughly 20-250 Hz, the sEMG band
+	double a_lo = 1.0 - exp(-2.0 * M_PI * 250.0 / sim->srate);
+	double a_hi = 1.0 - exp(-2.0 * M_PI * 20.0 / sim->srate);
+	double w = sim_rand_gauss(sim);
+	sim->lp1[ch] += a_lo * (w - sim->lp1[ch]);
+	sim->lp2[ch] += a_hi * (sim->lp1[ch] - sim->lp2[ch]);
+	double emg = (sim->lp1[ch] - sim->lp2[ch]) * 2.0;
+
+	double baseline_noise = 5e-6 / SIM_VLSB * sim_rand_gauss(sim);
+	double mains = 15e-6 / SIM_VLSB * sin(2.0 * M_PI * 60.0 * t);
+
+	return sim->dc_lsb[ch] + env * sim->burst_amp_lsb[ch] * emg
+		+ baseline_noise + mains;
+}
+
+// electrode voltage in LSB on the Zcheck selected channel: the DAC step
+// since its last conversion through the series capacitor (reg 5 scale),
+// spread over 1/srate, into the electrode model
+static double sim_zcheck_sample(rhd_sim_t *sim, int ch) {
+	static const double cap_f[4] = { 0.1e-12, 1e-12, 0, 10e-12 };
+	double dt = 1.0 / sim->srate;
+
+	if (sim->zc_ch != ch) {
+		sim->zc_ch = ch;
+		sim->zc_dac = sim->regs[6];
+		sim->zc_vc = 0;
+	}
+	double i = cap_f[(sim->regs[5] >> 3) & 0b11] * ((int) sim->regs[6] - sim->zc_dac) * SIM_ZCHECK_DAC_V_PER_LSB / dt;
+	double a = exp(-dt / (sim->z_rct[ch] * sim->z_cdl[ch]));
+	sim->zc_dac = sim->regs[6];
+	sim->zc_vc = a * sim->zc_vc + (1.0 - a) * sim->z_rct[ch] * i;
+	return (i * sim->z_rs[ch] + sim->zc_vc) / SIM_VLSB;
+}
+
+static uint16_t sim_format(rhd_sim_t *sim, double x) {
+	int twoscomp = (sim->regs[4] >> 6) & 0b1;
+	long v = lround(x);
+	if (v > 32767) {
+		v = 32767;
+	} else if (v < -32768) {
+		v = -32768;
+	}
+	if (!twoscomp) {
+		v += 32768;
+	}
+	return (uint16_t) v;
+}
+
+static uint16_t sim_convert(rhd_sim_t *sim, uint8_t ch, int h_flag) {
+	if (ch < SIM_NUM_AMPS) {
+		int powered = (sim->regs[14 + ch / 8] >> (ch % 8)) & 0b1;
+		double x = powered ? sim_emg_sample(sim, ch) : 0;
+		// Zcheck enabled with the DAC powered, and ch selected
+		if (powered && (sim->regs[5] & 0b1) && ((sim->regs[5] >> 6) & 0b1) && (sim->regs[7] & 0x3f) == ch) {
+			x += sim_zcheck_sample(sim, ch);
+		}
+		if (!sim->calibrated) {
+			x += sim->adc_offset_lsb[ch];
+		}
+		sim->n[ch]++;
+
+		// first order high pass when DSPen (reg 4 bit 4) is set.
+		// H flag resets the filter to the current input.
+		if ((sim->regs[4] >> 4) & 0b1) {
+			double k = 2.0 * M_PI * dsp_cutoff_ratio[sim->regs[4] & 0xf];
+			if (h_flag) {
+				sim->hpf[ch] = x;
+			}
+			double y = x - sim->hpf[ch];
+			sim->hpf[ch] = (k == 0) ? x : sim->hpf[ch] + k * y;
+			x = y;
+		}
+		return sim_format(sim, x);
+	}
+
+	// aux inputs and supply sensor are always unsigned
+	switch (ch) {
+	case 32:
+	case 33:
+	case 34:
+		return 0x8000 + (uint16_t) (sim_rand_u64(sim) & 0x1f);
+	case 48:
+		// Vdd = result * 74.8 uV * 4, assume 3.3 V supply
+		return (uint16_t) (3.3 / (74.8e-6 * 4));
+	case 63:
+		return sim_format(sim, 0);
+	default:
+		return 0;
+	}
+}
+
+// executes one command word and returns the result it will produce
+static uint16_t sim_execute(rhd_sim_t *sim, uint8_t b0, uint8_t b1) {
+	uint8_t arg = b0 & 0x3f;
+
+	if (sim->cal_busy > 0) {
+		if (--sim->cal_busy == 0) {
+			sim->calibrated = 1;
+		}
+		return 0;
+	}
+
+	switch (b0 >> 6) {
+	case 0b00:
+		return sim_convert(sim, arg, b1 & 0b1);
+	case 0b01:
+		if (b0 == 0b01010101) {
+			sim->cal_busy = RHD_SIM_CAL_BUSY_CMDS;
+		} else if (b0 == 0b01101010) {
+			sim->calibrated = 0;
+		}
+		return 0;
+	case 0b10:
+		if (arg <= 17) {
+			sim->regs[arg] = b1;
+		}
+		if (arg == 5 || arg == 7) {
+			sim->zc_ch = -1;
+		}
+		return 0xff00 | b1;
+	default:
+		return sim->regs[arg];
+	}
+}
+
+// geometric gap to the next flipped bit at bit error rate ber
+static uint64_t sim_err_gap(rhd_sim_t *sim) {
+	double u = ((xorshift64s(&sim->err_rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+	double gap = log(u) / log1p(-sim->ber);
+	return (gap < 1e18) ? (uint64_t) gap : (uint64_t) 1e18;
+}
+
+// flips MISO bits of one word at the configured rate, if the clock is
+// above ber_above_speed. commands (MOSI) always arrive intact.
+static uint16_t sim_link_errors(rhd_sim_t *sim, uint16_t out) {
+	if (sim->ber <= 0 || sim->speed <= sim->ber_above_speed) {
+		return out;
+	}
+	while (sim->bits_to_err < 16) {
+		out ^= (uint16_t) (0x8000 >> sim->bits_to_err);
+		sim->n_bit_errs++;
+		sim->bits_to_err += 1 + sim_err_gap(sim);
+	}
+	sim->bits_to_err -= 16;
+	return out;
+}
+
+static void sim_word(rhd_sim_t *sim, uint8_t *tx, uint8_t *rx) {
+	uint16_t out = sim_link_errors(sim, sim->pipe[0]);
+	for (int i=0; i<SIM_PIPELINE_DEPTH-1; ++i) {
+		sim->pipe[i] = sim->pipe[i+1];
+	}
+	sim->pipe[SIM_PIPELINE_DEPTH-1] = sim_execute(sim, tx[0], tx[1]);
+	rx[0] = out >> 8;
+	rx[1] = out & 0xff;
+}
+
+// FNV-1a of whatever follows "sim" in the device name, so "sim" keeps its
+// original waveforms and "sim1", "sim2", ... each get their own.
+static uint64_t sim_seed(const char *device) {
+	uint64_t h = 0;
+	const char *p = device + strlen(RHD_SPI_SIM_PREFIX);
+	if (*p) {
+		h = 0xcbf29ce484222325ULL;
+		for (; *p; ++p) {
+			h ^= (uint8_t) *p;
+			h *= 0x100000001b3ULL;
+		}
+	}
+	return 0x9e3779b97f4a7c15ULL ^ h;
+}
+
+static int sim_open(rhd_spi_t *spi, const char *device) {
+	rhd_sim_t *sim = (rhd_sim_t*) calloc(1, sizeof(rhd_sim_t));
+	if (!sim) {
+		return -1;
+	}
+	sim->srate = RHD_SIM_DEFAULT_SRATE;
+	sim->seed = sim_seed(device);
+	sim_reset(sim);
+	spi->priv = sim;
+	spi->fd = -1;
+	printf("INFO: using simulated RHD2216 (%s)\n", device);
+	return 0;
+}
+
+static int sim_config(rhd_spi_t *spi, uint8_t mode, uint8_t bpw, uint32_t speed) {
+	rhd_sim_t *sim = (rhd_sim_t*) spi->priv;
+	sim->speed = speed;
+	spi->mode = mode;
+	spi->bpw = bpw;
+	spi->speed = speed;
+	printf("resulting sim SPI config:\n");
+	printf("spi mode: %d\n", mode);
+	printf("bits per word: %d\n", bpw);
+	printf("max speed: %d Hz (%d MHz)\n", speed, speed/1000000);
+	printf("\n");
+	return 0;
+}
+
+// one CS cycle. RHD only acts on complete 16-bit words.
+static int sim_xfer(rhd_spi_t *spi, uint8_t *tx_buf, size_t tx_len, uint8_t *rx_buf) {
+	rhd_sim_t *sim = (rhd_sim_t*) spi->priv;
+	if (tx_len < 2) {
+		return -1;
+	}
+	sim_word(sim, tx_buf, rx_buf);
+	memset(rx_buf + 2, 0, tx_len - 2);
+	return tx_len;
+}
+
+static int sim_xfer_words(rhd_spi_t *spi, uint8_t *tx_buf, uint8_t *rx_buf, size_t n_words) {
+	rhd_sim_t *sim = (rhd_sim_t*) spi->priv;
+	for (size_t i=0; i<n_words; ++i) {
+		sim_word(sim, tx_buf + 2*i, rx_buf + 2*i);
+	}
+	return 2 * n_words;
+}
+
+// same words as sim_xfer_words, but sleeps out each frame's gap against
+// an absolute clock like the kernel's delay_usecs, so a burst takes as
+// long as it would on the bus
+static int sim_xfer_frames(rhd_spi_t *spi, uint8_t *tx_buf, uint8_t *rx_buf, size_t words_per_frame, size_t n_frames, const uint16_t *gap_us) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	for (size_t f=0; f<n_frames; ++f) {
+		size_t w = f * words_per_frame;
+		sim_xfer_words(spi, tx_buf + 2*w, rx_buf + 2*w, words_per_frame);
+		if (gap_us[f] == 0) {
+			continue;
+		}
+		t.tv_nsec += (long) gap_us[f] * 1000;
+		while (t.tv_nsec >= 1000000000L) {
+			t.tv_nsec -= 1000000000L;
+			t.tv_sec++;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) {
+		}
+	}
+	return 2 * words_per_frame * n_frames;
+}
+
+static void sim_close(rhd_spi_t *spi) {
+	rhd_sim_t *sim = (rhd_sim_t*) spi->priv;
+	if (sim->ber > 0) {
+		printf("INFO: sim: flipped %llu MISO bits\n", (unsigned long long) sim->n_bit_errs);
+	}
+	free(spi->priv);
+	spi->priv = NULL;
+}
+
+const rhd_spi_backend_t rhd_sim_backend = {
+	.name = "rhd2216_sim",
+	.open = sim_open,
+	.config = sim_config,
+	.xfer = sim_xfer,
+	.xfer_words = sim_xfer_words,
+	.xfer_frames = sim_xfer_frames,
+	.close = sim_close,
+};
+
+int rhd_sim_set_srate(rhd_spi_t *spi, double srate) {
+	if (!rhd_sim_is_sim(spi) || srate <= 0) {
+		return -1;
+	}
+	((rhd_sim_t*) spi->priv)->srate = srate;
+	return 0;
+}
+
+int rhd_sim_is_sim(const rhd_spi_t *spi) {
+	return spi->backend == &rhd_sim_backend;
+}
+
+int rhd_sim_set_link_errors(rhd_spi_t *spi, double ber, uint32_t above_speed) {
+	rhd_sim_t *sim;
+	if (!rhd_sim_is_sim(spi) || ber < 0 || ber >= 1) {
+		return -1;
+	}
+	sim = (rhd_sim_t*) spi->priv;
+	sim->ber = ber;
+	sim->ber_above_speed = above_speed;
+	sim->err_rng = sim->seed ^ 0xd1b54a32d192ed03ULL;
+	sim->bits_to_err = (ber > 0) ? sim_err_gap(sim) : 0;
+	return 0;
+}
@@ -0,0 +1,48 @@
+/*
+Software model of the RHD2216, usable anywhere an rhd_spi_t is expected.
+Open with rhd_spi_open(&spi, "sim") to get it instead of a spidev device.
+Each distinct name ("sim1", "sim2", ...) gets its own synthetic waveforms.
+
+Models:
+* CONVERT(C) for amplifier chs 0-15, aux inputs 32-34, supply sensor 48
+  and ADC ground 63, including the DSP offset removal H flag.
+* CALIBRATE (9 command busy period) and CLEAR.
+* register WRITE/READ for regs 0-17 and the read-only ID regs 40-44, 60-63.
+* the 2-command result pipeline: each word returns the result of the
+  command sent two words earlier.
+* reg 4 twoscomp bit and DSP high-pass cutoff, regs 14-15 amplifier power.
+* the Zcheck circuit (regs 5-7): DAC steps through the series capacitor
+  into a per-channel electrode model (R in series with R || C, 1.7-8
+  kOhm at 1 kHz), added to the selected amplifier channel on top of its
+  EMG and mains. Against the model's impedance, --zcheck at 1 kHz reads
+  within 3.3% and 2.1 deg on channels it doesn't mark noisy, and within
+  5.5% and 3.3 deg on those it does (worst of "sim", "sim1"-"sim3", 1-2
+  of 16 channels mid EMG burst each).
+* optionally, a marginal link: random MISO bit flips above some SPI clock
+  (rhd_sim_set_link_errors), to exercise --link_check.
+
+Amplifier channels produce synthetic surface EMG: band-limited gaussian
+noise gated by periodic contraction bursts, a per-channel electrode DC
+offset and 60 Hz mains pickup. The waveform time base advances by
+1/srate per conversion of a channel, so it runs at full CPU speed.
+
+Usage:
+	./build/rhd2216_util --device sim --config --calibrate --convert 1000
+*/
+#ifndef RHD_SIM_H
+#define RHD_SIM_H
+
+#include "rhd_spi.h"
+
+#define RHD_SIM_DEFAULT_SRATE 1000.0 // Hz, per channel time base
+#define RHD_SIM_CAL_BUSY_CMDS 9 // commands ignored after CALIBRATE
+
+// set per channel sample rate used to generate waveforms
+int rhd_sim_set_srate(rhd_spi_t *spi, double srate);
+// flip each MISO bit with probability ber while the clock is above
+// above_speed Hz
+int rhd_sim_set_link_errors(rhd_spi_t *spi, double ber, uint32_t above_speed);
+// returns 1 if spi is backed by the device model
+int rhd_sim_is_sim(const rhd_spi_t *spi);
+
+#endif
@@ -0,0 +1,48 @@
+#include <string.h>
+#include <unistd.h>
+#include "rhd_spi.h"
+
+// picks backend from device name. anything starting with "sim" uses the
+// software RHD2216 model, everything else is treated as a spidev path.
+int rhd_spi_open(rhd_spi_t *spi, const char *device) {
+	memset(spi, 0, sizeof(*spi));
+	spi->fd = -1;
+	if (strncmp(device, RHD_SPI_SIM_PREFIX, strlen(RHD_SPI_SIM_PREFIX)) == 0) {
+		spi->backend = &rhd_sim_backend;
+	} else {
+		spi->backend = &pi_spi_backend;
+	}
+	return spi->backend->open(spi, device);
+}
+
+int rhd_spi_config(rhd_spi_t *spi, uint8_t mode, uint8_t bpw, uint32_t speed) {
+	return spi->backend->config(spi, mode, bpw, speed);
+}
+
+// rx buf must have same size as tx buf
+// result stored in rx_buf
+int rhd_spi_xfer(rhd_spi_t *spi, uint8_t *tx_buf, size_t tx_len, uint8_t *rx_buf) {
+	return spi->backend->xfer(spi, tx_buf, tx_len, rx_buf);
+}
+
+int rhd_spi_xfer_words(rhd_spi_t *spi, uint8_t *tx_buf, uint8_t *rx_buf, size_t n_words) {
+	return spi->backend->xfer_words(spi, tx_buf, rx_buf, n_words);
+}
+
+int rhd_spi_xfer_frames(rhd_spi_t *spi, uint8_t *tx_buf, uint8_t *rx_buf, size_t words_per_frame, size_t n_frames, const uint16_t *gap_us) {
+	return spi->backend->xfer_frames(spi, tx_buf, rx_buf, words_per_frame, n_frames, gap_us);
+}
+
+void rhd_spi_close(rhd_spi_t *spi) {
+	if (spi->backend) {
+		spi->backend->close(spi);
+	}
+	spi->backend = NULL;
+}
+
+// making a wrapper function because I don't want any dependent
+// libraries to use wiringPi functions (because it's only for pi).
+// -PV 2024-May-18
+void delay_us(unsigned long us) {
+	usleep(us);
+}
@@ -0,0 +1,70 @@
+/*
+SPI transport layer for the RHD2216 library.
+rhd2216_lib.c only talks to the chip through an rhd_spi_t, so the same
+acquisition code runs against a real /dev/spidev* device (pi_spi_lib.c)
+or the software device model (rhd_sim.c).
+
+Each rhd_spi_t carries its own backend state and config, so several
+devices can be open at once. Usually opened through rhd_dev_open (see
+rhd2216_lib.h) rather than directly.
+
+Usage:
+	rhd_spi_t spi;
+	rhd_spi_open(&spi, PI_SPI_0_0); // or "sim"
+	rhd_spi_config(&spi, 0, 8, 8000000);
+	rhd_spi_xfer_words(&spi, tx_buf, rx_buf, n_words);
+	rhd_spi_xfer_frames(&spi, tx_buf, rx_buf, words_per_frame, n_frames, gap_us);
+	rhd_spi_close(&spi);
+*/
+#ifndef RHD_SPI_H
+#define RHD_SPI_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef DEBUG
+#define DEBUG 0 // if nonzero, prints debug statements
+#endif
+
+// device name prefix that selects the simulated backend, e.g. "sim"
+#define RHD_SPI_SIM_PREFIX "sim"
+
+typedef struct rhd_spi rhd_spi_t;
+
+typedef struct rhd_spi_backend {
+	const char *name;
+	int (*open)(rhd_spi_t *spi, const char *device);
+	int (*config)(rhd_spi_t *spi, uint8_t mode, uint8_t bpw, uint32_t speed);
+	// single transfer, CS held for all tx_len bytes
+	int (*xfer)(rhd_spi_t *spi, uint8_t *tx_buf, size_t tx_len, uint8_t *rx_buf);
+	// n_words 16-bit words, CS toggled between each word
+	int (*xfer_words)(rhd_spi_t *spi, uint8_t *tx_buf, uint8_t *rx_buf, size_t n_words);
+	// n_frames frames of words_per_frame words, CS toggled between each
+	// word, bus held idle gap_us[f] after frame f so the controller paces
+	// frames instead of the caller
+	int (*xfer_frames)(rhd_spi_t *spi, uint8_t *tx_buf, uint8_t *rx_buf, size_t words_per_frame, size_t n_frames, const uint16_t *gap_us);
+	void (*close)(rhd_spi_t *spi);
+} rhd_spi_backend_t;
+
+struct rhd_spi {
+	const rhd_spi_backend_t *backend;
+	int fd; // -1 if backend has no file descriptor
+	void *priv; // backend specific state
+	// resulting config after rhd_spi_config
+	uint8_t mode;
+	uint8_t bpw;
+	uint32_t speed;
+};
+
+extern const rhd_spi_backend_t pi_spi_backend;
+extern const rhd_spi_backend_t rhd_sim_backend;
+
+int rhd_spi_open(rhd_spi_t *spi, const char *device);
+int rhd_spi_config(rhd_spi_t *spi, uint8_t mode, uint8_t bpw, uint32_t speed);
+int rhd_spi_xfer(rhd_spi_t *spi, uint8_t *tx_buf, size_t tx_len, uint8_t *rx_buf);
+int rhd_spi_xfer_words(rhd_spi_t *spi, uint8_t *tx_buf, uint8_t *rx_buf, size_t n_words);
+int rhd_spi_xfer_frames(rhd_spi_t *spi, uint8_t *tx_buf, uint8_t *rx_buf, size_t words_per_frame, size_t n_frames, const uint16_t *gap_us);
+void rhd_spi_close(rhd_spi_t *spi);
+void delay_us(unsigned long us);
+
+#endif
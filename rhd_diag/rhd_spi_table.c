@@ -0,0 +1,256 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "rhd_spi_table.h"
+#include "rhd_pacer.h"
+
+// ROM regs 40-44 read "INTAN" on every RHD2000 chip
+#define ROM_FIRST_REG 40
+#define ROM_ID "INTAN"
+#define ROM_CHECK_READS 20 // per register per clock
+
+// 8 and 12.5 MHz are what this tool has always used, 25 MHz is the
+// RHD2216 maximum
+const uint32_t rhd_spi_table_speeds[] = { 8000000, 10000000, 12500000, 16000000, 20000000, 25000000 };
+const size_t rhd_spi_table_n_speeds = sizeof(rhd_spi_table_speeds) / sizeof(rhd_spi_table_speeds[0]);
+
+// $HOME/RHD_SPI_TABLE_DIR/spi_<device with / as _>.txt, creating the
+// directory if needed
+int rhd_spi_table_path(const char *device, char *path, size_t len) {
+	const char *home = getenv("HOME");
+	char dir[256];
+	char name[64];
+	size_t n = 0;
+
+	if (!home || !*home) {
+		return -1;
+	}
+	for (const char *c=device; *c && n+1<sizeof(name); ++c) {
+		if (n == 0 && *c == '/') {
+			continue;
+		}
+		name[n++] = (*c == '/') ? '_' : *c;
+	}
+	name[n] = '\0';
+
+	snprintf(dir, sizeof(dir), "%s/.cache", home);
+	mkdir(dir, 0755);
+	snprintf(dir, sizeof(dir), "%s/%s", home, RHD_SPI_TABLE_DIR);
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+		return -1;
+	}
+	if ((size_t) snprintf(path, len, "%s/spi_%s.txt", dir, name) >= len) {
+		return -1;
+	}
+	return 0;
+}
+
+static int check_link(rhd_dev_t *dev) {
+	for (int i=0; i<ROM_CHECK_READS; ++i) {
+		for (size_t r=0; r<strlen(ROM_ID); ++r) {
+			uint8_t val;
+			if (rhd_reg_read(dev, ROM_FIRST_REG + r, &val) == -1 || val != (uint8_t) ROM_ID[r]) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+// sustained time per frame of words_per_frame words: amplifier CONVERTs
+// first, the rest filler aux slots, same as a real acquisition plan
+static double time_frames(rhd_dev_t *dev, size_t words_per_frame, size_t burst) {
+	rhd_acq_plan_t plan;
+	uint16_t no_gap[RHD_SPI_TABLE_BURST] = {0};
+	size_t n_chs = (words_per_frame < RHD_NUM_CHS) ? words_per_frame : RHD_NUM_CHS;
+	uint16_t msk = (uint16_t) ((1u << n_chs) - 1);
+	uint64_t n_frames = 0;
+	int64_t begin;
+	int64_t end;
+
+	if (rhd_acq_plan_init(&plan, msk, 0, words_per_frame - n_chs, burst) == -1) {
+		return 0;
+	}
+	begin = rhd_now_ns();
+	end = begin + (int64_t) (RHD_SPI_TABLE_SWEEP_SEC * 1e9);
+	do {
+		if (burst > 1) {
+			rhd_spi_xfer_frames(&dev->spi, plan.tx_buf, plan.rx_buf, words_per_frame, burst, no_gap);
+		} else {
+			rhd_acq_plan_run(dev, &plan, words_per_frame);
+		}
+		n_frames += burst;
+	} while (rhd_now_ns() < end);
+	end = rhd_now_ns();
+	rhd_acq_plan_free(&plan);
+	return (end - begin) / 1e9 / n_frames;
+}
+
+// sweeps every clock and frame size on dev, leaving dev at the clock it
+// started at. takes about n_speeds * 2 * RHD_SPI_TABLE_MAX_WORDS *
+// RHD_SPI_TABLE_SWEEP_SEC seconds.
+int rhd_spi_table_characterize(rhd_spi_table_t *table, rhd_dev_t *dev) {
+	uint8_t mode = dev->spi.mode;
+	uint8_t bpw = dev->spi.bpw;
+	uint32_t speed = dev->spi.speed;
+
+	memset(table, 0, sizeof(*table));
+	snprintf(table->device, sizeof(table->device), "%s", dev->name);
+	for (size_t s=0; s<rhd_spi_table_n_speeds && s<RHD_SPI_TABLE_MAX_SPEEDS; ++s) {
+		rhd_spi_table_row_t *row = &table->row[table->n_speeds];
+		if (rhd_spi_config(&dev->spi, mode, bpw, rhd_spi_table_speeds[s]) == -1) {
+			printf("WARNING: characterize: %s could not set %u Hz\n", dev->name, rhd_spi_table_speeds[s]);
+			continue;
+		}
+		row->speed = dev->spi.speed;
+		row->link_ok = check_link(dev);
+		for (size_t w=1; w<=RHD_SPI_TABLE_MAX_WORDS; ++w) {
+			row->frame_sec[w] = time_frames(dev, w, 1);
+			row->burst_frame_sec[w] = time_frames(dev, w, RHD_SPI_TABLE_BURST);
+		}
+		printf("INFO: characterize: %s %.1f MHz, link %s, 16 ch frame %.2f us (%.2f us in bursts)\n",
+			dev->name,
+			row->speed / 1e6,
+			row->link_ok ? "ok" : "BAD",
+			row->frame_sec[RHD_NUM_CHS] * 1e6,
+			row->burst_frame_sec[RHD_NUM_CHS] * 1e6);
+		table->n_speeds++;
+	}
+	rhd_spi_config(&dev->spi, mode, bpw, speed);
+	return table->n_speeds ? 0 : -1;
+}
+
+int rhd_spi_table_save(const rhd_spi_table_t *table, const char *path) {
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		return -1;
+	}
+	fprintf(f, "# rhd spi table v%d %s\n", RHD_SPI_TABLE_VERSION, table->device);
+	fprintf(f, "# speed_hz link_ok frame_us[1..%d words] burst_frame_us[1..%d words]\n", RHD_SPI_TABLE_MAX_WORDS, RHD_SPI_TABLE_MAX_WORDS);
+	for (size_t s=0; s<table->n_speeds; ++s) {
+		const rhd_spi_table_row_t *row = &table->row[s];
+		fprintf(f, "%u %d", row->speed, row->link_ok);
+		for (size_t w=1; w<=RHD_SPI_TABLE_MAX_WORDS; ++w) {
+			fprintf(f, " %.3f", row->frame_sec[w] * 1e6);
+		}
+		for (size_t w=1; w<=RHD_SPI_TABLE_MAX_WORDS; ++w) {
+			fprintf(f, " %.3f", row->burst_frame_sec[w] * 1e6);
+		}
+		fprintf(f, "\n");
+	}
+	return (fclose(f) == 0) ? 0 : -1;
+}
+
+// returns -1 if there is no table for device at path, or it is from an
+// incompatible version
+int rhd_spi_table_load(rhd_spi_table_t *table, const char *device, const char *path) {
+	FILE *f = fopen(path, "r");
+	char line[2048];
+	int version;
+	char dev_name[64];
+
+	memset(table, 0, sizeof(*table));
+	if (!f) {
+		return -1;
+	}
+	if (!fgets(line, sizeof(line), f)
+		|| sscanf(line, "# rhd spi table v%d %63s", &version, dev_name) != 2
+		|| version != RHD_SPI_TABLE_VERSION
+		|| strcmp(dev_name, device) != 0) {
+		fclose(f);
+		return -1;
+	}
+	snprintf(table->device, sizeof(table->device), "%s", device);
+	while (fgets(line, sizeof(line), f) && table->n_speeds < RHD_SPI_TABLE_MAX_SPEEDS) {
+		rhd_spi_table_row_t *row = &table->row[table->n_speeds];
+		char *p = line;
+		char *end;
+		int ok = 1;
+		if (line[0] == '#') {
+			continue;
+		}
+		row->speed = (uint32_t) strtoul(p, &end, 10);
+		p = end;
+		row->link_ok = (int) strtol(p, &end, 10);
+		ok &= (end != p);
+		p = end;
+		for (size_t w=1; w<=2*RHD_SPI_TABLE_MAX_WORDS && ok; ++w) {
+			double us = strtod(p, &end);
+			ok &= (end != p && us > 0);
+			p = end;
+			if (w <= RHD_SPI_TABLE_MAX_WORDS) {
+				row->frame_sec[w] = us / 1e6;
+			} else {
+				row->burst_frame_sec[w - RHD_SPI_TABLE_MAX_WORDS] = us / 1e6;
+			}
+		}
+		if (!ok || row->speed == 0) {
+			printf("WARNING: %s: skipping malformed line\n", path);
+			continue;
+		}
+		table->n_speeds++;
+	}
+	fclose(f);
+	return table->n_speeds ? 0 : -1;
+}
+
+void rhd_spi_table_print(const rhd_spi_table_t *table) {
+	printf("SPI throughput of %s, max srate (Hz) by channels per frame:\n", table->device);
+	printf("  clock MHz  link    1 ch    4 ch    8 ch   16 ch   16 ch burst\n");
+	for (size_t s=0; s<table->n_speeds; ++s) {
+		const rhd_spi_table_row_t *row = &table->row[s];
+		printf("  %9.1f  %-4s %7.0f %7.0f %7.0f %7.0f %13.0f\n",
+			row->speed / 1e6,
+			row->link_ok ? "ok" : "BAD",
+			1.0 / row->frame_sec[1],
+			1.0 / row->frame_sec[4],
+			1.0 / row->frame_sec[8],
+			1.0 / row->frame_sec[16],
+			1.0 / row->burst_frame_sec[16]);
+	}
+}
+
+// slowest clock with a good link whose frames of words_per_frame words
+// take at most RHD_SPI_TABLE_HEADROOM of 1/srate, else the fastest good
+// clock. 0 if no clock is usable.
+uint32_t rhd_spi_table_pick_speed(const rhd_spi_table_t *table, size_t words_per_frame, uint16_t srate, int burst) {
+	uint32_t best = 0;
+	uint32_t fastest = 0;
+	double fastest_sec = 0;
+
+	if (words_per_frame == 0 || words_per_frame > RHD_SPI_TABLE_MAX_WORDS) {
+		return 0;
+	}
+	for (size_t s=0; s<table->n_speeds; ++s) {
+		const rhd_spi_table_row_t *row = &table->row[s];
+		double sec = burst ? row->burst_frame_sec[words_per_frame] : row->frame_sec[words_per_frame];
+		if (!row->link_ok) {
+			continue;
+		}
+		if (fastest == 0 || sec < fastest_sec) {
+			fastest = row->speed;
+			fastest_sec = sec;
+		}
+		if (sec <= RHD_SPI_TABLE_HEADROOM / srate && (best == 0 || row->speed < best)) {
+			best = row->speed;
+		}
+	}
+	return best ? best : fastest;
+}
+
+// cached time of one frame of words_per_frame words at speed, -1 if the
+// table has no such entry
+int rhd_spi_table_frame_sec(const rhd_spi_table_t *table, uint32_t speed, size_t words_per_frame, int burst, double *frame_sec) {
+	if (words_per_frame == 0 || words_per_frame > RHD_SPI_TABLE_MAX_WORDS) {
+		return -1;
+	}
+	for (size_t s=0; s<table->n_speeds; ++s) {
+		if (table->row[s].speed == speed) {
+			*frame_sec = burst ? table->row[s].burst_frame_sec[words_per_frame] : table->row[s].frame_sec[words_per_frame];
+			return 0;
+		}
+	}
+	return -1;
+}
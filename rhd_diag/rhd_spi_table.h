@@ -0,0 +1,77 @@
+/*
+Cached SPI throughput table (--characterize).
+
+How long a frame takes on the bus depends on the SPI clock, the number
+of command words per frame and on the controller/driver overhead per
+word, which only a measurement on the actual pi and wiring gives.
+rhd_spi_table_characterize sweeps every clock in rhd_spi_table_speeds
+(8 MHz up to the RHD2216's 25 MHz limit) and every frame size from 1 to
+RHD_NUM_CHS + RHD_AUX_MAX_SLOTS words, timing back to back frames for
+RHD_SPI_TABLE_SWEEP_SEC each, both one frame per SPI message and in
+RHD_SPI_TABLE_BURST frame bursts (rhd_acq_burst). Each clock is also
+checked by reading back the ROM id registers, so a clock the wiring
+can't carry is never picked.
+
+The table is saved per device under $HOME/RHD_SPI_TABLE_DIR. Later runs
+load it, pick the slowest good clock that leaves RHD_SPI_TABLE_HEADROOM
+of each frame period free (rhd_spi_table_pick_speed), and with
+dev->spi_table set, rhd_acq_probe takes the frame time from the table
+instead of timing probe transfers. Re-run --characterize after changing
+wiring, kernel or pi.
+
+File format, one line per clock after a header:
+	# rhd spi table v1 <device>
+	<speed_hz> <link_ok> <frame_us for 1..N words> <burst frame_us for 1..N words>
+
+Usage:
+	rhd_spi_table_t table;
+	char path[256];
+	rhd_spi_table_path(dev->name, path, sizeof(path));
+	if (rhd_spi_table_load(&table, dev->name, path) == -1) {
+		rhd_spi_table_characterize(&table, dev);
+		rhd_spi_table_save(&table, path);
+	}
+	speed = rhd_spi_table_pick_speed(&table, n_chs, srate, 0);
+	dev->spi_table = &table;
+*/
+#ifndef RHD_SPI_TABLE_H
+#define RHD_SPI_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rhd2216_lib.h"
+
+#define RHD_SPI_TABLE_VERSION 1
+#define RHD_SPI_TABLE_DIR ".cache/rhdutil"
+#define RHD_SPI_TABLE_MAX_SPEEDS 8
+#define RHD_SPI_TABLE_MAX_WORDS (RHD_NUM_CHS + RHD_AUX_MAX_SLOTS) // per frame
+#define RHD_SPI_TABLE_SWEEP_SEC 0.05 // per point
+#define RHD_SPI_TABLE_BURST 64 // frames per message for burst timings
+#define RHD_SPI_TABLE_HEADROOM 0.75 // max fraction of a frame period spent on the bus
+
+typedef struct rhd_spi_table_row {
+	uint32_t speed; // Hz, as configured
+	int link_ok; // ROM id read back correctly at this clock
+	double frame_sec[RHD_SPI_TABLE_MAX_WORDS + 1]; // indexed by words per frame
+	double burst_frame_sec[RHD_SPI_TABLE_MAX_WORDS + 1];
+} rhd_spi_table_row_t;
+
+struct rhd_spi_table {
+	char device[64];
+	size_t n_speeds;
+	rhd_spi_table_row_t row[RHD_SPI_TABLE_MAX_SPEEDS];
+};
+typedef struct rhd_spi_table rhd_spi_table_t;
+
+extern const uint32_t rhd_spi_table_speeds[];
+extern const size_t rhd_spi_table_n_speeds;
+
+int rhd_spi_table_path(const char *device, char *path, size_t len);
+int rhd_spi_table_characterize(rhd_spi_table_t *table, rhd_dev_t *dev);
+int rhd_spi_table_save(const rhd_spi_table_t *table, const char *path);
+int rhd_spi_table_load(rhd_spi_table_t *table, const char *device, const char *path);
+void rhd_spi_table_print(const rhd_spi_table_t *table);
+uint32_t rhd_spi_table_pick_speed(const rhd_spi_table_t *table, size_t words_per_frame, uint16_t srate, int burst);
+int rhd_spi_table_frame_sec(const rhd_spi_table_t *table, uint32_t speed, size_t words_per_frame, int burst, double *frame_sec);
+
+#endif
@@ -0,0 +1,193 @@
+#include <math.h>
+#include <string.h>
+#include "rhd_stats.h"
+
+static size_t hist_index(uint64_t v) {
+	if (v < RHD_HIST_SUB) {
+		return v;
+	}
+	int e = 63 - __builtin_clzll(v); // >= RHD_HIST_SUB_BITS
+	if (e >= RHD_HIST_MAX_BITS) {
+		return RHD_HIST_N_BUCKETS - 1;
+	}
+	int shift = e - RHD_HIST_SUB_BITS;
+	return (shift + 1) * RHD_HIST_SUB + ((v >> shift) - RHD_HIST_SUB);
+}
+
+// largest value that lands in bucket idx
+static uint64_t hist_bucket_max(size_t idx) {
+	size_t b = idx / RHD_HIST_SUB;
+	if (b == 0) {
+		return idx;
+	}
+	int shift = b - 1;
+	uint64_t sub = idx % RHD_HIST_SUB + RHD_HIST_SUB;
+	return ((sub + 1) << shift) - 1;
+}
+
+void rhd_hist_reset(rhd_hist_t *hist) {
+	memset(hist, 0, sizeof(*hist));
+	hist->min = UINT64_MAX;
+}
+
+void rhd_hist_record(rhd_hist_t *hist, uint64_t v) {
+	hist->counts[hist_index(v)]++;
+	hist->n++;
+	hist->sum += v;
+	if (v < hist->min) {
+		hist->min = v;
+	}
+	if (v > hist->max) {
+		hist->max = v;
+	}
+}
+
+// value at or below which pct percent of recorded values fall, rounded
+// up to the end of its bucket. 0 if nothing recorded.
+uint64_t rhd_hist_percentile(const rhd_hist_t *hist, double pct) {
+	if (hist->n == 0) {
+		return 0;
+	}
+	uint64_t target = (uint64_t) ceil(pct / 100.0 * hist->n);
+	uint64_t seen = 0;
+	if (target == 0) {
+		target = 1;
+	}
+	for (size_t i=0; i<RHD_HIST_N_BUCKETS; ++i) {
+		seen += hist->counts[i];
+		if (seen >= target) {
+			uint64_t v = hist_bucket_max(i);
+			return (v < hist->max) ? v : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+void rhd_stats_init(rhd_stats_t *stats, double rate_hz) {
+	memset(stats, 0, sizeof(*stats));
+	stats->rate_hz = rate_hz;
+	stats->burst = 1;
+	stats->period_ns = (rate_hz > 0) ? (int64_t) llround(1e9 / rate_hz) : 0;
+	rhd_hist_reset(&stats->xfer_ns);
+	rhd_hist_reset(&stats->frame_ns);
+	rhd_hist_reset(&stats->ifi_ns);
+	rhd_hist_reset(&stats->lag_ns);
+}
+
+// the pacer issues burst frames per wakeup from now on, see rhd_stats.h
+void rhd_stats_set_burst(rhd_stats_t *stats, size_t burst) {
+	stats->burst = burst ? burst : 1;
+	stats->period_ns = (stats->rate_hz > 0) ? (int64_t) llround(stats->burst * 1e9 / stats->rate_hz) : 0;
+}
+
+// records the wakeup pacer just finished, which issued n_frames frames
+// (1, or up to burst). call after rhd_pacer_frame_done
+void rhd_stats_frame(rhd_stats_t *stats, const rhd_pacer_t *pacer, size_t n_frames) {
+	if (stats->n_wakeups == 0) {
+		stats->first_ns = pacer->last_ns;
+	} else {
+		rhd_hist_record(&stats->ifi_ns, pacer->last_ns - stats->last_ns);
+	}
+	stats->last_ns = pacer->last_ns;
+	stats->n_wakeups++;
+	stats->n_frames += n_frames;
+	stats->last_n_frames = n_frames;
+	rhd_hist_record(&stats->frame_ns, pacer->busy_ns);
+	if (pacer->lag_ns > 0) {
+		stats->n_missed++;
+		rhd_hist_record(&stats->lag_ns, pacer->lag_ns);
+	}
+	if (stats->period_ns && pacer->busy_ns > stats->period_ns) {
+		stats->n_overrun++;
+	}
+}
+
+// sample frames per second, over the frames issued before the last wakeup
+double rhd_stats_achieved_rate(const rhd_stats_t *stats) {
+	if (stats->n_wakeups < 2 || stats->last_ns == stats->first_ns) {
+		return 0;
+	}
+	return (stats->n_frames - stats->last_n_frames) * 1e9 / (stats->last_ns - stats->first_ns);
+}
+
+static void report_hist(const char *name, const char *what, const rhd_hist_t *hist) {
+	if (hist->n == 0) {
+		return;
+	}
+	printf("INFO: stats: %s %-5s n %llu, p50 %.2f us, p99 %.2f us, p99.9 %.2f us, max %.2f us\n",
+		name,
+		what,
+		(unsigned long long) hist->n,
+		rhd_hist_percentile(hist, 50) / 1000.0,
+		rhd_hist_percentile(hist, 99) / 1000.0,
+		rhd_hist_percentile(hist, 99.9) / 1000.0,
+		hist->max / 1000.0);
+}
+
+void rhd_stats_report(const rhd_stats_t *stats, const char *name) {
+	int bursts = stats->burst > 1;
+	if (bursts) {
+		printf("INFO: stats: %s %llu frames in %llu bursts of %zu, requested %.3f Hz, achieved %.3f Hz, %llu missed burst deadlines, %llu burst overruns\n",
+			name,
+			(unsigned long long) stats->n_frames,
+			(unsigned long long) stats->n_wakeups,
+			stats->burst,
+			stats->rate_hz,
+			rhd_stats_achieved_rate(stats),
+			(unsigned long long) stats->n_missed,
+			(unsigned long long) stats->n_overrun);
+	} else {
+		printf("INFO: stats: %s %llu frames, requested %.3f Hz, achieved %.3f Hz, %llu missed deadlines, %llu overruns\n",
+			name,
+			(unsigned long long) stats->n_frames,
+			stats->rate_hz,
+			rhd_stats_achieved_rate(stats),
+			(unsigned long long) stats->n_missed,
+			(unsigned long long) stats->n_overrun);
+	}
+	report_hist(name, "xfer", &stats->xfer_ns);
+	report_hist(name, bursts ? "burst" : "frame", &stats->frame_ns);
+	report_hist(name, bursts ? "ibi" : "ifi", &stats->ifi_ns);
+	report_hist(name, "lag", &stats->lag_ns);
+}
+
+static void write_hist_json(FILE *f, const char *key, const rhd_hist_t *hist, int last) {
+	fprintf(f,
+		"      \"%s\": {\"n\": %llu, \"min_ns\": %llu, \"mean_ns\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}%s\n",
+		key,
+		(unsigned long long) hist->n,
+		(unsigned long long) (hist->n ? hist->min : 0),
+		hist->n ? hist->sum / hist->n : 0.0,
+		(unsigned long long) rhd_hist_percentile(hist, 50),
+		(unsigned long long) rhd_hist_percentile(hist, 99),
+		(unsigned long long) rhd_hist_percentile(hist, 99.9),
+		(unsigned long long) hist->max,
+		last ? "" : ",");
+}
+
+// one json object, {"devices": [...]} with an entry per chip. names are
+// not escaped, device paths don't need it. keys are the same with
+// --burst, frame/ifi/lag and n_missed/n_overrun are then per burst of
+// frames_per_burst frames (n_bursts of them).
+int rhd_stats_write_json(FILE *f, rhd_stats_t *const *stats, const char *const *names, size_t n) {
+	fprintf(f, "{\n  \"devices\": [\n");
+	for (size_t i=0; i<n; ++i) {
+		const rhd_stats_t *s = stats[i];
+		fprintf(f, "    {\n");
+		fprintf(f, "      \"device\": \"%s\",\n", names[i]);
+		fprintf(f, "      \"requested_srate_hz\": %.3f,\n", s->rate_hz);
+		fprintf(f, "      \"achieved_srate_hz\": %.3f,\n", rhd_stats_achieved_rate(s));
+		fprintf(f, "      \"n_frames\": %llu,\n", (unsigned long long) s->n_frames);
+		fprintf(f, "      \"frames_per_burst\": %zu,\n", s->burst);
+		fprintf(f, "      \"n_bursts\": %llu,\n", (unsigned long long) s->n_wakeups);
+		fprintf(f, "      \"n_missed\": %llu,\n", (unsigned long long) s->n_missed);
+		fprintf(f, "      \"n_overrun\": %llu,\n", (unsigned long long) s->n_overrun);
+		write_hist_json(f, "xfer", &s->xfer_ns, 0);
+		write_hist_json(f, "frame", &s->frame_ns, 0);
+		write_hist_json(f, "ifi", &s->ifi_ns, 0);
+		write_hist_json(f, "lag", &s->lag_ns, 1);
+		fprintf(f, "    }%s\n", (i + 1 < n) ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	return ferror(f) ? -1 : 0;
+}
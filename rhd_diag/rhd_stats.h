@@ -0,0 +1,81 @@
+/*
+Hot-path timing instrumentation (--stats).
+
+Durations go into fixed-size log-linear histograms (same bucketing idea
+as HdrHistogram): values below 2^RHD_HIST_SUB_BITS ns get a bucket each,
+above that every power of two is split into 2^RHD_HIST_SUB_BITS buckets,
+so any recorded value is known to within ~3%. Recording is a clz, a
+shift and an increment, with no allocation or locking, so it is cheap
+enough to do on every frame. Each rhd_stats_t is only written by the
+thread acquiring from its chip and read after that thread is done.
+
+Recorded per chip:
+* xfer: each frame's SPI message (one ioctl on the pi)
+* frame: whole frame, deadline wakeup to rhd_pacer_frame_done
+* ifi: inter-frame interval
+* lag: how far past its deadline a missed frame started
+plus deadline misses and overruns (frames longer than the period).
+With --burst the pacer wakes once per burst: rhd_stats_set_burst makes
+frame/ifi/lag, misses and overruns per burst (period burst / rate_hz),
+while n_frames and the achieved rate still count sample frames.
+
+Usage:
+	rhd_stats_t stats;
+	rhd_stats_init(&stats, srate);
+	dev.stats = &stats; // rhd_convert_stream and rhd_multi_run record into it
+	rhd_stats_set_burst(&stats, burst); // rhd_convert_stream does this with --burst
+	... acquire ...
+	rhd_stats_report(&stats, dev.name);
+	rhd_stats_write_json(f, &stats_ptr, &name, 1);
+*/
+#ifndef RHD_STATS_H
+#define RHD_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "rhd_pacer.h"
+
+#define RHD_HIST_SUB_BITS 5
+#define RHD_HIST_SUB (1 << RHD_HIST_SUB_BITS)
+// values of 2^RHD_HIST_MAX_BITS ns (~18 min) and up share the last bucket
+#define RHD_HIST_MAX_BITS 40
+#define RHD_HIST_N_BUCKETS ((RHD_HIST_MAX_BITS - RHD_HIST_SUB_BITS + 1) * RHD_HIST_SUB)
+
+typedef struct rhd_hist {
+	uint64_t n;
+	uint64_t min;
+	uint64_t max;
+	double sum;
+	uint64_t counts[RHD_HIST_N_BUCKETS];
+} rhd_hist_t;
+
+typedef struct rhd_stats {
+	double rate_hz; // requested sample rate
+	size_t burst; // frames per pacer wakeup, 1 unless rhd_stats_set_burst
+	int64_t period_ns; // per wakeup
+	uint64_t n_frames;
+	uint64_t n_wakeups; // == n_frames unless bursting
+	uint64_t n_missed; // wakeups started after their deadline
+	uint64_t n_overrun; // wakeups that took longer than period_ns
+	int64_t first_ns;
+	int64_t last_ns;
+	size_t last_n_frames; // of the most recent wakeup
+	rhd_hist_t xfer_ns;
+	rhd_hist_t frame_ns;
+	rhd_hist_t ifi_ns;
+	rhd_hist_t lag_ns;
+} rhd_stats_t;
+
+void rhd_hist_reset(rhd_hist_t *hist);
+void rhd_hist_record(rhd_hist_t *hist, uint64_t v);
+uint64_t rhd_hist_percentile(const rhd_hist_t *hist, double pct);
+
+void rhd_stats_init(rhd_stats_t *stats, double rate_hz);
+void rhd_stats_set_burst(rhd_stats_t *stats, size_t burst);
+void rhd_stats_frame(rhd_stats_t *stats, const rhd_pacer_t *pacer, size_t n_frames);
+double rhd_stats_achieved_rate(const rhd_stats_t *stats);
+void rhd_stats_report(const rhd_stats_t *stats, const char *name);
+int rhd_stats_write_json(FILE *f, rhd_stats_t *const *stats, const char *const *names, size_t n);
+
+#endif
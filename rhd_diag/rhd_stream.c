@@ -0,0 +1,255 @@
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "rhd_stream.h"
+
+typedef struct stream_ctx {
+	rhd_dev_t *dev;
+	const rhd_stream_cfg_t *cfg;
+	volatile sig_atomic_t *stop;
+	rhd_ring_t ring;
+	rhd_dlog_t dlog;
+	atomic_int acq_done;
+	size_t max_ring_fill;
+	uint64_t n_written;
+	int write_err;
+	FILE *feat_f;
+	rhd_feat_vals_t feat_vals[RHD_NUM_CHS];
+	int64_t t0_ns; // issue time of first popped frame
+	int have_t0;
+	rhd_net_t net;
+	int serving;
+	rhd_shm_t shm;
+	FILE *events_f;
+	rhd_trig_t trig;
+	rhd_dlog_t decim_dlog[RHD_DECIM_MAX_OUTPUTS];
+	size_t n_decim_open;
+} stream_ctx_t;
+
+static int push_frame_cb(const rhd_frame_t *frame, size_t n_chs, void *arg) {
+	(void) n_chs;
+	stream_ctx_t *ctx = (stream_ctx_t*) arg;
+	rhd_ring_push(&ctx->ring, frame);
+	return 0;
+}
+
+static void *acq_thread(void *arg) {
+	stream_ctx_t *ctx = (stream_ctx_t*) arg;
+	uint64_t n_frames = (uint64_t) (ctx->cfg->duration_s * ctx->cfg->srate);
+
+	rhd_convert_stream(
+		ctx->dev,
+		ctx->cfg->active_chs_msk,
+		ctx->cfg->srate,
+		n_frames,
+		ctx->stop,
+		push_frame_cb,
+		ctx
+	);
+	atomic_store(&ctx->acq_done, 1);
+	return NULL;
+}
+
+static void *writer_thread(void *arg) {
+	stream_ctx_t *ctx = (stream_ctx_t*) arg;
+	rhd_frame_t frame;
+
+	while (1) {
+		size_t fill = rhd_ring_count(&ctx->ring);
+		if (fill > ctx->max_ring_fill) {
+			ctx->max_ring_fill = fill;
+		}
+		if (rhd_ring_pop(&ctx->ring, &frame) == 0) {
+			if (ctx->cfg->filter) {
+				rhd_filter_process_frame(ctx->cfg->filter, (int16_t*) frame.data, (int16_t*) frame.data);
+			}
+			if (!ctx->have_t0) {
+				// frame 0 may have been dropped on ring overflow
+				ctx->t0_ns = frame.t_ns;
+				ctx->have_t0 = 1;
+			}
+			for (size_t i=0; i<ctx->n_decim_open; ++i) {
+				int16_t y[RHD_NUM_CHS];
+				if (rhd_decim_push_frame(&ctx->cfg->decim[i], (int16_t*) frame.data, y)
+					&& !ctx->write_err
+					&& rhd_dlog_write_samples(&ctx->decim_dlog[i], (uint16_t*) y, ctx->cfg->decim[i].n_chs) == -1) {
+					printf("ERROR: stream: write to %s failed, dropping remaining frames\n", ctx->cfg->decim_fnames[i]);
+					ctx->write_err = 1;
+				}
+			}
+			if (ctx->feat_f && rhd_feat_push_frame(ctx->cfg->features, (int16_t*) frame.data, ctx->feat_vals)) {
+				rhd_feat_write_row(ctx->feat_f, ctx->cfg->features, (frame.t_ns - ctx->t0_ns) / 1e9, ctx->feat_vals);
+			}
+			if (ctx->shm.hdr) {
+				rhd_shm_publish(&ctx->shm, frame.seq, frame.t_ns, frame.data);
+			}
+			if (ctx->serving) {
+				rhd_net_publish(&ctx->net, frame.seq, frame.t_ns, frame.data);
+			}
+			if (ctx->events_f) {
+				if (!ctx->write_err && rhd_trig_push(&ctx->trig, &frame) == -1) {
+					printf("ERROR: stream: write to %s failed, dropping remaining frames\n", ctx->cfg->fname);
+					ctx->write_err = 1;
+				}
+			} else if (!ctx->write_err) {
+				if (rhd_dlog_write_frame(&ctx->dlog, &frame) == -1) {
+					printf("ERROR: stream: write to %s failed, dropping remaining frames\n", ctx->cfg->fname);
+					ctx->write_err = 1;
+				} else {
+					ctx->n_written++;
+				}
+			}
+			continue;
+		}
+		// check done only after ring found empty, so nothing is left behind
+		if (atomic_load(&ctx->acq_done) && rhd_ring_count(&ctx->ring) == 0) {
+			break;
+		}
+		if (ctx->serving) {
+			rhd_net_service(&ctx->net);
+		}
+		usleep(RHD_STREAM_WRITER_POLL_US);
+	}
+	return NULL;
+}
+
+int rhd_stream_run(rhd_dev_t *dev, const rhd_stream_cfg_t *cfg, volatile sig_atomic_t *stop, rhd_stream_result_t *result) {
+	stream_ctx_t ctx;
+	pthread_t acq_tid;
+	pthread_t writer_tid;
+	size_t n_chs = __builtin_popcount(cfg->active_chs_msk);
+	uint32_t flags = cfg->filter ? RHD_DLOG_FLAG_FILTERED : 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.dev = dev;
+	ctx.cfg = cfg;
+	ctx.stop = stop;
+	atomic_init(&ctx.acq_done, 0);
+
+	if (rhd_ring_init(&ctx.ring, cfg->ring_frames ? cfg->ring_frames : RHD_RING_DEFAULT_FRAMES) == -1) {
+		printf("ERROR: stream: could not allocate frame ring\n");
+		return -1;
+	}
+	if (dev->rt) {
+		rhd_rt_prefault(ctx.ring.slots, (ctx.ring.mask + 1) * sizeof(rhd_frame_t));
+	}
+	if (rhd_dlog_open_io(&ctx.dlog, cfg->fname, cfg->format, cfg->active_chs_msk, cfg->srate, cfg->spi_speed, cfg->io, (uint64_t) (cfg->duration_s * cfg->srate)) == -1) {
+		printf("ERROR: stream: could not open %s\n", cfg->fname);
+		rhd_ring_free(&ctx.ring);
+		return -1;
+	}
+
+	if (cfg->filter) {
+		rhd_dlog_set_flags(&ctx.dlog, RHD_DLOG_FLAG_FILTERED);
+	}
+	if (cfg->features) {
+		ctx.feat_f = fopen(cfg->feat_fname, "w");
+		if (!ctx.feat_f) {
+			printf("ERROR: stream: could not open %s\n", cfg->feat_fname);
+			rhd_dlog_close(&ctx.dlog);
+			rhd_ring_free(&ctx.ring);
+			return -1;
+		}
+		rhd_feat_write_header(ctx.feat_f, cfg->features, cfg->active_chs_msk);
+	}
+	for (; ctx.n_decim_open<cfg->n_decim && ctx.n_decim_open<RHD_DECIM_MAX_OUTPUTS; ++ctx.n_decim_open) {
+		size_t i = ctx.n_decim_open;
+		uint16_t decim_srate = cfg->srate / cfg->decim[i].factor;
+		if (rhd_dlog_open_io(&ctx.decim_dlog[i], cfg->decim_fnames[i], cfg->format, cfg->active_chs_msk, decim_srate, cfg->spi_speed, cfg->io, (uint64_t) (cfg->duration_s * decim_srate)) == -1) {
+			printf("ERROR: stream: could not open %s\n", cfg->decim_fnames[i]);
+			goto err_sinks;
+		}
+		if (cfg->filter) {
+			rhd_dlog_set_flags(&ctx.decim_dlog[i], RHD_DLOG_FLAG_FILTERED);
+		}
+	}
+	if (cfg->trigger) {
+		ctx.events_f = fopen(cfg->events_fname, "w");
+		if (!ctx.events_f) {
+			printf("ERROR: stream: could not open %s\n", cfg->events_fname);
+			goto err_sinks;
+		}
+		if (rhd_trig_init(&ctx.trig, cfg->trigger, n_chs, cfg->srate, &ctx.dlog, ctx.events_f) == -1) {
+			printf("ERROR: stream: invalid trigger config\n");
+			goto err_sinks;
+		}
+	}
+	if (cfg->serve_addr) {
+		if (rhd_net_open(&ctx.net, cfg->serve_addr, n_chs, cfg->active_chs_msk, cfg->srate, flags) == -1) {
+			printf("ERROR: stream: could not serve on %s\n", cfg->serve_addr);
+			goto err_sinks;
+		}
+		ctx.serving = 1;
+	}
+	if (cfg->shm_name && rhd_shm_create(&ctx.shm, cfg->shm_name, RHD_SHM_DEFAULT_SLOTS, n_chs, cfg->active_chs_msk, cfg->srate, flags) == -1) {
+		goto err_sinks;
+	}
+
+	if (pthread_create(&writer_tid, NULL, writer_thread, &ctx) != 0) {
+		printf("ERROR: stream: could not start the writer thread\n");
+		rhd_shm_close(&ctx.shm);
+		goto err_sinks;
+	}
+	int thread_err = 0;
+	if (pthread_create(&acq_tid, NULL, acq_thread, &ctx) != 0) {
+		printf("ERROR: stream: could not start the acquisition thread\n");
+		// let the writer drain the (empty) ring and exit
+		atomic_store(&ctx.acq_done, 1);
+		thread_err = 1;
+	} else {
+		pthread_join(acq_tid, NULL);
+	}
+	pthread_join(writer_tid, NULL);
+
+	if (ctx.events_f) {
+		if (rhd_trig_finish(&ctx.trig) == -1) {
+			ctx.write_err = 1;
+		}
+		// frames that made it into the datalog
+		ctx.n_written = ctx.trig.n_kept;
+		rhd_trig_free(&ctx.trig);
+		fclose(ctx.events_f);
+	}
+	// with aio, the last buffers are only written (and synced) here
+	if (rhd_dlog_close(&ctx.dlog) == -1) {
+		printf("ERROR: stream: could not finish %s\n", cfg->fname);
+		ctx.write_err = 1;
+	}
+	for (size_t i=0; i<ctx.n_decim_open; ++i) {
+		if (rhd_dlog_close(&ctx.decim_dlog[i]) == -1) {
+			ctx.write_err = 1;
+		}
+	}
+	if (ctx.serving) {
+		rhd_net_close(&ctx.net);
+	}
+	rhd_shm_close(&ctx.shm);
+	if (ctx.feat_f) {
+		fclose(ctx.feat_f);
+	}
+	if (result) {
+		result->n_frames = ctx.n_written;
+		result->n_dropped = atomic_load(&ctx.ring.n_dropped);
+		result->max_ring_fill = ctx.max_ring_fill;
+	}
+	rhd_ring_free(&ctx.ring);
+	return (ctx.write_err || thread_err) ? -1 : 0;
+
+err_sinks:
+	if (ctx.serving) {
+		rhd_net_close(&ctx.net);
+	}
+	if (ctx.events_f) {
+		rhd_trig_free(&ctx.trig);
+		fclose(ctx.events_f);
+	}
+	for (size_t i=0; i<ctx.n_decim_open; ++i) {
+		rhd_dlog_close(&ctx.decim_dlog[i]);
+	}
+	if (ctx.feat_f) {
+		fclose(ctx.feat_f);
+	}
+	rhd_dlog_close(&ctx.dlog);
+	rhd_ring_free(&ctx.ring);
+	return -1;
+}
@@ -0,0 +1,60 @@
+/*
+Streaming acquisition: records until a duration elapses or *stop is set
+(e.g. from a SIGINT handler), with memory use independent of length.
+
+An acquisition thread runs rhd_convert_stream and pushes frames into a
+lock-free SPSC ring (rhd_ring.h). A writer thread drains the ring,
+runs the optional filter bank (rhd_filter.h) and feature extraction
+(rhd_features.h), writes the datalog and, with serve_addr, sends the
+frames to live clients (rhd_net.h) and, with shm_name, publishes them
+to local readers (rhd_shm.h). The SPI loop never touches
+the file, so disk stalls only show up as ring occupancy (or dropped
+frames if the ring overflows).
+*/
+#ifndef RHD_STREAM_H
+#define RHD_STREAM_H
+
+#include <signal.h>
+#include "rhd2216_lib.h"
+#include "rhd_ring.h"
+#include "rhd_dlog.h"
+#include "rhd_filter.h"
+#include "rhd_features.h"
+#include "rhd_net.h"
+#include "rhd_shm.h"
+#include "rhd_trigger.h"
+#include "rhd_decim.h"
+
+// writer thread sleep when ring is empty
+#define RHD_STREAM_WRITER_POLL_US 1000
+
+typedef struct rhd_stream_cfg {
+	uint16_t active_chs_msk;
+	uint16_t srate;
+	double duration_s; // 0 = until *stop
+	size_t ring_frames;
+	const char *fname;
+	rhd_dlog_format_t format;
+	rhd_dlog_io_t io; // RHD_DLOG_AIO keeps the writer thread off the disk
+	uint32_t spi_speed; // recorded in binary datalog header
+	rhd_filter_t *filter; // applied by writer thread, NULL for raw data
+	rhd_feat_t *features; // computed after filter, NULL to disable
+	const char *feat_fname; // feature csv, required if features set
+	const char *serve_addr; // rhd_net_open address, NULL to not serve
+	const char *shm_name; // rhd_shm_create name, NULL for no frame ring
+	const rhd_trig_cfg_t *trigger; // only log bursts of activity, NULL = every frame
+	const char *events_fname; // event csv, required if trigger set
+	rhd_decim_t *decim; // n_decim decimated outputs, after filter, NULL for none
+	size_t n_decim;
+	const char *const *decim_fnames; // datalog for each, same format
+} rhd_stream_cfg_t;
+
+typedef struct rhd_stream_result {
+	uint64_t n_frames; // frames written to the datalog
+	uint64_t n_dropped; // frames lost to ring overflow
+	size_t max_ring_fill; // worst case ring occupancy
+} rhd_stream_result_t;
+
+int rhd_stream_run(rhd_dev_t *dev, const rhd_stream_cfg_t *cfg, volatile sig_atomic_t *stop, rhd_stream_result_t *result);
+
+#endif
@@ -0,0 +1,183 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rhd_trigger.h"
+
+static int64_t clock_ns(clockid_t clk) {
+	struct timespec ts;
+	clock_gettime(clk, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// EMA coefficient for a time constant of tau_s at srate
+static float ema_alpha(double tau_s, double srate) {
+	return (float) (1.0 - exp(-1.0 / (tau_s * srate)));
+}
+
+int rhd_trig_init(rhd_trig_t *trig, const rhd_trig_cfg_t *cfg, size_t n_chs, double srate, rhd_dlog_t *dlog, FILE *events_f) {
+	memset(trig, 0, sizeof(*trig));
+	if (cfg->thresh <= 1 || cfg->pre_s < 0 || cfg->pre_s > RHD_TRIG_MAX_PRE_S || cfg->post_s < 0 || n_chs == 0 || n_chs > RHD_NUM_CHS) {
+		return -1;
+	}
+	trig->cfg = *cfg;
+	if (trig->cfg.env_tau_s <= 0) {
+		trig->cfg.env_tau_s = RHD_TRIG_DEFAULT_ENV_TAU_S;
+	}
+	if (trig->cfg.base_tau_s <= 0) {
+		trig->cfg.base_tau_s = RHD_TRIG_DEFAULT_BASE_TAU_S;
+	}
+	if (trig->cfg.min_env <= 0) {
+		trig->cfg.min_env = RHD_TRIG_DEFAULT_MIN_ENV;
+	}
+	trig->n_chs = n_chs;
+	trig->dlog = dlog;
+	trig->events_f = events_f;
+	trig->mono_to_unix_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+
+	trig->a_dc = ema_alpha(RHD_TRIG_DC_TAU_S, srate);
+	trig->a_env = ema_alpha(trig->cfg.env_tau_s, srate);
+	trig->a_base = ema_alpha(trig->cfg.base_tau_s, srate);
+	trig->settle_frames = (uint64_t) (RHD_TRIG_SETTLE_TAUS * trig->cfg.env_tau_s * srate);
+	trig->warmup_frames = (uint64_t) (trig->cfg.base_tau_s * srate);
+	trig->post_frames = (uint64_t) (trig->cfg.post_s * srate);
+
+	trig->pre_len = (size_t) (trig->cfg.pre_s * srate);
+	if (trig->pre_len) {
+		trig->pre = (rhd_frame_t*) malloc(trig->pre_len * sizeof(rhd_frame_t));
+		if (!trig->pre) {
+			return -1;
+		}
+	}
+	if (events_f) {
+		fprintf(events_f, "# sample rate: %.0f Hz\n", srate);
+		fprintf(events_f, "# thresh: %.2f\n# pre_s: %.3f\n# post_s: %.3f\n", trig->cfg.thresh, trig->cfg.pre_s, trig->cfg.post_s);
+		fprintf(events_f, "event,file_frame,n_frames,start_seq,onset_seq,onset_ch,start_unix_ns,start_mono_ns\n");
+	}
+	return 0;
+}
+
+// updates the detector with one frame. returns the first channel over
+// threshold, -1 if none.
+static int detect(rhd_trig_t *trig, const int16_t *x) {
+	int fired = -1;
+	int warm = trig->n_seen >= trig->warmup_frames;
+	float thresh = (float) trig->cfg.thresh;
+	float min_env = (float) trig->cfg.min_env;
+
+	for (size_t ch=0; ch<trig->n_chs; ++ch) {
+		float v = (float) x[ch];
+		if (trig->n_seen == 0) {
+			trig->dc[ch] = v;
+		}
+		trig->dc[ch] += trig->a_dc * (v - trig->dc[ch]);
+		trig->env[ch] += trig->a_env * (fabsf(v - trig->dc[ch]) - trig->env[ch]);
+		if (trig->n_seen < trig->settle_frames || trig->env[ch] < trig->base[ch]) {
+			// noise floor: follows dips right away, rises slowly
+			trig->base[ch] = trig->env[ch];
+		} else if (warm && trig->env[ch] > thresh * trig->base[ch] && trig->env[ch] > min_env) {
+			if (fired < 0) {
+				fired = (int) ch;
+			}
+		} else if (!trig->active) {
+			trig->base[ch] += trig->a_base * (trig->env[ch] - trig->base[ch]);
+		}
+	}
+	trig->n_seen++;
+	return fired;
+}
+
+static int write_frame(rhd_trig_t *trig, const rhd_frame_t *frame) {
+	if (rhd_dlog_write_frame(trig->dlog, frame) == -1) {
+		trig->err = 1;
+		return -1;
+	}
+	trig->n_kept++;
+	return 0;
+}
+
+static void end_event(rhd_trig_t *trig) {
+	uint64_t n_frames = trig->n_kept - trig->ev_file_frame;
+	if (trig->events_f) {
+		fprintf(trig->events_f, "%llu,%llu,%llu,%llu,%llu,%d,%lld,%lld\n",
+			(unsigned long long) trig->n_events,
+			(unsigned long long) trig->ev_file_frame,
+			(unsigned long long) n_frames,
+			(unsigned long long) trig->ev_start_seq,
+			(unsigned long long) trig->ev_onset_seq,
+			trig->ev_onset_ch,
+			(long long) (trig->ev_start_t_ns + trig->mono_to_unix_ns),
+			(long long) trig->ev_start_t_ns);
+	}
+	trig->n_events++;
+	trig->active = 0;
+}
+
+// frame is written to the datalog if it is part of an event, otherwise
+// kept in the pre-trigger ring. returns -1 once a datalog write failed.
+int rhd_trig_push(rhd_trig_t *trig, const rhd_frame_t *frame) {
+	int ch = detect(trig, (const int16_t*) frame->data);
+
+	if (trig->err) {
+		return -1;
+	}
+	if (trig->active) {
+		if (write_frame(trig, frame) == -1) {
+			return -1;
+		}
+		trig->quiet = (ch >= 0) ? 0 : trig->quiet + 1;
+		if (trig->quiet > trig->post_frames) {
+			end_event(trig);
+		}
+		return 0;
+	}
+	if (ch < 0) {
+		if (trig->pre_len) {
+			trig->pre[trig->pre_head] = *frame;
+			trig->pre_head = (trig->pre_head + 1) % trig->pre_len;
+			if (trig->pre_fill < trig->pre_len) {
+				trig->pre_fill++;
+			}
+		}
+		return 0;
+	}
+
+	// onset: pre-trigger history oldest first, then this frame
+	trig->active = 1;
+	trig->quiet = 0;
+	trig->ev_file_frame = trig->n_kept;
+	trig->ev_onset_seq = frame->seq;
+	trig->ev_onset_ch = ch;
+	trig->ev_start_seq = frame->seq;
+	trig->ev_start_t_ns = frame->t_ns;
+	for (size_t i=0; i<trig->pre_fill; ++i) {
+		const rhd_frame_t *f = &trig->pre[(trig->pre_head + trig->pre_len - trig->pre_fill + i) % trig->pre_len];
+		if (i == 0) {
+			trig->ev_start_seq = f->seq;
+			trig->ev_start_t_ns = f->t_ns;
+		}
+		if (write_frame(trig, f) == -1) {
+			return -1;
+		}
+	}
+	trig->pre_fill = 0;
+	return write_frame(trig, frame);
+}
+
+// ends an event cut short by the end of acquisition and prints a summary
+int rhd_trig_finish(rhd_trig_t *trig) {
+	if (trig->active) {
+		end_event(trig);
+	}
+	printf("INFO: trigger: %llu events, kept %llu of %llu frames (%.1f%%)\n",
+		(unsigned long long) trig->n_events,
+		(unsigned long long) trig->n_kept,
+		(unsigned long long) trig->n_seen,
+		trig->n_seen ? 100.0 * trig->n_kept / trig->n_seen : 0.0);
+	return trig->err ? -1 : 0;
+}
+
+void rhd_trig_free(rhd_trig_t *trig) {
+	free(trig->pre);
+	trig->pre = NULL;
+}
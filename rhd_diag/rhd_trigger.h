@@ -0,0 +1,101 @@
+/*
+Event-triggered recording (--trigger). Most of a long session is idle
+baseline, so instead of every frame only bursts of activity, with some
+context before and after, go to the datalog.
+
+Onset detector, per channel, all one-pole (EMA) filters updated per frame:
+	dc: slow mean, removed from the sample (RHD_TRIG_DC_TAU_S)
+	env: envelope, mean of |x - dc| over env_tau_s
+	base: idle envelope (noise floor). drops with env right away, rises
+	towards it over base_tau_s, and not at all during an event, so bursts
+	don't raise their own threshold
+An event starts when env > thresh * base (and > min_env) on any channel
+and ends once every channel has been below that for post_s. There are no
+triggers in the first base_tau_s, while base settles.
+
+The last pre_s of frames are kept in a ring, so an event's frames in the
+datalog start pre_s before its onset. The datalog holds the frames of all
+events back to back; <datalog>.events.csv has one row per event with
+where its frames are in the datalog and when they were sampled:
+	event,file_frame,n_frames,start_seq,onset_seq,onset_ch,start_unix_ns,start_mono_ns
+read with read_rhdutil_events in postprocess/flexsemg_postprocess.py.
+
+Usage:
+	rhd_trig_t trig;
+	rhd_trig_cfg_t cfg = {.thresh = 4, .pre_s = 0.2, .post_s = 0.2};
+	rhd_trig_init(&trig, &cfg, n_chs, srate, &dlog, events_f);
+	// per frame, instead of rhd_dlog_write_frame
+	rhd_trig_push(&trig, &frame);
+	rhd_trig_finish(&trig); // closes an event still open
+	rhd_trig_free(&trig);
+*/
+#ifndef RHD_TRIGGER_H
+#define RHD_TRIGGER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "rhd2216_lib.h"
+#include "rhd_dlog.h"
+
+#define RHD_TRIG_DC_TAU_S 1.0
+#define RHD_TRIG_SETTLE_TAUS 5 // env_tau_s until base starts tracking env
+#define RHD_TRIG_DEFAULT_ENV_TAU_S 0.02
+#define RHD_TRIG_DEFAULT_BASE_TAU_S 2.0
+#define RHD_TRIG_DEFAULT_MIN_ENV 10.0 // ADC LSB, ~2 uV
+#define RHD_TRIG_MAX_PRE_S 10.0
+
+typedef struct rhd_trig_cfg {
+	double thresh; // onset when envelope > thresh * baseline
+	double pre_s; // context kept before onset
+	double post_s; // context kept after the last active frame
+	double env_tau_s; // 0 = RHD_TRIG_DEFAULT_ENV_TAU_S
+	double base_tau_s; // 0 = RHD_TRIG_DEFAULT_BASE_TAU_S
+	double min_env; // ADC LSB, 0 = RHD_TRIG_DEFAULT_MIN_ENV
+} rhd_trig_cfg_t;
+
+typedef struct rhd_trig {
+	rhd_trig_cfg_t cfg;
+	size_t n_chs;
+	rhd_dlog_t *dlog;
+	FILE *events_f;
+	int64_t mono_to_unix_ns; // CLOCK_REALTIME - CLOCK_MONOTONIC at init
+
+	// detector
+	float a_dc;
+	float a_env;
+	float a_base;
+	float dc[RHD_NUM_CHS];
+	float env[RHD_NUM_CHS];
+	float base[RHD_NUM_CHS];
+	uint64_t n_seen; // frames pushed
+	uint64_t settle_frames;
+	uint64_t warmup_frames;
+	uint64_t post_frames;
+
+	// pre-trigger ring
+	rhd_frame_t *pre;
+	size_t pre_len;
+	size_t pre_head; // slot the next frame goes into
+	size_t pre_fill;
+
+	// event in progress
+	int active;
+	uint64_t quiet; // frames since the detector last fired
+	uint64_t ev_file_frame; // first datalog frame of the event
+	uint64_t ev_start_seq;
+	uint64_t ev_onset_seq;
+	int64_t ev_start_t_ns;
+	int ev_onset_ch;
+
+	uint64_t n_events;
+	uint64_t n_kept; // frames written to the datalog
+	int err;
+} rhd_trig_t;
+
+int rhd_trig_init(rhd_trig_t *trig, const rhd_trig_cfg_t *cfg, size_t n_chs, double srate, rhd_dlog_t *dlog, FILE *events_f);
+int rhd_trig_push(rhd_trig_t *trig, const rhd_frame_t *frame);
+int rhd_trig_finish(rhd_trig_t *trig);
+void rhd_trig_free(rhd_trig_t *trig);
+
+#endif
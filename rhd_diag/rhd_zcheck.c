@@ -0,0 +1,392 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rhd_zcheck.h"
+#include "rhd_pacer.h"
+
+// reg 5, impedance check control
+#define ZCHECK_EN (0b1 << 0)
+#define ZCHECK_SCALE_SHIFT 3
+#define ZCHECK_DAC_POWER (0b1 << 6)
+#define REG4_DSP_EN (0b1 << 4)
+#define REG4_TWOSCOMP (0b1 << 6)
+// regs 8-11, RH1/RH2 DAC1 and DAC2 for a 20 kHz upper bandwidth
+#define BW_20K_RH1_DAC1 8
+#define BW_20K_RH1_DAC2 0
+#define BW_20K_RH2_DAC1 4
+#define BW_20K_RH2_DAC2 0
+#define SAVED_FIRST 4 // regs 4-11 are changed while checking
+#define SAVED_LAST 11
+
+// Zcheck scale (reg 5 bits [4:3]) and the series capacitor it selects,
+// smallest first
+static const struct {
+	uint8_t scale;
+	double cap_f;
+} caps[RHD_ZCHECK_N_CAPS] = {
+	{ 0b00, 0.1e-12 },
+	{ 0b01, 1e-12 },
+	{ 0b11, 10e-12 },
+};
+
+// single-bin DFT of x[0..n-1] at k cycles per n samples, X = sum x e^(-jwn)
+static void goertzel(const double *x, size_t n, size_t k, double *re, double *im) {
+	double w = 2.0 * M_PI * k / n;
+	double coef = 2.0 * cos(w);
+	double s1 = 0;
+	double s2 = 0;
+
+	for (size_t i=0; i<n; ++i) {
+		double s0 = x[i] + coef * s1 - s2;
+		s2 = s1;
+		s1 = s0;
+	}
+	*re = s1 * cos(w) - s2;
+	*im = s1 * sin(w);
+}
+
+// bus time of one two word frame, from a burst of them with no gaps
+static double probe_frame_sec(rhd_zcheck_t *zc) {
+	rhd_aux_cmd_t read = rhd_aux_cmd_read(40, NULL, NULL);
+	rhd_aux_cmd_t conv = rhd_aux_cmd_convert(RHD_AUX_CH_SUPPLY, NULL, NULL);
+	int64_t begin;
+
+	for (size_t f=0; f<RHD_ZCHECK_PROBE_FRAMES; ++f) {
+		memcpy(&zc->tx_buf[4*f], read.tx, 2);
+		memcpy(&zc->tx_buf[4*f + 2], conv.tx, 2);
+		zc->gap_us[f] = 0;
+	}
+	begin = rhd_now_ns();
+	if (rhd_spi_xfer_frames(&zc->dev->spi, zc->tx_buf, zc->rx_buf, 2, RHD_ZCHECK_PROBE_FRAMES, zc->gap_us) == -1) {
+		return -1;
+	}
+	return (rhd_now_ns() - begin) / 1e9 / RHD_ZCHECK_PROBE_FRAMES;
+}
+
+// probes the frame time at dev's current clock and lays out the DAC sine
+// and frame gaps for freq_hz
+int rhd_zcheck_init(rhd_zcheck_t *zc, rhd_dev_t *dev, double freq_hz) {
+	size_t n_alloc;
+	double gap;
+
+	memset(zc, 0, sizeof(*zc));
+	if (freq_hz < RHD_ZCHECK_MIN_FREQ_HZ || freq_hz > RHD_ZCHECK_MAX_FREQ_HZ) {
+		printf("ERROR: zcheck: %.1f Hz not in %.0f-%.0f Hz\n", freq_hz, RHD_ZCHECK_MIN_FREQ_HZ, RHD_ZCHECK_MAX_FREQ_HZ);
+		return -1;
+	}
+	zc->dev = dev;
+	zc->freq_hz = freq_hz;
+
+	// settle and analysed periods at the most steps per period
+	n_alloc = (size_t) ceil(RHD_ZCHECK_SETTLE_S * freq_hz) * RHD_ZCHECK_MAX_STEPS
+		+ RHD_ZCHECK_PERIODS * RHD_ZCHECK_MAX_STEPS + 1;
+	if (n_alloc < RHD_ZCHECK_PROBE_FRAMES) {
+		n_alloc = RHD_ZCHECK_PROBE_FRAMES;
+	}
+	zc->tx_buf = (uint8_t*) malloc(4 * n_alloc);
+	zc->rx_buf = (uint8_t*) malloc(4 * n_alloc);
+	zc->gap_us = (uint16_t*) malloc(n_alloc * sizeof(uint16_t));
+	zc->v = (double*) malloc(RHD_ZCHECK_PERIODS * RHD_ZCHECK_MAX_STEPS * sizeof(double));
+	if (!zc->tx_buf || !zc->rx_buf || !zc->gap_us || !zc->v) {
+		rhd_zcheck_free(zc);
+		return -1;
+	}
+
+	zc->frame_sec = probe_frame_sec(zc);
+	if (zc->frame_sec <= 0) {
+		rhd_zcheck_free(zc);
+		return -1;
+	}
+	zc->steps = (size_t) (1.0 / (freq_hz * zc->frame_sec));
+	if (zc->steps > RHD_ZCHECK_MAX_STEPS) {
+		zc->steps = RHD_ZCHECK_MAX_STEPS;
+	}
+	if (zc->steps < RHD_ZCHECK_MIN_STEPS) {
+		printf("ERROR: zcheck: %.1f Hz needs %d DAC steps per period, %.2f us frames at %.1f MHz only fit %zu\n",
+			freq_hz, RHD_ZCHECK_MIN_STEPS, zc->frame_sec * 1e6, dev->spi.speed / 1e6, zc->steps);
+		rhd_zcheck_free(zc);
+		return -1;
+	}
+	zc->step_rate = zc->steps * freq_hz;
+	zc->n_settle = (size_t) ceil(RHD_ZCHECK_SETTLE_S * freq_hz) * zc->steps;
+	zc->n_frames = zc->n_settle + RHD_ZCHECK_PERIODS * zc->steps + 1;
+
+	for (size_t k=0; k<zc->steps; ++k) {
+		zc->dac[k] = (uint8_t) lround(RHD_ZCHECK_DAC_MID + RHD_ZCHECK_DAC_AMPLITUDE * sin(2.0 * M_PI * k / zc->steps));
+	}
+	// WRITE(6) words are the same for every channel, CONVERT ones are
+	// filled in per channel. the last frame writes dac[0], the
+	// RHD_ZCHECK_DAC_MID the run started from, so the shadow stays right.
+	for (size_t f=0; f<zc->n_frames; ++f) {
+		rhd_aux_cmd_t write = rhd_aux_cmd_write(6, zc->dac[f % zc->steps], NULL, NULL);
+		memcpy(&zc->tx_buf[4*f], write.tx, 2);
+	}
+
+	// same dithering as rhd_acq_set_burst
+	gap = 1e6 / zc->step_rate - zc->frame_sec * 1e6;
+	if (gap < 0) {
+		gap = 0;
+	}
+	if (gap > 65535) {
+		gap = 65535;
+	}
+	for (size_t f=0; f<zc->n_frames; ++f) {
+		zc->gap_us[f] = (uint16_t) ((uint64_t) ((f + 1) * gap) - (uint64_t) (f * gap));
+	}
+	printf("PVDEBUG: zcheck %.1f Hz, %zu DAC steps per period, %.2f us per frame on the bus, %.2f us gap after each\n",
+		freq_hz, zc->steps, zc->frame_sec * 1e6, gap);
+	return 0;
+}
+
+// current phasor (A, DFT convention over one period from step 0) of the
+// DAC sine through cap_f. each step's charge is on the electrode by the
+// CONVERT right after its WRITE, so it is j w cap_f times the DAC phasor
+// as written, without the half step a staircase lags its samples by.
+static void current_phasor(const rhd_zcheck_t *zc, double cap_f, double *re, double *im) {
+	double d[RHD_ZCHECK_MAX_STEPS];
+	double scale = 2.0 * M_PI * zc->freq_hz * cap_f * RHD_ZCHECK_DAC_V_PER_LSB * 2.0 / zc->steps;
+	double d_re, d_im;
+
+	for (size_t k=0; k<zc->steps; ++k) {
+		d[k] = zc->dac[k];
+	}
+	goertzel(d, zc->steps, 1, &d_re, &d_im);
+	*re = -scale * d_im;
+	*im = scale * d_re;
+}
+
+// one run of frames on ch, conversions into zc->v with the drift taken
+// out and the window applied. returns the peak conversion in LSB before
+// windowing, or -1 on SPI error.
+static double capture(rhd_zcheck_t *zc, uint8_t ch, int twoscomp) {
+	rhd_dev_t *dev = zc->dev;
+	size_t n = RHD_ZCHECK_PERIODS * zc->steps;
+	double mean = 0;
+	double slope = 0;
+	double peak = 0;
+	int64_t begin;
+	double sec;
+
+	begin = rhd_now_ns();
+	if (rhd_spi_xfer_frames(&dev->spi, zc->tx_buf, zc->rx_buf, 2, zc->n_frames, zc->gap_us) == -1) {
+		return -1;
+	}
+	sec = (rhd_now_ns() - begin) / 1e9;
+	if (sec > 1.1 * zc->n_frames / zc->step_rate) {
+		printf("WARNING: zcheck: %s ch %u took %.1f ms, not %.1f, DAC steps were longer than planned\n",
+			dev->name, ch, sec * 1e3, zc->n_frames / zc->step_rate * 1e3);
+	}
+
+	// the CONVERT of frame f comes back in the second word of frame f+1
+	for (size_t k=0; k<n; ++k) {
+		const uint8_t *rx = &zc->rx_buf[4 * (zc->n_settle + k + 1) + 2];
+		uint16_t raw = ((uint16_t) rx[0] << 8) | rx[1];
+		zc->v[k] = twoscomp ? (double) (int16_t) raw : (double) raw - 32768.0;
+		mean += zc->v[k];
+	}
+	mean /= n;
+	// what is left of the switch-on transient (electrode double layer,
+	// amplifier high pass) is a slow drift, take the linear part out
+	// before the DFT so it doesn't leak into the bin
+	for (size_t k=0; k<n; ++k) {
+		slope += (k - (n - 1) / 2.0) * zc->v[k];
+	}
+	slope /= n * ((double) n * n - 1) / 12.0;
+	for (size_t k=0; k<n; ++k) {
+		zc->v[k] -= mean + slope * (k - (n - 1) / 2.0);
+		if (fabs(zc->v[k]) > peak) {
+			peak = fabs(zc->v[k]);
+		}
+	}
+
+	// mains and EMG sit well below the test frequency, but with a
+	// rectangular window they leak into its bin through 1/f sidelobes.
+	// a periodic Hann window falls off as 1/f^3, and a tone on the bin
+	// only comes out at half amplitude with its phase unchanged
+	for (size_t k=0; k<n; ++k) {
+		zc->v[k] *= 0.5 - 0.5 * cos(2.0 * M_PI * k / n);
+	}
+	return peak;
+}
+
+// one channel at one capacitor. captures are repeated and their DFT bins
+// averaged (every capture starts at dac step 0, so the test tone adds up
+// coherently and in band noise such as EMG does not) until the noise in
+// the bins around the test frequency is below RHD_ZCHECK_MAX_NOISE of the
+// electrode voltage, or RHD_ZCHECK_MAX_CAPTURES were taken. returns the
+// peak conversion in LSB, drift removed, or -1 on SPI error.
+static double measure(rhd_zcheck_t *zc, uint8_t ch, int cap_i, int twoscomp, rhd_zcheck_result_t *res) {
+	rhd_dev_t *dev = zc->dev;
+	rhd_aux_cmd_t conv = rhd_aux_cmd_convert(ch, NULL, NULL);
+	size_t n = RHD_ZCHECK_PERIODS * zc->steps;
+	// Hann window: the tone is in bins k-1..k+1, noise only from k+-2 on
+	double sum_re[2 * RHD_ZCHECK_NOISE_BINS + 1] = {0};
+	double sum_im[2 * RHD_ZCHECK_NOISE_BINS + 1] = {0};
+	double v_re, v_im, i_re, i_im;
+	double noise = 0;
+	double peak = 0;
+	int n_captures = 0;
+
+	if (rhd_reg_write(dev, 7, ch) == -1
+			|| rhd_reg_write(dev, 5, ZCHECK_DAC_POWER | (caps[cap_i].scale << ZCHECK_SCALE_SHIFT) | ZCHECK_EN) == -1) {
+		return -1;
+	}
+	for (size_t f=0; f<zc->n_frames; ++f) {
+		memcpy(&zc->tx_buf[4*f + 2], conv.tx, 2);
+	}
+
+	while (n_captures < RHD_ZCHECK_MAX_CAPTURES) {
+		double p = capture(zc, ch, twoscomp);
+		if (p < 0) {
+			return -1;
+		}
+		if (p > peak) {
+			peak = p;
+		}
+		n_captures++;
+
+		// n_settle is whole periods, so both phasors start at dac step 0
+		for (int b=0; b<2*RHD_ZCHECK_NOISE_BINS+1; ++b) {
+			size_t bin = RHD_ZCHECK_PERIODS;
+			double re, im;
+			if (b > 0) {
+				size_t off = 1 + (b + 1) / 2;
+				bin = (b % 2) ? bin - off : bin + off;
+			}
+			goertzel(zc->v, n, bin, &re, &im);
+			sum_re[b] += re;
+			sum_im[b] += im;
+		}
+
+		// Hann coherent gain is 1/2, hence 4/n for the amplitude
+		double scale = RHD_ZCHECK_AMP_V_PER_LSB * 4.0 / n / n_captures;
+		v_re = sum_re[0] * scale;
+		v_im = sum_im[0] * scale;
+		noise = 0;
+		for (int b=1; b<2*RHD_ZCHECK_NOISE_BINS+1; ++b) {
+			noise += (sum_re[b] * sum_re[b] + sum_im[b] * sum_im[b]) * scale * scale;
+		}
+		noise = sqrt(noise / (2 * RHD_ZCHECK_NOISE_BINS));
+		if (peak > RHD_ZCHECK_MAX_LSB || noise <= RHD_ZCHECK_MAX_NOISE * hypot(v_re, v_im)) {
+			break;
+		}
+	}
+	current_phasor(zc, caps[cap_i].cap_f, &i_re, &i_im);
+
+	double phase = (atan2(v_im, v_re) - atan2(i_im, i_re)) * 180.0 / M_PI;
+	while (phase > 180.0) {
+		phase -= 360.0;
+	}
+	while (phase <= -180.0) {
+		phase += 360.0;
+	}
+	res->ch = ch;
+	res->cap_f = caps[cap_i].cap_f;
+	res->v_uv = hypot(v_re, v_im) * 1e6;
+	res->noise_uv = noise * 1e6;
+	res->n_captures = n_captures;
+	res->z_ohm = hypot(v_re, v_im) / hypot(i_re, i_im);
+	res->phase_deg = phase;
+	res->clipped = 0;
+	return peak;
+}
+
+// checks every channel of active_chs_msk, lowest first, into results
+// (one per channel). returns the number of results, or -1 on SPI error.
+int rhd_zcheck_run(rhd_zcheck_t *zc, uint16_t active_chs_msk, rhd_zcheck_result_t *results) {
+	rhd_dev_t *dev = zc->dev;
+	uint8_t saved[SAVED_LAST + 1];
+	uint8_t twoscomp;
+	int64_t begin = rhd_now_ns();
+	int n = 0;
+	int ret = 0;
+
+	for (uint8_t r=SAVED_FIRST; r<=SAVED_LAST; ++r) {
+		if (rhd_reg_shadow_get(dev, r, &saved[r]) == -1 && rhd_reg_read(dev, r, &saved[r]) == -1) {
+			return -1;
+		}
+	}
+	twoscomp = saved[4] & REG4_TWOSCOMP;
+	if (rhd_reg_write(dev, 4, saved[4] & ~REG4_DSP_EN) == -1
+			|| rhd_reg_write(dev, 8, (saved[8] & 0xc0) | BW_20K_RH1_DAC1) == -1
+			|| rhd_reg_write(dev, 9, (saved[9] & 0xe0) | BW_20K_RH1_DAC2) == -1
+			|| rhd_reg_write(dev, 10, (saved[10] & 0xc0) | BW_20K_RH2_DAC1) == -1
+			|| rhd_reg_write(dev, 11, (saved[11] & 0xe0) | BW_20K_RH2_DAC2) == -1
+			|| rhd_reg_write(dev, 6, RHD_ZCHECK_DAC_MID) == -1) {
+		ret = -1;
+	}
+
+	for (uint8_t ch=0; ch<RHD_NUM_CHS && ret == 0; ++ch) {
+		rhd_zcheck_result_t *res = &results[n];
+		if (!((active_chs_msk >> ch) & 0b1)) {
+			continue;
+		}
+		// largest capacitor first, smaller ones while the voltage is too big
+		for (int cap_i=RHD_ZCHECK_N_CAPS-1; cap_i>=0; --cap_i) {
+			double peak = measure(zc, ch, cap_i, twoscomp, res);
+			if (peak < 0) {
+				ret = -1;
+				break;
+			}
+			if (peak <= RHD_ZCHECK_MAX_LSB) {
+				break;
+			}
+			res->clipped = (cap_i == 0);
+		}
+		if (ret == -1) {
+			break;
+		}
+		res->noisy = !res->clipped && res->noise_uv > RHD_ZCHECK_MAX_NOISE * res->v_uv;
+		printf("INFO: zcheck: %s ch %u: %.1f kOhm at %.1f deg (%.1f pF, %.1f uV, noise %.2f uV in %d captures)%s\n",
+			dev->name, ch, res->z_ohm / 1e3, res->phase_deg, res->cap_f * 1e12, res->v_uv, res->noise_uv, res->n_captures,
+			res->clipped ? ", too high to measure" : res->noisy ? ", too noisy to trust (EMG? relax the muscle and redo)" : "");
+		n++;
+	}
+
+	// Zcheck off first, then the rest as it was
+	for (uint8_t r=5; r<=SAVED_LAST; ++r) {
+		if (rhd_reg_write(dev, r, saved[r]) == -1) {
+			ret = -1;
+		}
+	}
+	if (rhd_reg_write(dev, 4, saved[4]) == -1) {
+		ret = -1;
+	}
+	if (ret == -1) {
+		printf("ERROR: zcheck: %s SPI transfer failed\n", dev->name);
+		return -1;
+	}
+	printf("INFO: zcheck: %s %d chs at %.1f Hz in %.0f ms\n", dev->name, n, zc->freq_hz, (rhd_now_ns() - begin) / 1e6);
+	return n;
+}
+
+int rhd_zcheck_write_header(FILE *f, const rhd_zcheck_t *zc) {
+	fprintf(f, "# freq: %.1f Hz\n", zc->freq_hz);
+	fprintf(f, "# dac steps per period: %zu\n# periods: %d\n", zc->steps, RHD_ZCHECK_PERIODS);
+	return (fprintf(f, "ch,z_ohm,phase_deg,cap_pf,v_uv,noise_uv,captures,clipped,noisy\n") < 0) ? -1 : 0;
+}
+
+// chs are numbered from ch_offset, 16 * i for chip i of several
+int rhd_zcheck_write_rows(FILE *f, const rhd_zcheck_result_t *results, size_t n, size_t ch_offset) {
+	for (size_t i=0; i<n; ++i) {
+		const rhd_zcheck_result_t *res = &results[i];
+		if (fprintf(f, "%zu,%.1f,%.2f,%.1f,%.2f,%.2f,%d,%d,%d\n",
+				ch_offset + res->ch, res->z_ohm, res->phase_deg, res->cap_f * 1e12, res->v_uv, res->noise_uv,
+				res->n_captures, res->clipped, res->noisy) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void rhd_zcheck_free(rhd_zcheck_t *zc) {
+	free(zc->tx_buf);
+	free(zc->rx_buf);
+	free(zc->gap_us);
+	free(zc->v);
+	zc->tx_buf = NULL;
+	zc->rx_buf = NULL;
+	zc->gap_us = NULL;
+	zc->v = NULL;
+}
@@ -0,0 +1,101 @@
+/*
+Electrode impedance check (--zcheck) with the RHD2216's on-chip Zcheck
+circuit: an 8-bit DAC (reg 6) driving a sine through a 0.1, 1 or 10 pF
+series capacitor (reg 5) into the electrode of one amplifier (reg 7). The
+current is C dV/dt, the electrode voltage it makes shows up on that
+amplifier, and their ratio at the test frequency is the impedance.
+
+Each channel is one SPI message of back-to-back frames of two words,
+	WRITE(6, dac[k % steps]) CONVERT(ch)
+spaced by the SPI controller (delay_usecs, like --burst) so one frame is
+one DAC step of 1 / (steps * freq_hz). steps per period is as many as
+the probed frame time allows, up to RHD_ZCHECK_MAX_STEPS. the first
+RHD_ZCHECK_SETTLE_S of conversions are dropped, and a single-bin DFT
+(Goertzel) over the next RHD_ZCHECK_PERIODS periods, Hann windowed so
+mains and the low frequency EMG band don't leak in, gives the electrode
+voltage phasor. EMG at the test frequency itself can't be filtered out:
+the bins 2-5 off the test frequency estimate it, and while it is above
+RHD_ZCHECK_MAX_NOISE of the voltage the run is repeated (up to
+RHD_ZCHECK_MAX_CAPTURES) and averaged, after which the result is
+marked noisy. The current phasor is j 2 pi freq_hz C times that of the
+DAC sequence (each CONVERT comes right after its step's WRITE), and
+Z = V / I is the impedance at freq_hz.
+A channel starts at 10 pF (1-100 kOhm, surface EMG electrodes) and
+is redone with the next smaller capacitor while its voltage peaks above
+RHD_ZCHECK_MAX_LSB.
+
+While it runs, DSP offset removal is off and the amplifier upper
+bandwidth is 20 kHz, so neither shifts the phase at the test frequency.
+Regs 4-11 are put back afterwards. At the default 1 kHz a capture takes
+25 ms, so 16 quiet channels about 0.4 s, and up to 0.2 s more for each
+channel with active EMG.
+
+Usage:
+	rhd_zcheck_t zc;
+	rhd_zcheck_result_t res[RHD_NUM_CHS];
+	rhd_zcheck_init(&zc, dev, RHD_ZCHECK_DEFAULT_FREQ_HZ); // probes the frame time
+	n = rhd_zcheck_run(&zc, active_chs_msk, res);
+	rhd_zcheck_write_header(f, &zc);
+	rhd_zcheck_write_rows(f, res, n, 0);
+	rhd_zcheck_free(&zc);
+*/
+#ifndef RHD_ZCHECK_H
+#define RHD_ZCHECK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "rhd2216_lib.h"
+
+#define RHD_ZCHECK_DEFAULT_FREQ_HZ 1000.0
+#define RHD_ZCHECK_MIN_FREQ_HZ 20.0 // amplifier lower bandwidth
+#define RHD_ZCHECK_MAX_FREQ_HZ 5000.0
+#define RHD_ZCHECK_MIN_STEPS 8 // DAC steps per period
+#define RHD_ZCHECK_MAX_STEPS 40
+#define RHD_ZCHECK_SETTLE_S 0.005
+#define RHD_ZCHECK_PERIODS 20 // analysed per capture
+#define RHD_ZCHECK_MAX_CAPTURES 8 // averaged while the bin is noisy
+#define RHD_ZCHECK_NOISE_BINS 4 // each side of the test frequency, from 2 bins off
+#define RHD_ZCHECK_MAX_NOISE 0.02 // of the electrode voltage, ~2% / ~1 deg
+#define RHD_ZCHECK_PROBE_FRAMES 64
+#define RHD_ZCHECK_DAC_MID 128
+#define RHD_ZCHECK_DAC_AMPLITUDE 127
+#define RHD_ZCHECK_DAC_V_PER_LSB (1.225 / 256)
+#define RHD_ZCHECK_AMP_V_PER_LSB 0.195e-6
+#define RHD_ZCHECK_MAX_LSB 12800 // 2.5 mV peak, half the amplifier input range
+#define RHD_ZCHECK_N_CAPS 3
+
+typedef struct rhd_zcheck_result {
+	uint8_t ch;
+	double cap_f; // series capacitor the result is from
+	double v_uv; // electrode voltage amplitude
+	double z_ohm;
+	double phase_deg;
+	double noise_uv; // rms of the RHD_ZCHECK_NOISE_BINS bins each side
+	int n_captures;
+	int clipped; // still above RHD_ZCHECK_MAX_LSB at 0.1 pF
+	int noisy; // noise_uv still above RHD_ZCHECK_MAX_NOISE after RHD_ZCHECK_MAX_CAPTURES
+} rhd_zcheck_result_t;
+
+typedef struct rhd_zcheck {
+	rhd_dev_t *dev;
+	double freq_hz;
+	size_t steps; // per period
+	double step_rate; // steps per second
+	size_t n_settle; // frames dropped before the analysed ones
+	size_t n_frames; // n_settle + RHD_ZCHECK_PERIODS * steps, plus one for the pipeline
+	double frame_sec; // two word frame on the bus, no gap
+	uint8_t dac[RHD_ZCHECK_MAX_STEPS];
+	uint8_t *tx_buf;
+	uint8_t *rx_buf;
+	uint16_t *gap_us;
+	double *v; // analysed conversions of the current channel, in LSB
+} rhd_zcheck_t;
+
+int rhd_zcheck_init(rhd_zcheck_t *zc, rhd_dev_t *dev, double freq_hz);
+int rhd_zcheck_run(rhd_zcheck_t *zc, uint16_t active_chs_msk, rhd_zcheck_result_t *results);
+int rhd_zcheck_write_header(FILE *f, const rhd_zcheck_t *zc);
+int rhd_zcheck_write_rows(FILE *f, const rhd_zcheck_result_t *results, size_t n, size_t ch_offset);
+void rhd_zcheck_free(rhd_zcheck_t *zc);
+
+#endif